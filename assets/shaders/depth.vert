@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth only passes, reading the tightly packed position stream alone. The
+// EQUAL test of the shading pass after the pre-pass needs gl_Position to
+// match shader.vert exactly, so both declare it invariant
+
+layout(binding = 0) uniform UniformBufferViewProjection {
+    mat4 view_projection;
+} ubo_vp;
+
+layout(binding = 1) uniform UniformBufferModel {
+    mat4 model;
+} ubo_m;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+    invariant vec4 gl_Position;
+};
+
+void main() {
+    gl_Position = ubo_vp.view_projection * ubo_m.model * vec4(inPosition, 1.0);
+}
@@ -15,7 +15,7 @@ layout(location = 1) in vec2 inTexCoord;
 layout(location = 0) out vec2 fragTexCoord;
 
 out gl_PerVertex {
-    vec4 gl_Position;
+    invariant vec4 gl_Position; // Matches depth.vert, see there
 };
 
 void main() {
@@ -1 +1 @@
-gcc -g src/*.c -o src/main -I/c/VulkanSDK/1.2.154.1/Include -I/c/assimp/include -I/c/ -lvulkan-1 -lglfw3 -llibassimp -lgdi32
+gcc -g -pthread $(ls src/*.c | grep -v 'src/bench.c\|src/linmath_bench.c\|src/job_bench.c') -o src/main -I/c/VulkanSDK/1.2.154.1/Include -I/c/assimp/include -I/c/ -lvulkan-1 -lglfw3 -llibassimp -lgdi32
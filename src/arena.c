@@ -0,0 +1,167 @@
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <assert.h>
+
+static uint64_t blocks_allocated = 0;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static struct arena_block* arena_new_block(
+        size_t capacity,
+        struct arena_block* previous)
+{
+    // The header's size is a multiple of max_align_t, so is the data
+    struct arena_block* block = malloc(sizeof(*block) + capacity);
+    assert(block);
+    __atomic_add_fetch(&blocks_allocated, 1, __ATOMIC_RELAXED);
+
+    block->previous = previous;
+    block->capacity = capacity;
+
+    return block;
+}
+
+static void arena_free_blocks(
+        struct arena_block* block,
+        struct arena_block* last)
+{
+    while (block != last) {
+        struct arena_block* previous = block->previous;
+        free(block);
+        block = previous;
+    }
+}
+
+// capacity 0 allocates nothing until the first alloc
+void arena_init(
+        struct arena* arena,
+        size_t capacity)
+{
+    arena->block = capacity > 0 ? arena_new_block(capacity, NULL) : NULL;
+    arena->offset = 0;
+    arena->used = 0;
+    arena->high_water = 0;
+}
+
+/* Never fails, a block at least twice the size of the last is chained on
+ * when the allocation doesn't fit. alignment is a power of two no larger
+ * than max_align_t's */
+void* arena_alloc(
+        struct arena* arena,
+        size_t size,
+        size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    assert(alignment <= alignof(max_align_t));
+
+    struct arena_block* block = arena->block;
+    size_t start = (arena->offset + alignment - 1) & ~(alignment - 1);
+
+    if (!block || start + size > block->capacity) {
+        size_t capacity = block ? block->capacity * 2 : ARENA_SCRATCH_SIZE;
+        if (capacity < size)
+            capacity = size;
+
+        block = arena_new_block(capacity, block);
+        arena->block = block;
+        arena->offset = 0;
+        start = 0;
+    }
+
+    arena->used += start + size - arena->offset;
+    arena->offset = start + size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+
+    return (uint8_t*)(block + 1) + start;
+}
+
+/* Everything allocated is released at once. Chained blocks are replaced by
+ * one holding the most ever used plus half, after which resetting is only
+ * a matter of moving the offset back */
+void arena_reset(
+        struct arena* arena)
+{
+    if (arena->block && arena->block->previous) {
+        arena_free_blocks(arena->block, NULL);
+        arena->block = arena_new_block(
+            arena->high_water + arena->high_water / 2,
+            NULL
+        );
+    }
+
+    arena->offset = 0;
+    arena->used = 0;
+}
+
+/* Releases what was allocated since the mark, for scoped use of an arena
+ * that is not reset, such as a thread's scratch */
+void arena_rewind(
+        struct arena* arena,
+        struct arena_mark mark)
+{
+    arena_free_blocks(arena->block, mark.block);
+    arena->block = mark.block;
+    arena->offset = mark.offset;
+    arena->used = mark.used;
+}
+
+struct arena_mark arena_get_mark(
+        struct arena* arena)
+{
+    struct arena_mark mark = {
+        .block = arena->block,
+        .offset = arena->offset,
+        .used = arena->used
+    };
+
+    return mark;
+}
+
+void arena_destroy(
+        struct arena* arena)
+{
+    arena_free_blocks(arena->block, NULL);
+    arena->block = NULL;
+}
+
+static void arena_destroy_scratch(void* data)
+{
+    arena_destroy(data);
+    free(data);
+}
+
+static void arena_create_scratch_key()
+{
+    pthread_key_create(&scratch_key, arena_destroy_scratch);
+}
+
+/* The calling thread's own arena, created on first use and freed when the
+ * thread exits. Used between arena_get_mark and arena_rewind, so callers
+ * further up the stack keep what they allocated */
+struct arena* arena_thread_scratch()
+{
+    pthread_once(&scratch_once, arena_create_scratch_key);
+
+    struct arena* arena = pthread_getspecific(scratch_key);
+    if (!arena) {
+        arena = malloc(sizeof(*arena));
+        assert(arena);
+        __atomic_add_fetch(&blocks_allocated, 1, __ATOMIC_RELAXED);
+
+        arena_init(arena, ARENA_SCRATCH_SIZE);
+        pthread_setspecific(scratch_key, arena);
+    }
+
+    return arena;
+}
+
+/* Blocks and scratch arenas allocated so far, by every thread. Other heap
+ * allocations are not counted, see bench.c for those */
+uint64_t arena_blocks_allocated()
+{
+    return __atomic_load_n(&blocks_allocated, __ATOMIC_RELAXED);
+}
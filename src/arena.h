@@ -0,0 +1,75 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_SCRATCH_SIZE 16384 // Initial size of each thread's scratch arena
+
+// Space for count elements of type, aligned for it
+#define ARENA_NEW(arena, type, count) \
+    ((type*)arena_alloc((arena), sizeof(type) * (count), alignof(type)))
+
+// Allocations follow this header in each block
+struct arena_block
+{
+    struct arena_block* previous; // Outgrown, freed by the next reset
+    size_t capacity; // Bytes after the header
+    max_align_t align;
+};
+
+/* Bump allocator for data that lives until the next reset, such as one
+ * frame's draw lists. When a block runs out another one is chained on, and
+ * the next reset replaces them with one block large enough for all, so once
+ * the largest frame has been seen, allocating and resetting never touch the
+ * heap */
+struct arena
+{
+    struct arena_block* block; // Allocated from, NULL until the first alloc
+    size_t offset; // Into the newest block
+    size_t used; // Since the reset, over every block
+    size_t high_water; // Most used between two resets
+};
+
+// Where an arena was, to rewind it back there
+struct arena_mark
+{
+    struct arena_block* block;
+    size_t offset;
+    size_t used;
+};
+
+void arena_init(
+    struct arena* arena,
+    size_t capacity
+);
+
+void* arena_alloc(
+    struct arena* arena,
+    size_t size,
+    size_t alignment
+);
+
+void arena_reset(
+    struct arena* arena
+);
+
+struct arena_mark arena_get_mark(
+    struct arena* arena
+);
+
+void arena_rewind(
+    struct arena* arena,
+    struct arena_mark mark
+);
+
+void arena_destroy(
+    struct arena* arena
+);
+
+struct arena* arena_thread_scratch();
+
+uint64_t arena_blocks_allocated();
+
+#endif
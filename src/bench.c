@@ -0,0 +1,839 @@
+#include "renderer_buffer.h"
+#include "renderer_image.h"
+#include "renderer_tools.h"
+#include "renderer_mesh.h"
+#include "renderer.h"
+#include "renderer_scene.h"
+#include "renderer_gpu_profiler.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+/* Renders a generated scene headless along a fixed camera path and writes
+ * per frame timings, so runs on the same machine (and ICD) can be compared
+ * across commits. Nothing depends on wall clock time or unseeded randomness,
+ * every run with the same arguments submits identical work */
+
+#define BENCH_TEXTURE_SIZE 256
+#define BENCH_SPACING 3.0f // Between instances, meshes have a radius of 1
+
+/* The program is linked with --wrap for these (see Makefile.am), so every
+ * allocation made by the renderer's code is counted, on any thread. Those
+ * made inside libraries such as the Vulkan driver are not */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+static uint64_t heap_allocations = 0;
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size)
+{
+    __atomic_add_fetch(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(pointer, size);
+}
+
+struct bench_settings
+{
+    uint32_t mesh_count;
+    uint32_t instance_count; // Drawables per mesh
+    uint32_t texture_count; // 0 uses the renderer's default texture
+    uint32_t minimized_frames; // Drawn at a zero extent before the warmup
+    uint32_t warmup_frames; // Rendered but not recorded
+    uint32_t frame_count;
+    uint32_t width, height;
+    uint32_t seed;
+    bool occlusion_culling;
+    bool depth_prepass;
+    bool frustum_culling;
+    bool retained; // Objects added to the scene once instead of drawn
+    bool profile_gpu; // Off lets unchanged frames reuse their primary cmds
+    uint32_t job_threads;
+    uint32_t msaa_samples;
+    const char* csv_path;
+    const char* json_path;
+    const char* label; // e.g. the commit, copied into the JSON
+};
+
+struct bench_frame
+{
+    double cpu_ms; // Spent in renderer_draw_frame
+    double gpu_ms; // The GPU profiler's "frame" scope, NAN if unavailable
+    uint32_t draw_count;
+    uint64_t triangle_count;
+    uint64_t device_bytes; // Device memory allocated by the renderer
+    uint32_t device_allocations;
+    uint32_t heap_allocations; // malloc, calloc and realloc while drawing
+    uint32_t cmds_recorded, cmds_reused; // Secondaries
+    bool primary_reused;
+    uint64_t renderer_frame; // frame_count when submitted, matches GPU times
+};
+
+// Fractions of secondary and primary cmds submitted without recording
+struct bench_reuse
+{
+    double secondary, primary;
+};
+
+struct bench_summary
+{
+    double avg, p50, p99, max;
+};
+
+static void bench_default_settings(struct bench_settings* settings)
+{
+    memset(settings, 0, sizeof(*settings));
+
+    settings->mesh_count = 4;
+    settings->instance_count = 16;
+    settings->texture_count = 4;
+    settings->minimized_frames = 4;
+    settings->warmup_frames = 16;
+    settings->frame_count = 256;
+    settings->width = 800;
+    settings->height = 600;
+    settings->seed = 1;
+    settings->msaa_samples = 1;
+    settings->profile_gpu = true;
+    settings->csv_path = "bench.csv";
+    settings->json_path = "bench.json";
+    settings->label = "";
+}
+
+static void bench_parse_args(
+        struct bench_settings* settings,
+        int argc,
+        char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--meshes") && has_value) {
+            settings->mesh_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--instances") && has_value) {
+            settings->instance_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--textures") && has_value) {
+            settings->texture_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--minimized") && has_value) {
+            settings->minimized_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--warmup") && has_value) {
+            settings->warmup_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--frames") && has_value) {
+            settings->frame_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--size") && has_value) {
+            unsigned width, height;
+            if (sscanf(argv[++i], "%ux%u", &width, &height) == 2) {
+                settings->width = width;
+                settings->height = height;
+            } else {
+                fprintf(stderr, "Invalid size %s\n", argv[i]);
+            }
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            settings->seed = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--occlusion-culling")) {
+            settings->occlusion_culling = true;
+        } else if (!strcmp(argv[i], "--depth-prepass")) {
+            settings->depth_prepass = true;
+        } else if (!strcmp(argv[i], "--frustum-culling")) {
+            settings->frustum_culling = true;
+        } else if (!strcmp(argv[i], "--retained")) {
+            settings->retained = true;
+        } else if (!strcmp(argv[i], "--no-profile-gpu")) {
+            settings->profile_gpu = false;
+        } else if (!strcmp(argv[i], "--jobs") && has_value) {
+            settings->job_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--msaa") && has_value) {
+            settings->msaa_samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--csv") && has_value) {
+            settings->csv_path = argv[++i];
+        } else if (!strcmp(argv[i], "--json") && has_value) {
+            settings->json_path = argv[++i];
+        } else if (!strcmp(argv[i], "--label") && has_value) {
+            settings->label = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        }
+    }
+
+    if (settings->mesh_count == 0)
+        settings->mesh_count = 1;
+    if (settings->frame_count == 0)
+        settings->frame_count = 1;
+}
+
+// Same sequence on every platform, unlike rand()
+static uint32_t bench_random(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static float bench_random_float(uint32_t* state)
+{
+    return (bench_random(state) & 0xFFFF) / 65535.0f;
+}
+
+/* Unit sphere, more finely tessellated for each mesh so the meshes cost
+ * different amounts of vertex work */
+static void bench_generate_sphere(
+        uint32_t stacks,
+        uint32_t slices,
+        struct renderer_mesh_data* mesh)
+{
+    mesh->vertex_count = (stacks + 1) * (slices + 1);
+    mesh->index_count = stacks * slices * 6;
+    mesh->vertices = malloc(mesh->vertex_count * sizeof(*mesh->vertices));
+    mesh->indices = malloc(mesh->index_count * sizeof(*mesh->indices));
+    assert(mesh->vertices && mesh->indices);
+
+    const float pi = 3.14159265f;
+
+    for (uint32_t i = 0; i <= stacks; i++) {
+        float v = (float)i / stacks;
+        float theta = v * pi;
+
+        for (uint32_t j = 0; j <= slices; j++) {
+            float u = (float)j / slices;
+            float phi = u * 2.0f * pi;
+
+            struct renderer_vertex* vertex;
+            vertex = &mesh->vertices[i * (slices + 1) + j];
+            vertex->x = sinf(theta) * cosf(phi);
+            vertex->y = sinf(theta) * sinf(phi);
+            vertex->z = cosf(theta);
+            vertex->u = u;
+            vertex->v = v;
+        }
+    }
+
+    // Counter clockwise seen from outside, matching the pipeline's front face
+    uint32_t* index = mesh->indices;
+    for (uint32_t i = 0; i < stacks; i++) {
+        for (uint32_t j = 0; j < slices; j++) {
+            uint32_t a = i * (slices + 1) + j;
+            uint32_t b = a + slices + 1;
+
+            *index++ = a;
+            *index++ = b;
+            *index++ = a + 1;
+
+            *index++ = a + 1;
+            *index++ = b;
+            *index++ = b + 1;
+        }
+    }
+}
+
+// Checkerboard with a different tint and cell size per texture
+static uint8_t* bench_generate_texture(uint32_t index, uint32_t* seed)
+{
+    uint8_t* pixels = malloc(BENCH_TEXTURE_SIZE * BENCH_TEXTURE_SIZE * 4);
+    assert(pixels);
+
+    uint8_t tint[3] = {
+        64 + bench_random(seed) % 192,
+        64 + bench_random(seed) % 192,
+        64 + bench_random(seed) % 192
+    };
+    uint32_t cell = 8u << (index % 4);
+
+    for (uint32_t y = 0; y < BENCH_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < BENCH_TEXTURE_SIZE; x++) {
+            bool dark = ((x / cell) + (y / cell)) % 2;
+            uint8_t* pixel = &pixels[(y * BENCH_TEXTURE_SIZE + x) * 4];
+            for (uint32_t c = 0; c < 3; c++)
+                pixel[c] = dark ? tint[c] / 4 : tint[c];
+            pixel[3] = 255;
+        }
+    }
+
+    return pixels;
+}
+
+/* One full orbit over the recorded frames, always looking at the middle of
+ * the scene. Warmup frames hold the starting position */
+static struct camera bench_camera(
+        uint32_t frame,
+        uint32_t frame_count,
+        float radius)
+{
+    float angle = 2.0f * 3.14159265f * frame / frame_count;
+    float height = radius * 0.5f;
+
+    // The renderer looks one unit along yaw, at a height of pitch
+    struct camera camera = {
+        .x = radius * cosf(angle),
+        .y = radius * sinf(angle),
+        .z = height,
+        .pitch = height - height / radius,
+        .yaw = angle + 3.14159265f
+    };
+
+    return camera;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+// Frames without a value (NAN) are left out
+static struct bench_summary bench_summarize(
+        const struct bench_frame* frames,
+        uint32_t frame_count,
+        bool gpu)
+{
+    struct bench_summary summary = {NAN, NAN, NAN, NAN};
+
+    double* values = malloc(frame_count * sizeof(*values));
+    assert(values);
+
+    uint32_t count = 0;
+    double sum = 0.0;
+    for (uint32_t i = 0; i < frame_count; i++) {
+        double value = gpu ? frames[i].gpu_ms : frames[i].cpu_ms;
+        if (isnan(value))
+            continue;
+        values[count++] = value;
+        sum += value;
+    }
+
+    if (count > 0) {
+        qsort(values, count, sizeof(*values), compare_double);
+        summary.avg = sum / count;
+        summary.p50 = values[(count - 1) / 2];
+        summary.p99 = values[(count - 1) * 99 / 100];
+        summary.max = values[count - 1];
+    }
+
+    free(values);
+
+    return summary;
+}
+
+// JSON has no NAN, missing values are written as null
+static void bench_write_json_number(FILE* file, double value)
+{
+    if (isnan(value))
+        fprintf(file, "null");
+    else
+        fprintf(file, "%.4f", value);
+}
+
+static void bench_write_json_summary(
+        FILE* file,
+        const char* name,
+        struct bench_summary summary)
+{
+    fprintf(file, "    \"%s\": {\"avg\": ", name);
+    bench_write_json_number(file, summary.avg);
+    fprintf(file, ", \"p50\": ");
+    bench_write_json_number(file, summary.p50);
+    fprintf(file, ", \"p99\": ");
+    bench_write_json_number(file, summary.p99);
+    fprintf(file, ", \"max\": ");
+    bench_write_json_number(file, summary.max);
+    fprintf(file, "}");
+}
+
+static struct bench_reuse bench_summarize_reuse(
+        const struct bench_frame* frames,
+        uint32_t frame_count)
+{
+    uint64_t recorded = 0, reused = 0;
+    uint32_t primaries_reused = 0;
+    for (uint32_t i = 0; i < frame_count; i++) {
+        recorded += frames[i].cmds_recorded;
+        reused += frames[i].cmds_reused;
+        primaries_reused += frames[i].primary_reused;
+    }
+
+    struct bench_reuse reuse = {
+        .secondary = recorded + reused ?
+            (double)reused / (double)(recorded + reused) : 0.0,
+        .primary = frame_count ?
+            (double)primaries_reused / frame_count : 0.0
+    };
+
+    return reuse;
+}
+
+// The recorded frame submitted as renderer_frame, searched from the newest
+static struct bench_frame* bench_find_frame(
+        struct bench_frame* frames,
+        uint32_t recorded_count,
+        uint64_t renderer_frame)
+{
+    for (uint32_t i = recorded_count; i > 0; i--) {
+        if (frames[i - 1].renderer_frame == renderer_frame)
+            return &frames[i - 1];
+        if (frames[i - 1].renderer_frame < renderer_frame)
+            break;
+    }
+
+    return NULL;
+}
+
+// Over every measured frame, zero once the frame arenas fit the scene
+static uint64_t bench_count_heap_allocations(
+        const struct bench_frame* frames,
+        uint32_t frame_count)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < frame_count; i++)
+        count += frames[i].heap_allocations;
+
+    return count;
+}
+
+static bool bench_write_csv(
+        const char* path,
+        const struct bench_frame* frames,
+        uint32_t frame_count)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "frame,cpu_ms,gpu_ms,draws,triangles,"
+            "device_bytes,device_allocations,heap_allocations\n");
+
+    for (uint32_t i = 0; i < frame_count; i++) {
+        const struct bench_frame* frame = &frames[i];
+
+        fprintf(file, "%u,%.4f,", i, frame->cpu_ms);
+        if (!isnan(frame->gpu_ms))
+            fprintf(file, "%.4f", frame->gpu_ms);
+        fprintf(file, ",%u,%llu,%llu,%u,%u\n",
+                frame->draw_count,
+                (unsigned long long)frame->triangle_count,
+                (unsigned long long)frame->device_bytes,
+                frame->device_allocations,
+                frame->heap_allocations);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+// Quoted, with the characters JSON doesn't allow raw in strings escaped
+static void bench_write_json_string(
+        FILE* file,
+        const char* string)
+{
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*)string; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static bool bench_write_json(
+        const char* path,
+        const struct bench_settings* settings,
+        const char* device_name,
+        const struct bench_frame* frames,
+        uint32_t frame_count)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    struct renderer_memory_stats memory = renderer_get_memory_stats();
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"label\": ");
+    bench_write_json_string(file, settings->label);
+    fprintf(file, ",\n  \"device\": ");
+    bench_write_json_string(file, device_name);
+    fprintf(file, ",\n");
+    fprintf(file, "  \"config\": {\"meshes\": %u, \"instances\": %u, "
+            "\"textures\": %u, \"warmup\": %u, \"frames\": %u, "
+            "\"width\": %u, \"height\": %u, \"seed\": %u, "
+            "\"occlusion_culling\": %s, \"depth_prepass\": %s, "
+            "\"frustum_culling\": %s, \"retained\": %s, \"msaa\": %u, "
+            "\"jobs\": %u},\n",
+            settings->mesh_count,
+            settings->instance_count,
+            settings->texture_count,
+            settings->warmup_frames,
+            settings->frame_count,
+            settings->width,
+            settings->height,
+            settings->seed,
+            settings->occlusion_culling ? "true" : "false",
+            settings->depth_prepass ? "true" : "false",
+            settings->frustum_culling ? "true" : "false",
+            settings->retained ? "true" : "false",
+            settings->msaa_samples,
+            settings->job_threads);
+
+    fprintf(file, "  \"summary\": {\n");
+    bench_write_json_summary(
+        file,
+        "cpu_ms",
+        bench_summarize(frames, frame_count, false)
+    );
+    fprintf(file, ",\n");
+    bench_write_json_summary(
+        file,
+        "gpu_ms",
+        bench_summarize(frames, frame_count, true)
+    );
+    struct bench_reuse reuse = bench_summarize_reuse(frames, frame_count);
+    fprintf(file, ",\n    \"secondary_reuse\": %.4f, \"primary_reuse\": %.4f",
+            reuse.secondary, reuse.primary);
+    fprintf(file, ",\n    \"heap_allocations\": %llu",
+            (unsigned long long)bench_count_heap_allocations(
+                frames,
+                frame_count
+            ));
+    fprintf(file, ",\n    \"peak_device_bytes\": %llu\n  },\n",
+            (unsigned long long)memory.peak_allocated_bytes);
+
+    fprintf(file, "  \"frames\": [\n");
+    for (uint32_t i = 0; i < frame_count; i++) {
+        const struct bench_frame* frame = &frames[i];
+
+        fprintf(file, "    {\"cpu_ms\": %.4f, \"gpu_ms\": ", frame->cpu_ms);
+        bench_write_json_number(file, frame->gpu_ms);
+        fprintf(file, ", \"draws\": %u, \"triangles\": %llu, "
+                "\"device_bytes\": %llu, \"device_allocations\": %u, "
+                "\"heap_allocations\": %u}%s\n",
+                frame->draw_count,
+                (unsigned long long)frame->triangle_count,
+                (unsigned long long)frame->device_bytes,
+                frame->device_allocations,
+                frame->heap_allocations,
+                i + 1 < frame_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_settings settings;
+    bench_default_settings(&settings);
+    bench_parse_args(&settings, argc, argv);
+
+    uint32_t drawable_count = settings.mesh_count * settings.instance_count;
+
+    struct renderer_settings renderer_settings;
+    renderer_default_settings(&renderer_settings);
+    renderer_settings.headless = true;
+    renderer_settings.headless_width = settings.width;
+    renderer_settings.headless_height = settings.height;
+    renderer_settings.profile_gpu = settings.profile_gpu;
+    renderer_settings.occlusion_culling = settings.occlusion_culling;
+    renderer_settings.depth_prepass = settings.depth_prepass;
+    renderer_settings.frustum_culling = settings.frustum_culling;
+    renderer_settings.job_threads = settings.job_threads;
+    renderer_settings.msaa_samples = settings.msaa_samples;
+    renderer_settings.max_drawables = MAX(drawable_count, 1);
+    renderer_settings.max_textures = MAX(settings.texture_count, 1);
+
+    struct renderer_resources* resources = malloc(sizeof(*resources));
+    assert(resources);
+    renderer_initialize_resources(resources, NULL, &renderer_settings);
+
+    VkPhysicalDeviceProperties gpu_props;
+    vkGetPhysicalDeviceProperties(resources->physical_device, &gpu_props);
+
+    uint32_t seed = settings.seed;
+
+    // Scene
+    struct renderer_mesh_data* meshes = malloc(
+        settings.mesh_count * sizeof(*meshes)
+    );
+    assert(meshes);
+    for (uint32_t i = 0; i < settings.mesh_count; i++) {
+        uint32_t stacks = 8 + 4 * i;
+        bench_generate_sphere(stacks, stacks * 2, &meshes[i]);
+    }
+    struct renderer_resource_handle* mesh_handles = malloc(
+        settings.mesh_count * sizeof(*mesh_handles)
+    );
+    assert(mesh_handles);
+    renderer_upload_meshes(
+        resources,
+        meshes,
+        settings.mesh_count,
+        mesh_handles
+    );
+    for (uint32_t i = 0; i < settings.mesh_count; i++) {
+        free(meshes[i].indices);
+        free(meshes[i].vertices);
+    }
+    free(meshes);
+
+    // Owned by the registry, destroyed with the resources
+    struct renderer_resource_handle* textures = calloc(
+        MAX(settings.texture_count, 1),
+        sizeof(*textures)
+    );
+    assert(textures);
+    for (uint32_t i = 0; i < settings.texture_count; i++) {
+        uint8_t* pixels = bench_generate_texture(i, &seed);
+        struct renderer_image image = renderer_create_texture(
+            pixels,
+            BENCH_TEXTURE_SIZE,
+            BENCH_TEXTURE_SIZE,
+            resources->physical_device,
+            resources->device,
+            resources->graphics_queue,
+            resources->command_pool,
+            resources->gpu_profiler
+        );
+        free(pixels);
+
+        textures[i] = renderer_registry_add_texture(resources, image);
+    }
+
+    // Instances on a jittered grid centred on the origin
+    struct renderer_drawable* drawables = calloc(
+        MAX(drawable_count, 1),
+        sizeof(*drawables)
+    );
+    float* positions = malloc(MAX(drawable_count, 1) * 3 * sizeof(*positions));
+    assert(drawables && positions);
+
+    uint32_t grid = (uint32_t)ceilf(sqrtf((float)drawable_count));
+    float extent = grid * BENCH_SPACING;
+    for (uint32_t i = 0; i < drawable_count; i++) {
+        // A null texture handle draws with the default texture
+        struct renderer_resource_handle mesh =
+            mesh_handles[i % settings.mesh_count];
+        struct renderer_resource_handle texture =
+            textures[i % MAX(settings.texture_count, 1)];
+
+        float jitter = BENCH_SPACING * 0.25f;
+        positions[i * 3 + 0] = (i % grid + 0.5f) * BENCH_SPACING -
+            extent / 2 + (bench_random_float(&seed) - 0.5f) * jitter;
+        positions[i * 3 + 1] = (i / grid + 0.5f) * BENCH_SPACING -
+            extent / 2 + (bench_random_float(&seed) - 0.5f) * jitter;
+        positions[i * 3 + 2] = (bench_random_float(&seed) - 0.5f) * jitter;
+
+        // Placed once, nothing is submitted per frame
+        if (settings.retained) {
+            struct renderer_object_handle handle = renderer_scene_add(
+                resources,
+                mesh,
+                texture
+            );
+            renderer_scene_set_position(
+                resources,
+                handle,
+                positions[i * 3 + 0],
+                positions[i * 3 + 1],
+                positions[i * 3 + 2]
+            );
+        } else {
+            renderer_init_drawable(
+                resources,
+                mesh,
+                texture,
+                &drawables[i]
+            );
+        }
+    }
+
+    float radius = MAX(extent, 4.0f);
+
+    /* GPU times of a frame are resolved when its slot is reused, so they
+     * arrive GPU_PROFILER_FRAMES frames late. Extra frames are rendered at
+     * the end to collect the times of the last recorded ones */
+    struct bench_frame* frames = calloc(
+        settings.frame_count,
+        sizeof(*frames)
+    );
+    assert(frames);
+
+    uint32_t total_frames =
+        settings.warmup_frames + settings.frame_count + GPU_PROFILER_FRAMES;
+
+    printf("Benchmarking %u meshes x %u instances, %u textures, "
+            "%u frames at %ux%u on %s\n",
+            settings.mesh_count,
+            settings.instance_count,
+            settings.texture_count,
+            settings.frame_count,
+            settings.width,
+            settings.height,
+            gpu_props.deviceName);
+
+    /* As if the window were minimized, every frame is skipped while its
+     * draws are still queued. Each frame queues all the drawables, so from
+     * the second one on this overflows the draw queue unless skipped frames
+     * drop their draws */
+    if (settings.minimized_frames > 0) {
+        renderer_resize(resources, 0, 0);
+        for (uint32_t i = 0; i < settings.minimized_frames; i++) {
+            for (uint32_t j = 0; j < drawable_count && !settings.retained;
+                    j++) {
+                renderer_draw(
+                    resources,
+                    &drawables[j],
+                    positions[j * 3 + 0],
+                    positions[j * 3 + 1],
+                    positions[j * 3 + 2]
+                );
+            }
+            renderer_draw_frame(resources);
+        }
+        renderer_resize(resources, settings.width, settings.height);
+    }
+
+    for (uint32_t i = 0; i < total_frames; i++) {
+        uint32_t path_frame = i < settings.warmup_frames ?
+            0 : i - settings.warmup_frames;
+        resources->camera = bench_camera(
+            MIN(path_frame, settings.frame_count),
+            settings.frame_count,
+            radius
+        );
+
+        uint64_t allocations = __atomic_load_n(
+            &heap_allocations,
+            __ATOMIC_RELAXED
+        );
+
+        for (uint32_t j = 0; j < drawable_count && !settings.retained; j++) {
+            renderer_draw(
+                resources,
+                &drawables[j],
+                positions[j * 3 + 0],
+                positions[j * 3 + 1],
+                positions[j * 3 + 2]
+            );
+        }
+
+        uint64_t renderer_frame = resources->frame_count;
+        renderer_draw_frame(resources);
+
+        allocations = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED) -
+            allocations;
+
+        if (i >= settings.warmup_frames &&
+                path_frame < settings.frame_count) {
+            struct bench_frame* frame = &frames[path_frame];
+            struct renderer_frame_stats* stats = &resources->frame_stats;
+            struct renderer_memory_stats memory = renderer_get_memory_stats();
+
+            frame->renderer_frame = renderer_frame;
+            frame->cpu_ms = stats->cpu_time * 1000.0;
+            frame->gpu_ms = NAN;
+            frame->draw_count = stats->draw_count;
+            frame->triangle_count = stats->triangle_count;
+            frame->device_bytes = memory.allocated_bytes;
+            frame->device_allocations = memory.allocation_count;
+            frame->heap_allocations = (uint32_t)allocations;
+            frame->cmds_recorded = stats->cmds_recorded;
+            frame->cmds_reused = stats->cmds_reused;
+            frame->primary_reused = stats->primary_reused;
+        }
+
+        // The GPU time resolved this frame belongs to an earlier one, found
+        // by the frame it was recorded in since results can be skipped
+        struct renderer_gpu_profiler_stats gpu_stats;
+        if (resources->gpu_profiler &&
+                renderer_gpu_profiler_get_stats(
+                    resources->gpu_profiler,
+                    "frame",
+                    &gpu_stats)) {
+            struct bench_frame* frame = bench_find_frame(
+                frames,
+                i < settings.warmup_frames ?
+                    0 : MIN(path_frame + 1, settings.frame_count),
+                gpu_stats.latest_frame
+            );
+            if (frame)
+                frame->gpu_ms = gpu_stats.latest;
+        }
+    }
+
+    vkDeviceWaitIdle(resources->device);
+
+    struct bench_summary cpu = bench_summarize(
+        frames,
+        settings.frame_count,
+        false
+    );
+    struct bench_summary gpu = bench_summarize(
+        frames,
+        settings.frame_count,
+        true
+    );
+    printf("cpu ms: avg %.3f p50 %.3f p99 %.3f max %.3f\n",
+            cpu.avg, cpu.p50, cpu.p99, cpu.max);
+    printf("gpu ms: avg %.3f p50 %.3f p99 %.3f max %.3f\n",
+            gpu.avg, gpu.p50, gpu.p99, gpu.max);
+
+    struct bench_reuse reuse = bench_summarize_reuse(
+        frames,
+        settings.frame_count
+    );
+    printf("cmd reuse: secondary %.1f%% primary %.1f%%\n",
+            reuse.secondary * 100.0, reuse.primary * 100.0);
+    printf("heap allocations while drawing: %llu\n",
+            (unsigned long long)bench_count_heap_allocations(
+                frames,
+                settings.frame_count
+            ));
+
+    bool written = bench_write_csv(
+        settings.csv_path,
+        frames,
+        settings.frame_count
+    );
+    written &= bench_write_json(
+        settings.json_path,
+        &settings,
+        gpu_props.deviceName,
+        frames,
+        settings.frame_count
+    );
+
+    renderer_destroy_resources(resources);
+
+    free(frames);
+    free(positions);
+    free(drawables);
+    free(textures);
+    free(mesh_handles);
+    free(resources);
+
+    return written ? 0 : 1;
+}
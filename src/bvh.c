@@ -0,0 +1,524 @@
+#include "bvh.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+// A tree of n leaves has n - 1 internal nodes
+void bvh_init(
+        struct bvh* bvh,
+        uint32_t max_leaves,
+        float margin)
+{
+    bvh->capacity = max_leaves > 0 ? 2 * max_leaves - 1 : 1;
+    bvh->nodes = malloc(bvh->capacity * sizeof(*bvh->nodes));
+    assert(bvh->nodes);
+
+    bvh->root = BVH_NONE;
+    bvh->margin = margin;
+
+    for (uint32_t i = 0; i < bvh->capacity; i++)
+        bvh->nodes[i].parent = i + 1 < bvh->capacity ? i + 1 : BVH_NONE;
+    bvh->free_list = 0;
+}
+
+static uint32_t allocate_node(
+        struct bvh* bvh)
+{
+    uint32_t node = bvh->free_list;
+    assert(node != BVH_NONE);
+    bvh->free_list = bvh->nodes[node].parent;
+
+    bvh->nodes[node].data = NULL;
+    bvh->nodes[node].parent = BVH_NONE;
+    bvh->nodes[node].children[0] = BVH_NONE;
+    bvh->nodes[node].children[1] = BVH_NONE;
+    bvh->nodes[node].height = 0;
+
+    return node;
+}
+
+static void free_node(
+        struct bvh* bvh,
+        uint32_t node)
+{
+    bvh->nodes[node].parent = bvh->free_list;
+    bvh->nodes[node].height = -1;
+    bvh->free_list = node;
+}
+
+static bool is_leaf(
+        const struct bvh_node* node)
+{
+    return node->children[0] == BVH_NONE;
+}
+
+static void combine(
+        float min[3],
+        float max[3],
+        const struct bvh_node* a,
+        const struct bvh_node* b)
+{
+    for (int i = 0; i < 3; i++) {
+        min[i] = fminf(a->min[i], b->min[i]);
+        max[i] = fmaxf(a->max[i], b->max[i]);
+    }
+}
+
+static float surface_area(
+        const float min[3],
+        const float max[3])
+{
+    float x = max[0] - min[0];
+    float y = max[1] - min[1];
+    float z = max[2] - min[2];
+
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+static float node_area(
+        const struct bvh_node* node)
+{
+    return surface_area(node->min, node->max);
+}
+
+static float combined_area(
+        const struct bvh_node* a,
+        const struct bvh_node* b)
+{
+    float min[3], max[3];
+    combine(min, max, a, b);
+
+    return surface_area(min, max);
+}
+
+static void refit(
+        struct bvh* bvh,
+        uint32_t index)
+{
+    struct bvh_node* node = &bvh->nodes[index];
+    struct bvh_node* a = &bvh->nodes[node->children[0]];
+    struct bvh_node* b = &bvh->nodes[node->children[1]];
+
+    combine(node->min, node->max, a, b);
+    node->height = 1 + (a->height > b->height ? a->height : b->height);
+}
+
+static void replace_child(
+        struct bvh* bvh,
+        uint32_t parent,
+        uint32_t old_child,
+        uint32_t new_child)
+{
+    if (parent == BVH_NONE) {
+        bvh->root = new_child;
+        return;
+    }
+
+    struct bvh_node* node = &bvh->nodes[parent];
+    int side = node->children[0] == old_child ? 0 : 1;
+    assert(node->children[side] == old_child);
+    node->children[side] = new_child;
+}
+
+/* If one child of a is taller than the other by more than one, rotates that
+ * child up in a's place, with a taking its shorter grandchild. Returns the
+ * node now at a's place */
+static uint32_t balance(
+        struct bvh* bvh,
+        uint32_t a)
+{
+    struct bvh_node* node_a = &bvh->nodes[a];
+    if (is_leaf(node_a) || node_a->height < 2)
+        return a;
+
+    for (int side = 0; side < 2; side++) {
+        uint32_t up = node_a->children[1 - side];
+        uint32_t stay = node_a->children[side];
+        struct bvh_node* node_up = &bvh->nodes[up];
+
+        if (node_up->height - bvh->nodes[stay].height <= 1)
+            continue;
+
+        uint32_t f = node_up->children[0];
+        uint32_t g = node_up->children[1];
+        if (bvh->nodes[f].height > bvh->nodes[g].height) {
+            uint32_t swap = f;
+            f = g;
+            g = swap;
+        }
+
+        // The taller grandchild g stays under up, a takes the shorter f
+        node_up->children[0] = a;
+        node_up->children[1] = g;
+        node_up->parent = node_a->parent;
+        replace_child(bvh, node_a->parent, a, up);
+
+        node_a->parent = up;
+        node_a->children[1 - side] = f;
+        bvh->nodes[f].parent = a;
+
+        refit(bvh, a);
+        refit(bvh, up);
+
+        return up;
+    }
+
+    return a;
+}
+
+// Refits and rebalances from index up to the root
+static void fix_upwards(
+        struct bvh* bvh,
+        uint32_t index)
+{
+    while (index != BVH_NONE) {
+        index = balance(bvh, index);
+        refit(bvh, index);
+        index = bvh->nodes[index].parent;
+    }
+}
+
+static void insert_leaf(
+        struct bvh* bvh,
+        uint32_t leaf)
+{
+    if (bvh->root == BVH_NONE) {
+        bvh->root = leaf;
+        bvh->nodes[leaf].parent = BVH_NONE;
+        return;
+    }
+
+    // Descend towards the sibling that adds the least surface area, counting
+    // the growth of every ancestor on the way
+    struct bvh_node* leaf_node = &bvh->nodes[leaf];
+    uint32_t index = bvh->root;
+    while (!is_leaf(&bvh->nodes[index])) {
+        struct bvh_node* node = &bvh->nodes[index];
+
+        float area = node_area(node);
+        float combined = combined_area(node, leaf_node);
+
+        // As a sibling of this node, or pushed further down
+        float cost = 2.0f * combined;
+        float inheritance = 2.0f * (combined - area);
+
+        float child_costs[2];
+        for (int i = 0; i < 2; i++) {
+            struct bvh_node* child = &bvh->nodes[node->children[i]];
+            float child_combined = combined_area(child, leaf_node);
+            if (is_leaf(child)) {
+                child_costs[i] = child_combined + inheritance;
+            } else {
+                child_costs[i] = child_combined - node_area(child) +
+                    inheritance;
+            }
+        }
+
+        if (cost < child_costs[0] && cost < child_costs[1])
+            break;
+
+        index = node->children[child_costs[0] <= child_costs[1] ? 0 : 1];
+    }
+
+    uint32_t sibling = index;
+    uint32_t old_parent = bvh->nodes[sibling].parent;
+
+    uint32_t parent = allocate_node(bvh);
+    struct bvh_node* parent_node = &bvh->nodes[parent];
+    parent_node->parent = old_parent;
+    parent_node->children[0] = sibling;
+    parent_node->children[1] = leaf;
+    replace_child(bvh, old_parent, sibling, parent);
+
+    bvh->nodes[sibling].parent = parent;
+    bvh->nodes[leaf].parent = parent;
+
+    fix_upwards(bvh, parent);
+}
+
+static void remove_leaf(
+        struct bvh* bvh,
+        uint32_t leaf)
+{
+    if (leaf == bvh->root) {
+        bvh->root = BVH_NONE;
+        return;
+    }
+
+    uint32_t parent = bvh->nodes[leaf].parent;
+    struct bvh_node* parent_node = &bvh->nodes[parent];
+    uint32_t grandparent = parent_node->parent;
+    uint32_t sibling = parent_node->children[0] == leaf ?
+        parent_node->children[1] :
+        parent_node->children[0];
+
+    // The sibling takes the parent's place
+    replace_child(bvh, grandparent, parent, sibling);
+    bvh->nodes[sibling].parent = grandparent;
+    free_node(bvh, parent);
+
+    fix_upwards(bvh, grandparent);
+}
+
+static void set_fat_bounds(
+        struct bvh* bvh,
+        uint32_t proxy,
+        const float min[3],
+        const float max[3])
+{
+    struct bvh_node* node = &bvh->nodes[proxy];
+    for (int i = 0; i < 3; i++) {
+        node->min[i] = min[i] - bvh->margin;
+        node->max[i] = max[i] + bvh->margin;
+    }
+}
+
+uint32_t bvh_insert(
+        struct bvh* bvh,
+        const float min[3],
+        const float max[3],
+        void* data)
+{
+    uint32_t proxy = allocate_node(bvh);
+    bvh->nodes[proxy].data = data;
+    set_fat_bounds(bvh, proxy, min, max);
+
+    insert_leaf(bvh, proxy);
+
+    return proxy;
+}
+
+void bvh_remove(
+        struct bvh* bvh,
+        uint32_t proxy)
+{
+    assert(is_leaf(&bvh->nodes[proxy]));
+
+    remove_leaf(bvh, proxy);
+    free_node(bvh, proxy);
+}
+
+/* Updates the proxy's bounds, only reinserting it once they leave the grown
+ * bounds it was inserted with. Returns whether it was reinserted */
+bool bvh_move(
+        struct bvh* bvh,
+        uint32_t proxy,
+        const float min[3],
+        const float max[3])
+{
+    struct bvh_node* node = &bvh->nodes[proxy];
+    assert(is_leaf(node));
+
+    bool contained = true;
+    for (int i = 0; i < 3; i++) {
+        if (min[i] < node->min[i] || max[i] > node->max[i])
+            contained = false;
+    }
+    if (contained)
+        return false;
+
+    remove_leaf(bvh, proxy);
+    set_fat_bounds(bvh, proxy, min, max);
+    insert_leaf(bvh, proxy);
+
+    return true;
+}
+
+/* Left, right, bottom, top, near and far planes of a view projection, as
+ * (a, b, c, d) with a * x + b * y + c * z + d >= 0 inside. Not normalized,
+ * only the sign is used */
+void bvh_extract_planes(
+        float planes[6][4],
+        mat4x4 view_proj)
+{
+    for (int i = 0; i < 4; i++) {
+        float row0 = view_proj[i][0];
+        float row1 = view_proj[i][1];
+        float row2 = view_proj[i][2];
+        float row3 = view_proj[i][3];
+
+        planes[0][i] = row3 + row0;
+        planes[1][i] = row3 - row0;
+        planes[2][i] = row3 + row1;
+        planes[3][i] = row3 - row1;
+        planes[4][i] = row3 + row2;
+        planes[5][i] = row3 - row2;
+    }
+}
+
+// Calls back for every leaf under index
+static void report_subtree(
+        struct bvh* bvh,
+        uint32_t index,
+        bvh_query_fn callback,
+        void* user)
+{
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = index;
+
+    while (stack_size > 0) {
+        struct bvh_node* node = &bvh->nodes[stack[--stack_size]];
+        if (is_leaf(node)) {
+            callback(node->data, user);
+            continue;
+        }
+
+        assert(stack_size + 2 <= BVH_MAX_DEPTH);
+        stack[stack_size++] = node->children[0];
+        stack[stack_size++] = node->children[1];
+    }
+}
+
+/* Calls back for every leaf whose bounds are not entirely outside a plane.
+ * Subtrees entirely inside every plane are reported without further tests,
+ * so the cost follows the visible leaves rather than all of them */
+void bvh_query_frustum(
+        struct bvh* bvh,
+        const float planes[6][4],
+        bvh_query_fn callback,
+        void* user)
+{
+    if (bvh->root == BVH_NONE)
+        return;
+
+    // Planes still to be tested against each node's subtree
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint8_t masks[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+
+    stack[stack_size] = bvh->root;
+    masks[stack_size++] = 0x3F;
+
+    while (stack_size > 0) {
+        stack_size--;
+        uint32_t index = stack[stack_size];
+        uint8_t mask = masks[stack_size];
+        struct bvh_node* node = &bvh->nodes[index];
+
+        bool outside = false;
+        for (int i = 0; i < 6 && !outside; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+
+            const float* plane = planes[i];
+
+            // The corner furthest along the normal, then the nearest
+            float far = plane[3], near = plane[3];
+            for (int j = 0; j < 3; j++) {
+                float low = plane[j] * node->min[j];
+                float high = plane[j] * node->max[j];
+                far += fmaxf(low, high);
+                near += fminf(low, high);
+            }
+
+            if (far < 0.0f)
+                outside = true;
+            else if (near >= 0.0f)
+                mask &= ~(1 << i);
+        }
+
+        if (outside)
+            continue;
+
+        if (mask == 0 || is_leaf(node)) {
+            report_subtree(bvh, index, callback, user);
+            continue;
+        }
+
+        assert(stack_size + 2 <= BVH_MAX_DEPTH);
+        for (int i = 0; i < 2; i++) {
+            stack[stack_size] = node->children[i];
+            masks[stack_size++] = mask;
+        }
+    }
+}
+
+// Distance at which the ray enters the box, INFINITY when it misses
+static float ray_box(
+        const struct bvh_node* node,
+        const float origin[3],
+        const float inverse_direction[3],
+        float max_distance)
+{
+    float enter = 0.0f, exit = max_distance;
+
+    for (int i = 0; i < 3; i++) {
+        float t0 = (node->min[i] - origin[i]) * inverse_direction[i];
+        float t1 = (node->max[i] - origin[i]) * inverse_direction[i];
+
+        // NaN from a zero direction inside the slab is ignored by fminf
+        enter = fmaxf(enter, fminf(t0, t1));
+        exit = fminf(exit, fmaxf(t0, t1));
+    }
+
+    return enter <= exit ? enter : INFINITY;
+}
+
+/* Returns the data of the nearest leaf hit within max_distance, or NULL, and
+ * its distance in distance if not NULL. The callback decides hits against
+ * the actual object, subtrees further than the nearest hit so far are
+ * skipped */
+void* bvh_ray_cast(
+        struct bvh* bvh,
+        const float origin[3],
+        const float direction[3],
+        float max_distance,
+        bvh_ray_fn callback,
+        void* user,
+        float* distance)
+{
+    void* nearest = NULL;
+    float nearest_distance = max_distance;
+
+    if (bvh->root == BVH_NONE)
+        return NULL;
+
+    float inverse_direction[3];
+    for (int i = 0; i < 3; i++)
+        inverse_direction[i] = 1.0f / direction[i];
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = bvh->root;
+
+    while (stack_size > 0) {
+        struct bvh_node* node = &bvh->nodes[stack[--stack_size]];
+
+        float enter = ray_box(
+            node,
+            origin,
+            inverse_direction,
+            nearest_distance
+        );
+        if (enter == INFINITY)
+            continue;
+
+        if (is_leaf(node)) {
+            float hit = callback(node->data, origin, direction, user);
+            if (hit >= 0.0f && hit < nearest_distance) {
+                nearest = node->data;
+                nearest_distance = hit;
+            }
+            continue;
+        }
+
+        assert(stack_size + 2 <= BVH_MAX_DEPTH);
+        stack[stack_size++] = node->children[0];
+        stack[stack_size++] = node->children[1];
+    }
+
+    if (distance && nearest)
+        *distance = nearest_distance;
+
+    return nearest;
+}
+
+void bvh_destroy(
+        struct bvh* bvh)
+{
+    free(bvh->nodes);
+    memset(bvh, 0, sizeof(*bvh));
+}
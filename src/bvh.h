@@ -0,0 +1,98 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "linmath.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BVH_NONE UINT32_MAX
+#define BVH_MAX_DEPTH 64 // Traversal stack, a balanced tree stays far below
+
+// Leaves hold the user's bounds grown by the margin, internal nodes the
+// union of their children
+struct bvh_node
+{
+    float min[3], max[3];
+    void* data; // Leaves only
+    uint32_t parent; // Next free node while unused
+    uint32_t children[2]; // BVH_NONE for leaves
+    int32_t height; // 0 for leaves
+};
+
+/* Dynamic bounding volume hierarchy over axis aligned boxes. Inserting picks
+ * the sibling that grows the tree's surface area least and rotations keep it
+ * balanced, so queries visit O(log n) nodes plus the ones they return.
+ * Leaves are returned as proxies that stay valid until removed */
+struct bvh
+{
+    struct bvh_node* nodes;
+    uint32_t capacity;
+    uint32_t root;
+    uint32_t free_list;
+    float margin; // Moves within it do not touch the tree
+};
+
+// Called for each leaf inside the frustum
+typedef void (*bvh_query_fn)(void* data, void* user);
+
+// Distance along the ray to the leaf's object, negative for a miss
+typedef float (*bvh_ray_fn)(
+    void* data,
+    const float origin[3],
+    const float direction[3],
+    void* user
+);
+
+void bvh_init(
+    struct bvh* bvh,
+    uint32_t max_leaves,
+    float margin
+);
+
+uint32_t bvh_insert(
+    struct bvh* bvh,
+    const float min[3],
+    const float max[3],
+    void* data
+);
+
+void bvh_remove(
+    struct bvh* bvh,
+    uint32_t proxy
+);
+
+bool bvh_move(
+    struct bvh* bvh,
+    uint32_t proxy,
+    const float min[3],
+    const float max[3]
+);
+
+void bvh_extract_planes(
+    float planes[6][4],
+    mat4x4 view_proj
+);
+
+void bvh_query_frustum(
+    struct bvh* bvh,
+    const float planes[6][4],
+    bvh_query_fn callback,
+    void* user
+);
+
+void* bvh_ray_cast(
+    struct bvh* bvh,
+    const float origin[3],
+    const float direction[3],
+    float max_distance,
+    bvh_ray_fn callback,
+    void* user,
+    float* distance
+);
+
+void bvh_destroy(
+    struct bvh* bvh
+);
+
+#endif
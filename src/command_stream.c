@@ -0,0 +1,131 @@
+#include "command_stream.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+// malloc alone aligns the buffer, MinGW has no aligned_alloc
+_Static_assert(
+    COMMAND_STREAM_ALIGNMENT <= _Alignof(max_align_t),
+    "Command stream alignment must not exceed malloc's"
+);
+
+static size_t command_size(uint32_t payload_size)
+{
+    size_t size = COMMAND_STREAM_ALIGNMENT + (size_t)payload_size;
+    return (size + COMMAND_STREAM_ALIGNMENT - 1) &
+        ~(size_t)(COMMAND_STREAM_ALIGNMENT - 1);
+}
+
+static struct command_header* command_at(
+        struct command_stream* stream,
+        size_t position)
+{
+    return (struct command_header*)(
+        stream->buffer + (position & (stream->capacity - 1))
+    );
+}
+
+// capacity is rounded up to a power of two
+void command_stream_init(
+        struct command_stream* stream,
+        size_t capacity)
+{
+    size_t rounded = COMMAND_STREAM_ALIGNMENT;
+    while (rounded < capacity)
+        rounded *= 2;
+
+    stream->buffer = malloc(rounded);
+    assert(stream->buffer);
+    stream->capacity = rounded;
+    stream->head = 0;
+    stream->tail = 0;
+    stream->write = 0;
+    stream->read = 0;
+}
+
+/* Producer. Returns space for size bytes of payload, NULL while the consumer
+ * has not handed back enough. Commands never wrap, the rest of the buffer is
+ * skipped with a pad when one doesn't fit before the end */
+void* command_stream_write(
+        struct command_stream* stream,
+        uint32_t type,
+        uint32_t size)
+{
+    size_t total = command_size(size);
+    assert(total <= stream->capacity / 2);
+
+    size_t offset = stream->write & (stream->capacity - 1);
+    size_t pad = 0;
+    if (offset + total > stream->capacity)
+        pad = stream->capacity - offset;
+
+    // The consumer is done with everything before tail
+    size_t tail = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+    if (stream->write + pad + total - tail > stream->capacity)
+        return NULL;
+
+    if (pad > 0) {
+        struct command_header* header = command_at(stream, stream->write);
+        header->type = COMMAND_STREAM_PAD;
+        header->size = (uint32_t)pad;
+        stream->write += pad;
+    }
+
+    struct command_header* header = command_at(stream, stream->write);
+    header->type = type;
+    header->size = (uint32_t)total;
+    stream->write += total;
+
+    return (uint8_t*)header + COMMAND_STREAM_ALIGNMENT;
+}
+
+// Producer. Everything written so far becomes visible to the consumer
+void command_stream_publish(
+        struct command_stream* stream)
+{
+    __atomic_store_n(&stream->head, stream->write, __ATOMIC_RELEASE);
+}
+
+/* Consumer. The payload of the next published command, NULL if there is
+ * none. It stays valid until command_stream_consume */
+const void* command_stream_read(
+        struct command_stream* stream,
+        uint32_t* type)
+{
+    size_t head = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE);
+
+    while (stream->read != head) {
+        struct command_header* header = command_at(stream, stream->read);
+        if (header->type != COMMAND_STREAM_PAD) {
+            *type = header->type;
+            return (uint8_t*)header + COMMAND_STREAM_ALIGNMENT;
+        }
+        stream->read += header->size;
+    }
+
+    return NULL;
+}
+
+// Consumer. Hands the command last read back to the producer
+void command_stream_consume(
+        struct command_stream* stream)
+{
+    assert(stream->read != __atomic_load_n(&stream->head, __ATOMIC_RELAXED));
+    struct command_header* header = command_at(stream, stream->read);
+
+    stream->read += header->size;
+    __atomic_store_n(&stream->tail, stream->read, __ATOMIC_RELEASE);
+}
+
+// Consumer. Whether nothing published is left to read
+bool command_stream_empty(
+        struct command_stream* stream)
+{
+    return __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) == stream->read;
+}
+
+void command_stream_destroy(
+        struct command_stream* stream)
+{
+    free(stream->buffer);
+}
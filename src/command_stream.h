@@ -0,0 +1,68 @@
+#ifndef COMMAND_STREAM_H_
+#define COMMAND_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMMAND_STREAM_ALIGNMENT 16 // Of each command, payloads follow one
+#define COMMAND_STREAM_PAD UINT32_MAX // Fills the end when a command wraps
+
+struct command_header
+{
+    uint32_t type;
+    uint32_t size; // Of the whole command, header and alignment included
+};
+
+/* Single producer, single consumer ring of variable sized commands. The
+ * producer writes any number of commands and makes them visible together
+ * with command_stream_publish, the consumer reads them in order and hands
+ * the space back with command_stream_consume. Positions only ever grow, the
+ * offset in the buffer is the position modulo the capacity */
+struct command_stream
+{
+    uint8_t* buffer;
+    size_t capacity; // A power of two
+
+    size_t head; // Published by the producer
+    char head_padding[56];
+    size_t tail; // Handed back by the consumer
+    char tail_padding[56];
+
+    size_t write; // Producer only, not yet published past head
+    size_t read; // Consumer only, not yet handed back past tail
+};
+
+void command_stream_init(
+    struct command_stream* stream,
+    size_t capacity
+);
+
+void* command_stream_write(
+    struct command_stream* stream,
+    uint32_t type,
+    uint32_t size
+);
+
+void command_stream_publish(
+    struct command_stream* stream
+);
+
+const void* command_stream_read(
+    struct command_stream* stream,
+    uint32_t* type
+);
+
+void command_stream_consume(
+    struct command_stream* stream
+);
+
+bool command_stream_empty(
+    struct command_stream* stream
+);
+
+void command_stream_destroy(
+    struct command_stream* stream
+);
+
+#endif
@@ -0,0 +1,173 @@
+#include "cpu_profiler.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static bool profiler_enabled = false;
+
+// Buffers of every thread that recorded an event, kept until shutdown so a
+// trace can include threads that have already exited
+static struct cpu_profiler_thread* threads[CPU_PROFILER_MAX_THREADS];
+static uint32_t thread_count = 0;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local struct cpu_profiler_thread* thread_buffer = NULL;
+static _Thread_local const char* thread_name = NULL;
+
+static uint64_t profiler_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Registers the calling thread on its first event, NULL if out of slots
+static struct cpu_profiler_thread* get_thread_buffer()
+{
+    if (thread_buffer)
+        return thread_buffer;
+
+    pthread_mutex_lock(&threads_mutex);
+    if (thread_count < CPU_PROFILER_MAX_THREADS) {
+        thread_buffer = calloc(1, sizeof(*thread_buffer));
+        if (thread_buffer) {
+            thread_buffer->id = thread_count;
+            thread_buffer->name = thread_name;
+            threads[thread_count++] = thread_buffer;
+        }
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    return thread_buffer;
+}
+
+void cpu_profiler_set_enabled(
+        bool enabled)
+{
+    __atomic_store_n(&profiler_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+bool cpu_profiler_enabled()
+{
+    return __atomic_load_n(&profiler_enabled, __ATOMIC_RELAXED);
+}
+
+// Shown as the thread's name in the trace viewer
+void cpu_profiler_set_thread_name(
+        const char* name)
+{
+    thread_name = name;
+    if (thread_buffer)
+        thread_buffer->name = name;
+}
+
+struct cpu_profiler_scope cpu_profiler_begin(
+        const char* name)
+{
+    struct cpu_profiler_scope scope = {
+        .name = name,
+        .begin = cpu_profiler_enabled() ? profiler_now() : 0
+    };
+
+    return scope;
+}
+
+void cpu_profiler_end(
+        struct cpu_profiler_scope* scope)
+{
+    if (scope->begin == 0)
+        return;
+
+    struct cpu_profiler_thread* thread = get_thread_buffer();
+    if (!thread)
+        return;
+
+    uint64_t index = thread->event_count % CPU_PROFILER_EVENTS;
+    thread->events[index].name = scope->name;
+    thread->events[index].begin = scope->begin;
+    thread->events[index].end = profiler_now();
+
+    // Publish the event to a concurrent cpu_profiler_write_trace
+    __atomic_store_n(
+        &thread->event_count,
+        thread->event_count + 1,
+        __ATOMIC_RELEASE
+    );
+}
+
+/* Writes the events still in each thread's ring as Chrome trace JSON, for
+ * chrome://tracing or ui.perfetto.dev. Safe to call while other threads
+ * record, events being overwritten during the dump may come out garbled */
+bool cpu_profiler_write_trace(
+        const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    pthread_mutex_lock(&threads_mutex);
+    for (uint32_t t = 0; t < thread_count; t++) {
+        struct cpu_profiler_thread* thread = threads[t];
+
+        if (thread->name) {
+            fprintf(file,
+                    "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n",
+                    thread->id,
+                    thread->name);
+            first = false;
+        }
+
+        uint64_t count = __atomic_load_n(
+            &thread->event_count,
+            __ATOMIC_ACQUIRE
+        );
+        uint64_t start = count > CPU_PROFILER_EVENTS ?
+            count - CPU_PROFILER_EVENTS : 0;
+
+        for (uint64_t i = start; i < count; i++) {
+            struct cpu_profiler_event* event;
+            event = &thread->events[i % CPU_PROFILER_EVENTS];
+
+            // Trace timestamps are in microseconds
+            fprintf(file,
+                    "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                    "\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n",
+                    event->name,
+                    thread->id,
+                    event->begin / 1000.0,
+                    (event->end - event->begin) / 1000.0);
+            first = false;
+        }
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote CPU trace to %s\n", path);
+
+    return true;
+}
+
+// Frees every thread's buffer, no thread may record afterwards
+void cpu_profiler_shutdown()
+{
+    pthread_mutex_lock(&threads_mutex);
+    for (uint32_t i = 0; i < thread_count; i++)
+        free(threads[i]);
+    thread_count = 0;
+    pthread_mutex_unlock(&threads_mutex);
+
+    thread_buffer = NULL;
+}
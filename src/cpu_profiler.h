@@ -0,0 +1,56 @@
+#ifndef CPU_PROFILER_H_
+#define CPU_PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CPU_PROFILER_EVENTS 16384 // Per thread, oldest are overwritten
+#define CPU_PROFILER_MAX_THREADS 16
+
+// A finished scope, written as a Chrome trace "complete" event
+struct cpu_profiler_event
+{
+    const char* name; // Not copied, scope names are string literals
+    uint64_t begin, end; // Nanoseconds, CLOCK_MONOTONIC
+};
+
+// Written only by its own thread, so recording takes no locks
+struct cpu_profiler_thread
+{
+    const char* name;
+    uint32_t id;
+    uint64_t event_count; // Total recorded, index is count % EVENTS
+    struct cpu_profiler_event events[CPU_PROFILER_EVENTS];
+};
+
+struct cpu_profiler_scope
+{
+    const char* name;
+    uint64_t begin; // 0 when profiling was disabled at begin
+};
+
+void cpu_profiler_set_enabled(
+    bool enabled
+);
+
+bool cpu_profiler_enabled();
+
+void cpu_profiler_set_thread_name(
+    const char* name
+);
+
+struct cpu_profiler_scope cpu_profiler_begin(
+    const char* name
+);
+
+void cpu_profiler_end(
+    struct cpu_profiler_scope* scope
+);
+
+bool cpu_profiler_write_trace(
+    const char* path
+);
+
+void cpu_profiler_shutdown();
+
+#endif
@@ -3,8 +3,16 @@
 #include "renderer_image.h"
 #include "renderer_tools.h"
 #include "renderer.h"
+#include "renderer_capture.h"
+#include "renderer_gpu_profiler.h"
+#include "renderer_pipeline_stats.h"
+#include "renderer_occlusion.h"
+#include "renderer_scene.h"
+#include "cpu_profiler.h"
+#include "timer.h"
 #include "game.h"
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,144 +60,745 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
     game_update_mouse_pos(game, xpos, ypos);
 }
 
-void game_run(struct game* game)
+static VkPresentModeKHR parse_present_mode(const char* name)
+{
+    if (!strcmp(name, "mailbox"))
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    if (!strcmp(name, "immediate"))
+        return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    if (!strcmp(name, "fifo"))
+        return VK_PRESENT_MODE_FIFO_KHR;
+    if (!strcmp(name, "fifo-relaxed"))
+        return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+
+    fprintf(stderr, "Unknown present mode %s, using fifo\n", name);
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+/* A swapchain never has fewer than one image nor more than the per-image
+ * arrays hold. What the surface allows is applied when it is created */
+static uint32_t parse_image_count(const char* value)
+{
+    char* end;
+    long count = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || count < 1 ||
+            count > MAX_FRAMEBUFFERS) {
+        fprintf(
+            stderr,
+            "Invalid image count %s, expected 1 to %d\n",
+            value,
+            MAX_FRAMEBUFFERS
+        );
+        exit(-1);
+    }
+
+    return (uint32_t)count;
+}
+
+// Counters of the latest frame whose queries have resolved
+static void print_pipeline_stats(struct renderer_resources* resources)
+{
+    struct renderer_frame_stats* stats = &resources->frame_stats;
+    struct renderer_pipeline_counters* counters;
+    counters = &resources->pipeline_stats->latest;
+
+    double pixels = (double)resources->swapchain_extent.width *
+        resources->swapchain_extent.height;
+
+    printf("draws %u, triangles %llu\n",
+            stats->draw_count,
+            (unsigned long long)stats->triangle_count);
+    printf("frame %llu: vertices %llu, vs invocations %llu (reuse %.2f), "
+            "primitives %llu -> %llu clipped\n",
+            (unsigned long long)counters->frame,
+            (unsigned long long)counters->input_assembly_vertices,
+            (unsigned long long)counters->vertex_shader_invocations,
+            counters->vertex_shader_invocations ?
+                (double)counters->input_assembly_vertices /
+                counters->vertex_shader_invocations : 0.0,
+            (unsigned long long)counters->clipping_invocations,
+            (unsigned long long)counters->clipping_primitives);
+    printf("fs invocations %llu (overdraw %.2f), samples passed %llu\n",
+            (unsigned long long)counters->fragment_shader_invocations,
+            counters->fragment_shader_invocations / pixels,
+            (unsigned long long)counters->samples_passed);
+
+    if (resources->occlusion) {
+        struct renderer_occlusion_counts* counts;
+        counts = &resources->occlusion->latest;
+        printf("occlusion: first pass %u, second pass %u, culled %u\n",
+                counts->first_pass,
+                counts->second_pass,
+                counts->culled);
+    }
+}
+
+static void write_ppm(
+        const char* path,
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    for (uint32_t i = 0; i < width * height; i++)
+        fwrite(&pixels[i * 4], 1, 3, file); // Drop alpha
+
+    fclose(file);
+}
+
+// Sent by the game thread, in the order they are to be applied
+enum game_command
+{
+    GAME_COMMAND_FRAME,
+    GAME_COMMAND_SET_VISIBLE,
+    GAME_COMMAND_PRESENT_MODE,
+    GAME_COMMAND_IMAGE_COUNT,
+    GAME_COMMAND_RESIZE,
+    GAME_COMMAND_GPU_REPORT,
+    GAME_COMMAND_QUIT
+};
+
+struct game_frame_command
+{
+    struct camera camera; // Interpolated for the frame
+    double input_time;
+};
+
+struct game_visible_command
+{
+    struct renderer_object_handle object;
+    bool visible;
+};
+
+struct game_present_mode_command
+{
+    VkPresentModeKHR present_mode;
+};
+
+struct game_image_count_command
+{
+    uint32_t image_count;
+};
+
+struct game_resize_command
+{
+    int width, height;
+};
+
+// Makes the commands written so far visible, waking the render thread
+static void game_publish(struct game* game)
+{
+    command_stream_publish(&game->commands);
+
+    pthread_mutex_lock(&game->render_mutex);
+    if (game->render_waiting)
+        pthread_cond_signal(&game->commands_published);
+    pthread_mutex_unlock(&game->render_mutex);
+}
+
+/* Space for a command's payload. When the stream is full what was written
+ * is published early and the render thread is given time to catch up */
+static void* game_send(
+        struct game* game,
+        enum game_command type,
+        uint32_t size)
+{
+    void* payload;
+    while (!(payload = command_stream_write(&game->commands, type, size))) {
+        game_publish(game);
+        sched_yield();
+    }
+
+    return payload;
+}
+
+// Lets the game thread run at most GAME_FRAMES_AHEAD frames ahead of drawing
+static void game_wait_for_render(struct game* game)
+{
+    pthread_mutex_lock(&game->render_mutex);
+    while (game->frames_sent - game->frames_drawn > GAME_FRAMES_AHEAD)
+        pthread_cond_wait(&game->frame_drawn, &game->render_mutex);
+    pthread_mutex_unlock(&game->render_mutex);
+}
+
+/* Checked under the mutex, and game_publish publishes before taking it, so
+ * commands published while going to sleep always wake the thread */
+static void game_wait_for_commands(struct game* game)
+{
+    pthread_mutex_lock(&game->render_mutex);
+    game->render_waiting = true;
+    while (command_stream_empty(&game->commands))
+        pthread_cond_wait(&game->commands_published, &game->render_mutex);
+    game->render_waiting = false;
+    pthread_mutex_unlock(&game->render_mutex);
+}
+
+static void game_draw(
+        struct game* game,
+        const struct game_frame_command* frame,
+        double* next_stats_report)
+{
+    struct renderer_resources* resources = game->renderer_resources;
+
+    resources->camera = frame->camera;
+    resources->frame_stats.input_time = frame->input_time;
+    renderer_draw_frame(resources);
+
+    if (game->settings.report_latency) {
+        struct renderer_frame_stats* stats = &resources->frame_stats;
+        printf("input to queue present %.3f ms, cpu %.3f ms\n",
+                stats->input_to_queue_present * 1000.0,
+                stats->cpu_time * 1000.0);
+    }
+
+    if (resources->pipeline_stats && timer_now() >= *next_stats_report) {
+        print_pipeline_stats(resources);
+        *next_stats_report += 1.0;
+    }
+
+    pthread_mutex_lock(&game->render_mutex);
+    game->frames_drawn++;
+    pthread_cond_signal(&game->frame_drawn);
+    pthread_mutex_unlock(&game->render_mutex);
+}
+
+// Applies the game thread's commands until told to quit
+static void* game_render_main(void* argument)
+{
+    struct game* game = argument;
+    struct renderer_resources* resources = game->renderer_resources;
+
+    cpu_profiler_set_thread_name("render");
+    renderer_set_render_thread(resources);
+
+    double next_stats_report = timer_now() + 1.0;
+    bool quit = false;
+    while (!quit) {
+        uint32_t type;
+        const void* command = command_stream_read(&game->commands, &type);
+        if (!command) {
+            struct cpu_profiler_scope scope;
+            scope = cpu_profiler_begin("wait for commands");
+            game_wait_for_commands(game);
+            cpu_profiler_end(&scope);
+            continue;
+        }
+
+        switch (type) {
+        case GAME_COMMAND_FRAME:
+            game_draw(game, command, &next_stats_report);
+            break;
+        case GAME_COMMAND_SET_VISIBLE: {
+            const struct game_visible_command* visible = command;
+            renderer_scene_set_visible(
+                resources->scene,
+                visible->object,
+                visible->visible
+            );
+            break;
+        }
+        case GAME_COMMAND_PRESENT_MODE: {
+            const struct game_present_mode_command* mode = command;
+            renderer_set_present_mode(resources, mode->present_mode);
+            break;
+        }
+        case GAME_COMMAND_IMAGE_COUNT: {
+            const struct game_image_count_command* count = command;
+            renderer_set_swapchain_image_count(resources, count->image_count);
+            break;
+        }
+        case GAME_COMMAND_RESIZE: {
+            const struct game_resize_command* size = command;
+            renderer_resize(resources, size->width, size->height);
+            break;
+        }
+        case GAME_COMMAND_GPU_REPORT:
+            renderer_gpu_profiler_print_report(resources->gpu_profiler);
+            break;
+        case GAME_COMMAND_QUIT:
+            quit = true;
+            break;
+        default:
+            assert(!"Unknown game command");
+            break;
+        }
+
+        command_stream_consume(&game->commands);
+    }
+
+    return NULL;
+}
+
+void game_default_settings(struct game_settings* settings)
+{
+    memset(settings, 0, sizeof(*settings));
+
+    renderer_default_settings(&settings->renderer);
+    settings->fps_limit = 0.0;
+    settings->report_latency = false;
+
+    settings->frame_count = 1;
+    settings->output_path = NULL;
+
+    settings->capture_directory = NULL;
+    settings->capture_raw = false;
+
+    settings->trace_path = NULL;
+
+    settings->tick_rate = 120.0;
+}
+
+void game_parse_args(
+        struct game_settings* settings,
+        int argc,
+        char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--present-mode") && has_value) {
+            settings->renderer.present_mode = parse_present_mode(argv[++i]);
+        } else if (!strcmp(argv[i], "--images") && has_value) {
+            settings->renderer.swapchain_image_count =
+                parse_image_count(argv[++i]);
+        } else if (!strcmp(argv[i], "--fps-limit") && has_value) {
+            settings->fps_limit = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--report-latency")) {
+            settings->report_latency = true;
+        } else if (!strcmp(argv[i], "--trace") && has_value) {
+            settings->trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--pipeline-stats")) {
+            settings->renderer.pipeline_stats = true;
+        } else if (!strcmp(argv[i], "--occlusion-culling")) {
+            settings->renderer.occlusion_culling = true;
+        } else if (!strcmp(argv[i], "--depth-prepass")) {
+            settings->renderer.depth_prepass = true;
+        } else if (!strcmp(argv[i], "--frustum-culling")) {
+            settings->renderer.frustum_culling = true;
+        } else if (!strcmp(argv[i], "--jobs") && has_value) {
+            settings->renderer.job_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--msaa") && has_value) {
+            settings->renderer.msaa_samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--profile-gpu")) {
+            settings->renderer.profile_gpu = true;
+        } else if (!strcmp(argv[i], "--headless")) {
+            settings->renderer.headless = true;
+        } else if (!strcmp(argv[i], "--size") && has_value) {
+            unsigned width, height;
+            if (sscanf(argv[++i], "%ux%u", &width, &height) == 2) {
+                settings->renderer.headless_width = width;
+                settings->renderer.headless_height = height;
+            } else {
+                fprintf(stderr, "Invalid size %s\n", argv[i]);
+            }
+        } else if (!strcmp(argv[i], "--frames") && has_value) {
+            settings->frame_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && has_value) {
+            settings->output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--capture") && has_value) {
+            settings->capture_directory = argv[++i];
+        } else if (!strcmp(argv[i], "--capture-raw")) {
+            settings->capture_raw = true;
+        } else if (!strcmp(argv[i], "--tick-rate") && has_value) {
+            settings->tick_rate = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        }
+    }
+
+    if (settings->tick_rate <= 0.0)
+        settings->tick_rate = 120.0;
+}
+
+void game_run(struct game* game, const struct game_settings* settings)
 {
     memset(game, 0, sizeof(*game));
     game->running = true;
+    game->settings = *settings;
+    frame_limiter_init(&game->frame_limiter, settings->fps_limit);
+
+    if (settings->trace_path) {
+        cpu_profiler_set_thread_name("main");
+        cpu_profiler_set_enabled(true);
+    }
 
     game->renderer_resources = malloc(sizeof(*game->renderer_resources));
 
-    game->draw_house = true;
+    // Headless runs never touch GLFW, there may be no display to connect to
+    bool headless = settings->renderer.headless;
+    GLFWwindow* window = NULL;
+    if (!headless) {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        window = glfwCreateWindow(
+            800, 600,
+            "Vulkan Window",
+            NULL,
+            NULL
+        );
+        glfwSetWindowUserPointer(window, game);
+        glfwSetWindowSizeCallback(window, resize_callback);
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetCursorPosCallback(window, cursor_pos_callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
-    glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    GLFWwindow* window = glfwCreateWindow(
-        800, 600,
-        "Vulkan Window",
-        NULL,
-        NULL
+    renderer_initialize_resources(
+        game->renderer_resources,
+        window,
+        &game->settings.renderer
     );
-    glfwSetWindowUserPointer(window, game);
-    glfwSetWindowSizeCallback(window, resize_callback);
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, cursor_pos_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-    renderer_initialize_resources(game->renderer_resources, window);
+    if (settings->capture_directory) {
+        game->capture = malloc(sizeof(*game->capture));
+        if (renderer_capture_init(
+                game->capture,
+                game->renderer_resources,
+                settings->capture_directory,
+                settings->capture_raw ?
+                    RENDERER_CAPTURE_RAW :
+                    RENDERER_CAPTURE_PNG)) {
+            game->renderer_resources->capture = game->capture;
+        } else {
+            free(game->capture);
+            game->capture = NULL;
+        }
+    }
 
     const char* model_files[] = {
         "assets/models/chalet.obj"
     };
+    struct renderer_resource_handle house_mesh;
     renderer_generate_meshes(
         game->renderer_resources,
         model_files,
-        1
+        1,
+        &house_mesh
     );
 
-    struct renderer_drawable test_drawable;
-    renderer_create_drawable(
+    // Added once and from then on only shown or hidden, with the default
+    // texture
+    struct renderer_object_handle house = renderer_scene_add(
         game->renderer_resources,
-        "assets/models/chalet.obj",
-        "texture_src",
-        &test_drawable
+        house_mesh,
+        (struct renderer_resource_handle){0}
     );
 
-    struct renderer_mesh* house_mesh = &game->renderer_resources->meshes[0];
-
-    while(!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+    // Both states start out the same, so the first frames draw them as is
+    game->states[0].camera = game->renderer_resources->camera;
+    game->states[0].draw_house = true;
+    game->states[1] = game->states[0];
+    game->current_state = 0;
+    game->tick = 1.0 / settings->tick_rate;
+    game->accumulator = 0.0;
+    game->last_time = timer_now();
+
+    // From here on only the render thread touches the renderer, until it
+    // has been joined
+    command_stream_init(&game->commands, GAME_COMMAND_STREAM_SIZE);
+    pthread_mutex_init(&game->render_mutex, NULL);
+    pthread_cond_init(&game->commands_published, NULL);
+    pthread_cond_init(&game->frame_drawn, NULL);
+    game->frames_sent = 0;
+    game->frames_drawn = 0;
+    int error = pthread_create(
+        &game->render_thread,
+        NULL,
+        game_render_main,
+        game
+    );
+    assert(error == 0);
+
+    uint32_t frames_rendered = 0;
+    while (headless ?
+            frames_rendered < settings->frame_count :
+            !glfwWindowShouldClose(window)) {
+        struct cpu_profiler_scope frame_scope = cpu_profiler_begin("frame");
+
+        // Frame N + 1 is simulated while frame N is drawn, but no further
+        // ahead, which would only add latency
+        struct cpu_profiler_scope scope = cpu_profiler_begin("render wait");
+        game_wait_for_render(game);
+        cpu_profiler_end(&scope);
+
+        // Wait before sampling input rather than after, so the time spent
+        // limiting does not add to input latency
+        scope = cpu_profiler_begin("limiter wait");
+        frame_limiter_wait(&game->frame_limiter);
+        cpu_profiler_end(&scope);
+
+        scope = cpu_profiler_begin("poll events");
+        if (!headless)
+            glfwPollEvents();
+        cpu_profiler_end(&scope);
+        game->input_time = timer_now();
 
         game_process_input(game);
         if (game->running) {
-            game_update(game);
+            float alpha = game_simulate(game);
+
+            // Toggles are not interpolated, the newest state is drawn
+            struct game_visible_command* visible = game_send(
+                game,
+                GAME_COMMAND_SET_VISIBLE,
+                sizeof(*visible)
+            );
+            visible->object = house;
+            visible->visible = game->states[game->current_state].draw_house;
+
+            game_render(game, alpha);
+        }
 
-            if (game->draw_house) {
-                renderer_draw(
-                    game->renderer_resources,
-                    &test_drawable,
-                    0.0f, 0.0f, 0.0f
-                );
-            }
+        frames_rendered++;
 
-            game_render(game);
-        }
+        cpu_profiler_end(&frame_scope);
+    }
+
+    game_send(game, GAME_COMMAND_QUIT, 0);
+    game_publish(game);
+    pthread_join(game->render_thread, NULL);
+    renderer_set_render_thread(game->renderer_resources);
+
+    pthread_cond_destroy(&game->frame_drawn);
+    pthread_cond_destroy(&game->commands_published);
+    pthread_mutex_destroy(&game->render_mutex);
+    command_stream_destroy(&game->commands);
+
+    if (headless && settings->output_path) {
+        uint32_t width, height;
+        const void* pixels = renderer_get_frame_pixels(
+            game->renderer_resources,
+            &width,
+            &height
+        );
+        if (pixels)
+            write_ppm(settings->output_path, pixels, width, height);
+    }
+
+    if (!headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 
-        game->mouse.dx = 0.f;
-        game->mouse.dy = 0.f;
+    if (game->capture) {
+        // Lets the last copies complete so the worker can write them out
+        vkDeviceWaitIdle(game->renderer_resources->device);
+        renderer_capture_finish(game->capture);
+        renderer_capture_print_report(game->capture);
+        renderer_capture_destroy(game->capture);
+        free(game->capture);
     }
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    struct renderer_gpu_profiler* profiler;
+    profiler = game->renderer_resources->gpu_profiler;
+    if (profiler)
+        renderer_gpu_profiler_print_report(profiler);
 
     renderer_destroy_resources(game->renderer_resources);
     free(game->renderer_resources);
+
+    if (settings->trace_path) {
+        cpu_profiler_write_trace(settings->trace_path);
+        cpu_profiler_shutdown();
+    }
 }
 
+/* Handles what happens once per frame, and gathers the movement of the
+ * mouse and toggles for the next tick. Held keys are read by the ticks */
 void game_process_input(struct game* game)
 {
-    struct camera* camera = &game->renderer_resources->camera;
+    struct cpu_profiler_scope scope = cpu_profiler_begin("process input");
 
     if (game->running) {
-        float cam_speed = 0.0035f;
-        float sensitivity = 0.005f;
-
-        if (game->keys[GLFW_KEY_W]) {
-            camera->x += cosf(camera->yaw) * cam_speed;
-            camera->y += sinf(camera->yaw) * cam_speed;
-        }
-        if (game->keys[GLFW_KEY_S]) {
-            camera->x -= cosf(camera->yaw) * cam_speed;
-            camera->y -= sinf(camera->yaw) * cam_speed;
-        }
-        if (game->keys[GLFW_KEY_A]) {
-            camera->x += cosf(camera->yaw + M_PI/2) * cam_speed;
-            camera->y += sinf(camera->yaw + M_PI/2) * cam_speed;
+        if (game->keys[GLFW_KEY_T] && !game->keys_prev[GLFW_KEY_T]) {
+            game->input.toggle_house = true;
         }
-        if (game->keys[GLFW_KEY_D]) {
-            camera->x -= cosf(camera->yaw + M_PI/2) * cam_speed;
-            camera->y -= sinf(camera->yaw + M_PI/2) * cam_speed;
+
+        // Latency policy, lowest latency first
+        VkPresentModeKHR present_modes[] = {
+            VK_PRESENT_MODE_IMMEDIATE_KHR,
+            VK_PRESENT_MODE_MAILBOX_KHR,
+            VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+            VK_PRESENT_MODE_FIFO_KHR
+        };
+        for (int i = 0; i < 4; i++) {
+            int key = GLFW_KEY_F1 + i;
+            if (game->keys[key] && !game->keys_prev[key]) {
+                struct game_present_mode_command* mode = game_send(
+                    game,
+                    GAME_COMMAND_PRESENT_MODE,
+                    sizeof(*mode)
+                );
+                mode->present_mode = present_modes[i];
+            }
         }
 
-        if (game->keys[GLFW_KEY_LEFT_SHIFT]) {
-            camera->z += cam_speed;
-            camera->pitch += cam_speed;
+        // Double, triple and quadruple buffering
+        for (uint32_t i = 0; i < 3; i++) {
+            int key = GLFW_KEY_F6 + i;
+            if (game->keys[key] && !game->keys_prev[key]) {
+                struct game_image_count_command* count = game_send(
+                    game,
+                    GAME_COMMAND_IMAGE_COUNT,
+                    sizeof(*count)
+                );
+                count->image_count = 2 + i;
+            }
         }
-        if (game->keys[GLFW_KEY_LEFT_CONTROL]) {
-            camera->z -= cam_speed;
-            camera->pitch -= cam_speed;
+
+        if (game->keys[GLFW_KEY_F12] && !game->keys_prev[GLFW_KEY_F12] &&
+                game->settings.trace_path) {
+            cpu_profiler_write_trace(game->settings.trace_path);
         }
 
-        if (game->keys[GLFW_KEY_T] && !game->keys_prev[GLFW_KEY_T]) {
-            game->draw_house = !game->draw_house;
+        if (game->keys[GLFW_KEY_F5] && !game->keys_prev[GLFW_KEY_F5] &&
+                game->renderer_resources->gpu_profiler) {
+            game_send(game, GAME_COMMAND_GPU_REPORT, 0);
         }
 
-        camera->yaw += game->mouse.dx * sensitivity;
-        camera->pitch += game->mouse.dy * sensitivity;
+        game->input.look_x += game->mouse.dx;
+        game->input.look_y += game->mouse.dy;
     }
+    game->mouse.dx = 0.f;
+    game->mouse.dy = 0.f;
 
     if (game->keys[GLFW_KEY_ESCAPE] && !game->keys_prev[GLFW_KEY_ESCAPE])
     {
         game->running = !game->running;
+
+        // The time spent paused is not simulated
+        game->last_time = timer_now();
     }
 
     memcpy(game->keys_prev, game->keys, GLFW_KEY_LAST * sizeof(game->keys[0]));
+
+    cpu_profiler_end(&scope);
 }
 
+/* Advances the simulation by one tick, from the newest state into the other
+ * one, so the last two ticks are always whole for game_render */
 void game_update(struct game* game)
 {
-    // Update code
+    struct cpu_profiler_scope scope = cpu_profiler_begin("update");
+
+    uint32_t next = game->current_state ^ 1;
+    struct game_state* state = &game->states[next];
+    *state = game->states[game->current_state];
+
+    struct camera* camera = &state->camera;
+    float cam_speed = GAME_CAMERA_SPEED * (float)game->tick;
+    float sensitivity = 0.005f;
+
+    if (game->keys[GLFW_KEY_W]) {
+        camera->x += cosf(camera->yaw) * cam_speed;
+        camera->y += sinf(camera->yaw) * cam_speed;
+    }
+    if (game->keys[GLFW_KEY_S]) {
+        camera->x -= cosf(camera->yaw) * cam_speed;
+        camera->y -= sinf(camera->yaw) * cam_speed;
+    }
+    if (game->keys[GLFW_KEY_A]) {
+        camera->x += cosf(camera->yaw + M_PI/2) * cam_speed;
+        camera->y += sinf(camera->yaw + M_PI/2) * cam_speed;
+    }
+    if (game->keys[GLFW_KEY_D]) {
+        camera->x -= cosf(camera->yaw + M_PI/2) * cam_speed;
+        camera->y -= sinf(camera->yaw + M_PI/2) * cam_speed;
+    }
+
+    if (game->keys[GLFW_KEY_LEFT_SHIFT]) {
+        camera->z += cam_speed;
+        camera->pitch += cam_speed;
+    }
+    if (game->keys[GLFW_KEY_LEFT_CONTROL]) {
+        camera->z -= cam_speed;
+        camera->pitch -= cam_speed;
+    }
+
+    camera->yaw += game->input.look_x * sensitivity;
+    camera->pitch += game->input.look_y * sensitivity;
+
+    if (game->input.toggle_house)
+        state->draw_house = !state->draw_house;
+
+    memset(&game->input, 0, sizeof(game->input));
+    game->current_state = next;
+    game->tick_count++;
+
+    cpu_profiler_end(&scope);
+}
+
+/* Runs the ticks that have come due since the last call. Returns how far
+ * past the newest tick the time now is, as a fraction of a tick, which is
+ * how far the frame is drawn from the previous state towards the newest */
+float game_simulate(struct game* game)
+{
+    double now = timer_now();
+    double elapsed = now - game->last_time;
+    game->last_time = now;
+
+    // After a stall, e.g. a window drag, slow down instead of running many
+    // ticks in one frame, which would only make the next frame late too
+    if (elapsed > GAME_MAX_FRAME_TIME)
+        elapsed = GAME_MAX_FRAME_TIME;
+
+    game->accumulator += elapsed;
+    while (game->accumulator >= game->tick) {
+        game_update(game);
+        game->accumulator -= game->tick;
+    }
+
+    return (float)(game->accumulator / game->tick);
+}
+
+static float lerp(float from, float to, float alpha)
+{
+    return from + (to - from) * alpha;
 }
 
-void game_render(struct game* game)
+/* Sends the frame to the render thread, with the camera interpolated
+ * between the last two ticks */
+void game_render(struct game* game, float alpha)
 {
-    renderer_draw_frame(game->renderer_resources);
+    const struct camera* from = &game->states[game->current_state ^ 1].camera;
+    const struct camera* to = &game->states[game->current_state].camera;
+
+    struct game_frame_command* frame = game_send(
+        game,
+        GAME_COMMAND_FRAME,
+        sizeof(*frame)
+    );
+    struct camera* camera = &frame->camera;
+
+    camera->x = lerp(from->x, to->x, alpha);
+    camera->y = lerp(from->y, to->y, alpha);
+    camera->z = lerp(from->z, to->z, alpha);
+    camera->pitch = lerp(from->pitch, to->pitch, alpha);
+    camera->yaw = lerp(from->yaw, to->yaw, alpha);
+    frame->input_time = game->input_time;
+
+    game_publish(game);
+    game->frames_sent++;
 }
 
+// Called while polling events, applied by the render thread
 void game_resize(
         struct game* game,
         int width, int height)
 {
-    renderer_resize(game->renderer_resources, width, height);
+    struct game_resize_command* size = game_send(
+        game,
+        GAME_COMMAND_RESIZE,
+        sizeof(*size)
+    );
+    size->width = width;
+    size->height = height;
 }
 
 void game_update_keys(
@@ -205,8 +814,8 @@ void game_update_mouse_pos(
         double x,
         double y)
 {
-    game->mouse.dx = game->mouse.x - (float)x;
-    game->mouse.dy = game->mouse.y - (float)y;
+    game->mouse.dx += game->mouse.x - (float)x;
+    game->mouse.dy += game->mouse.y - (float)y;
     game->mouse.x = (float)x;
     game->mouse.y = (float)y;
 }
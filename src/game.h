@@ -4,13 +4,52 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "command_stream.h"
+
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#define GAME_MAX_FRAME_TIME 0.25 // Longer frames are not caught up with
+#define GAME_CAMERA_SPEED 2.0f // Units per second
+#define GAME_COMMAND_STREAM_SIZE 65536
+#define GAME_FRAMES_AHEAD 1 // Sent to the render thread and not drawn yet
+
 struct mouse
 {
     float x, y;
-    float dx, dy;
+    float dx, dy; // Moved since the last frame
+};
+
+// Everything the simulation advances, one copy per tick
+struct game_state
+{
+    struct camera camera;
+    bool draw_house;
+};
+
+// Gathered from events every frame, used up by the next tick
+struct game_input
+{
+    float look_x, look_y; // Mouse movement
+    bool toggle_house;
+};
+
+struct game_settings
+{
+    struct renderer_settings renderer;
+    double fps_limit; // 0 renders as fast as the present mode allows
+    bool report_latency; // Print input-to-present latency every frame
+
+    uint32_t frame_count; // Frames to render when headless
+    const char* output_path; // Last headless frame is written here as PPM
+
+    const char* capture_directory; // Write every frame here when set
+    bool capture_raw; // Raw RGBA instead of PNG
+
+    const char* trace_path; // CPU trace written here on F12 and on exit
+
+    double tick_rate; // Simulation updates per second, whatever the fps
 };
 
 struct game
@@ -20,14 +59,40 @@ struct game
     bool keys[GLFW_KEY_LAST];
     bool keys_prev[GLFW_KEY_LAST];
     struct renderer_resources* renderer_resources;
+    struct game_settings settings;
+    struct frame_limiter frame_limiter;
+    struct renderer_capture* capture;
 
-    bool draw_house;
+    // The last two ticks, rendered in between. states[current_state] is the
+    // newest, the other is overwritten by the next tick
+    struct game_state states[2];
+    uint32_t current_state;
+    struct game_input input;
+    double tick; // Seconds simulated per update
+    double accumulator; // Elapsed but not yet simulated
+    double last_time;
+    uint64_t tick_count;
+    double input_time; // When the events of the frame were polled
+
+    // After initialization the renderer belongs to the render thread, which
+    // draws and changes it as told by the commands of the game thread
+    struct command_stream commands;
+    pthread_t render_thread;
+    pthread_mutex_t render_mutex;
+    pthread_cond_t commands_published;
+    pthread_cond_t frame_drawn;
+    bool render_waiting; // For commands, under render_mutex
+    uint64_t frames_sent; // Game thread only
+    uint64_t frames_drawn; // Under render_mutex
 };
 
-void game_run(struct game* game);
+void game_default_settings(struct game_settings* settings);
+void game_parse_args(struct game_settings* settings, int argc, char** argv);
+void game_run(struct game* game, const struct game_settings* settings);
 void game_process_input(struct game* game);
 void game_update(struct game* game);
-void game_render(struct game* game);
+float game_simulate(struct game* game);
+void game_render(struct game* game, float alpha);
 
 void game_resize(
     struct game* game,
@@ -0,0 +1,341 @@
+#include "job.h"
+#include "cpu_profiler.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define JOB_SPIN_ROUNDS 64 // Failed searches for work before sleeping
+
+static _Thread_local struct job_worker* current_worker = NULL;
+
+static bool job_deque_push(
+        struct job_deque* deque,
+        const struct job* job)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= JOB_QUEUE_SIZE)
+        return false;
+
+    deque->slots[bottom & (JOB_QUEUE_SIZE - 1)] = *job;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+// Newest first, so a thread keeps working on what it just split up
+static bool job_deque_take(
+        struct job_deque* deque,
+        struct job* job)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    *job = deque->slots[bottom & (JOB_QUEUE_SIZE - 1)];
+    if (top < bottom)
+        return true;
+
+    // The last job, race the stealers for it
+    bool taken = __atomic_compare_exchange_n(
+        &deque->top,
+        &top,
+        top + 1,
+        false,
+        __ATOMIC_SEQ_CST,
+        __ATOMIC_RELAXED
+    );
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+    return taken;
+}
+
+// Oldest first, which tend to be the largest pieces of work
+static bool job_deque_steal(
+        struct job_deque* deque,
+        struct job* job)
+{
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom)
+        return false;
+
+    // Copied before claiming it, the owner can't reuse the slot until then
+    *job = deque->slots[top & (JOB_QUEUE_SIZE - 1)];
+
+    return __atomic_compare_exchange_n(
+        &deque->top,
+        &top,
+        top + 1,
+        false,
+        __ATOMIC_SEQ_CST,
+        __ATOMIC_RELAXED
+    );
+}
+
+static void job_execute(const struct job* job)
+{
+    job->function(job->data);
+
+    if (job->counter)
+        __atomic_sub_fetch(&job->counter->value, 1, __ATOMIC_RELEASE);
+}
+
+// Own jobs first, then one steal attempt from each other worker
+static bool job_find(
+        struct job_system* system,
+        struct job_worker* worker,
+        struct job* job)
+{
+    bool found = job_deque_take(&worker->deque, job);
+
+    uint32_t count = system->thread_count;
+    uint32_t start = 0;
+    if (!found && count > 1) {
+        worker->random = worker->random * 1664525u + 1013904223u;
+        start = (worker->random >> 8) % count;
+    }
+
+    for (uint32_t i = 0; !found && count > 1 && i < count; i++) {
+        struct job_worker* victim = &system->workers[(start + i) % count];
+        if (victim != worker)
+            found = job_deque_steal(&victim->deque, job);
+    }
+
+    if (found)
+        __atomic_sub_fetch(&system->queued, 1, __ATOMIC_SEQ_CST);
+
+    return found;
+}
+
+/* Sleeping is announced before checking for work under the mutex, and job_run
+ * counts the job before checking for sleepers, so one of them always sees the
+ * other and no wake up is lost */
+static void job_sleep(struct job_system* system)
+{
+    pthread_mutex_lock(&system->mutex);
+    __atomic_add_fetch(&system->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&system->queued, __ATOMIC_SEQ_CST) <= 0 &&
+            !__atomic_load_n(&system->quit, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&system->wake, &system->mutex);
+
+    __atomic_sub_fetch(&system->sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&system->mutex);
+}
+
+static void* job_worker_main(void* argument)
+{
+    struct job_worker* worker = argument;
+    struct job_system* system = worker->system;
+
+    current_worker = worker;
+    cpu_profiler_set_thread_name(worker->name);
+
+    uint32_t spins = 0;
+    while (!__atomic_load_n(&system->quit, __ATOMIC_ACQUIRE)) {
+        struct job job;
+        if (job_find(system, worker, &job)) {
+            job_execute(&job);
+            spins = 0;
+        } else if (++spins < JOB_SPIN_ROUNDS) {
+            sched_yield();
+        } else {
+            job_sleep(system);
+            spins = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/* thread_count includes the calling thread, 0 uses one per online CPU.
+ * A count of 1 starts no threads and runs every job in job_wait */
+void job_system_init(
+        struct job_system* system,
+        uint32_t thread_count)
+{
+    if (thread_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    if (thread_count > JOB_MAX_THREADS)
+        thread_count = JOB_MAX_THREADS;
+
+    system->workers = calloc(thread_count, sizeof(*system->workers));
+    assert(system->workers);
+    system->thread_count = thread_count;
+    system->quit = false;
+    system->queued = 0;
+    system->sleeping = 0;
+    pthread_mutex_init(&system->mutex, NULL);
+    pthread_cond_init(&system->wake, NULL);
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        struct job_worker* worker = &system->workers[i];
+        worker->system = system;
+        worker->index = i;
+        worker->random = i + 1;
+        snprintf(worker->name, sizeof(worker->name), "job worker %u", i);
+    }
+
+    current_worker = &system->workers[0];
+
+    for (uint32_t i = 1; i < thread_count; i++) {
+        struct job_worker* worker = &system->workers[i];
+        int error = pthread_create(
+            &worker->thread,
+            NULL,
+            job_worker_main,
+            worker
+        );
+        assert(error == 0);
+    }
+}
+
+/* Queues the job on the calling worker, or runs it right away when that
+ * worker's queue is full. counter is incremented here and decremented once
+ * the job has returned */
+void job_run(
+        struct job_system* system,
+        job_function function,
+        void* data,
+        struct job_counter* counter)
+{
+    struct job_worker* worker = current_worker;
+    assert(worker && worker->system == system);
+
+    struct job job = {
+        .function = function,
+        .data = data,
+        .counter = counter
+    };
+
+    if (counter)
+        __atomic_add_fetch(&counter->value, 1, __ATOMIC_RELAXED);
+
+    if (!job_deque_push(&worker->deque, &job)) {
+        job_execute(&job);
+        return;
+    }
+
+    __atomic_add_fetch(&system->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&system->sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&system->mutex);
+        pthread_cond_signal(&system->wake);
+        pthread_mutex_unlock(&system->mutex);
+    }
+}
+
+/* Runs queued jobs until every job of the counter has finished. Jobs may
+ * wait on counters too, which is how a job depends on others */
+void job_wait(
+        struct job_system* system,
+        struct job_counter* counter)
+{
+    struct job_worker* worker = current_worker;
+    assert(worker && worker->system == system);
+
+    while (__atomic_load_n(&counter->value, __ATOMIC_ACQUIRE) > 0) {
+        struct job job;
+        if (job_find(system, worker, &job))
+            job_execute(&job);
+        else
+            sched_yield();
+    }
+}
+
+struct job_range
+{
+    job_range_function function;
+    void* data;
+    uint32_t begin, end;
+};
+
+static void job_run_range(void* data)
+{
+    struct job_range* range = data;
+    range->function(range->data, range->begin, range->end);
+}
+
+/* Calls function over [0, count) in contiguous ranges, a few per thread,
+ * and returns once all of them have */
+void job_parallel_for(
+        struct job_system* system,
+        uint32_t count,
+        job_range_function function,
+        void* data)
+{
+    struct job_range ranges[JOB_MAX_THREADS * JOB_RANGES_PER_THREAD];
+
+    uint32_t range_count = system->thread_count * JOB_RANGES_PER_THREAD;
+    if (range_count > count)
+        range_count = count;
+    if (range_count <= 1) {
+        if (count > 0)
+            function(data, 0, count);
+        return;
+    }
+
+    struct job_counter counter = {0};
+    for (uint32_t i = 0; i < range_count; i++) {
+        ranges[i] = (struct job_range){
+            .function = function,
+            .data = data,
+            .begin = (uint32_t)((uint64_t)count * i / range_count),
+            .end = (uint32_t)((uint64_t)count * (i + 1) / range_count)
+        };
+        job_run(system, job_run_range, &ranges[i], &counter);
+    }
+
+    job_wait(system, &counter);
+}
+
+// Whether the calling thread may run and wait on jobs of the system
+bool job_is_worker(
+        struct job_system* system)
+{
+    return current_worker && current_worker->system == system;
+}
+
+/* Makes the calling thread worker 0 in place of the one that created the
+ * system, which must not run or wait on jobs any more. Its queue must be
+ * empty, e.g. when handing the system over to another thread between frames */
+void job_system_attach(
+        struct job_system* system)
+{
+    current_worker = &system->workers[0];
+}
+
+// Queued jobs that have not started are dropped
+void job_system_destroy(
+        struct job_system* system)
+{
+    pthread_mutex_lock(&system->mutex);
+    __atomic_store_n(&system->quit, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->mutex);
+
+    for (uint32_t i = 1; i < system->thread_count; i++)
+        pthread_join(system->workers[i].thread, NULL);
+
+    if (current_worker && current_worker->system == system)
+        current_worker = NULL;
+
+    pthread_cond_destroy(&system->wake);
+    pthread_mutex_destroy(&system->mutex);
+    free(system->workers);
+}
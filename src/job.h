@@ -0,0 +1,101 @@
+#ifndef JOB_H_
+#define JOB_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JOB_MAX_THREADS 16 // Including the thread that created the system
+#define JOB_QUEUE_SIZE 1024 // Jobs a thread can have queued, a power of two
+#define JOB_RANGES_PER_THREAD 4 // Parallel for splits, so stealing can balance
+
+typedef void (*job_function)(void* data);
+typedef void (*job_range_function)(void* data, uint32_t begin, uint32_t end);
+
+// Counts the jobs run with it that have not finished, zero it before use
+struct job_counter
+{
+    uint32_t value;
+};
+
+struct job
+{
+    job_function function;
+    void* data;
+    struct job_counter* counter; // May be NULL
+};
+
+/* Chase-Lev deque. Only its own thread pushes and takes, at the bottom,
+ * others steal from the top, so the two ends only contend over the last job.
+ * Jobs are kept by value, a slot is not written again until the top has
+ * moved past it */
+struct job_deque
+{
+    int64_t top;
+    char padding[56]; // Stealers and the owner write different cache lines
+    int64_t bottom;
+    struct job slots[JOB_QUEUE_SIZE];
+};
+
+struct job_worker
+{
+    struct job_system* system;
+    uint32_t index;
+    pthread_t thread; // Not started for worker 0, the creating thread
+    uint32_t random; // Picks whom to steal from
+    char name[16]; // Shown in CPU traces
+    struct job_deque deque;
+};
+
+/* Work-stealing scheduler. The thread calling job_system_init becomes worker
+ * 0 and only workers may run jobs, worker 0 runs them while it waits on a
+ * counter. Idle workers spin briefly, then sleep until a job is queued */
+struct job_system
+{
+    struct job_worker* workers;
+    uint32_t thread_count;
+    bool quit;
+
+    int32_t queued; // Pushed and not yet taken by anyone
+    uint32_t sleeping;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+};
+
+void job_system_init(
+    struct job_system* system,
+    uint32_t thread_count
+);
+
+void job_run(
+    struct job_system* system,
+    job_function function,
+    void* data,
+    struct job_counter* counter
+);
+
+void job_wait(
+    struct job_system* system,
+    struct job_counter* counter
+);
+
+void job_parallel_for(
+    struct job_system* system,
+    uint32_t count,
+    job_range_function function,
+    void* data
+);
+
+bool job_is_worker(
+    struct job_system* system
+);
+
+void job_system_attach(
+    struct job_system* system
+);
+
+void job_system_destroy(
+    struct job_system* system
+);
+
+#endif
@@ -0,0 +1,387 @@
+#include "linmath_simd.h"
+#include "bvh.h"
+#include "job.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <assert.h>
+
+/* Times the per-frame CPU stages the renderer can split into jobs on an
+ * increasing number of threads: world matrices (update), frustum tests of
+ * bounding spheres (cull), copying the matrices into a dynamic uniform
+ * buffer (upload) and all three as a frame graph, where cull and upload both
+ * depend on update but not on each other. Also reports the cost of a job */
+
+#define JOB_BENCH_RUNS 5
+#define JOB_BENCH_EMPTY_JOBS 100000
+
+struct job_bench_settings
+{
+    uint32_t count; // Objects per frame
+    uint32_t iterations; // Frames per run
+    uint32_t max_threads;
+    uint32_t seed;
+};
+
+struct job_bench_data
+{
+    struct job_system* jobs;
+    mat4x4 view_proj;
+    float planes[6][4];
+    mat4x4 parent;
+    mat4x4* locals;
+    mat4x4* worlds;
+    float (*spheres)[4];
+    uint8_t* visible;
+    char* uniforms; // One matrix every uniform_stride bytes
+    size_t uniform_stride;
+};
+
+enum job_bench_stage
+{
+    JOB_BENCH_UPDATE,
+    JOB_BENCH_CULL,
+    JOB_BENCH_UPLOAD,
+    JOB_BENCH_GRAPH,
+    JOB_BENCH_STAGE_COUNT
+};
+
+static const char* stage_names[] = {
+    "update",
+    "cull",
+    "upload",
+    "frame graph"
+};
+
+static void job_bench_parse_args(
+        struct job_bench_settings* settings,
+        int argc,
+        char** argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    settings->count = 65536;
+    settings->iterations = 32;
+    settings->max_threads = cpus > 0 ? (uint32_t)cpus : 1;
+    settings->seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--count") && has_value) {
+            settings->count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && has_value) {
+            settings->iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && has_value) {
+            settings->max_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            settings->seed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        }
+    }
+
+    if (settings->count == 0)
+        settings->count = 1;
+    if (settings->iterations == 0)
+        settings->iterations = 1;
+    if (settings->max_threads == 0)
+        settings->max_threads = 1;
+    if (settings->max_threads > JOB_MAX_THREADS)
+        settings->max_threads = JOB_MAX_THREADS;
+}
+
+// Same sequence on every platform, unlike rand()
+static float job_bench_random(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (float)((*state >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+}
+
+// Objects scattered around the camera, so roughly a quarter are in view
+static void job_bench_generate(
+        struct job_bench_data* data,
+        uint32_t count,
+        uint32_t seed)
+{
+    uint32_t state = seed;
+
+    mat4x4 view, projection;
+    vec3 eye = {0.0f, 0.0f, 0.0f};
+    vec3 center = {0.0f, 0.0f, -1.0f};
+    vec3 up = {0.0f, 1.0f, 0.0f};
+    mat4x4_look_at(view, eye, center, up);
+    mat4x4_perspective(projection, 1.0f, 16.0f / 9.0f, 0.1f, 200.0f);
+    mat4x4_mul(data->view_proj, projection, view);
+    bvh_extract_planes(data->planes, data->view_proj);
+
+    mat4x4 identity;
+    mat4x4_identity(identity);
+    mat4x4_rotate_Y(data->parent, identity, 0.25f);
+
+    data->uniform_stride = 256; // A common minUniformBufferOffsetAlignment
+    data->locals = malloc(count * sizeof(mat4x4));
+    data->worlds = malloc(count * sizeof(mat4x4));
+    data->spheres = malloc(count * sizeof(*data->spheres));
+    data->visible = malloc(count);
+    data->uniforms = malloc(count * data->uniform_stride);
+    assert(data->locals && data->worlds && data->spheres);
+    assert(data->visible && data->uniforms);
+
+    for (uint32_t i = 0; i < count; i++) {
+        mat4x4 rotation, translated;
+        mat4x4_rotate_Y(rotation, identity, job_bench_random(&state) * 3.0f);
+        mat4x4_translate(
+            translated,
+            job_bench_random(&state) * 100.0f,
+            job_bench_random(&state) * 100.0f,
+            job_bench_random(&state) * 100.0f
+        );
+        mat4x4_mul(data->locals[i], translated, rotation);
+    }
+}
+
+static void job_bench_update_range(void* argument, uint32_t begin, uint32_t end)
+{
+    struct job_bench_data* data = argument;
+
+    mat4x4_mul_batch(
+        &data->worlds[begin],
+        data->parent,
+        &data->locals[begin],
+        end - begin
+    );
+    for (uint32_t i = begin; i < end; i++) {
+        data->spheres[i][0] = data->worlds[i][3][0];
+        data->spheres[i][1] = data->worlds[i][3][1];
+        data->spheres[i][2] = data->worlds[i][3][2];
+        data->spheres[i][3] = 1.0f;
+    }
+}
+
+static void job_bench_cull_range(void* argument, uint32_t begin, uint32_t end)
+{
+    struct job_bench_data* data = argument;
+
+    for (uint32_t i = begin; i < end; i++) {
+        const float* sphere = data->spheres[i];
+        bool visible = true;
+
+        for (int p = 0; p < 6 && visible; p++) {
+            const float* plane = data->planes[p];
+            float distance = plane[0] * sphere[0] + plane[1] * sphere[1] +
+                plane[2] * sphere[2] + plane[3];
+            visible = distance >= -sphere[3];
+        }
+        data->visible[i] = visible;
+    }
+}
+
+static void job_bench_upload_range(void* argument, uint32_t begin, uint32_t end)
+{
+    struct job_bench_data* data = argument;
+
+    for (uint32_t i = begin; i < end; i++) {
+        memcpy(
+            data->uniforms + i * data->uniform_stride,
+            data->worlds[i],
+            sizeof(mat4x4)
+        );
+    }
+}
+
+struct job_bench_stage_job
+{
+    struct job_bench_data* data;
+    uint32_t count;
+    job_range_function function;
+};
+
+static void job_bench_stage_job(void* argument)
+{
+    struct job_bench_stage_job* stage = argument;
+    job_parallel_for(
+        stage->data->jobs,
+        stage->count,
+        stage->function,
+        stage->data
+    );
+}
+
+// Update, then cull and upload as two jobs that split up further
+static void job_bench_frame_graph(
+        struct job_bench_data* data,
+        uint32_t count)
+{
+    job_parallel_for(data->jobs, count, job_bench_update_range, data);
+
+    struct job_bench_stage_job stages[] = {
+        {data, count, job_bench_cull_range},
+        {data, count, job_bench_upload_range}
+    };
+    struct job_counter counter = {0};
+    job_run(data->jobs, job_bench_stage_job, &stages[0], &counter);
+    job_run(data->jobs, job_bench_stage_job, &stages[1], &counter);
+    job_wait(data->jobs, &counter);
+}
+
+// Seconds for the fastest of the runs
+static double job_bench_run(
+        struct job_bench_data* data,
+        enum job_bench_stage stage,
+        const struct job_bench_settings* settings)
+{
+    uint32_t count = settings->count;
+    double best = INFINITY;
+
+    // Inputs of the later stages
+    job_parallel_for(data->jobs, count, job_bench_update_range, data);
+
+    for (uint32_t run = 0; run < JOB_BENCH_RUNS; run++) {
+        double start = timer_now();
+
+        for (uint32_t it = 0; it < settings->iterations; it++) {
+            switch (stage) {
+            case JOB_BENCH_UPDATE:
+                job_parallel_for(
+                    data->jobs,
+                    count,
+                    job_bench_update_range,
+                    data
+                );
+                break;
+            case JOB_BENCH_CULL:
+                job_parallel_for(data->jobs, count, job_bench_cull_range, data);
+                break;
+            case JOB_BENCH_UPLOAD:
+                job_parallel_for(
+                    data->jobs,
+                    count,
+                    job_bench_upload_range,
+                    data
+                );
+                break;
+            case JOB_BENCH_GRAPH:
+                job_bench_frame_graph(data, count);
+                break;
+            default:
+                break;
+            }
+        }
+
+        double elapsed = timer_now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+static void job_bench_empty(void* argument)
+{
+    (void)argument;
+}
+
+// Nanoseconds to queue, run and wait for a job that does nothing
+static double job_bench_job_cost(struct job_system* jobs)
+{
+    double best = INFINITY;
+
+    for (uint32_t run = 0; run < JOB_BENCH_RUNS; run++) {
+        double start = timer_now();
+
+        struct job_counter counter = {0};
+        for (uint32_t i = 0; i < JOB_BENCH_EMPTY_JOBS; i++) {
+            job_run(jobs, job_bench_empty, NULL, &counter);
+
+            // Stay within the queue, which runs jobs inline when full
+            if (__atomic_load_n(&counter.value, __ATOMIC_RELAXED) >=
+                    JOB_QUEUE_SIZE / 2)
+                job_wait(jobs, &counter);
+        }
+        job_wait(jobs, &counter);
+
+        double elapsed = timer_now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best * 1e9 / JOB_BENCH_EMPTY_JOBS;
+}
+
+int main(int argc, char** argv)
+{
+    struct job_bench_settings settings;
+    job_bench_parse_args(&settings, argc, argv);
+
+    linmath_simd_init();
+
+    struct job_bench_data data;
+    job_bench_generate(&data, settings.count, settings.seed);
+
+    printf(
+        "%u objects x %u frames, best of %d runs, up to %u threads\n\n",
+        settings.count,
+        settings.iterations,
+        JOB_BENCH_RUNS,
+        settings.max_threads
+    );
+    printf(
+        "%-8s %-12s %12s %10s %11s\n",
+        "threads",
+        "stage",
+        "ms/frame",
+        "speedup",
+        "efficiency"
+    );
+
+    double single_seconds[JOB_BENCH_STAGE_COUNT];
+
+    // Powers of two, and the maximum if it is not one
+    uint32_t thread_counts[8];
+    uint32_t run_count = 0;
+    for (uint32_t threads = 1; threads < settings.max_threads; threads *= 2)
+        thread_counts[run_count++] = threads;
+    thread_counts[run_count++] = settings.max_threads;
+
+    for (uint32_t i = 0; i < run_count; i++) {
+        uint32_t threads = thread_counts[i];
+        struct job_system jobs;
+        job_system_init(&jobs, threads);
+        data.jobs = &jobs;
+
+        for (int stage = 0; stage < JOB_BENCH_STAGE_COUNT; stage++) {
+            double seconds = job_bench_run(&data, stage, &settings);
+            if (threads == 1)
+                single_seconds[stage] = seconds;
+
+            double speedup = single_seconds[stage] / seconds;
+            printf(
+                "%-8u %-12s %12.3f %9.2fx %10.0f%%\n",
+                threads,
+                stage_names[stage],
+                seconds * 1e3 / settings.iterations,
+                speedup,
+                speedup * 100.0 / threads
+            );
+        }
+
+        printf("%-8u %-12s %9.1f ns\n", threads, "empty job",
+                job_bench_job_cost(&jobs));
+
+        job_system_destroy(&jobs);
+    }
+
+    free(data.uniforms);
+    free(data.visible);
+    free(data.spheres);
+    free(data.worlds);
+    free(data.locals);
+
+    return 0;
+}
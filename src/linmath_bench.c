@@ -0,0 +1,281 @@
+#include "linmath_simd.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+/* Times the linmath_simd kernels for every implementation the CPU supports
+ * against the scalar linmath.h versions, on the same generated matrices.
+ * Each kernel is run a few times and the fastest run is reported, which is
+ * the least disturbed by the rest of the system */
+
+#define LINMATH_BENCH_RUNS 5
+
+struct linmath_bench_settings
+{
+    uint32_t count; // Matrices per run
+    uint32_t iterations; // Passes over them per run
+    uint32_t seed;
+};
+
+struct linmath_bench_data
+{
+    mat4x4 view_proj;
+    mat4x4* models;
+    mat4x4* results;
+    vec4* vectors;
+    vec4* vector_results;
+};
+
+enum linmath_bench_kernel
+{
+    LINMATH_BENCH_BATCH,
+    LINMATH_BENCH_MUL,
+    LINMATH_BENCH_MUL_VEC4,
+    LINMATH_BENCH_INVERT,
+    LINMATH_BENCH_KERNEL_COUNT
+};
+
+static const char* kernel_names[] = {
+    "mat4x4_mul_batch",
+    "mat4x4_mul",
+    "mat4x4_mul_vec4",
+    "mat4x4_invert"
+};
+
+static void linmath_bench_parse_args(
+        struct linmath_bench_settings* settings,
+        int argc,
+        char** argv)
+{
+    settings->count = 16384;
+    settings->iterations = 64;
+    settings->seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--count") && has_value) {
+            settings->count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && has_value) {
+            settings->iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            settings->seed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        }
+    }
+
+    if (settings->count == 0)
+        settings->count = 1;
+    if (settings->iterations == 0)
+        settings->iterations = 1;
+}
+
+// Same sequence on every platform, unlike rand()
+static float linmath_bench_random(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (float)((*state >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+}
+
+// Affine transforms like the renderer's, so they are invertible
+static void linmath_bench_generate(
+        struct linmath_bench_data* data,
+        uint32_t count,
+        uint32_t seed)
+{
+    uint32_t state = seed;
+
+    mat4x4 view, projection;
+    vec3 eye = {4.0f, 3.0f, 8.0f};
+    vec3 center = {0.0f, 0.0f, 0.0f};
+    vec3 up = {0.0f, 1.0f, 0.0f};
+    mat4x4_look_at(view, eye, center, up);
+    mat4x4_perspective(projection, 1.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+    mat4x4_mul(data->view_proj, projection, view);
+
+    data->models = malloc(count * sizeof(mat4x4));
+    data->results = malloc(count * sizeof(mat4x4));
+    data->vectors = malloc(count * sizeof(vec4));
+    data->vector_results = malloc(count * sizeof(vec4));
+    assert(data->models && data->results);
+    assert(data->vectors && data->vector_results);
+
+    for (uint32_t i = 0; i < count; i++) {
+        mat4x4 identity, rotation, translated;
+        float angle = linmath_bench_random(&state) * 3.0f;
+
+        mat4x4_identity(identity);
+        mat4x4_rotate_Y(rotation, identity, angle);
+        mat4x4_translate(
+            translated,
+            linmath_bench_random(&state) * 50.0f,
+            linmath_bench_random(&state) * 50.0f,
+            linmath_bench_random(&state) * 50.0f
+        );
+        mat4x4_mul(data->models[i], translated, rotation);
+
+        data->vectors[i][0] = linmath_bench_random(&state);
+        data->vectors[i][1] = linmath_bench_random(&state);
+        data->vectors[i][2] = linmath_bench_random(&state);
+        data->vectors[i][3] = 1.0f;
+    }
+}
+
+// Seconds for the fastest of the runs
+static double linmath_bench_run(
+        struct linmath_bench_data* data,
+        enum linmath_bench_kernel kernel,
+        const struct linmath_bench_settings* settings)
+{
+    uint32_t count = settings->count;
+    double best = INFINITY;
+
+    for (uint32_t run = 0; run < LINMATH_BENCH_RUNS; run++) {
+        double start = timer_now();
+
+        for (uint32_t it = 0; it < settings->iterations; it++) {
+            switch (kernel) {
+            case LINMATH_BENCH_BATCH:
+                mat4x4_mul_batch(
+                    data->results,
+                    data->view_proj,
+                    data->models,
+                    count
+                );
+                break;
+            case LINMATH_BENCH_MUL:
+                for (uint32_t i = 0; i < count; i++) {
+                    mat4x4_mul_simd(
+                        data->results[i],
+                        data->view_proj,
+                        data->models[i]
+                    );
+                }
+                break;
+            case LINMATH_BENCH_MUL_VEC4:
+                for (uint32_t i = 0; i < count; i++) {
+                    mat4x4_mul_vec4_simd(
+                        data->vector_results[i],
+                        data->models[i],
+                        data->vectors[i]
+                    );
+                }
+                break;
+            case LINMATH_BENCH_INVERT:
+                for (uint32_t i = 0; i < count; i++)
+                    mat4x4_invert_simd(data->results[i], data->models[i]);
+                break;
+            default:
+                break;
+            }
+        }
+
+        double elapsed = timer_now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+// Largest difference to the scalar results, FMA rounds differently
+static float linmath_bench_error(
+        const float* results,
+        const float* reference,
+        size_t float_count)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < float_count; i++) {
+        float difference = fabsf(results[i] - reference[i]);
+        if (difference > error)
+            error = difference;
+    }
+
+    return error;
+}
+
+int main(int argc, char** argv)
+{
+    struct linmath_bench_settings settings;
+    linmath_bench_parse_args(&settings, argc, argv);
+
+    struct linmath_bench_data data;
+    linmath_bench_generate(&data, settings.count, settings.seed);
+
+    size_t matrix_floats = (size_t)settings.count * 16;
+    size_t vector_floats = (size_t)settings.count * 4;
+    float* reference = malloc(
+        LINMATH_BENCH_KERNEL_COUNT * matrix_floats * sizeof(float)
+    );
+    assert(reference);
+
+    double scalar_seconds[LINMATH_BENCH_KERNEL_COUNT];
+
+    printf(
+        "%u matrices x %u iterations, best of %d runs\n\n",
+        settings.count,
+        settings.iterations,
+        LINMATH_BENCH_RUNS
+    );
+    printf(
+        "%-8s %-18s %12s %10s %10s\n",
+        "isa",
+        "kernel",
+        "ns/matrix",
+        "speedup",
+        "max error"
+    );
+
+    for (int isa = 0; isa < LINMATH_SIMD_ISA_COUNT; isa++) {
+        if (!linmath_simd_set_isa((enum linmath_simd_isa)isa))
+            continue;
+
+        for (int kernel = 0; kernel < LINMATH_BENCH_KERNEL_COUNT; kernel++) {
+            double seconds = linmath_bench_run(&data, kernel, &settings);
+
+            bool vectors = kernel == LINMATH_BENCH_MUL_VEC4;
+            const float* results = vectors ?
+                &data.vector_results[0][0] :
+                &data.results[0][0][0];
+            size_t float_count = vectors ? vector_floats : matrix_floats;
+            float* kernel_reference = reference + kernel * matrix_floats;
+
+            // The scalar implementation always comes first
+            if (isa == LINMATH_SIMD_SCALAR) {
+                scalar_seconds[kernel] = seconds;
+                memcpy(kernel_reference, results, float_count * sizeof(float));
+            }
+
+            double ns = seconds * 1e9 /
+                ((double)settings.count * settings.iterations);
+            printf(
+                "%-8s %-18s %12.2f %9.2fx %10.2e\n",
+                linmath_simd_isa_name((enum linmath_simd_isa)isa),
+                kernel_names[kernel],
+                ns,
+                scalar_seconds[kernel] / seconds,
+                linmath_bench_error(results, kernel_reference, float_count)
+            );
+        }
+    }
+
+    linmath_simd_init();
+    printf(
+        "\nDispatched to %s\n",
+        linmath_simd_isa_name(linmath_simd_get_isa())
+    );
+
+    free(reference);
+    free(data.vector_results);
+    free(data.vectors);
+    free(data.results);
+    free(data.models);
+
+    return 0;
+}
@@ -0,0 +1,435 @@
+#include "linmath_simd.h"
+
+#include <string.h>
+
+/* SSE is part of x86-64, so only AVX2 needs checking at runtime. Its
+ * functions are compiled for it with target attributes, the rest of the
+ * program is not, so they are only ever called after the CPU was checked.
+ * NEON is decided at compile time, it is part of AArch64 */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+        defined(__SSE2__)
+#define LINMATH_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LINMATH_SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+// linmath.h doesn't allow the result to alias an operand
+
+static void mat4x4_mul_scalar(mat4x4 M, mat4x4 a, mat4x4 b)
+{
+    mat4x4 temp;
+    mat4x4_mul(temp, a, b);
+    memcpy(M, temp, sizeof(mat4x4));
+}
+
+static void mat4x4_mul_vec4_scalar(vec4 r, mat4x4 M, vec4 v)
+{
+    vec4 temp;
+    mat4x4_mul_vec4(temp, M, v);
+    memcpy(r, temp, sizeof(vec4));
+}
+
+static void mat4x4_invert_scalar(mat4x4 T, mat4x4 M)
+{
+    mat4x4 temp;
+    mat4x4_invert(temp, M);
+    memcpy(T, temp, sizeof(mat4x4));
+}
+
+static void mat4x4_mul_batch_scalar(
+        mat4x4* out,
+        mat4x4 M,
+        mat4x4* in,
+        uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        mat4x4_mul_scalar(out[i], M, in[i]);
+}
+
+#ifdef LINMATH_SIMD_X86
+
+#define SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+
+/* Matrices are columns of vec4, so column c of a * b is the columns of a
+ * weighted by the elements of column c of b */
+static inline __m128 mul_column_sse(
+        __m128 a0,
+        __m128 a1,
+        __m128 a2,
+        __m128 a3,
+        __m128 b)
+{
+    __m128 r = _mm_mul_ps(a0, SHUFFLE(b, 0, 0, 0, 0));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, SHUFFLE(b, 1, 1, 1, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, SHUFFLE(b, 2, 2, 2, 2)));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, SHUFFLE(b, 3, 3, 3, 3)));
+
+    return r;
+}
+
+static void mat4x4_mul_sse(mat4x4 M, mat4x4 a, mat4x4 b)
+{
+    __m128 a0 = _mm_loadu_ps(a[0]);
+    __m128 a1 = _mm_loadu_ps(a[1]);
+    __m128 a2 = _mm_loadu_ps(a[2]);
+    __m128 a3 = _mm_loadu_ps(a[3]);
+
+    for (int c = 0; c < 4; c++) {
+        __m128 column = mul_column_sse(a0, a1, a2, a3, _mm_loadu_ps(b[c]));
+        _mm_storeu_ps(M[c], column);
+    }
+}
+
+static void mat4x4_mul_vec4_sse(vec4 r, mat4x4 M, vec4 v)
+{
+    __m128 result = mul_column_sse(
+        _mm_loadu_ps(M[0]),
+        _mm_loadu_ps(M[1]),
+        _mm_loadu_ps(M[2]),
+        _mm_loadu_ps(M[3]),
+        _mm_loadu_ps(v)
+    );
+    _mm_storeu_ps(r, result);
+}
+
+// 2x2 matrices as (m00, m01, m10, m11), a * b
+static inline __m128 mat2_mul(__m128 a, __m128 b)
+{
+    return _mm_add_ps(
+        _mm_mul_ps(a, SHUFFLE(b, 0, 3, 0, 3)),
+        _mm_mul_ps(SHUFFLE(a, 1, 0, 3, 2), SHUFFLE(b, 2, 1, 2, 1))
+    );
+}
+
+// adj(a) * b
+static inline __m128 mat2_adj_mul(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(
+        _mm_mul_ps(SHUFFLE(a, 3, 3, 0, 0), b),
+        _mm_mul_ps(SHUFFLE(a, 1, 1, 2, 2), SHUFFLE(b, 2, 3, 0, 1))
+    );
+}
+
+// a * adj(b)
+static inline __m128 mat2_mul_adj(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(
+        _mm_mul_ps(a, SHUFFLE(b, 3, 0, 3, 0)),
+        _mm_mul_ps(SHUFFLE(a, 1, 0, 3, 2), SHUFFLE(b, 2, 1, 2, 1))
+    );
+}
+
+/* Blockwise, with the 4x4 matrix split into 2x2 matrices
+ *
+ *     | A B |
+ *     | C D |
+ *
+ * Reading the columns as rows inverts the transpose, whose inverse read
+ * the same way is the inverse. Assumes it is invertible, like linmath.h */
+static void mat4x4_invert_sse(mat4x4 T, mat4x4 M)
+{
+    __m128 m0 = _mm_loadu_ps(M[0]);
+    __m128 m1 = _mm_loadu_ps(M[1]);
+    __m128 m2 = _mm_loadu_ps(M[2]);
+    __m128 m3 = _mm_loadu_ps(M[3]);
+
+    __m128 A = _mm_movelh_ps(m0, m1);
+    __m128 B = _mm_movehl_ps(m1, m0);
+    __m128 C = _mm_movelh_ps(m2, m3);
+    __m128 D = _mm_movehl_ps(m3, m2);
+
+    // Determinants of A, B, C and D
+    __m128 dets = _mm_sub_ps(
+        _mm_mul_ps(
+            _mm_shuffle_ps(m0, m2, _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(3, 1, 3, 1))
+        ),
+        _mm_mul_ps(
+            _mm_shuffle_ps(m0, m2, _MM_SHUFFLE(3, 1, 3, 1)),
+            _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(2, 0, 2, 0))
+        )
+    );
+    __m128 det_a = SHUFFLE(dets, 0, 0, 0, 0);
+    __m128 det_b = SHUFFLE(dets, 1, 1, 1, 1);
+    __m128 det_c = SHUFFLE(dets, 2, 2, 2, 2);
+    __m128 det_d = SHUFFLE(dets, 3, 3, 3, 3);
+
+    __m128 d_c = mat2_adj_mul(D, C);
+    __m128 a_b = mat2_adj_mul(A, B);
+
+    // Adjugates of the blocks of the inverse times its determinant
+    __m128 X = _mm_sub_ps(_mm_mul_ps(det_d, A), mat2_mul(B, d_c));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(det_a, D), mat2_mul(C, a_b));
+    __m128 Y = _mm_sub_ps(_mm_mul_ps(det_b, C), mat2_mul_adj(D, a_b));
+    __m128 Z = _mm_sub_ps(_mm_mul_ps(det_c, B), mat2_mul_adj(A, d_c));
+
+    // det = det(A) det(D) + det(B) det(C) - tr(adj(A) B adj(D) C)
+    __m128 trace = _mm_mul_ps(a_b, SHUFFLE(d_c, 0, 2, 1, 3));
+    trace = _mm_add_ps(trace, SHUFFLE(trace, 2, 3, 0, 1));
+    trace = _mm_add_ps(trace, SHUFFLE(trace, 1, 0, 3, 2));
+
+    __m128 det = _mm_add_ps(
+        _mm_mul_ps(det_a, det_d),
+        _mm_mul_ps(det_b, det_c)
+    );
+    det = _mm_sub_ps(det, trace);
+
+    // The signs of the adjugates
+    __m128 idet = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det);
+    X = _mm_mul_ps(X, idet);
+    Y = _mm_mul_ps(Y, idet);
+    Z = _mm_mul_ps(Z, idet);
+    W = _mm_mul_ps(W, idet);
+
+    // Taking the adjugates and putting the blocks back together
+    _mm_storeu_ps(T[0], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(T[1], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(0, 2, 0, 2)));
+    _mm_storeu_ps(T[2], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(T[3], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(0, 2, 0, 2)));
+}
+
+static void mat4x4_mul_batch_sse(
+        mat4x4* out,
+        mat4x4 M,
+        mat4x4* in,
+        uint32_t count)
+{
+    __m128 a0 = _mm_loadu_ps(M[0]);
+    __m128 a1 = _mm_loadu_ps(M[1]);
+    __m128 a2 = _mm_loadu_ps(M[2]);
+    __m128 a3 = _mm_loadu_ps(M[3]);
+
+    for (uint32_t i = 0; i < count; i++) {
+        __m128 b0 = _mm_loadu_ps(in[i][0]);
+        __m128 b1 = _mm_loadu_ps(in[i][1]);
+        __m128 b2 = _mm_loadu_ps(in[i][2]);
+        __m128 b3 = _mm_loadu_ps(in[i][3]);
+
+        _mm_storeu_ps(out[i][0], mul_column_sse(a0, a1, a2, a3, b0));
+        _mm_storeu_ps(out[i][1], mul_column_sse(a0, a1, a2, a3, b1));
+        _mm_storeu_ps(out[i][2], mul_column_sse(a0, a1, a2, a3, b2));
+        _mm_storeu_ps(out[i][3], mul_column_sse(a0, a1, a2, a3, b3));
+    }
+}
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+// Two columns of b at once, one per 128 bit lane
+AVX2 static inline __m256 mul_columns_avx2(
+        __m256 a0,
+        __m256 a1,
+        __m256 a2,
+        __m256 a3,
+        __m256 b)
+{
+    __m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(b, 0x00));
+    r = _mm256_fmadd_ps(a1, _mm256_permute_ps(b, 0x55), r);
+    r = _mm256_fmadd_ps(a2, _mm256_permute_ps(b, 0xaa), r);
+    r = _mm256_fmadd_ps(a3, _mm256_permute_ps(b, 0xff), r);
+
+    return r;
+}
+
+AVX2 static void mat4x4_mul_avx2(mat4x4 M, mat4x4 a, mat4x4 b)
+{
+    __m256 a0 = _mm256_broadcast_ps((const __m128*)a[0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128*)a[1]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128*)a[2]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128*)a[3]);
+
+    __m256 b01 = _mm256_loadu_ps(b[0]);
+    __m256 b23 = _mm256_loadu_ps(b[2]);
+
+    _mm256_storeu_ps(M[0], mul_columns_avx2(a0, a1, a2, a3, b01));
+    _mm256_storeu_ps(M[2], mul_columns_avx2(a0, a1, a2, a3, b23));
+}
+
+AVX2 static void mat4x4_mul_batch_avx2(
+        mat4x4* out,
+        mat4x4 M,
+        mat4x4* in,
+        uint32_t count)
+{
+    __m256 a0 = _mm256_broadcast_ps((const __m128*)M[0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128*)M[1]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128*)M[2]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128*)M[3]);
+
+    for (uint32_t i = 0; i < count; i++) {
+        __m256 b01 = _mm256_loadu_ps(in[i][0]);
+        __m256 b23 = _mm256_loadu_ps(in[i][2]);
+
+        _mm256_storeu_ps(out[i][0], mul_columns_avx2(a0, a1, a2, a3, b01));
+        _mm256_storeu_ps(out[i][2], mul_columns_avx2(a0, a1, a2, a3, b23));
+    }
+}
+
+#endif
+
+#ifdef LINMATH_SIMD_ARM
+
+static inline float32x4_t mul_column_neon(
+        float32x4_t a0,
+        float32x4_t a1,
+        float32x4_t a2,
+        float32x4_t a3,
+        float32x4_t b)
+{
+    float32x4_t r = vmulq_lane_f32(a0, vget_low_f32(b), 0);
+    r = vmlaq_lane_f32(r, a1, vget_low_f32(b), 1);
+    r = vmlaq_lane_f32(r, a2, vget_high_f32(b), 0);
+    r = vmlaq_lane_f32(r, a3, vget_high_f32(b), 1);
+
+    return r;
+}
+
+static void mat4x4_mul_neon(mat4x4 M, mat4x4 a, mat4x4 b)
+{
+    float32x4_t a0 = vld1q_f32(a[0]);
+    float32x4_t a1 = vld1q_f32(a[1]);
+    float32x4_t a2 = vld1q_f32(a[2]);
+    float32x4_t a3 = vld1q_f32(a[3]);
+
+    for (int c = 0; c < 4; c++)
+        vst1q_f32(M[c], mul_column_neon(a0, a1, a2, a3, vld1q_f32(b[c])));
+}
+
+static void mat4x4_mul_vec4_neon(vec4 r, mat4x4 M, vec4 v)
+{
+    float32x4_t result = mul_column_neon(
+        vld1q_f32(M[0]),
+        vld1q_f32(M[1]),
+        vld1q_f32(M[2]),
+        vld1q_f32(M[3]),
+        vld1q_f32(v)
+    );
+    vst1q_f32(r, result);
+}
+
+static void mat4x4_mul_batch_neon(
+        mat4x4* out,
+        mat4x4 M,
+        mat4x4* in,
+        uint32_t count)
+{
+    float32x4_t a0 = vld1q_f32(M[0]);
+    float32x4_t a1 = vld1q_f32(M[1]);
+    float32x4_t a2 = vld1q_f32(M[2]);
+    float32x4_t a3 = vld1q_f32(M[3]);
+
+    for (uint32_t i = 0; i < count; i++) {
+        float32x4_t b0 = vld1q_f32(in[i][0]);
+        float32x4_t b1 = vld1q_f32(in[i][1]);
+        float32x4_t b2 = vld1q_f32(in[i][2]);
+        float32x4_t b3 = vld1q_f32(in[i][3]);
+
+        vst1q_f32(out[i][0], mul_column_neon(a0, a1, a2, a3, b0));
+        vst1q_f32(out[i][1], mul_column_neon(a0, a1, a2, a3, b1));
+        vst1q_f32(out[i][2], mul_column_neon(a0, a1, a2, a3, b2));
+        vst1q_f32(out[i][3], mul_column_neon(a0, a1, a2, a3, b3));
+    }
+}
+
+#endif
+
+void (*mat4x4_mul_simd)(mat4x4, mat4x4, mat4x4) = mat4x4_mul_scalar;
+void (*mat4x4_mul_vec4_simd)(vec4, mat4x4, vec4) = mat4x4_mul_vec4_scalar;
+void (*mat4x4_invert_simd)(mat4x4, mat4x4) = mat4x4_invert_scalar;
+void (*mat4x4_mul_batch)(mat4x4*, mat4x4, mat4x4*, uint32_t) =
+    mat4x4_mul_batch_scalar;
+
+static enum linmath_simd_isa current_isa = LINMATH_SIMD_SCALAR;
+
+bool linmath_simd_supported(
+        enum linmath_simd_isa isa)
+{
+    switch (isa) {
+    case LINMATH_SIMD_SCALAR:
+        return true;
+#ifdef LINMATH_SIMD_X86
+    case LINMATH_SIMD_SSE:
+        return true;
+    case LINMATH_SIMD_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#ifdef LINMATH_SIMD_ARM
+    case LINMATH_SIMD_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* Switches every function to the given implementation, e.g. to compare
+ * them. Not thread safe, call before any other thread uses them */
+bool linmath_simd_set_isa(
+        enum linmath_simd_isa isa)
+{
+    if (!linmath_simd_supported(isa))
+        return false;
+
+    mat4x4_mul_simd = mat4x4_mul_scalar;
+    mat4x4_mul_vec4_simd = mat4x4_mul_vec4_scalar;
+    mat4x4_invert_simd = mat4x4_invert_scalar;
+    mat4x4_mul_batch = mat4x4_mul_batch_scalar;
+
+    // Where a wider ISA has nothing to add, the narrower version is kept
+#ifdef LINMATH_SIMD_X86
+    if (isa == LINMATH_SIMD_SSE || isa == LINMATH_SIMD_AVX2) {
+        mat4x4_mul_simd = mat4x4_mul_sse;
+        mat4x4_mul_vec4_simd = mat4x4_mul_vec4_sse;
+        mat4x4_invert_simd = mat4x4_invert_sse;
+        mat4x4_mul_batch = mat4x4_mul_batch_sse;
+    }
+    if (isa == LINMATH_SIMD_AVX2) {
+        mat4x4_mul_simd = mat4x4_mul_avx2;
+        mat4x4_mul_batch = mat4x4_mul_batch_avx2;
+    }
+#endif
+
+#ifdef LINMATH_SIMD_ARM
+    // The inverse stays scalar for now
+    if (isa == LINMATH_SIMD_NEON) {
+        mat4x4_mul_simd = mat4x4_mul_neon;
+        mat4x4_mul_vec4_simd = mat4x4_mul_vec4_neon;
+        mat4x4_mul_batch = mat4x4_mul_batch_neon;
+    }
+#endif
+
+    current_isa = isa;
+    return true;
+}
+
+// Picks the widest supported implementation
+void linmath_simd_init()
+{
+    for (int isa = LINMATH_SIMD_ISA_COUNT - 1; isa > LINMATH_SIMD_SCALAR;
+            isa--) {
+        if (linmath_simd_set_isa((enum linmath_simd_isa)isa))
+            return;
+    }
+
+    linmath_simd_set_isa(LINMATH_SIMD_SCALAR);
+}
+
+enum linmath_simd_isa linmath_simd_get_isa()
+{
+    return current_isa;
+}
+
+const char* linmath_simd_isa_name(
+        enum linmath_simd_isa isa)
+{
+    const char* names[] = {"scalar", "SSE", "AVX2", "NEON"};
+    if (isa >= LINMATH_SIMD_ISA_COUNT)
+        return "unknown";
+
+    return names[isa];
+}
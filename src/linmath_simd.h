@@ -0,0 +1,49 @@
+#ifndef LINMATH_SIMD_H_
+#define LINMATH_SIMD_H_
+
+#include "linmath.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum linmath_simd_isa
+{
+    LINMATH_SIMD_SCALAR, // linmath.h itself
+    LINMATH_SIMD_SSE,
+    LINMATH_SIMD_AVX2, // With FMA
+    LINMATH_SIMD_NEON,
+    LINMATH_SIMD_ISA_COUNT
+};
+
+/* Same arguments as their linmath.h counterparts, except that the result
+ * may alias an operand. They point to the scalar versions until
+ * linmath_simd_init picks the best the CPU supports */
+extern void (*mat4x4_mul_simd)(mat4x4 M, mat4x4 a, mat4x4 b);
+extern void (*mat4x4_mul_vec4_simd)(vec4 r, mat4x4 M, vec4 v);
+extern void (*mat4x4_invert_simd)(mat4x4 T, mat4x4 M);
+
+// out[i] = M * in[i], e.g. the view projection times each model matrix
+extern void (*mat4x4_mul_batch)(
+    mat4x4* out,
+    mat4x4 M,
+    mat4x4* in,
+    uint32_t count
+);
+
+void linmath_simd_init();
+
+bool linmath_simd_supported(
+    enum linmath_simd_isa isa
+);
+
+bool linmath_simd_set_isa(
+    enum linmath_simd_isa isa
+);
+
+enum linmath_simd_isa linmath_simd_get_isa();
+
+const char* linmath_simd_isa_name(
+    enum linmath_simd_isa isa
+);
+
+#endif
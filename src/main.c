@@ -2,15 +2,20 @@
 #include "renderer_image.h"
 #include "renderer_tools.h"
 #include "renderer.h"
+#include "timer.h"
 #include "game.h"
 
 #include <stdlib.h>
 
-int main()
+int main(int argc, char** argv)
 {
+    struct game_settings settings;
+    game_default_settings(&settings);
+    game_parse_args(&settings, argc, argv);
+
     struct game* game = malloc(sizeof(*game));
 
-    game_run(game);
+    game_run(game, &settings);
 
     free(game);
 
@@ -23,7 +23,8 @@ void queue_enqueue(struct queue* queue, void* value)
     memcpy(queue->end, value, queue->element_size);
     queue->end += queue->element_size;
 
-    if (queue->end >
+    // Wrap once the last slot is used, not a slot past it
+    if (queue->end >=
             (queue->data + (queue->element_size * queue->max_elements))) {
         queue->end = queue->data;
     }
@@ -34,13 +35,31 @@ void queue_dequeue(struct queue* queue, void* value)
     assert(queue->elements_in_use > 0);
     queue->elements_in_use--;
 
-    if (queue->start > queue->data + queue->max_elements * queue->element_size)
-        queue->start = queue->data;
+    assert(value);
+    memcpy(value, queue->start, queue->element_size);
 
     queue->start += queue->element_size;
+    if (queue->start >= queue->data + queue->max_elements * queue->element_size)
+        queue->start = queue->data;
+}
 
-    assert(value);
-    memcpy(value, queue->start - queue->element_size, queue->element_size);
+// The element index places from the front, left in the queue
+void* queue_peek(struct queue* queue, size_t index)
+{
+    assert(index < queue->elements_in_use);
+
+    size_t first = (queue->start - queue->data) / queue->element_size;
+    size_t slot = (first + index) % queue->max_elements;
+
+    return queue->data + slot * queue->element_size;
+}
+
+// Drops every element without reading them
+void queue_clear(struct queue* queue)
+{
+    queue->elements_in_use = 0;
+    queue->start = queue->data;
+    queue->end = queue->data;
 }
 
 void queue_destroy(struct queue* queue)
@@ -30,6 +30,15 @@ void queue_dequeue(
     void* value
 );
 
+void* queue_peek(
+    struct queue* queue,
+    size_t index
+);
+
+void queue_clear(
+    struct queue* queue
+);
+
 void queue_destroy(
     struct queue* queue
 );
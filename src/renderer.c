@@ -3,6 +3,14 @@
 #include "renderer_tools.h"
 #include "renderer_mesh.h"
 #include "renderer.h"
+#include "renderer_capture.h"
+#include "renderer_gpu_profiler.h"
+#include "renderer_pipeline_stats.h"
+#include "renderer_occlusion.h"
+#include "renderer_scene.h"
+#include "cpu_profiler.h"
+#include "timer.h"
+#include "linmath_simd.h"
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -16,37 +24,99 @@
 #include <math.h>
 #include <assert.h>
 
+// Rings of per-frame GPU results are indexed by the frame slot
+_Static_assert(
+    GPU_PROFILER_FRAMES == MAX_FRAMES_IN_FLIGHT,
+    "GPU profiler frames must match the frames in flight"
+);
+_Static_assert(
+    PIPELINE_STATS_FRAMES == MAX_FRAMES_IN_FLIGHT,
+    "Pipeline statistics frames must match the frames in flight"
+);
+_Static_assert(
+    OCCLUSION_FRAMES == MAX_FRAMES_IN_FLIGHT,
+    "Occlusion culling frames must match the frames in flight"
+);
+
+void renderer_default_settings(
+        struct renderer_settings* settings)
+{
+    memset(settings, 0, sizeof(*settings));
+
+    // Lowest latency without tearing where available
+    settings->present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    settings->swapchain_image_count = 0;
+
+    settings->headless = false;
+    settings->headless_width = 800;
+    settings->headless_height = 600;
+
+    settings->profile_gpu = false;
+    settings->pipeline_stats = false;
+    settings->occlusion_culling = false;
+    settings->depth_prepass = false;
+    settings->frustum_culling = false;
+    settings->job_threads = 0;
+    settings->msaa_samples = 1;
+
+    settings->max_drawables = 64;
+    settings->max_textures = 16;
+}
+
 void renderer_initialize_resources(
         struct renderer_resources* resources,
-        GLFWwindow* window)
+        GLFWwindow* window,
+        const struct renderer_settings* settings)
 {
     memset(resources, 0, sizeof(*resources));
 
     resources->window = window;
+    resources->settings = *settings;
 
-    resources->meshes = malloc(10 * sizeof(*resources->meshes));
+    linmath_simd_init();
 
     queue_init(&resources->drawable_queue,
                 sizeof(struct renderer_draw_command),
-                6);
+                resources->settings.max_drawables);
+    transform_store_init(
+        &resources->transforms,
+        resources->settings.max_drawables,
+        MAX_FRAMEBUFFERS
+    );
+    resources->transform_drawables = calloc(
+        resources->settings.max_drawables,
+        sizeof(*resources->transform_drawables)
+    );
+    assert(resources->transform_drawables);
+
+    // Drawables moving less than half a unit from where they were inserted
+    // leave the tree alone
+    bvh_init(&resources->bvh, resources->settings.max_drawables, 0.5f);
+
+    bool headless = resources->settings.headless;
 
-    resources->instance = renderer_get_instance();
+    resources->instance = renderer_get_instance(headless);
 
     resources->debug_callback_ext = renderer_get_debug_callback_ext(
         resources->instance
     );
 
-    resources->surface = renderer_get_surface(
-        resources->instance,
-        window
-    );
+    // Headless rendering has no window, surface or swapchain, everything
+    // below that takes a surface accepts VK_NULL_HANDLE for that case
+    resources->surface = VK_NULL_HANDLE;
+    if (!headless) {
+        resources->surface = renderer_get_surface(
+            resources->instance,
+            window
+        );
 
-    resources->device_extensions[resources->device_extension_count] =
-        calloc(1, strlen(VK_KHR_SWAPCHAIN_EXTENSION_NAME)+1);
-    strcpy(
-        resources->device_extensions[resources->device_extension_count++],
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME
-    );
+        resources->device_extensions[resources->device_extension_count] =
+            calloc(1, strlen(VK_KHR_SWAPCHAIN_EXTENSION_NAME)+1);
+        strcpy(
+            resources->device_extensions[resources->device_extension_count++],
+            VK_KHR_SWAPCHAIN_EXTENSION_NAME
+        );
+    }
 
     resources->physical_device = renderer_get_physical_device(
         resources->instance,
@@ -55,10 +125,30 @@ void renderer_initialize_resources(
         (const char**)resources->device_extensions
     );
 
+    // Query features are only enabled when asked for, they can make the
+    // driver take slower paths
+    VkPhysicalDeviceFeatures enabled_features;
+    memset(&enabled_features, 0, sizeof(enabled_features));
+
+    bool pipeline_stats = resources->settings.pipeline_stats;
+    if (pipeline_stats &&
+            !renderer_pipeline_stats_supported(resources->physical_device)) {
+        printf("Pipeline statistics not supported\n");
+        pipeline_stats = false;
+    }
+    if (pipeline_stats) {
+        VkPhysicalDeviceFeatures features;
+        vkGetPhysicalDeviceFeatures(resources->physical_device, &features);
+
+        enabled_features.pipelineStatisticsQuery = VK_TRUE;
+        enabled_features.inheritedQueries = VK_TRUE;
+        enabled_features.occlusionQueryPrecise = features.occlusionQueryPrecise;
+    }
+
     resources->device = renderer_get_device(
         resources->physical_device,
         resources->surface,
-        NULL,
+        &enabled_features,
         resources->device_extension_count,
         (const char**)resources->device_extensions
     );
@@ -84,51 +174,130 @@ void renderer_initialize_resources(
         &(resources->present_queue)
     );
 
-    resources->swapchain_image_format = renderer_get_swapchain_image_format(
-		resources->physical_device,
-		resources->surface
-    );
-
-    int window_width, window_height = 0;
-    glfwGetWindowSize(window, &window_width, &window_height);
-    resources->swapchain_extent = renderer_get_swapchain_extent(
+    resources->command_pool = renderer_get_command_pool(
         resources->physical_device,
-        resources->surface,
-        window_width,
-        window_height
+        resources->device
     );
 
-    resources->swapchain = renderer_get_swapchain(
-        resources->physical_device,
-        resources->device,
-        resources->surface,
-        resources->swapchain_image_format,
-        resources->swapchain_extent,
-        VK_NULL_HANDLE
-    );
+    // The calling thread becomes worker 0 and must be the one drawing frames
+    if (resources->settings.job_threads > 1) {
+        resources->jobs = malloc(sizeof(*resources->jobs));
+        assert(resources->jobs);
+        job_system_init(resources->jobs, resources->settings.job_threads);
+
+        resources->record_pool_count = resources->jobs->thread_count;
+        for (uint32_t i = 0; i < resources->record_pool_count; i++) {
+            resources->record_pools[i] = renderer_get_command_pool(
+                resources->physical_device,
+                resources->device
+            );
+        }
+    }
 
-    resources->image_count = renderer_get_swapchain_image_count(
-        resources->device,
-        resources->swapchain
-    );
-    //printf("%d\n", resources->image_count);
+    // Enough for every drawable to be queued, so steady frames don't grow them
+    size_t frame_arena_size = (size_t)resources->settings.max_drawables * (
+        sizeof(struct renderer_drawable*) +
+        sizeof(VkCommandBuffer) +
+        sizeof(struct renderer_draw_command) +
+        sizeof(uint32_t)
+    ) + ARENA_SCRATCH_SIZE;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        arena_init(&resources->frame_arenas[i], frame_arena_size);
+
+    if (pipeline_stats) {
+        resources->pipeline_stats = malloc(sizeof(*resources->pipeline_stats));
+        assert(resources->pipeline_stats);
+        renderer_pipeline_stats_init(
+            resources->pipeline_stats,
+            resources->physical_device,
+            resources->device
+        );
+    }
 
-    resources->command_pool = renderer_get_command_pool(
-        resources->physical_device,
-        resources->device
-    );
+    // Created before any upload so the uploads below are timed too
+    if (resources->settings.profile_gpu) {
+        resources->gpu_profiler = malloc(sizeof(*resources->gpu_profiler));
+        if (!renderer_gpu_profiler_init(
+                resources->gpu_profiler,
+                resources->physical_device,
+                resources->device,
+                resources->graphics_family_index)) {
+            free(resources->gpu_profiler);
+            resources->gpu_profiler = NULL;
+        }
+    }
 
-    resources->swapchain_buffers = malloc(
-        resources->image_count * sizeof(*resources->swapchain_buffers)
-    );
-    renderer_create_swapchain_buffers(
-        resources->device,
-        resources->command_pool,
-        resources->swapchain,
-        resources->swapchain_image_format,
-        resources->swapchain_buffers,
-        resources->image_count
-    );
+    if (headless) {
+        resources->swapchain_image_format.format = VK_FORMAT_R8G8B8A8_UNORM;
+        resources->swapchain_image_format.colorSpace =
+            VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+        resources->window_width = resources->settings.headless_width;
+        resources->window_height = resources->settings.headless_height;
+        resources->swapchain_extent.width = resources->window_width;
+        resources->swapchain_extent.height = resources->window_height;
+
+        // One target per frame in flight, so image index == frame index
+        resources->image_count = MAX_FRAMES_IN_FLIGHT;
+        resources->swapchain_buffers = malloc(
+            resources->image_count * sizeof(*resources->swapchain_buffers)
+        );
+        renderer_create_offscreen_buffers(
+            resources->physical_device,
+            resources->device,
+            resources->command_pool,
+            resources->swapchain_image_format,
+            resources->swapchain_extent,
+            resources->swapchain_buffers,
+            resources->offscreen_images,
+            resources->readback_buffers,
+            resources->image_count
+        );
+    } else {
+        resources->swapchain_image_format = renderer_get_swapchain_image_format(
+            resources->physical_device,
+            resources->surface
+        );
+
+        int window_width, window_height = 0;
+        glfwGetWindowSize(window, &window_width, &window_height);
+        resources->window_width = window_width;
+        resources->window_height = window_height;
+        resources->swapchain_extent = renderer_get_swapchain_extent(
+            resources->physical_device,
+            resources->surface,
+            window_width,
+            window_height
+        );
+
+        resources->swapchain = renderer_get_swapchain(
+            resources->physical_device,
+            resources->device,
+            resources->surface,
+            resources->swapchain_image_format,
+            resources->swapchain_extent,
+            resources->settings.present_mode,
+            resources->settings.swapchain_image_count,
+            VK_NULL_HANDLE
+        );
+
+        resources->image_count = renderer_get_swapchain_image_count(
+            resources->device,
+            resources->swapchain
+        );
+
+        resources->swapchain_buffers = malloc(
+            resources->image_count * sizeof(*resources->swapchain_buffers)
+        );
+        renderer_create_swapchain_buffers(
+            resources->device,
+            resources->command_pool,
+            resources->swapchain,
+            resources->swapchain_image_format,
+            resources->swapchain_buffers,
+            resources->image_count
+        );
+    }
 
     resources->depth_format = renderer_get_depth_format(
         resources->physical_device,
@@ -136,56 +305,87 @@ void renderer_initialize_resources(
         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
     );
 
-    resources->depth_image = renderer_get_image(
+    // The pyramid is built from single sampled depth, so MSAA and occlusion
+    // culling don't mix
+    resources->samples = renderer_get_sample_count(
         resources->physical_device,
-        resources->device,
-        resources->swapchain_extent,
-        resources->depth_format,
-        VK_IMAGE_ASPECT_DEPTH_BIT,
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        resources->settings.msaa_samples
     );
+    if (resources->samples != VK_SAMPLE_COUNT_1_BIT &&
+            resources->settings.occlusion_culling) {
+        printf("MSAA not used with occlusion culling\n");
+        resources->samples = VK_SAMPLE_COUNT_1_BIT;
+    }
+    if (resources->samples != resources->settings.msaa_samples)
+        printf("Using %u samples\n", (uint32_t)resources->samples);
+
+    // The occlusion pyramid is built by sampling the depth image
+    resources->depth_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    bool occlusion_culling = resources->settings.occlusion_culling;
+    if (occlusion_culling &&
+            !renderer_occlusion_supported(
+                resources->physical_device,
+                resources->depth_format)) {
+        // Asked for explicitly, quietly drawing everything would make any
+        // measurement of it meaningless
+        fprintf(stderr, "Occlusion culling not supported.\n");
+        exit(-1);
+    }
+    // Otherwise depth never leaves the render pass (its storeOp is
+    // DONT_CARE), so it can live in tile memory only, see renderer_get_image
+    if (occlusion_culling)
+        resources->depth_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    else
+        resources->depth_usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
 
-    renderer_set_depth_image_layout(
-        resources->device,
-        resources->graphics_queue,
-        resources->command_pool,
-        resources->depth_image.image,
-        resources->depth_format
-    );
+    // Every render pass clears depth from VK_IMAGE_LAYOUT_UNDEFINED first
+    renderer_create_attachment_images(resources);
 
+    // The default set plus one for each texture given its own
     resources->descriptor_pool = renderer_get_descriptor_pool(
-        resources->device
+        resources->device,
+        1 + resources->settings.max_textures
+    );
+    renderer_registry_init(
+        &resources->registry,
+        resources->settings.max_textures
     );
 
     resources->descriptor_layout = renderer_get_descriptor_layout(
         resources->device
     );
 
-    /*VkPhysicalDeviceProperties gpu_props;
-    vkGetPhysicalDeviceProperties(resources->physical_device, &gpu_props);
-
-    VkDeviceSize min_ubo_offset;
-    min_ubo_offset = gpu_props.limits.minUniformBufferOffsetAlignment;*/
-
+    // Sized for the most swapchain images there can be, so recreation never
+    // has to reallocate it
+    resources->matrix_alignment = renderer_get_buffer_alignment(
+        resources->physical_device,
+        sizeof(mat4x4)
+    );
     resources->dynamic_uniform_buffer = renderer_get_buffer(
         resources->physical_device,
         resources->device,
-        sizeof(mat4x4),
+        MAX_FRAMEBUFFERS * resources->settings.max_drawables *
+            resources->matrix_alignment,
         0,
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
     );
+    renderer_map_buffer(
+        resources->device,
+        0,
+        &resources->dynamic_uniform_buffer
+    );
 
+    // One matrix per image as well, an earlier frame may still read its own
     resources->view_projection_uniform_buffer = renderer_get_buffer(
         resources->physical_device,
         resources->device,
-        sizeof(resources->view_proj_matrix),
+        MAX_FRAMEBUFFERS * resources->matrix_alignment,
         0,
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
     );
     renderer_map_buffer(
         resources->device,
@@ -193,12 +393,14 @@ void renderer_initialize_resources(
         &resources->view_projection_uniform_buffer
     );
 
-    resources->tex_image = renderer_load_texture(
+    struct renderer_texture default_texture;
+    default_texture.image = renderer_load_texture(
         "assets/textures/chalet.jpg",
         resources->physical_device,
         resources->device,
         resources->graphics_queue,
-        resources->command_pool
+        resources->command_pool,
+        resources->gpu_profiler
     );
 
     resources->descriptor_set = renderer_get_descriptor_set(
@@ -208,12 +410,19 @@ void renderer_initialize_resources(
         1,
         &resources->view_projection_uniform_buffer,
         &resources->dynamic_uniform_buffer,
-        &resources->tex_image
+        &default_texture.image
+    );
+    default_texture.descriptor_set = resources->descriptor_set;
+    resources->default_texture = renderer_registry_add(
+        &resources->registry,
+        RENDERER_RESOURCE_TEXTURE,
+        &default_texture
     );
 
     renderer_update_view_projection_uniform_buffer(
         resources->swapchain_extent,
         &resources->view_projection_uniform_buffer,
+        0,
         resources->view_matrix,
         resources->projection_matrix,
         resources->view_proj_matrix,
@@ -221,10 +430,25 @@ void renderer_initialize_resources(
         NULL
     );
 
+    // The occlusion passes draw with the pipeline below, which must then be
+    // the single subpass kind
+    bool depth_prepass = resources->settings.depth_prepass;
+    if (depth_prepass && occlusion_culling) {
+        printf("Depth pre-pass not used with occlusion culling\n");
+        depth_prepass = false;
+    }
+
 	resources->render_pass = renderer_get_render_pass(
 		resources->device,
 		resources->swapchain_image_format.format,
-        resources->depth_format
+        resources->depth_format,
+        resources->samples,
+        VK_ATTACHMENT_LOAD_OP_CLEAR,
+        false,
+        depth_prepass,
+        headless ?
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
 	);
 
     resources->pipeline_layout = renderer_get_pipeline_layout(
@@ -235,12 +459,49 @@ void renderer_initialize_resources(
         0
     );
 
-    resources->graphics_pipeline = renderer_get_graphics_pipeline(
-        resources->device,
-        resources->swapchain_extent,
-        resources->pipeline_layout,
-        resources->render_pass,
-        0
+    VkPipeline graphics_pipeline;
+    if (depth_prepass) {
+        VkPipeline depth_pipeline = renderer_get_graphics_pipeline(
+            resources->device,
+            resources->pipeline_layout,
+            resources->render_pass,
+            0,
+            resources->samples,
+            true,
+            VK_COMPARE_OP_LESS,
+            true
+        );
+        resources->depth_pipeline = renderer_registry_add(
+            &resources->registry,
+            RENDERER_RESOURCE_PIPELINE,
+            &depth_pipeline
+        );
+        graphics_pipeline = renderer_get_graphics_pipeline(
+            resources->device,
+            resources->pipeline_layout,
+            resources->render_pass,
+            1,
+            resources->samples,
+            false,
+            VK_COMPARE_OP_EQUAL,
+            false
+        );
+    } else {
+        graphics_pipeline = renderer_get_graphics_pipeline(
+            resources->device,
+            resources->pipeline_layout,
+            resources->render_pass,
+            0,
+            resources->samples,
+            false,
+            VK_COMPARE_OP_LESS,
+            true
+        );
+    }
+    resources->graphics_pipeline = renderer_registry_add(
+        &resources->registry,
+        RENDERER_RESOURCE_PIPELINE,
+        &graphics_pipeline
     );
 
     resources->framebuffers = malloc(
@@ -251,15 +512,47 @@ void renderer_initialize_resources(
         resources->swapchain_extent,
         resources->swapchain_buffers,
         resources->depth_image.image_view,
+        resources->color_image.image_view,
         resources->framebuffers,
         resources->image_count
     );
 
-	resources->image_available = renderer_get_semaphore(resources->device);
-	resources->render_finished = renderer_get_semaphore(resources->device);
+    if (occlusion_culling) {
+        resources->occlusion = malloc(sizeof(*resources->occlusion));
+        assert(resources->occlusion);
+        renderer_occlusion_init(resources->occlusion, resources);
+    }
+
+    for (uint32_t i = 0; i < MAX_FRAMEBUFFERS; i++) {
+        resources->primary_records[i].draws = malloc(
+            resources->settings.max_drawables *
+            sizeof(*resources->primary_records[i].draws)
+        );
+        assert(resources->primary_records[i].draws);
+    }
+
+    resources->scene = malloc(sizeof(*resources->scene));
+    assert(resources->scene);
+    renderer_scene_init(resources->scene, resources);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        resources->frames[i].image_available =
+            renderer_get_semaphore(resources->device);
+        resources->frames[i].render_finished =
+            renderer_get_semaphore(resources->device);
+        resources->frames[i].in_flight =
+            renderer_get_fence(resources->device, true);
+    }
+
+    resources->images_in_flight = calloc(
+        resources->image_count,
+        sizeof(*resources->images_in_flight)
+    );
+    assert(resources->images_in_flight);
 }
 
-VkInstance renderer_get_instance()
+VkInstance renderer_get_instance(
+        bool headless)
 {
     VkInstance instance_handle;
     instance_handle = VK_NULL_HANDLE;
@@ -294,10 +587,9 @@ VkInstance renderer_get_instance()
     uint32_t available_layer_count;
 
     vkEnumerateInstanceLayerProperties(&available_layer_count, NULL);
-    assert(available_layer_count > 0);
 
     available_layers = malloc(
-        available_layer_count * sizeof(*available_layers)
+        MAX(available_layer_count, 1) * sizeof(*available_layers)
     );
     assert(available_layers);
 
@@ -313,9 +605,6 @@ VkInstance renderer_get_instance()
 
     bool layer_found = true;
     for (uint32_t i = 0; i < enabled_layer_count; i++) {
-        if (VALIDATION_ENABLED)
-            break;
-
         layer_found = false;
         for (uint32_t j = 0; j < available_layer_count; j++) {
             if (!strcmp(enabled_layers[i], available_layers[j].layerName)) {
@@ -324,12 +613,15 @@ VkInstance renderer_get_instance()
             }
         }
 
-        if (layer_found)
+        if (!layer_found)
             break;
     }
-    assert(layer_found);
 
-    if (VALIDATION_ENABLED) {
+    // CI machines and software ICDs often ship without the layers
+    if (VALIDATION_ENABLED && !layer_found)
+        printf("Validation layers not available\n");
+
+    if (VALIDATION_ENABLED && layer_found) {
         create_info.enabledLayerCount = enabled_layer_count;
         create_info.ppEnabledLayerNames = enabled_layers;
     } else {
@@ -338,11 +630,15 @@ VkInstance renderer_get_instance()
     }
 
     // Extensions
-    const char** glfw_extensions;
-    uint32_t glfw_extension_count;
-    glfw_extensions = glfwGetRequiredInstanceExtensions(
-        &glfw_extension_count
-    );
+    // Surface extensions are only needed (and GLFW only initialized) when
+    // rendering to a window
+    const char** glfw_extensions = NULL;
+    uint32_t glfw_extension_count = 0;
+    if (!headless) {
+        glfw_extensions = glfwGetRequiredInstanceExtensions(
+            &glfw_extension_count
+        );
+    }
 
     const char* my_extensions[] = {VK_EXT_DEBUG_REPORT_EXTENSION_NAME};
     uint32_t my_extension_count = 1;
@@ -394,19 +690,32 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
     const char* pMsg,
     void* pUserData)
 {
-    char* message = malloc(strlen(pMsg) + 100);
-    assert(message);
-
+    const char* severity;
     if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT)
-        sprintf(message, "%s error, code %d: %s", pLayerPrefix, code, pMsg);
+        severity = "error";
     else if (flags & VK_DEBUG_REPORT_WARNING_BIT_EXT)
-        sprintf(message, "%s warning, code %d: %s", pLayerPrefix, code, pMsg);
+        severity = "warning";
     else
         return VK_FALSE;
 
+    // Called from whichever thread made the Vulkan call
+    struct arena* scratch = arena_thread_scratch();
+    struct arena_mark mark = arena_get_mark(scratch);
+    size_t size = strlen(pLayerPrefix) + strlen(pMsg) + 100;
+    char* message = ARENA_NEW(scratch, char, size);
+
+    snprintf(
+        message,
+        size,
+        "%s %s, code %d: %s",
+        pLayerPrefix,
+        severity,
+        code,
+        pMsg
+    );
     fprintf(stderr, "%s\n", message);
 
-    free(message);
+    arena_rewind(scratch, mark);
 
     return VK_FALSE;
 }
@@ -497,10 +806,9 @@ bool physical_device_extensions_supported(
         &available_extension_count,
         NULL
     );
-    assert(available_extension_count > 0);
 
     available_extensions = malloc(
-        available_extension_count * sizeof(*available_extensions)
+        MAX(available_extension_count, 1) * sizeof(*available_extensions)
     );
     assert(available_extensions);
 
@@ -512,16 +820,21 @@ bool physical_device_extensions_supported(
     );
 
     // Determine if device's extensions contain necessary extensions
-    for (uint32_t i = 0; i < required_extension_count; i++) {
+    bool supported = true;
+    for (uint32_t i = 0; i < required_extension_count && supported; i++) {
+        supported = false;
         for (uint32_t j = 0; j < available_extension_count; j++) {
-            if (strcmp(required_extensions[i],
+            if (!strcmp(required_extensions[i],
                         available_extensions[j].extensionName)) {
-                return false;
+                supported = true;
+                break;
             }
         }
     }
 
-    return true;
+    free(available_extensions);
+
+    return supported;
 }
 
 VkPhysicalDevice renderer_get_physical_device(
@@ -553,7 +866,7 @@ VkPhysicalDevice renderer_get_physical_device(
 
     for (uint32_t i = 0; i < physical_device_count; i++) {
         // Ensure required extensions are supported
-        if (physical_device_extensions_supported(
+        if (!physical_device_extensions_supported(
                 physical_devices[i],
                 device_extension_count,
                 device_extensions)) {
@@ -561,6 +874,13 @@ VkPhysicalDevice renderer_get_physical_device(
             continue;
         }
 
+        // Without a surface any device that can do graphics will do,
+        // including software implementations like lavapipe
+        if (surface == VK_NULL_HANDLE) {
+            physical_device_handle = physical_devices[i];
+            break;
+        }
+
         // Ensure there is at least one surface format
         // compatible with the surface
         uint32_t format_count;
@@ -760,6 +1080,9 @@ uint32_t renderer_get_present_queue_family(
         VkPhysicalDevice physical_device,
         VkSurfaceKHR surface)
 {
+    if (surface == VK_NULL_HANDLE)
+        return renderer_get_graphics_queue_family(physical_device);
+
     uint32_t present_queue_index;
 
     uint32_t queue_family_count;
@@ -901,6 +1224,8 @@ VkSwapchainKHR renderer_get_swapchain(
         VkSurfaceKHR surface,
         VkSurfaceFormatKHR image_format,
         VkExtent2D swapchain_extent,
+        VkPresentModeKHR requested_present_mode,
+        uint32_t requested_image_count,
         VkSwapchainKHR old_swapchain)
 {
     VkSwapchainKHR swapchain_handle;
@@ -916,9 +1241,17 @@ VkSwapchainKHR renderer_get_swapchain(
     );
     assert(result == VK_SUCCESS);
 
-    uint32_t desired_image_count;
-    desired_image_count = surface_capabilities.minImageCount + 1;
-    if (desired_image_count > 0 &&
+    // Drawables keep one cmd per image, but never ask for fewer images than
+    // the surface needs
+    uint32_t desired_image_count = requested_image_count;
+    if (desired_image_count == 0)
+        desired_image_count = surface_capabilities.minImageCount + 1;
+    desired_image_count = MIN(desired_image_count, MAX_FRAMEBUFFERS);
+    desired_image_count = MAX(
+        desired_image_count,
+        surface_capabilities.minImageCount
+    );
+    if (surface_capabilities.maxImageCount > 0 &&
             desired_image_count > surface_capabilities.maxImageCount) {
         desired_image_count = surface_capabilities.maxImageCount;
     }
@@ -951,7 +1284,7 @@ VkSwapchainKHR renderer_get_swapchain(
         queue_family_indices = NULL;
     }
 
-    // Find a present mode, ideally MAILBOX unless unavailable,
+    // Use the requested present mode unless unavailable,
     // in which case fall back to FIFO (always available)
     VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
 
@@ -975,14 +1308,26 @@ VkSwapchainKHR renderer_get_swapchain(
     );
 
     for (uint32_t i = 0; i < present_mode_count; i++) {
-        if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+        if (present_modes[i] == requested_present_mode) {
             present_mode = present_modes[i];
             break;
         }
     }
 
+    if (present_mode != requested_present_mode) {
+        printf("Present mode %d unavailable, using FIFO\n",
+                requested_present_mode);
+    }
+
     free(present_modes);
 
+    // Transfer source lets frames be captured straight from the swapchain
+    VkImageUsageFlags image_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (surface_capabilities.supportedUsageFlags &
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+        image_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
     VkSwapchainCreateInfoKHR swapchain_info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .pNext = NULL,
@@ -993,7 +1338,7 @@ VkSwapchainKHR renderer_get_swapchain(
         .imageColorSpace = image_format.colorSpace,
         .imageExtent = swapchain_extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageUsage = image_usage,
         .imageSharingMode = sharing_mode,
         .queueFamilyIndexCount = queue_family_count,
         .pQueueFamilyIndices = queue_family_indices,
@@ -1004,6 +1349,8 @@ VkSwapchainKHR renderer_get_swapchain(
         .oldSwapchain = old_swapchain
     };
 
+    // The old swapchain is retired by the caller, which destroys it once the
+    // frames presenting its images have completed
     result = vkCreateSwapchainKHR(
         device,
         &swapchain_info,
@@ -1012,17 +1359,11 @@ VkSwapchainKHR renderer_get_swapchain(
     );
     assert(result == VK_SUCCESS);
 
-    if (old_swapchain != VK_NULL_HANDLE) {
-        vkDestroySwapchainKHR(
-            device,
-            old_swapchain,
-            NULL
-        );
-    }
-
     return swapchain_handle;
 }
 
+/* The driver may create more images than asked for, or the surface may need
+ * more than the per-image arrays hold. Rendering can't go on then */
 uint32_t renderer_get_swapchain_image_count(
         VkDevice device,
         VkSwapchainKHR swapchain)
@@ -1034,6 +1375,17 @@ uint32_t renderer_get_swapchain_image_count(
         &image_count,
         NULL
     );
+
+    if (image_count > MAX_FRAMEBUFFERS) {
+        fprintf(
+            stderr,
+            "Swapchain has %u images, at most %u are supported.\n",
+            image_count,
+            MAX_FRAMEBUFFERS
+        );
+        exit(-1);
+    }
+
     return image_count;
 }
 
@@ -1140,6 +1492,96 @@ void renderer_create_swapchain_buffers(
     free(images);
 }
 
+/* Stand-ins for swapchain images when running headless. The images are only
+ * ever rendered to and copied from, each with a persistently mapped buffer
+ * the copy lands in */
+void renderer_create_offscreen_buffers(
+        VkPhysicalDevice physical_device,
+        VkDevice device,
+        VkCommandPool command_pool,
+        VkSurfaceFormatKHR image_format,
+        VkExtent2D extent,
+        struct renderer_swapchain_buffer* swapchain_buffers,
+        struct renderer_image* offscreen_images,
+        struct renderer_buffer* readback_buffers,
+        uint32_t image_count)
+{
+    VkCommandBufferAllocateInfo cmd_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+
+    VkResult result;
+    for (uint32_t i = 0; i < image_count; i++) {
+        result = vkAllocateCommandBuffers(
+            device,
+            &cmd_alloc_info,
+            &swapchain_buffers[i].cmd
+        );
+        assert(result == VK_SUCCESS);
+
+        offscreen_images[i] = renderer_get_image(
+            physical_device,
+            device,
+            extent,
+            image_format.format,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+
+        swapchain_buffers[i].image = offscreen_images[i].image;
+        swapchain_buffers[i].image_view = offscreen_images[i].image_view;
+
+        // 4 bytes per pixel, the offscreen format is always R8G8B8A8
+        readback_buffers[i] = renderer_get_buffer(
+            physical_device,
+            device,
+            (VkDeviceSize)extent.width * extent.height * 4,
+            0,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        renderer_map_buffer(device, 0, &readback_buffers[i]);
+    }
+}
+
+void renderer_destroy_offscreen_buffers(
+        VkDevice device,
+        VkCommandPool command_pool,
+        struct renderer_swapchain_buffer* swapchain_buffers,
+        struct renderer_image* offscreen_images,
+        struct renderer_buffer* readback_buffers,
+        uint32_t image_count)
+{
+    for (uint32_t i = 0; i < image_count; i++) {
+        vkFreeCommandBuffers(
+            device,
+            command_pool,
+            1,
+            &swapchain_buffers[i].cmd
+        );
+
+        vkDestroyImageView(device, offscreen_images[i].image_view, NULL);
+        vkDestroyImage(device, offscreen_images[i].image, NULL);
+        renderer_free_memory(
+            device,
+            offscreen_images[i].memory,
+            offscreen_images[i].memory_size
+        );
+
+        renderer_unmap_buffer(device, &readback_buffers[i]);
+        renderer_destroy_buffer(device, &readback_buffers[i]);
+    }
+}
+
 VkFormat renderer_get_depth_format(
         VkPhysicalDevice physical_device,
         VkImageTiling tiling,
@@ -1178,64 +1620,94 @@ VkFormat renderer_get_depth_format(
     return format;
 }
 
-void renderer_set_depth_image_layout(
-        VkDevice device,
-        VkQueue graphics_queue,
-        VkCommandPool command_pool,
-        VkImage depth_image,
-        VkFormat depth_format)
+/* Largest sample count up to the requested one that both color and depth
+ * attachments support, at least VK_SAMPLE_COUNT_1_BIT */
+VkSampleCountFlagBits renderer_get_sample_count(
+        VkPhysicalDevice physical_device,
+        uint32_t requested_samples)
 {
-    VkImageAspectFlags aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT;
-    if (depth_format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
-            depth_format == VK_FORMAT_D24_UNORM_S8_UINT) {
-        aspect_mask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    VkSampleCountFlags supported =
+        properties.limits.framebufferColorSampleCounts &
+        properties.limits.framebufferDepthSampleCounts;
+
+    // The flag bits equal the counts they stand for
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    for (uint32_t count = 2; count <= requested_samples && count <= 64;
+            count *= 2) {
+        if (supported & count)
+            samples = (VkSampleCountFlagBits)count;
     }
 
-    renderer_change_image_layout(
-        device,
-        graphics_queue,
-        command_pool,
-        depth_image,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-        0,
-        aspect_mask
+    return samples;
+}
+
+/* Depth and, with MSAA, the multisampled color target that is resolved
+ * into the swapchain image. Neither is needed once the render pass ends */
+void renderer_create_attachment_images(
+        struct renderer_resources* resources)
+{
+    resources->depth_image = renderer_get_image(
+        resources->physical_device,
+        resources->device,
+        resources->swapchain_extent,
+        resources->depth_format,
+        VK_IMAGE_ASPECT_DEPTH_BIT,
+        VK_IMAGE_TILING_OPTIMAL,
+        resources->samples,
+        resources->depth_usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
     );
+
+    memset(&resources->color_image, 0, sizeof(resources->color_image));
+    if (resources->samples != VK_SAMPLE_COUNT_1_BIT) {
+        resources->color_image = renderer_get_image(
+            resources->physical_device,
+            resources->device,
+            resources->swapchain_extent,
+            resources->swapchain_image_format.format,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            resources->samples,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+    }
 }
 
 VkDescriptorPool renderer_get_descriptor_pool(
-        VkDevice device)
+        VkDevice device,
+        uint32_t max_sets)
 {
     VkDescriptorPool descriptor_pool_handle;
     descriptor_pool_handle = VK_NULL_HANDLE;
 
-    VkDescriptorPoolSize dynamic_uniform_buffer_pool_size = {
-        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = 1
-    };
-
-    VkDescriptorPoolSize view_projection_uniform_buffer_pool_size = {
+    // The view projection and model matrices, both picked per image
+    VkDescriptorPoolSize uniform_buffer_pool_size = {
         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-        .descriptorCount = 1
+        .descriptorCount = 2 * max_sets
     };
 
     VkDescriptorPoolSize sampler_pool_size = {
         .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-        .descriptorCount = 1
+        .descriptorCount = max_sets
     };
 
     VkDescriptorPoolSize pool_sizes[] = {
-        view_projection_uniform_buffer_pool_size,
-        dynamic_uniform_buffer_pool_size,
+        uniform_buffer_pool_size,
         sampler_pool_size
     };
 
+    // Released textures hand their sets back, see renderer_registry_release
     VkDescriptorPoolCreateInfo descriptor_pool_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .pNext = NULL,
-        .flags = 0,
-        .maxSets = 1,
-        .poolSizeCount = 3,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .maxSets = max_sets,
+        .poolSizeCount = 2,
         .pPoolSizes = pool_sizes
     };
 
@@ -1259,7 +1731,7 @@ VkDescriptorSetLayout renderer_get_descriptor_layout(
 
     VkDescriptorSetLayoutBinding dynamic_ubo_layout_binding = {
         .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .descriptorCount = 1,
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
         .pImmutableSamplers = NULL
@@ -1307,24 +1779,12 @@ VkDescriptorSetLayout renderer_get_descriptor_layout(
 	return descriptor_layout_handle;
 }
 
-void renderer_update_dynamic_uniform_buffer(
-        VkDevice device,
-        struct renderer_buffer* uniform_buffer,
-        mat4x4 model_matrix)
-{
-    mat4x4_identity(model_matrix);
-    mat4x4_rotate_all(model_matrix, 0.0f, 0.0f, 0.0f);
-
-    renderer_map_buffer(device, 0, uniform_buffer);
-
-    memcpy((float*)uniform_buffer->mapped, model_matrix, sizeof(mat4x4));
-
-    renderer_unmap_buffer(device, uniform_buffer);
-}
-
+/* Writes the matrix at offset, see renderer_get_view_projection_offset. The
+ * buffer is host coherent so nothing needs flushing */
 void renderer_update_view_projection_uniform_buffer(
         VkExtent2D swapchain_extent,
         struct renderer_buffer* uniform_buffer,
+        size_t offset,
         mat4x4 view_matrix,
         mat4x4 projection_matrix,
         mat4x4 view_proj_matrix,
@@ -1353,8 +1813,12 @@ void renderer_update_view_projection_uniform_buffer(
     projection_matrix[1][1] *= -1;
 
     // Save a multiplication in the shader
-    mat4x4_mul(view_proj_matrix, projection_matrix, view_matrix);
-    memcpy((float*)uniform_buffer->mapped, view_proj_matrix, sizeof(mat4x4));
+    mat4x4_mul_simd(view_proj_matrix, projection_matrix, view_matrix);
+    memcpy(
+        (char*)uniform_buffer->mapped + offset,
+        view_proj_matrix,
+        sizeof(mat4x4)
+    );
 }
 
 VkDescriptorSet renderer_get_descriptor_set(
@@ -1385,16 +1849,17 @@ VkDescriptorSet renderer_get_descriptor_set(
     );
     assert(result == VK_SUCCESS);
 
+    // The dynamic offsets pick which of the buffers' matrices are bound
 	VkDescriptorBufferInfo view_projection_ubo_buffer_info = {
         .buffer = view_projection_uniform_buffer->buffer,
         .offset = 0,
-        .range = view_projection_uniform_buffer->size
+        .range = sizeof(mat4x4)
     };
 
 	VkDescriptorBufferInfo dynamic_ubo_buffer_info = {
         .buffer = dynamic_uniform_buffer->buffer,
         .offset = 0,
-        .range = dynamic_uniform_buffer->size
+        .range = sizeof(mat4x4)
     };
 
 	VkDescriptorImageInfo image_info = {
@@ -1410,7 +1875,7 @@ VkDescriptorSet renderer_get_descriptor_set(
         .dstBinding = 0,
         .dstArrayElement = 0,
         .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .pImageInfo = NULL,
         .pBufferInfo = &view_projection_ubo_buffer_info,
         .pTexelBufferView = NULL
@@ -1453,24 +1918,44 @@ VkDescriptorSet renderer_get_descriptor_set(
     return descriptor_set_handle;
 }
 
+/* load_op VK_ATTACHMENT_LOAD_OP_LOAD continues a pass that left both
+ * attachments in their attachment layouts, storing depth if store_depth */
 VkRenderPass renderer_get_render_pass(
         VkDevice device,
         VkFormat image_format,
-        VkFormat depth_format)
+        VkFormat depth_format,
+        VkSampleCountFlagBits samples,
+        VkAttachmentLoadOp load_op,
+        bool store_depth,
+        bool depth_prepass,
+        VkImageLayout final_layout)
 {
     VkRenderPass render_pass_handle;
     render_pass_handle = VK_NULL_HANDLE;
 
+    bool load = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+
+    // Multisampled color is resolved into the image (attachment 2) at the
+    // end of the subpass and never stored itself
+    bool multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+    assert(!(multisampled && load));
+
     VkAttachmentDescription color_desc = {
         .flags = 0,
         .format = image_format,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .samples = samples,
+        .loadOp = load_op,
+        .storeOp = multisampled ?
+            VK_ATTACHMENT_STORE_OP_DONT_CARE :
+            VK_ATTACHMENT_STORE_OP_STORE,
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+        .initialLayout = load ?
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+            VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = multisampled ?
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+            final_layout
     };
     VkAttachmentReference color_ref = {
         .attachment = 0,
@@ -1480,12 +1965,16 @@ VkRenderPass renderer_get_render_pass(
     VkAttachmentDescription depth_desc = {
         .flags = 0,
         .format = depth_format,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .samples = samples,
+        .loadOp = load_op,
+        .storeOp = store_depth ?
+            VK_ATTACHMENT_STORE_OP_STORE :
+            VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .initialLayout = load ?
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL :
+            VK_IMAGE_LAYOUT_UNDEFINED,
         .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
     };
     VkAttachmentReference depth_ref = {
@@ -1493,30 +1982,117 @@ VkRenderPass renderer_get_render_pass(
         .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
     };
 
-    VkAttachmentDescription attachments[] = {color_desc, depth_desc};
+    VkAttachmentDescription resolve_desc = {
+        .flags = 0,
+        .format = image_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = final_layout
+    };
+    VkAttachmentReference resolve_ref = {
+        .attachment = 2,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+
+    VkAttachmentDescription attachments[] = {
+        color_desc,
+        depth_desc,
+        resolve_desc
+    };
+
+    // With a pre-pass, the first subpass only lays down depth and the
+    // second shades against it without writing it
+    VkSubpassDescription depth_subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .flags = 0,
+        .inputAttachmentCount = 0,
+        .pInputAttachments = NULL,
+        .colorAttachmentCount = 0,
+        .pColorAttachments = NULL,
+        .pResolveAttachments = NULL,
+        .pDepthStencilAttachment = &depth_ref,
+        .preserveAttachmentCount = 0,
+        .pPreserveAttachments = NULL
+    };
 
-    VkSubpassDescription subpass = {
+    VkSubpassDescription color_subpass = {
         .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
         .flags = 0,
         .inputAttachmentCount = 0,
         .pInputAttachments = NULL,
         .colorAttachmentCount = 1,
         .pColorAttachments = &color_ref,
-        .pResolveAttachments = NULL,
+        .pResolveAttachments = multisampled ? &resolve_ref : NULL,
         .pDepthStencilAttachment = &depth_ref,
         .preserveAttachmentCount = 0,
         .pPreserveAttachments = NULL
     };
 
-    VkSubpassDependency subpass_dependency = {
-        .srcSubpass = VK_SUBPASS_EXTERNAL,
-        .dstSubpass = 0,
+    VkSubpassDescription subpasses[] = {depth_subpass, color_subpass};
+    uint32_t color_subpass_index = depth_prepass ? 1 : 0;
+
+    VkSubpassDependency subpass_dependencies[4] = {
+        // A loaded color attachment was written by the pass before
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = color_subpass_index,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = load ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask =
+                VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dependencyFlags = 0
+        },
+        // Frames share the depth image, the last frame's depth tests are
+        // done before this one clears or writes it
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask =
+                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstStageMask =
+                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstAccessMask =
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dependencyFlags = 0
+        }
+    };
+    uint32_t dependency_count = 2;
+
+    // Each pixel's pre-pass depth is complete before it is shaded
+    if (depth_prepass) {
+        subpass_dependencies[dependency_count++] = (VkSubpassDependency){
+            .srcSubpass = 0,
+            .dstSubpass = 1,
+            .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstStageMask =
+                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT
+        };
+    }
+
+    // The color image is copied out after the pass (headless readback and
+    // capture). Without this the implicit dependency only orders the final
+    // layout transition before BOTTOM_OF_PIPE, which no barrier can wait on
+    subpass_dependencies[dependency_count++] = (VkSubpassDependency){
+        .srcSubpass = color_subpass_index,
+        .dstSubpass = VK_SUBPASS_EXTERNAL,
         .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
-        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .dstAccessMask =
-            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
         .dependencyFlags = 0
     };
 
@@ -1524,12 +2100,12 @@ VkRenderPass renderer_get_render_pass(
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .attachmentCount = 2,
+        .attachmentCount = multisampled ? 3 : 2,
         .pAttachments = attachments,
-        .subpassCount = 1,
-        .pSubpasses = &subpass,
-        .dependencyCount = 1,
-        .pDependencies = &subpass_dependency
+        .subpassCount = depth_prepass ? 2 : 1,
+        .pSubpasses = depth_prepass ? subpasses : &color_subpass,
+        .dependencyCount = dependency_count,
+        .pDependencies = subpass_dependencies
     };
 
     VkResult result;
@@ -1603,20 +2179,41 @@ VkShaderModule renderer_get_shader_module(
     return shader_module_handle;
 }
 
+/* A depth only pipeline has no fragment shader and writes no color, for
+ * the pre-pass, and reads only the position stream when depth.spv exists.
+ * The pass shading after it tests EQUAL without writing depth, which relies
+ * on both vertex shaders computing gl_Position invariantly */
 VkPipeline renderer_get_graphics_pipeline(
         VkDevice device,
-        VkExtent2D swapchain_extent,
         VkPipelineLayout pipeline_layout,
         VkRenderPass render_pass,
-        uint32_t subpass)
+        uint32_t subpass,
+        VkSampleCountFlagBits samples,
+        bool depth_only,
+        VkCompareOp depth_compare_op,
+        bool depth_write)
 {
+    // Depth only passes read just the position stream when the position
+    // only shader has been built, otherwise they go through vert.spv too
+    bool position_only = depth_only &&
+        renderer_file_exists("assets/shaders/depth.spv");
+    if (depth_only && !position_only) {
+        fprintf(
+            stderr,
+            "Missing assets/shaders/depth.spv, the depth pre-pass falls back "
+            "to vert.spv and reads every vertex attribute. Build it with make "
+            "shaders.\n"
+        );
+    }
+    const char* vert_shader_path = position_only ?
+        "assets/shaders/depth.spv" :
+        "assets/shaders/vert.spv";
+
     VkShaderModule vert_shader_module;
-    size_t vert_shader_size = renderer_get_file_size(
-        "assets/shaders/vert.spv"
-    );
+    size_t vert_shader_size = renderer_get_file_size(vert_shader_path);
     char* vert_shader_code = malloc(vert_shader_size);
     renderer_read_file_to_buffer(
-        "assets/shaders/vert.spv",
+        vert_shader_path,
         &vert_shader_code,
         vert_shader_size
     );
@@ -1627,22 +2224,24 @@ VkPipeline renderer_get_graphics_pipeline(
     );
     free(vert_shader_code);
 
-    VkShaderModule frag_shader_module;
-    size_t frag_shader_size = renderer_get_file_size(
-        "assets/shaders/frag.spv"
-    );
-    char* frag_shader_code = malloc(frag_shader_size);
-    renderer_read_file_to_buffer(
-        "assets/shaders/frag.spv",
-        &frag_shader_code,
-        frag_shader_size
-    );
-    frag_shader_module = renderer_get_shader_module(
-        device,
-        frag_shader_code,
-        frag_shader_size
-    );
-    free(frag_shader_code);
+    VkShaderModule frag_shader_module = VK_NULL_HANDLE;
+    if (!depth_only) {
+        size_t frag_shader_size = renderer_get_file_size(
+            "assets/shaders/frag.spv"
+        );
+        char* frag_shader_code = malloc(frag_shader_size);
+        renderer_read_file_to_buffer(
+            "assets/shaders/frag.spv",
+            &frag_shader_code,
+            frag_shader_size
+        );
+        frag_shader_module = renderer_get_shader_module(
+            device,
+            frag_shader_code,
+            frag_shader_size
+        );
+        free(frag_shader_code);
+    }
 
     VkShaderModule shader_modules[] = {
         vert_shader_module,
@@ -1652,7 +2251,7 @@ VkPipeline renderer_get_graphics_pipeline(
         VK_SHADER_STAGE_VERTEX_BIT,
         VK_SHADER_STAGE_FRAGMENT_BIT
     };
-    uint32_t shader_stage_count = 2;
+    uint32_t shader_stage_count = depth_only ? 1 : 2;
 
     VkPipelineShaderStageCreateInfo* shader_infos;
     shader_infos = malloc(shader_stage_count * sizeof(*shader_infos));
@@ -1668,24 +2267,32 @@ VkPipeline renderer_get_graphics_pipeline(
         shader_infos[i].pSpecializationInfo = NULL;
     }
 
-    VkVertexInputBindingDescription binding_description = {
-        .binding = 0,
-        .stride = sizeof(struct renderer_vertex),
-        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+    // One binding per stream, see renderer_upload_meshes
+    VkVertexInputBindingDescription binding_descriptions[] = {
+        {
+            .binding = 0,
+            .stride = sizeof(struct renderer_vertex_position),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        },
+        {
+            .binding = 1,
+            .stride = sizeof(struct renderer_vertex_attributes),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        }
     };
 
     VkVertexInputAttributeDescription position_attribute_description = {
         .location = 0,
         .binding = 0,
         .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(struct renderer_vertex, x)
+        .offset = offsetof(struct renderer_vertex_position, x)
     };
 
     VkVertexInputAttributeDescription texture_attribute_description = {
         .location = 1,
-        .binding = 0,
+        .binding = 1,
         .format = VK_FORMAT_R32G32_SFLOAT,
-        .offset = offsetof(struct renderer_vertex, u)
+        .offset = offsetof(struct renderer_vertex_attributes, u)
     };
 
     VkVertexInputAttributeDescription attribute_descriptions[] = {
@@ -1697,9 +2304,9 @@ VkPipeline renderer_get_graphics_pipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &binding_description,
-        .vertexAttributeDescriptionCount = 2,
+        .vertexBindingDescriptionCount = position_only ? 1 : 2,
+        .pVertexBindingDescriptions = binding_descriptions,
+        .vertexAttributeDescriptionCount = position_only ? 1 : 2,
         .pVertexAttributeDescriptions = attribute_descriptions
     };
 
@@ -1711,28 +2318,29 @@ VkPipeline renderer_get_graphics_pipeline(
         .primitiveRestartEnable = VK_FALSE
     };
 
-	VkViewport viewport = {
-        .x = 0,
-        .y = 0,
-        .width = (float)swapchain_extent.width,
-        .height = (float)swapchain_extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f
-    };
-
-    VkRect2D scissor = {
-        .offset = {0, 0},
-        .extent = swapchain_extent
-    };
-
+    // Viewport and scissor are set when recording so the pipeline does not
+    // depend on the swapchain extent and survives a resize
     VkPipelineViewportStateCreateInfo viewport_state = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
         .viewportCount = 1,
-        .pViewports = &viewport,
+        .pViewports = NULL,
         .scissorCount = 1,
-        .pScissors = &scissor
+        .pScissors = NULL
+    };
+
+    VkDynamicState dynamic_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dynamic_states
     };
 
     VkPipelineRasterizationStateCreateInfo rasterization_state = {
@@ -1755,7 +2363,7 @@ VkPipeline renderer_get_graphics_pipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .rasterizationSamples = samples,
         .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 0.0f,
         .pSampleMask = NULL,
@@ -1768,8 +2376,8 @@ VkPipeline renderer_get_graphics_pipeline(
         .pNext = NULL,
         .flags = 0,
         .depthTestEnable = VK_TRUE,
-        .depthWriteEnable = VK_TRUE,
-        .depthCompareOp = VK_COMPARE_OP_LESS,
+        .depthWriteEnable = depth_write ? VK_TRUE : VK_FALSE,
+        .depthCompareOp = depth_compare_op,
         .depthBoundsTestEnable = VK_FALSE,
         .stencilTestEnable = VK_FALSE,
         .front.failOp = 0,
@@ -1811,7 +2419,7 @@ VkPipeline renderer_get_graphics_pipeline(
         .flags = 0,
         .logicOpEnable = VK_FALSE,
         .logicOp = 0,
-        .attachmentCount = 1,
+        .attachmentCount = depth_only ? 0 : 1,
         .pAttachments = &color_blend_attachment,
         .blendConstants[0] = 0.0f,
         .blendConstants[1] = 0.0f,
@@ -1833,7 +2441,7 @@ VkPipeline renderer_get_graphics_pipeline(
         .pMultisampleState = &multisample_state,
         .pDepthStencilState = &depth_stencil_state,
         .pColorBlendState = &color_blend_state,
-        .pDynamicState = NULL,
+        .pDynamicState = &dynamic_state,
         .layout = pipeline_layout,
         .renderPass = render_pass,
         .subpass = subpass,
@@ -1858,7 +2466,8 @@ VkPipeline renderer_get_graphics_pipeline(
     free(shader_infos);
 
     vkDestroyShaderModule(device, vert_shader_module, NULL);
-    vkDestroyShaderModule(device, frag_shader_module, NULL);
+    if (frag_shader_module != VK_NULL_HANDLE)
+        vkDestroyShaderModule(device, frag_shader_module, NULL);
 
     return graphics_pipeline_handle;
 }
@@ -1869,10 +2478,16 @@ void renderer_create_framebuffers(
         VkExtent2D swapchain_extent,
         struct renderer_swapchain_buffer* swapchain_buffers,
         VkImageView depth_image_view,
+        VkImageView color_image_view,
         VkFramebuffer* framebuffers,
         uint32_t swapchain_image_count)
 {
-    VkImageView attachments[2];
+    // With a multisampled color image the swapchain image is the resolve
+    // attachment, see renderer_get_render_pass
+    bool multisampled = color_image_view != VK_NULL_HANDLE;
+
+    VkImageView attachments[3];
+    attachments[0] = color_image_view;
     attachments[1] = depth_image_view;
 
     VkFramebufferCreateInfo framebuffer_info = {
@@ -1880,7 +2495,7 @@ void renderer_create_framebuffers(
         .pNext = NULL,
         .flags = 0,
         .renderPass = render_pass,
-        .attachmentCount = 2,
+        .attachmentCount = multisampled ? 3 : 2,
         .pAttachments = attachments,
         .width = swapchain_extent.width,
         .height = swapchain_extent.height,
@@ -1888,7 +2503,7 @@ void renderer_create_framebuffers(
     };
 
     for (uint32_t i = 0; i < swapchain_image_count; i++) {
-        attachments[0] = swapchain_buffers[i].image_view;
+        attachments[multisampled ? 2 : 0] = swapchain_buffers[i].image_view;
 
         VkResult result;
         result = vkCreateFramebuffer(
@@ -1906,13 +2521,14 @@ struct renderer_buffer renderer_get_vertex_buffer(
         VkDevice device,
         VkCommandPool command_pool,
         VkQueue queue,
-        struct renderer_vertex* vertices,
-        uint32_t vertex_count)
+        const void* vertices,
+        VkDeviceSize size,
+        struct renderer_gpu_profiler* profiler)
 {
     struct renderer_buffer vbo;
     struct renderer_buffer staging_vbo;
 
-    VkDeviceSize mem_size = sizeof(*vertices) * vertex_count;
+    VkDeviceSize mem_size = size;
 
     staging_vbo = renderer_get_buffer(
         physical_device,
@@ -1944,11 +2560,11 @@ struct renderer_buffer renderer_get_vertex_buffer(
         queue,
         staging_vbo.buffer,
         vbo.buffer,
-        mem_size
+        mem_size,
+        profiler
     );
 
-    vkDestroyBuffer(device, staging_vbo.buffer, NULL);
-    vkFreeMemory(device, staging_vbo.memory, NULL);
+    renderer_destroy_buffer(device, &staging_vbo);
 
     return vbo;
 }
@@ -1959,7 +2575,8 @@ struct renderer_buffer renderer_get_index_buffer(
         VkCommandPool command_pool,
         VkQueue queue,
         uint32_t* indices,
-        uint32_t index_count)
+        uint32_t index_count,
+        struct renderer_gpu_profiler* profiler)
 {
     struct renderer_buffer ibo;
     struct renderer_buffer staging_ibo;
@@ -1996,17 +2613,176 @@ struct renderer_buffer renderer_get_index_buffer(
         queue,
         staging_ibo.buffer,
         ibo.buffer,
-        mem_size
+        mem_size,
+        profiler
     );
 
-    vkDestroyBuffer(device, staging_ibo.buffer, NULL);
-    vkFreeMemory(device, staging_ibo.memory, NULL);
+    renderer_destroy_buffer(device, &staging_ibo);
 
     return ibo;
 }
 
+/* Dynamic offset of a matrix for the image. Each image has its own matrices,
+ * so writing them cannot race with an earlier frame that used the same image
+ * and is still in flight */
+uint32_t renderer_get_matrix_offset(
+        size_t matrix_alignment,
+        uint32_t max_drawables,
+        uint32_t image_index,
+        uint32_t matrix_index)
+{
+    return (uint32_t)(
+        (image_index * max_drawables + matrix_index) * matrix_alignment
+    );
+}
+
+// Dynamic offset of the image's view projection matrix, for the same reason
+uint32_t renderer_get_view_projection_offset(
+        size_t matrix_alignment,
+        uint32_t image_index)
+{
+    return (uint32_t)(image_index * matrix_alignment);
+}
+
+// What recording a drawable's cmds for an image takes, shared by the jobs
+struct renderer_record_state
+{
+    VkCommandBufferInheritanceInfo inheritance_info;
+    VkPipeline pipelines[2]; // Depth, then shading
+    bool depth_prepass;
+    VkViewport viewport;
+    VkRect2D scissor;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSet* descriptor_sets;
+    const struct renderer_registry* registry;
+    uint32_t image_index;
+    size_t matrix_alignment;
+    uint32_t max_drawables;
+    struct renderer_drawable** draws; // Queued this frame, with a mesh
+    uint32_t draw_count;
+};
+
+struct renderer_record_job
+{
+    const struct renderer_record_state* state;
+    uint32_t pool; // Records the pending draws whose cmds come from it
+};
+
+static void renderer_record_drawable(
+        const struct renderer_record_state* state,
+        struct renderer_drawable* drawable)
+{
+    uint32_t image_index = state->image_index;
+    uint32_t matrix_offset = renderer_get_matrix_offset(
+        state->matrix_alignment,
+        state->max_drawables,
+        image_index,
+        drawable->matrix_index
+    );
+
+    // Only drawables whose mesh resolves are recorded
+    const struct renderer_mesh* mesh =
+        renderer_registry_get_mesh(state->registry, drawable->mesh);
+    struct renderer_texture* texture =
+        renderer_registry_get_texture(state->registry, drawable->texture);
+
+    // A copy per caller, the subpass differs between the two cmds
+    VkCommandBufferInheritanceInfo inheritance_info = state->inheritance_info;
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info
+    };
+
+    // The depth cmd is only recorded with a pre-pass
+    VkCommandBuffer drawable_cmds[] = {
+        drawable->depth_cmd[image_index],
+        drawable->cmd[image_index]
+    };
+    bool depth_prepass = state->depth_prepass;
+
+    for (uint32_t pass = depth_prepass ? 0 : 1; pass < 2; pass++) {
+        VkCommandBuffer drawable_cmd = drawable_cmds[pass];
+
+        inheritance_info.subpass = depth_prepass ? pass : 0;
+        vkBeginCommandBuffer(
+            drawable_cmd,
+            &begin_info
+        );
+
+        vkCmdBindPipeline(
+            drawable_cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            state->pipelines[pass]
+        );
+
+        vkCmdSetViewport(drawable_cmd, 0, 1, &state->viewport);
+        vkCmdSetScissor(drawable_cmd, 0, 1, &state->scissor);
+
+        renderer_bind_mesh_buffers(state->registry, drawable_cmd, mesh);
+
+        // The offset of a drawable's matrix never changes for an image, so
+        // the recorded cmd stays valid as the drawable moves
+        VkDescriptorSet* drawable_descriptor_set = state->descriptor_sets;
+        if (texture)
+            drawable_descriptor_set = &texture->descriptor_set;
+
+        uint32_t dynamic_offsets[2] = {
+            renderer_get_view_projection_offset(
+                state->matrix_alignment,
+                image_index
+            ),
+            matrix_offset
+        };
+        vkCmdBindDescriptorSets(
+            drawable_cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            state->pipeline_layout,
+            0,
+            1,
+            drawable_descriptor_set,
+            2,
+            dynamic_offsets
+        );
+
+        vkCmdDrawIndexed(
+            drawable_cmd,
+            mesh->index_count,
+            1,
+            mesh->ibo_offset,
+            mesh->vbo_offset,
+            0
+        );
+
+        vkEndCommandBuffer(drawable_cmd);
+    }
+}
+
+static void renderer_record_pool_job(void* data)
+{
+    struct renderer_record_job* job = data;
+    const struct renderer_record_state* state = job->state;
+
+    struct cpu_profiler_scope scope = cpu_profiler_begin("record drawables");
+    for (uint32_t i = 0; i < state->draw_count; i++) {
+        struct renderer_drawable* drawable = state->draws[i];
+        if (drawable->record_pending && drawable->record_pool == job->pool) {
+            renderer_record_drawable(state, drawable);
+            drawable->record_pending = false;
+        }
+    }
+    cpu_profiler_end(&scope);
+}
+
+/* With a depth pipeline, the render pass must have been created with
+ * depth_prepass. Each drawable then has a depth cmd executed in the first
+ * subpass, and its color cmds are executed together in the second. With
+ * jobs, the stale cmds are recorded in parallel, one job per command pool.
+ * draws holds max_drawables */
 void renderer_record_draw_commands(
         VkPipeline pipeline,
+        VkPipeline depth_pipeline,
         VkRenderPass render_pass,
         VkExtent2D swapchain_extent,
         VkFramebuffer *framebuffers,
@@ -2014,25 +2790,26 @@ void renderer_record_draw_commands(
         struct renderer_swapchain_buffer swapchain_buffer,
         struct queue *drawable_queue,
         VkPipelineLayout pipeline_layout,
-        VkDescriptorSet *descriptor_sets)
+        VkDescriptorSet *descriptor_sets,
+        uint32_t framebuffer_generation,
+        struct renderer_buffer* dynamic_uniform_buffer,
+        size_t matrix_alignment,
+        uint32_t max_drawables,
+        struct renderer_scene* scene,
+        const struct renderer_registry* registry,
+        struct job_system* jobs,
+        struct arena* frame_arena,
+        struct renderer_gpu_profiler* profiler,
+        struct renderer_pipeline_stats* pipeline_stats,
+        struct renderer_frame_stats* frame_stats)
 {
     // TODO: move all these structures somewhere permanent so they're not
     // being created every frame
 
-    // Primary cmd buffer
-    VkCommandBufferBeginInfo cmd_begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .pNext = NULL,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-        .pInheritanceInfo = NULL
-    };
+    // The primary cmd is begun and ended by the caller, which may record
+    // more work around the render pass
 
-    VkResult result;
-    result = vkBeginCommandBuffer(
-        swapchain_buffer.cmd,
-        &cmd_begin_info
-    );
-    assert(result == VK_SUCCESS);
+    struct cpu_profiler_scope record_scope = cpu_profiler_begin("record");
 
     // Render pass
     VkClearValue clear_values[] = {
@@ -2050,6 +2827,18 @@ void renderer_record_draw_commands(
         .pClearValues = clear_values,
     };
 
+    uint32_t render_pass_scope = GPU_PROFILER_NO_SCOPE;
+    if (profiler) {
+        render_pass_scope = renderer_gpu_profiler_begin_scope(
+            profiler,
+            swapchain_buffer.cmd,
+            "render pass"
+        );
+    }
+
+    if (pipeline_stats)
+        renderer_pipeline_stats_begin(pipeline_stats, swapchain_buffer.cmd);
+
     render_pass_info.framebuffer = framebuffers[image_index];
     vkCmdBeginRenderPass(
         swapchain_buffer.cmd,
@@ -2057,21 +2846,21 @@ void renderer_record_draw_commands(
         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
     );
 
-    /*VkViewport viewport = {
+    // Dynamic state is not inherited by secondary command buffers, so the
+    // viewport and scissor are set in each drawable's cmd below
+    VkViewport viewport = {
         .x = 0,
         .y = 0,
-        .width = swapchain_extent.width,
-        .height = swapchain_extent.height,
+        .width = (float)swapchain_extent.width,
+        .height = (float)swapchain_extent.height,
         .minDepth = 0.0f,
         .maxDepth = 1.0f
     };
-    vkCmdSetViewport(swapchain_buffer.cmd, 0, 1, &viewport);
 
     VkRect2D scissor = {
         .offset = {0,0},
         .extent = {swapchain_extent.width, swapchain_extent.height}
     };
-    vkCmdSetScissor(swapchain_buffer.cmd, 0, 1, &scissor);*/
 
     /*vkCmdBindPipeline(
         swapchain_buffer.cmd,
@@ -2091,6 +2880,13 @@ void renderer_record_draw_commands(
         .pipelineStatistics = 0
     };
 
+    // Secondaries must declare the queries that are active when they execute
+    if (pipeline_stats) {
+        inheritance_info.occlusionQueryEnable = VK_TRUE;
+        inheritance_info.queryFlags = pipeline_stats->occlusion_flags;
+        inheritance_info.pipelineStatistics = pipeline_stats->statistics;
+    }
+
     // Secondary command buffer begin info
     VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -2099,81 +2895,242 @@ void renderer_record_draw_commands(
         .pInheritanceInfo = &inheritance_info
     };
 
-    // Record secondary command buffers
+    bool depth_prepass = depth_pipeline != VK_NULL_HANDLE;
+
+    // Only as long as this frame's queue, the scene adds one shade cmd
+    uint32_t queued = (uint32_t)drawable_queue->elements_in_use;
+    struct renderer_drawable** draws =
+        ARENA_NEW(frame_arena, struct renderer_drawable*, queued);
+    VkCommandBuffer* shade_cmds = NULL;
+    if (depth_prepass)
+        shade_cmds = ARENA_NEW(frame_arena, VkCommandBuffer, queued + 1);
+    uint32_t shade_count = 0;
+
+    frame_stats->draw_count = 0;
+    frame_stats->triangle_count = 0;
+    frame_stats->cmds_recorded = 0;
+    frame_stats->cmds_reused = 0;
+
+    struct renderer_record_state state = {
+        .inheritance_info = inheritance_info,
+        .pipelines = {depth_pipeline, pipeline},
+        .depth_prepass = depth_prepass,
+        .viewport = viewport,
+        .scissor = scissor,
+        .pipeline_layout = pipeline_layout,
+        .descriptor_sets = descriptor_sets,
+        .registry = registry,
+        .image_index = image_index,
+        .matrix_alignment = matrix_alignment,
+        .max_drawables = max_drawables,
+        .draws = draws,
+        .draw_count = 0
+    };
+    uint32_t pending_count = 0;
+
     while (!queue_empty(drawable_queue)) {
         struct renderer_draw_command draw_command;
         queue_dequeue(drawable_queue, &draw_command);
 
         struct renderer_drawable *drawable = draw_command.drawable;
 
-        if (drawable->updated[image_index]) {
-            printf("Updating drawable for framebuffer %d\n", image_index);
-			fflush(stdout);
-            drawable->updated[image_index] = false;
+        // Nothing to draw with a released mesh, marked as recorded so the
+        // primary cmd can still be replayed
+        if (!renderer_registry_get_mesh(registry, drawable->mesh)) {
+            drawable->recorded_generation[image_index] = drawable->generation;
+            continue;
+        }
+        draws[state.draw_count++] = drawable;
+
+        // Recorded again after its mesh or texture changed, or on resize
+        // since the framebuffers (and the extent) change
+        bool recorded = drawable->recorded_generation[image_index] ==
+                drawable->generation &&
+            drawable->framebuffer_generation[image_index] ==
+                framebuffer_generation;
+        uint32_t cmd_count = depth_prepass ? 2 : 1;
+
+        if (recorded) {
+            frame_stats->cmds_reused += cmd_count;
+        } else {
+            frame_stats->cmds_recorded += cmd_count;
+            drawable->recorded_generation[image_index] = drawable->generation;
+            drawable->framebuffer_generation[image_index] =
+                framebuffer_generation;
+            drawable->record_pending = true;
+            pending_count++;
+        }
+    }
 
-            inheritance_info.framebuffer = framebuffers[image_index];
-            vkBeginCommandBuffer(
-                drawable->cmd[image_index],
-                &begin_info
-            );
+    // Record secondary command buffers, one job per pool
+    if (jobs && pending_count > 1) {
+        struct renderer_record_job record_jobs[JOB_MAX_THREADS];
+        struct job_counter counter = {0};
 
-            vkCmdBindPipeline(
-                drawable->cmd[image_index],
-                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                pipeline
-            );
+        for (uint32_t i = 0; i < jobs->thread_count; i++) {
+            record_jobs[i].state = &state;
+            record_jobs[i].pool = i;
+            job_run(jobs, renderer_record_pool_job, &record_jobs[i], &counter);
+        }
+        job_wait(jobs, &counter);
+    } else {
+        for (uint32_t i = 0; i < state.draw_count; i++) {
+            if (draws[i]->record_pending) {
+                renderer_record_drawable(&state, draws[i]);
+                draws[i]->record_pending = false;
+            }
+        }
+    }
+
+    // Executed in the order they were queued
+    for (uint32_t i = 0; i < state.draw_count; i++) {
+        struct renderer_drawable *drawable = draws[i];
 
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(
-                drawable->cmd[image_index],
-                0,
+        if (depth_prepass) {
+            vkCmdExecuteCommands(
+                swapchain_buffer.cmd,
                 1,
-                &(drawable->mesh->vbo->buffer),
-                offsets
+                &(drawable->depth_cmd[image_index])
             );
-
-            vkCmdBindIndexBuffer(
-                drawable->cmd[image_index],
-                drawable->mesh->ibo->buffer,
-                0,
-                VK_INDEX_TYPE_UINT32
+            shade_cmds[shade_count++] = drawable->cmd[image_index];
+        } else {
+            vkCmdExecuteCommands(
+                swapchain_buffer.cmd,
+                1,
+                &(drawable->cmd[image_index])
             );
+        }
 
-            uint32_t dynamic_offsets[1] = {0};
-            vkCmdBindDescriptorSets(
-                drawable->cmd[image_index],
-                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                pipeline_layout,
-                0,
-                1,
-                descriptor_sets,
+        const struct renderer_mesh* mesh =
+            renderer_registry_get_mesh(registry, drawable->mesh);
+        frame_stats->draw_count++;
+        frame_stats->triangle_count += mesh->index_count / 3;
+    }
+
+    // The retained objects, in one secondary per subpass
+    if (scene && scene->draw_count > 0) {
+        inheritance_info.framebuffer = framebuffers[image_index];
+        bool recorded = renderer_scene_record(
+            scene,
+            image_index,
+            framebuffer_generation,
+            &inheritance_info,
+            &begin_info,
+            depth_pipeline,
+            pipeline,
+            &viewport,
+            &scissor,
+            pipeline_layout,
+            descriptor_sets,
+            registry,
+            matrix_alignment,
+            max_drawables
+        );
+        if (recorded)
+            frame_stats->cmds_recorded += depth_prepass ? 2 : 1;
+        else
+            frame_stats->cmds_reused += depth_prepass ? 2 : 1;
+
+        if (depth_prepass) {
+            vkCmdExecuteCommands(
+                swapchain_buffer.cmd,
                 1,
-                dynamic_offsets
+                &scene->depth_cmds[image_index]
             );
-
-            vkCmdDrawIndexed(
-                drawable->cmd[image_index],
-                drawable->mesh->index_count,
+            shade_cmds[shade_count++] = scene->cmds[image_index];
+        } else {
+            vkCmdExecuteCommands(
+                swapchain_buffer.cmd,
                 1,
-                drawable->mesh->ibo_offset,
-                drawable->mesh->vbo_offset,
-                0
+                &scene->cmds[image_index]
             );
-
-            vkEndCommandBuffer(drawable->cmd[image_index]);
         }
 
-        vkCmdExecuteCommands(
+        frame_stats->draw_count += scene->draw_count;
+        frame_stats->triangle_count += scene->triangle_count;
+    }
+
+    if (depth_prepass) {
+        vkCmdNextSubpass(
             swapchain_buffer.cmd,
-            1,
-            &(drawable->cmd[image_index])
+            VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
         );
+        if (shade_count > 0)
+            vkCmdExecuteCommands(swapchain_buffer.cmd, shade_count, shade_cmds);
     }
 
     vkCmdEndRenderPass(swapchain_buffer.cmd);
 
-    result = vkEndCommandBuffer(swapchain_buffer.cmd);
-    assert(result == VK_SUCCESS);
+    if (pipeline_stats)
+        renderer_pipeline_stats_end(pipeline_stats, swapchain_buffer.cmd);
+
+    if (profiler) {
+        renderer_gpu_profiler_end_scope(
+            profiler,
+            swapchain_buffer.cmd,
+            render_pass_scope
+        );
+    }
+
+    cpu_profiler_end(&record_scope);
+}
+
+/* Copies a color image left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL by the
+ * render pass into a tightly packed host visible buffer. The pass's external
+ * dependency makes its color writes and layout transition visible to the copy,
+ * see renderer_get_render_pass */
+void renderer_record_image_readback(
+        VkCommandBuffer cmd,
+        VkImage image,
+        VkExtent2D extent,
+        struct renderer_buffer* readback_buffer)
+{
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {extent.width, extent.height, 1}
+    };
+
+    vkCmdCopyImageToBuffer(
+        cmd,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        readback_buffer->buffer,
+        1,
+        &region
+    );
+
+    // Host reads happen after the frame fence, which only covers device
+    // writes once they are made available to the host
+    VkBufferMemoryBarrier buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = readback_buffer->buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+    };
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0, NULL,
+        1, &buffer_barrier,
+        0, NULL
+    );
 }
 
 VkSemaphore renderer_get_semaphore(
@@ -2199,80 +3156,493 @@ VkSemaphore renderer_get_semaphore(
     return semaphore_handle;
 }
 
-void renderer_draw_frame(struct renderer_resources* resources)
+VkFence renderer_get_fence(
+        VkDevice device,
+        bool signaled)
 {
-    renderer_update_dynamic_uniform_buffer(
-        resources->device,
-        &resources->dynamic_uniform_buffer,
-        resources->model_matrix
-    );
-
-    renderer_update_view_projection_uniform_buffer(
-        resources->swapchain_extent,
-        &resources->view_projection_uniform_buffer,
-        resources->view_matrix,
-        resources->projection_matrix,
-        resources->view_proj_matrix,
-        resources->camera,
-        NULL
-    );
+    VkFence fence_handle;
 
-    uint32_t image_index;
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = signaled ? VK_FENCE_CREATE_SIGNALED_BIT : 0
+    };
 
     VkResult result;
-    result = vkAcquireNextImageKHR(
-        resources->device,
-        resources->swapchain,
-        UINT64_MAX, // Wait for next image indefinitely (ns)
-        resources->image_available,
-        VK_NULL_HANDLE,
-        &image_index
+    result = vkCreateFence(
+        device,
+        &fence_info,
+        NULL,
+        &fence_handle
     );
     assert(result == VK_SUCCESS);
 
-    renderer_record_draw_commands(
-        resources->graphics_pipeline,
-        resources->render_pass,
-        resources->swapchain_extent,
-        resources->framebuffers,
-        image_index,
-        resources->swapchain_buffers[image_index],
-        &resources->drawable_queue,
-        resources->pipeline_layout,
-        &resources->descriptor_set
-    );
+    return fence_handle;
+}
 
-    VkSemaphore wait_semaphores[] = {resources->image_available};
-    VkSemaphore signal_semaphores[] = {resources->render_finished};
+/* Per frame work in the primary cmd: GPU timestamps, statistics queries,
+ * occlusion culling and captures. Without any of it, the primary only
+ * depends on the queued drawables, the scene and the framebuffers */
+bool renderer_frame_reusable(
+        struct renderer_resources* resources)
+{
+    return !resources->gpu_profiler && !resources->pipeline_stats &&
+        !resources->occlusion && !resources->capture;
+}
 
-    VkPipelineStageFlags wait_stages[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-    };
+/* Whether the image's primary cmd was recorded for the same drawables in the
+ * same order, none of whose cmds has been invalidated since, and for the
+ * current scene draw list and framebuffers */
+bool renderer_can_replay_frame(
+        struct renderer_resources* resources,
+        uint32_t image_index)
+{
+    struct renderer_primary_record* record =
+        &resources->primary_records[image_index];
+
+    if (!record->valid || !renderer_frame_reusable(resources))
+        return false;
+    if (record->framebuffer_generation != resources->framebuffer_generation)
+        return false;
+    if (record->scene_generation != resources->scene->draw_list_generation)
+        return false;
+
+    struct queue* queue = &resources->drawable_queue;
+    if (queue->elements_in_use != record->draw_count)
+        return false;
+
+    for (uint32_t i = 0; i < record->draw_count; i++) {
+        struct renderer_draw_command* draw_command = queue_peek(queue, i);
+        struct renderer_drawable* drawable = draw_command->drawable;
+
+        if (drawable != record->draws[i] ||
+                drawable->recorded_generation[image_index] !=
+                    drawable->generation)
+            return false;
+    }
 
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = NULL,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = wait_semaphores,
-        .pWaitDstStageMask = wait_stages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &resources->swapchain_buffers[image_index].cmd,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = signal_semaphores
-    };
+    return true;
+}
 
-    result = vkQueueSubmit(
-        resources->graphics_queue,
-        1,
+// Consumes the queued draws that the image's primary cmd already has
+void renderer_replay_frame(
+        struct renderer_resources* resources,
+        uint32_t image_index)
+{
+    struct renderer_primary_record* record =
+        &resources->primary_records[image_index];
+
+    while (!queue_empty(&resources->drawable_queue)) {
+        struct renderer_draw_command draw_command;
+        queue_dequeue(&resources->drawable_queue, &draw_command);
+    }
+
+    struct renderer_frame_stats* stats = &resources->frame_stats;
+    stats->draw_count = record->stats.draw_count;
+    stats->triangle_count = record->stats.triangle_count;
+    stats->cmds_recorded = 0;
+    stats->cmds_reused =
+        record->stats.cmds_recorded + record->stats.cmds_reused;
+    stats->primary_reused = true;
+}
+
+/* Records the image's primary cmd, executing the drawables' secondaries and
+ * recording those that are out of date */
+void renderer_record_frame(
+        struct renderer_resources* resources,
+        uint32_t image_index)
+{
+    VkCommandBuffer cmd = resources->swapchain_buffers[image_index].cmd;
+    struct renderer_frame* frame = &resources->frames[resources->current_frame];
+    bool headless = resources->settings.headless;
+
+    // Remember what was queued, before recording dequeues it
+    struct renderer_primary_record* record =
+        &resources->primary_records[image_index];
+    record->valid = renderer_frame_reusable(resources);
+    if (record->valid) {
+        struct queue* queue = &resources->drawable_queue;
+
+        record->draw_count = (uint32_t)queue->elements_in_use;
+        for (uint32_t i = 0; i < record->draw_count; i++) {
+            struct renderer_draw_command* draw_command = queue_peek(queue, i);
+            record->draws[i] = draw_command->drawable;
+        }
+        record->framebuffer_generation = resources->framebuffer_generation;
+        record->scene_generation = resources->scene->draw_list_generation;
+    }
+
+    VkCommandBufferBeginInfo cmd_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = record->valid ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL
+    };
+
+    VkResult result;
+    result = vkBeginCommandBuffer(cmd, &cmd_begin_info);
+    assert(result == VK_SUCCESS);
+
+    // This slot's previous timestamps are complete since its fence was
+    // waited on before recording, resolving them here never stalls
+    struct renderer_gpu_profiler* profiler = resources->gpu_profiler;
+    uint32_t frame_scope = GPU_PROFILER_NO_SCOPE;
+    if (profiler) {
+        renderer_gpu_profiler_begin_frame(
+            profiler,
+            cmd,
+            resources->current_frame,
+            resources->frame_count
+        );
+        frame_scope = renderer_gpu_profiler_begin_scope(profiler, cmd, "frame");
+    }
+
+    if (resources->pipeline_stats) {
+        renderer_pipeline_stats_begin_frame(
+            resources->pipeline_stats,
+            cmd,
+            resources->current_frame,
+            resources->frame_count
+        );
+    }
+
+    if (resources->occlusion) {
+        // Culled on the GPU along with the queued draws
+        renderer_scene_enqueue(resources->scene, &resources->drawable_queue);
+        renderer_occlusion_record(
+            resources->occlusion,
+            resources,
+            cmd,
+            image_index
+        );
+    } else {
+        renderer_record_draw_commands(
+            renderer_registry_get_pipeline(
+                &resources->registry,
+                resources->graphics_pipeline
+            ),
+            renderer_registry_get_pipeline(
+                &resources->registry,
+                resources->depth_pipeline
+            ),
+            resources->render_pass,
+            resources->swapchain_extent,
+            resources->framebuffers,
+            image_index,
+            resources->swapchain_buffers[image_index],
+            &resources->drawable_queue,
+            resources->pipeline_layout,
+            &resources->descriptor_set,
+            resources->framebuffer_generation,
+            &resources->dynamic_uniform_buffer,
+            resources->matrix_alignment,
+            resources->settings.max_drawables,
+            resources->scene,
+            &resources->registry,
+            resources->jobs,
+            &resources->frame_arenas[resources->current_frame],
+            profiler,
+            resources->pipeline_stats,
+            &resources->frame_stats
+        );
+    }
+
+    uint32_t gpu_scope = GPU_PROFILER_NO_SCOPE;
+    if (headless) {
+        if (profiler) {
+            gpu_scope = renderer_gpu_profiler_begin_scope(
+                profiler,
+                cmd,
+                "readback"
+            );
+        }
+
+        renderer_record_image_readback(
+            cmd,
+            resources->swapchain_buffers[image_index].image,
+            resources->swapchain_extent,
+            &resources->readback_buffers[image_index]
+        );
+
+        if (profiler)
+            renderer_gpu_profiler_end_scope(profiler, cmd, gpu_scope);
+    }
+
+    if (resources->capture) {
+        if (profiler) {
+            gpu_scope = renderer_gpu_profiler_begin_scope(
+                profiler,
+                cmd,
+                "capture"
+            );
+        }
+
+        renderer_capture_record(
+            resources->capture,
+            cmd,
+            resources->swapchain_buffers[image_index].image,
+            resources->swapchain_image_format.format,
+            headless ?
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            resources->swapchain_extent,
+            frame->in_flight,
+            resources->frame_count
+        );
+
+        if (profiler)
+            renderer_gpu_profiler_end_scope(profiler, cmd, gpu_scope);
+    }
+
+    if (profiler)
+        renderer_gpu_profiler_end_scope(profiler, cmd, frame_scope);
+
+    result = vkEndCommandBuffer(cmd);
+    assert(result == VK_SUCCESS);
+
+    resources->frame_stats.primary_reused = false;
+    record->stats = resources->frame_stats;
+}
+
+struct renderer_upload_job
+{
+    struct renderer_resources* resources;
+    uint32_t image_index;
+};
+
+// Only transforms moved since the image's matrices were last written
+static void renderer_upload_transforms_job(void* data)
+{
+    struct renderer_upload_job* job = data;
+    struct renderer_resources* resources = job->resources;
+
+    struct cpu_profiler_scope scope = cpu_profiler_begin("upload matrices");
+    size_t image_size = (size_t)resources->settings.max_drawables *
+        resources->matrix_alignment;
+    transform_store_upload(
+        &resources->transforms,
+        job->image_index,
+        (char*)resources->dynamic_uniform_buffer.mapped +
+            job->image_index * image_size,
+        resources->matrix_alignment
+    );
+    cpu_profiler_end(&scope);
+}
+
+void renderer_draw_frame(struct renderer_resources* resources)
+{
+    double frame_start = timer_now();
+    uint64_t arena_blocks = arena_blocks_allocated();
+    struct cpu_profiler_scope draw_scope = cpu_profiler_begin("draw frame");
+
+    struct renderer_frame* frame = &resources->frames[resources->current_frame];
+
+    // Only wait for the frame that last used this slot, not the whole device
+    struct cpu_profiler_scope scope = cpu_profiler_begin("wait frame fence");
+    VkResult result;
+    result = vkWaitForFences(
+        resources->device,
+        1,
+        &frame->in_flight,
+        VK_TRUE,
+        UINT64_MAX
+    );
+    assert(result == VK_SUCCESS);
+    cpu_profiler_end(&scope);
+
+    // Nothing recorded for the slot's last frame is in use any more
+    arena_reset(&resources->frame_arenas[resources->current_frame]);
+
+    renderer_destroy_retired_swapchains(resources, false);
+    renderer_registry_update(resources);
+
+    // Before the fence is reset again below, see renderer_capture_poll
+    if (resources->capture)
+        renderer_capture_poll(resources->capture);
+
+    bool headless = resources->settings.headless;
+
+    if (resources->swapchain_dirty) {
+        // Minimized, nothing to present to until the window is restored.
+        // The frame's draws are dropped, or the queue would fill up
+        if (resources->window_width == 0 || resources->window_height == 0) {
+            queue_clear(&resources->drawable_queue);
+            cpu_profiler_end(&draw_scope);
+            return;
+        }
+
+        if (headless)
+            renderer_recreate_offscreen_targets(resources);
+        else
+            renderer_recreate_swapchain(resources);
+    }
+
+    uint32_t image_index;
+
+    if (headless) {
+        // Offscreen targets are owned per frame slot, so the fence waited on
+        // above already guarantees the image is free
+        image_index = resources->current_frame;
+    } else {
+        scope = cpu_profiler_begin("acquire");
+        result = vkAcquireNextImageKHR(
+            resources->device,
+            resources->swapchain,
+            UINT64_MAX, // Wait for next image indefinitely (ns)
+            frame->image_available,
+            VK_NULL_HANDLE,
+            &image_index
+        );
+        cpu_profiler_end(&scope);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            // No image was acquired and the semaphore is untouched, so the
+            // frame can simply be retried after recreation. Its draws are
+            // dropped, the next frame queues them again
+            resources->swapchain_dirty = true;
+            queue_clear(&resources->drawable_queue);
+            cpu_profiler_end(&draw_scope);
+            return;
+        }
+        // Suboptimal still acquired an image, render it and recreate after
+        if (result == VK_SUBOPTIMAL_KHR)
+            resources->swapchain_dirty = true;
+        else
+            assert(result == VK_SUCCESS);
+    }
+
+    // The image's cmd (and the drawables' cmds for it) may still be in use by
+    // an earlier frame that was given the same image
+    if (resources->images_in_flight[image_index] != VK_NULL_HANDLE &&
+            resources->images_in_flight[image_index] != frame->in_flight) {
+        result = vkWaitForFences(
+            resources->device,
+            1,
+            &resources->images_in_flight[image_index],
+            VK_TRUE,
+            UINT64_MAX
+        );
+        assert(result == VK_SUCCESS);
+    }
+    resources->images_in_flight[image_index] = frame->in_flight;
+
+    renderer_update_view_projection_uniform_buffer(
+        resources->swapchain_extent,
+        &resources->view_projection_uniform_buffer,
+        renderer_get_view_projection_offset(
+            resources->matrix_alignment,
+            image_index
+        ),
+        resources->view_matrix,
+        resources->projection_matrix,
+        resources->view_proj_matrix,
+        resources->camera,
+        NULL
+    );
+
+    // Only transforms moved since the image's matrices were last written are
+    // recomputed and copied
+    scope = cpu_profiler_begin("transforms");
+    transform_store_update(&resources->transforms);
+
+    // The copy only touches the image's matrices and upload list, so with
+    // jobs it runs alongside culling and recording until the submit
+    struct renderer_upload_job upload_job = {
+        .resources = resources,
+        .image_index = image_index
+    };
+    struct job_counter upload_counter = {0};
+    if (resources->jobs) {
+        job_run(
+            resources->jobs,
+            renderer_upload_transforms_job,
+            &upload_job,
+            &upload_counter
+        );
+    } else {
+        renderer_upload_transforms_job(&upload_job);
+    }
+
+    renderer_update_drawable_bounds(resources);
+    cpu_profiler_end(&scope);
+
+    if (resources->settings.frustum_culling) {
+        scope = cpu_profiler_begin("frustum cull");
+        renderer_frustum_cull(resources);
+        cpu_profiler_end(&scope);
+    }
+
+    renderer_scene_update(
+        resources->scene,
+        &resources->registry,
+        resources->settings.frustum_culling,
+        resources->cull_frame
+    );
+
+    VkCommandBuffer cmd = resources->swapchain_buffers[image_index].cmd;
+
+    // A frame that would be recorded exactly as last time for the image
+    // submits the image's primary cmd as it is
+    if (renderer_can_replay_frame(resources, image_index))
+        renderer_replay_frame(resources, image_index);
+    else
+        renderer_record_frame(resources, image_index);
+
+    if (resources->jobs)
+        job_wait(resources->jobs, &upload_counter);
+
+    VkSemaphore wait_semaphores[] = {frame->image_available};
+    VkSemaphore signal_semaphores[] = {frame->render_finished};
+
+    VkPipelineStageFlags wait_stages[] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+    };
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = signal_semaphores
+    };
+
+    // Nothing to acquire from or present to
+    if (headless) {
+        submit_info.waitSemaphoreCount = 0;
+        submit_info.signalSemaphoreCount = 0;
+    }
+
+    vkResetFences(resources->device, 1, &frame->in_flight);
+
+    scope = cpu_profiler_begin("submit");
+    result = vkQueueSubmit(
+        resources->graphics_queue,
+        1,
         &submit_info,
-        VK_NULL_HANDLE
+        frame->in_flight
     );
+    cpu_profiler_end(&scope);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Error while submitting queue.\n");
 		fflush(stdout);
         exit(-1);
     }
 
+    if (headless) {
+        resources->frame_stats.cpu_time = timer_now() - frame_start;
+        resources->frame_stats.input_to_queue_present = 0.0;
+        resources->frame_stats.arena_blocks_allocated =
+            (uint32_t)(arena_blocks_allocated() - arena_blocks);
+        resources->current_frame =
+            (resources->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+        resources->frame_count++;
+        cpu_profiler_end(&draw_scope);
+        return;
+    }
+
     VkSwapchainKHR swapchains[] = {resources->swapchain};
 
     VkPresentInfoKHR present_info = {
@@ -2286,9 +3656,35 @@ void renderer_draw_frame(struct renderer_resources* resources)
         .pResults = NULL
     };
 
-    vkQueuePresentKHR(resources->present_queue, &present_info);
+    scope = cpu_profiler_begin("present");
+    result = vkQueuePresentKHR(resources->present_queue, &present_info);
+    cpu_profiler_end(&scope);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        resources->swapchain_dirty = true;
+    else
+        assert(result == VK_SUCCESS);
+
+    double present_time = timer_now();
+    resources->frame_stats.cpu_time = present_time - frame_start;
+    resources->frame_stats.input_to_queue_present =
+        present_time - resources->frame_stats.input_time;
+    resources->frame_stats.arena_blocks_allocated =
+        (uint32_t)(arena_blocks_allocated() - arena_blocks);
 
-    vkDeviceWaitIdle(resources->device);
+    resources->current_frame =
+        (resources->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    resources->frame_count++;
+
+    cpu_profiler_end(&draw_scope);
+}
+
+/* Call on the thread that draws frames from now on, when it is not the one
+ * that initialized the resources. Calls must not overlap across threads */
+void renderer_set_render_thread(
+        struct renderer_resources* resources)
+{
+    if (resources->jobs)
+        job_system_attach(resources->jobs);
 }
 
 void renderer_resize(
@@ -2296,73 +3692,82 @@ void renderer_resize(
         int width,
         int height)
 {
-    vkDeviceWaitIdle(resources->device);
-
-    for (uint32_t i = 0; i < resources->image_count; i++) {
-        vkDestroyFramebuffer(
-            resources->device,
-            resources->framebuffers[i],
-            NULL
-        );
-    }
-
-    vkDestroyPipeline(
-        resources->device,
-        resources->graphics_pipeline,
-        NULL
-    );
-
-    vkDestroyPipelineLayout(
-        resources->device,
-        resources->pipeline_layout,
-        NULL
-    );
+    // Recreation is deferred to the next renderer_draw_frame so a burst of
+    // resize events during a window drag only rebuilds the swapchain once
+    resources->window_width = width;
+    resources->window_height = height;
+    resources->swapchain_dirty = true;
+}
 
-    vkDestroyRenderPass(resources->device, resources->render_pass, NULL);
+void renderer_set_present_mode(
+        struct renderer_resources* resources,
+        VkPresentModeKHR present_mode)
+{
+    resources->settings.present_mode = present_mode;
+    resources->swapchain_dirty = true;
+}
 
-    vkDestroyImage(resources->device, resources->depth_image.image, NULL);
-    vkDestroyImageView(
-        resources->device,
-        resources->depth_image.image_view,
-        NULL
-    );
-    vkFreeMemory(resources->device, resources->depth_image.memory, NULL);
+void renderer_set_swapchain_image_count(
+        struct renderer_resources* resources,
+        uint32_t image_count)
+{
+    resources->settings.swapchain_image_count = image_count;
+    resources->swapchain_dirty = true;
+}
 
-    for (uint32_t i = 0; i < resources->image_count; i++) {
-        vkDestroyImageView(
-            resources->device,
-            resources->swapchain_buffers[i].image_view,
-            NULL
-        );
-        vkFreeCommandBuffers(
-            resources->device,
-            resources->command_pool,
-            1,
-            &resources->swapchain_buffers[i].cmd
-        );
-    }
+void renderer_recreate_swapchain(
+        struct renderer_resources* resources)
+{
+    struct cpu_profiler_scope scope = cpu_profiler_begin("recreate swapchain");
+
+    // Make room for the current objects, only blocking on the frames in
+    // flight if swapchains were recreated faster than frames retire
+    if (resources->retired_swapchain_count == MAX_RETIRED_SWAPCHAINS)
+        renderer_destroy_retired_swapchains(resources, true);
+
+    struct renderer_retired_swapchain* retired;
+    retired = &resources->retired_swapchains[
+        resources->retired_swapchain_count++
+    ];
+    retired->swapchain = resources->swapchain;
+    retired->image_count = resources->image_count;
+    retired->swapchain_buffers = resources->swapchain_buffers;
+    retired->framebuffers = resources->framebuffers;
+    retired->depth_image = resources->depth_image;
+    retired->color_image = resources->color_image;
+    retired->retired_frame = resources->frame_count;
 
     resources->swapchain_extent = renderer_get_swapchain_extent(
         resources->physical_device,
         resources->surface,
-        width,
-        height
+        resources->window_width,
+        resources->window_height
     );
 
+    // Handing over the old swapchain lets the presentation engine reuse its
+    // resources and keep showing its images until the new ones are ready
     resources->swapchain = renderer_get_swapchain(
         resources->physical_device,
         resources->device,
         resources->surface,
         resources->swapchain_image_format,
         resources->swapchain_extent,
-        resources->swapchain
+        resources->settings.present_mode,
+        resources->settings.swapchain_image_count,
+        retired->swapchain
     );
 
+    uint32_t old_image_count = resources->image_count;
     resources->image_count = renderer_get_swapchain_image_count(
         resources->device,
         resources->swapchain
     );
 
+    resources->swapchain_buffers = malloc(
+        resources->image_count * sizeof(*resources->swapchain_buffers)
+    );
+    assert(resources->swapchain_buffers);
+
     renderer_create_swapchain_buffers(
         resources->device,
         resources->command_pool,
@@ -2372,76 +3777,297 @@ void renderer_resize(
         resources->image_count
     );
 
-    resources->depth_image = renderer_get_image(
-        resources->physical_device,
-        resources->device,
+    // No layout transition needed, the render pass starts the depth
+    // attachment from VK_IMAGE_LAYOUT_UNDEFINED
+    renderer_create_attachment_images(resources);
+
+    resources->framebuffers = malloc(
+        resources->image_count * sizeof(*resources->framebuffers)
+    );
+    assert(resources->framebuffers);
+
+	renderer_create_framebuffers(
+		resources->device,
+        resources->render_pass,
         resources->swapchain_extent,
-        resources->depth_format,
-        VK_IMAGE_ASPECT_DEPTH_BIT,
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        resources->swapchain_buffers,
+        resources->depth_image.image_view,
+        resources->color_image.image_view,
+        resources->framebuffers,
+        resources->image_count
     );
 
-    renderer_set_depth_image_layout(
+    if (resources->occlusion)
+        renderer_occlusion_resize(resources->occlusion, resources);
+
+    // Keep the fences of the old images, drawables record their cmds per
+    // image index and must not be re-recorded while an old frame uses them
+    resources->images_in_flight = realloc(
+        resources->images_in_flight,
+        resources->image_count * sizeof(*resources->images_in_flight)
+    );
+    assert(resources->images_in_flight);
+    for (uint32_t i = old_image_count; i < resources->image_count; i++)
+        resources->images_in_flight[i] = VK_NULL_HANDLE;
+
+    resources->framebuffer_generation++;
+    resources->swapchain_dirty = false;
+
+    cpu_profiler_end(&scope);
+}
+
+/* Headless counterpart of renderer_recreate_swapchain. Resizing offscreen
+ * targets is rare (there is no window to drag), so this simply waits for the
+ * frames in flight instead of retiring the old targets */
+void renderer_recreate_offscreen_targets(
+        struct renderer_resources* resources)
+{
+    struct cpu_profiler_scope scope = cpu_profiler_begin("recreate targets");
+
+    VkFence fences[MAX_FRAMES_IN_FLIGHT];
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        fences[i] = resources->frames[i].in_flight;
+
+    VkResult result;
+    result = vkWaitForFences(
+        resources->device,
+        MAX_FRAMES_IN_FLIGHT,
+        fences,
+        VK_TRUE,
+        UINT64_MAX
+    );
+    assert(result == VK_SUCCESS);
+
+    for (uint32_t i = 0; i < resources->image_count; i++) {
+        vkDestroyFramebuffer(
+            resources->device,
+            resources->framebuffers[i],
+            NULL
+        );
+    }
+
+    renderer_destroy_image(resources->device, &resources->depth_image);
+    renderer_destroy_image(resources->device, &resources->color_image);
+
+    renderer_destroy_offscreen_buffers(
         resources->device,
-        resources->graphics_queue,
         resources->command_pool,
-        resources->depth_image.image,
-        resources->depth_format
+        resources->swapchain_buffers,
+        resources->offscreen_images,
+        resources->readback_buffers,
+        resources->image_count
     );
 
-	resources->render_pass = renderer_get_render_pass(
+    resources->swapchain_extent.width = resources->window_width;
+    resources->swapchain_extent.height = resources->window_height;
+
+    renderer_create_offscreen_buffers(
+        resources->physical_device,
+        resources->device,
+        resources->command_pool,
+        resources->swapchain_image_format,
+        resources->swapchain_extent,
+        resources->swapchain_buffers,
+        resources->offscreen_images,
+        resources->readback_buffers,
+        resources->image_count
+    );
+
+    renderer_create_attachment_images(resources);
+
+	renderer_create_framebuffers(
 		resources->device,
-		resources->swapchain_image_format.format,
-        resources->depth_format
-	);
+        resources->render_pass,
+        resources->swapchain_extent,
+        resources->swapchain_buffers,
+        resources->depth_image.image_view,
+        resources->color_image.image_view,
+        resources->framebuffers,
+        resources->image_count
+    );
 
-    resources->pipeline_layout = renderer_get_pipeline_layout(
+    if (resources->occlusion)
+        renderer_occlusion_resize(resources->occlusion, resources);
+
+    resources->framebuffer_generation++;
+    resources->swapchain_dirty = false;
+
+    cpu_profiler_end(&scope);
+}
+
+/* Returns the pixels (R8G8B8A8, tightly packed) of the most recently drawn
+ * headless frame, waiting for it to finish rendering if needed. The pointer
+ * stays valid until the next call to renderer_draw_frame */
+const void* renderer_get_frame_pixels(
+        struct renderer_resources* resources,
+        uint32_t* width,
+        uint32_t* height)
+{
+    if (!resources->settings.headless || resources->frame_count == 0)
+        return NULL;
+
+    uint32_t last_frame = (resources->current_frame + MAX_FRAMES_IN_FLIGHT - 1)
+        % MAX_FRAMES_IN_FLIGHT;
+
+    VkResult result;
+    result = vkWaitForFences(
         resources->device,
-        &resources->descriptor_layout,
         1,
-        NULL,
-        0
+        &resources->frames[last_frame].in_flight,
+        VK_TRUE,
+        UINT64_MAX
     );
+    assert(result == VK_SUCCESS);
+
+    *width = resources->swapchain_extent.width;
+    *height = resources->swapchain_extent.height;
+
+    return resources->readback_buffers[last_frame].mapped;
+}
+
+void renderer_destroy_retired_swapchain(
+        VkDevice device,
+        VkCommandPool command_pool,
+        struct renderer_retired_swapchain* retired)
+{
+    for (uint32_t i = 0; i < retired->image_count; i++) {
+        vkDestroyFramebuffer(device, retired->framebuffers[i], NULL);
+    }
+    free(retired->framebuffers);
+
+    renderer_destroy_image(device, &retired->depth_image);
+    renderer_destroy_image(device, &retired->color_image);
+
+    for (uint32_t i = 0; i < retired->image_count; i++) {
+        vkDestroyImageView(
+            device,
+            retired->swapchain_buffers[i].image_view,
+            NULL
+        );
+        vkFreeCommandBuffers(
+            device,
+            command_pool,
+            1,
+            &retired->swapchain_buffers[i].cmd
+        );
+    }
+    free(retired->swapchain_buffers);
+
+    vkDestroySwapchainKHR(device, retired->swapchain, NULL);
+}
+
+/* Destroys swapchains whose frames have all completed. Frame N waits on the
+ * fence of frame N - MAX_FRAMES_IN_FLIGHT, so once MAX_FRAMES_IN_FLIGHT frames
+ * were submitted after retirement nothing can reference the old objects. With
+ * wait set, the frames in flight are waited on and everything is destroyed */
+void renderer_destroy_retired_swapchains(
+        struct renderer_resources* resources,
+        bool wait)
+{
+    if (resources->retired_swapchain_count == 0)
+        return;
 
-    resources->graphics_pipeline = renderer_get_graphics_pipeline(
-        resources->device,
-        resources->swapchain_extent,
-        resources->pipeline_layout,
-        resources->render_pass,
-        0
-    );
+    if (wait) {
+        VkFence fences[MAX_FRAMES_IN_FLIGHT];
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            fences[i] = resources->frames[i].in_flight;
 
-	renderer_create_framebuffers(
-		resources->device,
-        resources->render_pass,
-        resources->swapchain_extent,
-        resources->swapchain_buffers,
-        resources->depth_image.image_view,
-        resources->framebuffers,
-        resources->image_count
-    );
+        VkResult result;
+        result = vkWaitForFences(
+            resources->device,
+            MAX_FRAMES_IN_FLIGHT,
+            fences,
+            VK_TRUE,
+            UINT64_MAX
+        );
+        assert(result == VK_SUCCESS);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < resources->retired_swapchain_count; i++) {
+        struct renderer_retired_swapchain* retired;
+        retired = &resources->retired_swapchains[i];
+
+        if (wait || resources->frame_count >=
+                retired->retired_frame + MAX_FRAMES_IN_FLIGHT) {
+            renderer_destroy_retired_swapchain(
+                resources->device,
+                resources->command_pool,
+                retired
+            );
+        } else {
+            resources->retired_swapchains[kept++] = *retired;
+        }
+    }
+    resources->retired_swapchain_count = kept;
 }
 
 void renderer_destroy_resources(
         struct renderer_resources* resources)
 {
-    renderer_destroy_meshes(resources);
+    // Shutdown is the one place a full idle is fine
+    vkDeviceWaitIdle(resources->device);
 
-    queue_destroy(&resources->drawable_queue);
+    if (resources->gpu_profiler) {
+        renderer_gpu_profiler_destroy(resources->gpu_profiler);
+        free(resources->gpu_profiler);
+    }
 
-    vkDestroyImage(resources->device, resources->tex_image.image, NULL);
-    vkDestroyImageView(
-        resources->device,
-        resources->tex_image.image_view,
-        NULL
-    );
-    vkDestroySampler(resources->device, resources->tex_image.sampler, NULL);
-    vkFreeMemory(resources->device, resources->tex_image.memory, NULL);
+    if (resources->pipeline_stats) {
+        renderer_pipeline_stats_destroy(resources->pipeline_stats);
+        free(resources->pipeline_stats);
+    }
 
-    vkDestroySemaphore(resources->device, resources->image_available, NULL);
-    vkDestroySemaphore(resources->device, resources->render_finished, NULL);
+    if (resources->occlusion) {
+        renderer_occlusion_destroy(resources->occlusion);
+        free(resources->occlusion);
+    }
+
+    renderer_scene_destroy(resources->scene);
+    free(resources->scene);
+
+    for (uint32_t i = 0; i < MAX_FRAMEBUFFERS; i++)
+        free(resources->primary_records[i].draws);
+
+    // Frees the drawables' cmds along with them
+    for (uint32_t i = 0; i < resources->record_pool_count; i++) {
+        vkDestroyCommandPool(
+            resources->device,
+            resources->record_pools[i],
+            NULL
+        );
+    }
+
+    // Waits for the texture reads still running on jobs
+    renderer_registry_destroy(resources);
+
+    if (resources->jobs) {
+        job_system_destroy(resources->jobs);
+        free(resources->jobs);
+    }
+
+    renderer_destroy_retired_swapchains(resources, true);
+
+    queue_destroy(&resources->drawable_queue);
+    transform_store_destroy(&resources->transforms);
+    free(resources->transform_drawables);
+    bvh_destroy(&resources->bvh);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroySemaphore(
+            resources->device,
+            resources->frames[i].image_available,
+            NULL
+        );
+        vkDestroySemaphore(
+            resources->device,
+            resources->frames[i].render_finished,
+            NULL
+        );
+        vkDestroyFence(resources->device, resources->frames[i].in_flight, NULL);
+        arena_destroy(&resources->frame_arenas[i]);
+    }
+    free(resources->images_in_flight);
 
     for (uint32_t i = 0; i < resources->image_count; i++) {
         vkDestroyFramebuffer(
@@ -2450,12 +4076,7 @@ void renderer_destroy_resources(
             NULL
         );
     }
-
-    vkDestroyPipeline(
-        resources->device,
-        resources->graphics_pipeline,
-        NULL
-    );
+    free(resources->framebuffers);
 
     vkDestroyPipelineLayout(
         resources->device,
@@ -2465,6 +4086,10 @@ void renderer_destroy_resources(
 
     vkDestroyRenderPass(resources->device, resources->render_pass, NULL);
 
+    renderer_unmap_buffer(
+        resources->device,
+        &resources->dynamic_uniform_buffer
+    );
     renderer_destroy_buffer(
         resources->device,
         &resources->dynamic_uniform_buffer
@@ -2491,31 +4116,38 @@ void renderer_destroy_resources(
         NULL
     );
 
-    vkDestroyImage(resources->device, resources->depth_image.image, NULL);
-    vkDestroyImageView(
-        resources->device,
-        resources->depth_image.image_view,
-        NULL
-    );
-    vkFreeMemory(resources->device, resources->depth_image.memory, NULL);
+    renderer_destroy_image(resources->device, &resources->depth_image);
+    renderer_destroy_image(resources->device, &resources->color_image);
 
-    for (uint32_t i = 0; i < resources->image_count; i++) {
-        vkDestroyImageView(
-            resources->device,
-            resources->swapchain_buffers[i].image_view,
-            NULL
-        );
-        vkFreeCommandBuffers(
+    if (resources->settings.headless) {
+        renderer_destroy_offscreen_buffers(
             resources->device,
             resources->command_pool,
-            1,
-            &resources->swapchain_buffers[i].cmd
+            resources->swapchain_buffers,
+            resources->offscreen_images,
+            resources->readback_buffers,
+            resources->image_count
         );
+    } else {
+        for (uint32_t i = 0; i < resources->image_count; i++) {
+            vkDestroyImageView(
+                resources->device,
+                resources->swapchain_buffers[i].image_view,
+                NULL
+            );
+            vkFreeCommandBuffers(
+                resources->device,
+                resources->command_pool,
+                1,
+                &resources->swapchain_buffers[i].cmd
+            );
+        }
     }
     free(resources->swapchain_buffers);
 
     vkDestroyCommandPool(resources->device, resources->command_pool, NULL);
 
+    // Both are VK_NULL_HANDLE when headless, which destroy ignores
     vkDestroySwapchainKHR(resources->device, resources->swapchain, NULL);
 
     vkDestroyDevice(resources->device, NULL);
@@ -2536,102 +4168,248 @@ void renderer_destroy_resources(
     vkDestroyInstance(resources->instance, NULL);
 }
 
-/* Takes a list of model file paths and creates a single VBO and IBO and stores
- * a reference to the VBO and IBO in the resources.meshes array, as well as the
- * offset for that particular mesh */
+/* Takes a list of model file paths and creates a single VBO and IBO and
+ * registers a mesh for each model, holding the offset of that particular
+ * mesh, whose handles are written to handles */
 void renderer_generate_meshes(
         struct renderer_resources* resources,
         const char** models,
-        const uint32_t model_count)
+        const uint32_t model_count,
+        struct renderer_resource_handle* handles)
 {
-    uint32_t* vertex_offsets = malloc(model_count * sizeof(*vertex_offsets));
-    vertex_offsets[0] = 0;
-    uint32_t* index_offsets = malloc(model_count * sizeof(*index_offsets));
-    index_offsets[0] = 0;
+    struct cpu_profiler_scope scope = cpu_profiler_begin("generate meshes");
 
-    uint32_t* index_counts = malloc(model_count * sizeof(*index_counts));
-
-    uint32_t total_vertex_count = 0;
-    uint32_t total_index_count = 0;
+    struct renderer_mesh_data* meshes = malloc(model_count * sizeof(*meshes));
+    assert(meshes);
 
     for (uint32_t i = 0; i < model_count; i++) {
-        uint32_t vertex_count;
-        uint32_t index_count;
-
         renderer_get_model_vertex_count(
             models[i],
-            &vertex_count,
-            &index_count
+            &meshes[i].vertex_count,
+            &meshes[i].index_count
+        );
+
+        meshes[i].vertices = malloc(
+            meshes[i].vertex_count * sizeof(*meshes[i].vertices)
         );
+        assert(meshes[i].vertices);
+        meshes[i].indices = malloc(
+            meshes[i].index_count * sizeof(*meshes[i].indices)
+        );
+        assert(meshes[i].indices);
+
+        renderer_load_model(models[i], meshes[i].vertices, meshes[i].indices);
+    }
 
-        index_counts[i] = index_count;
+    renderer_upload_meshes(resources, meshes, model_count, handles);
 
-        if (i < model_count) {
-            vertex_offsets[i + 1] = vertex_offsets[i] + vertex_count;
-            index_offsets[i + 1] = index_offsets[i] + index_count;
-        }
+    for (uint32_t i = 0; i < model_count; i++) {
+        free(meshes[i].indices);
+        free(meshes[i].vertices);
+    }
+    free(meshes);
+
+    cpu_profiler_end(&scope);
+}
+
+/* All meshes share one vertex and one index buffer, so they are uploaded
+ * together, once. The data is copied and may be freed afterwards. The mesh
+ * handles are written to handles, in order */
+void renderer_upload_meshes(
+        struct renderer_resources* resources,
+        const struct renderer_mesh_data* meshes,
+        uint32_t mesh_count,
+        struct renderer_resource_handle* handles)
+{
+    struct renderer_registry* registry = &resources->registry;
+    assert(!renderer_registry_get_buffer(registry, resources->ibo));
+    assert(mesh_count > 0);
+
+    struct cpu_profiler_scope scope = cpu_profiler_begin("upload meshes");
 
-        total_vertex_count += vertex_count;
-        total_index_count += index_count;
+    uint32_t* first_vertices = malloc(mesh_count * sizeof(*first_vertices));
+    uint32_t* first_indices = malloc(mesh_count * sizeof(*first_indices));
+    assert(first_vertices && first_indices);
+
+    uint32_t total_vertex_count = 0;
+    uint32_t total_index_count = 0;
+
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        first_vertices[i] = total_vertex_count;
+        first_indices[i] = total_index_count;
+
+        total_vertex_count += meshes[i].vertex_count;
+        total_index_count += meshes[i].index_count;
     }
 
-    struct renderer_vertex* total_vertices;
-    total_vertices = malloc(total_vertex_count * sizeof(*total_vertices));
-    assert(total_vertices);
+    struct renderer_vertex_position* positions;
+    positions = malloc(total_vertex_count * sizeof(*positions));
+    assert(positions);
+
+    struct renderer_vertex_attributes* attributes;
+    attributes = malloc(total_vertex_count * sizeof(*attributes));
+    assert(attributes);
 
     uint32_t* total_indices;
     total_indices = malloc(total_index_count * sizeof(*total_indices));
     assert(total_indices);
 
-    for (uint32_t i = 0; i < model_count; i++) {
-        renderer_load_model(
-            models[i],
-            &total_vertices[vertex_offsets[i]],
-            &total_indices[index_offsets[i]]
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        uint32_t first_vertex = first_vertices[i];
+        for (uint32_t j = 0; j < meshes[i].vertex_count; j++) {
+            const struct renderer_vertex* vertex = &meshes[i].vertices[j];
+
+            positions[first_vertex + j].x = vertex->x;
+            positions[first_vertex + j].y = vertex->y;
+            positions[first_vertex + j].z = vertex->z;
+            attributes[first_vertex + j].u = vertex->u;
+            attributes[first_vertex + j].v = vertex->v;
+        }
+
+        memcpy(
+            &total_indices[first_indices[i]],
+            meshes[i].indices,
+            meshes[i].index_count * sizeof(*total_indices)
         );
     }
 
-    resources->vbo = renderer_get_vertex_buffer(
+    struct renderer_buffer position_vbo = renderer_get_vertex_buffer(
+        resources->physical_device,
+        resources->device,
+        resources->command_pool,
+        resources->graphics_queue,
+        positions,
+        total_vertex_count * sizeof(*positions),
+        resources->gpu_profiler
+    );
+
+    struct renderer_buffer vbo = renderer_get_vertex_buffer(
         resources->physical_device,
         resources->device,
         resources->command_pool,
         resources->graphics_queue,
-        total_vertices,
-        total_vertex_count
+        attributes,
+        total_vertex_count * sizeof(*attributes),
+        resources->gpu_profiler
     );
 
-    resources->ibo = renderer_get_index_buffer(
+    struct renderer_buffer ibo = renderer_get_index_buffer(
         resources->physical_device,
         resources->device,
         resources->command_pool,
         resources->graphics_queue,
         total_indices,
-        total_index_count
+        total_index_count,
+        resources->gpu_profiler
     );
 
-    for (uint32_t i = 0; i < model_count; i++) {
-        resources->meshes[i].vbo = &resources->vbo;
-        resources->meshes[i].vbo_offset = vertex_offsets[i];
-        resources->meshes[i].ibo = &resources->ibo;
-        resources->meshes[i].ibo_offset = index_offsets[i];
-        resources->meshes[i].index_count = index_counts[i];
+    resources->position_vbo = renderer_registry_add(
+        registry,
+        RENDERER_RESOURCE_BUFFER,
+        &position_vbo
+    );
+    resources->vbo = renderer_registry_add(
+        registry,
+        RENDERER_RESOURCE_BUFFER,
+        &vbo
+    );
+    resources->ibo = renderer_registry_add(
+        registry,
+        RENDERER_RESOURCE_BUFFER,
+        &ibo
+    );
+
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        struct renderer_mesh mesh = {
+            .position_vbo = resources->position_vbo,
+            .vbo = resources->vbo,
+            .vbo_offset = first_vertices[i],
+            .ibo = resources->ibo,
+            .ibo_offset = first_indices[i],
+            .index_count = meshes[i].index_count
+        };
+        renderer_get_mesh_bounds(&meshes[i], &mesh);
+
+        handles[i] = renderer_registry_add(
+            registry,
+            RENDERER_RESOURCE_MESH,
+            &mesh
+        );
     }
 
     free(total_indices);
-    free(total_vertices);
-    free(index_counts);
-    free(index_offsets);
-    free(vertex_offsets);
+    free(attributes);
+    free(positions);
+    free(first_indices);
+    free(first_vertices);
+
+    cpu_profiler_end(&scope);
+}
+
+// Sphere around the bounding box's center, loose but cheap to test
+void renderer_get_mesh_bounds(
+        const struct renderer_mesh_data* data,
+        struct renderer_mesh* mesh)
+{
+    float min[3] = {INFINITY, INFINITY, INFINITY};
+    float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    for (uint32_t i = 0; i < data->vertex_count; i++) {
+        const float* position = &data->vertices[i].x;
+        for (uint32_t j = 0; j < 3; j++) {
+            min[j] = MIN(min[j], position[j]);
+            max[j] = MAX(max[j], position[j]);
+        }
+    }
+
+    float radius_squared = 0.0f;
+    for (uint32_t j = 0; j < 3; j++)
+        mesh->center[j] = data->vertex_count ? (min[j] + max[j]) * 0.5f : 0.0f;
+
+    for (uint32_t i = 0; i < data->vertex_count; i++) {
+        const float* position = &data->vertices[i].x;
+        float distance_squared = 0.0f;
+        for (uint32_t j = 0; j < 3; j++) {
+            float d = position[j] - mesh->center[j];
+            distance_squared += d * d;
+        }
+        radius_squared = MAX(radius_squared, distance_squared);
+    }
+
+    mesh->radius = sqrtf(radius_squared);
 }
 
+/* Releases every mesh along with the shared buffers, drawables using them
+ * are skipped until given another mesh. The buffers are destroyed once the
+ * frames in flight are done with them */
 void renderer_destroy_meshes(
         struct renderer_resources* resources)
 {
-    vkDestroyBuffer(resources->device, resources->vbo.buffer, NULL);
-    vkFreeMemory(resources->device, resources->vbo.memory, NULL);
+    struct renderer_registry* registry = &resources->registry;
+
+    while (renderer_registry_count(registry, RENDERER_RESOURCE_MESH) > 0) {
+        renderer_registry_release(
+            resources,
+            RENDERER_RESOURCE_MESH,
+            renderer_registry_handle_at(registry, RENDERER_RESOURCE_MESH, 0)
+        );
+    }
 
-    vkDestroyBuffer(resources->device, resources->ibo.buffer, NULL);
-    vkFreeMemory(resources->device, resources->ibo.memory, NULL);
+    struct renderer_resource_handle* buffers[] = {
+        &resources->position_vbo,
+        &resources->vbo,
+        &resources->ibo
+    };
+    for (uint32_t i = 0; i < sizeof(buffers) / sizeof(*buffers); i++) {
+        if (renderer_registry_get_buffer(registry, *buffers[i])) {
+            renderer_registry_release(
+                resources,
+                RENDERER_RESOURCE_BUFFER,
+                *buffers[i]
+            );
+        }
+        *buffers[i] = (struct renderer_resource_handle){0};
+    }
 }
 
 void renderer_get_model_vertex_count(
@@ -2688,42 +4466,370 @@ void renderer_load_model(
     aiReleaseImport(scene);
 }
 
+/* Moves the drawable's transform, relative to its parent, and queues it for
+ * the next frame. A drawable that has not moved costs no matrix work */
 void renderer_draw(
         struct renderer_resources *resources,
         struct renderer_drawable *drawable,
         float x, float y, float z)
 {
+    transform_set_position(
+        &resources->transforms,
+        drawable->matrix_index,
+        x, y, z
+    );
+
+    struct renderer_draw_command draw_cmd = {
+        .drawable = drawable
+    };
+    queue_enqueue(&resources->drawable_queue, &draw_cmd);
+}
+
+/* A transform that is not drawn itself, for grouping drawables under with
+ * transform_set_parent. Takes a matrix slot like a drawable */
+uint32_t renderer_create_transform(
+        struct renderer_resources *resources,
+        uint32_t parent)
+{
+    return transform_create(&resources->transforms, parent);
+}
+
+/* Moves the BVH bounds of the drawables whose transforms the last
+ * transform_store_update recomputed, so still drawables cost nothing */
+void renderer_update_drawable_bounds(
+        struct renderer_resources *resources)
+{
+    struct transform_store* transforms = &resources->transforms;
+
+    for (uint32_t i = 0; i < transforms->updated_count; i++) {
+        uint32_t transform = transforms->updated_list[i];
+        struct renderer_drawable* drawable =
+            resources->transform_drawables[transform];
+        if (!drawable)
+            continue;
+
+        float sphere[4];
+        renderer_get_drawable_sphere(resources, drawable, sphere);
+
+        float min[3], max[3];
+        for (int j = 0; j < 3; j++) {
+            min[j] = sphere[j] - sphere[3];
+            max[j] = sphere[j] + sphere[3];
+        }
+        bvh_move(&resources->bvh, drawable->bvh_proxy, min, max);
+    }
+}
+
+static void renderer_cull_visit(
+        void* data,
+        void* user)
+{
+    struct renderer_resources* resources = user;
+    struct renderer_drawable* drawable = data;
+
+    if (drawable->retained) {
+        renderer_scene_cull_visit(
+            resources->scene,
+            drawable,
+            resources->cull_frame
+        );
+        return;
+    }
+
+    if (drawable->cull_frame != resources->cull_frame)
+        return;
+
     struct renderer_draw_command draw_cmd = {
-        .drawable = drawable,
-        .x = x,
-        .y = y,
-        .z = z
+        .drawable = drawable
     };
     queue_enqueue(&resources->drawable_queue, &draw_cmd);
 }
 
+/* Keeps only the queued draws whose bounds are in the view, and hands the
+ * retained objects in view to the scene. The drawables in view are found in
+ * the BVH, then those that were queued are queued again, so testing bounds
+ * costs about as much as the drawables in view however many there are
+ * outside it */
+void renderer_frustum_cull(
+        struct renderer_resources *resources)
+{
+    resources->cull_frame++;
+
+    while (!queue_empty(&resources->drawable_queue)) {
+        struct renderer_draw_command draw_cmd;
+        queue_dequeue(&resources->drawable_queue, &draw_cmd);
+        draw_cmd.drawable->cull_frame = resources->cull_frame;
+    }
+
+    renderer_scene_begin_cull(resources->scene);
+
+    float planes[6][4];
+    bvh_extract_planes(planes, resources->view_proj_matrix);
+    bvh_query_frustum(
+        &resources->bvh,
+        planes,
+        renderer_cull_visit,
+        resources
+    );
+}
+
+// Against the drawable's bounding sphere, direction is normalized
+static float renderer_pick_hit(
+        void* data,
+        const float origin[3],
+        const float direction[3],
+        void* user)
+{
+    struct renderer_resources* resources = user;
+    struct renderer_drawable* drawable = data;
+
+    float sphere[4];
+    renderer_get_drawable_sphere(resources, drawable, sphere);
+
+    float offset[3], b = 0.0f, c = -sphere[3] * sphere[3];
+    for (int i = 0; i < 3; i++) {
+        offset[i] = origin[i] - sphere[i];
+        b += offset[i] * direction[i];
+        c += offset[i] * offset[i];
+    }
+
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f)
+        return -1.0f;
+
+    // From inside the sphere the hit is at the origin
+    return MAX(-b - sqrtf(discriminant), 0.0f);
+}
+
+/* Nearest drawable whose bounding sphere the ray hits, as of the last frame
+ * drawn, or NULL. direction must be normalized */
+struct renderer_drawable* renderer_pick_drawable(
+        struct renderer_resources *resources,
+        vec3 origin,
+        vec3 direction)
+{
+    return bvh_ray_cast(
+        &resources->bvh,
+        origin,
+        direction,
+        INFINITY,
+        renderer_pick_hit,
+        resources,
+        NULL
+    );
+}
+
 void renderer_create_drawable(
         struct renderer_resources *resources,
         const char *model_src,
         const char *texture_src,
         struct renderer_drawable *drawable)
 {
-    drawable->mesh = &resources->meshes[0];
-    drawable->texture = NULL; // not using per object textures right now
+    // Not using per object models or textures here
+    renderer_init_drawable(
+        resources,
+        renderer_registry_handle_at(
+            &resources->registry,
+            RENDERER_RESOURCE_MESH,
+            0
+        ),
+        (struct renderer_resource_handle){0},
+        drawable
+    );
+}
+
+/* Changing what a drawable draws bumps its generation, so each image's cmds
+ * for it are recorded again on their next use. Its bounds follow the mesh */
+void renderer_set_drawable_mesh(
+        struct renderer_resources *resources,
+        struct renderer_drawable *drawable,
+        struct renderer_resource_handle mesh)
+{
+    if (renderer_resource_handle_equal(drawable->mesh, mesh))
+        return;
+
+    drawable->mesh = mesh;
+    drawable->generation++;
+    if (drawable->retained)
+        resources->scene->membership_changed = true;
+
+    float sphere[4];
+    renderer_get_drawable_sphere(resources, drawable, sphere);
+
+    float min[3], max[3];
+    for (int i = 0; i < 3; i++) {
+        min[i] = sphere[i] - sphere[3];
+        max[i] = sphere[i] + sphere[3];
+    }
+    bvh_move(&resources->bvh, drawable->bvh_proxy, min, max);
+}
+
+// A null texture handle draws with the default texture
+void renderer_set_drawable_texture(
+        struct renderer_resources *resources,
+        struct renderer_drawable *drawable,
+        struct renderer_resource_handle texture)
+{
+    if (renderer_resource_handle_equal(drawable->texture, texture))
+        return;
+
+    drawable->texture = texture;
+    drawable->generation++;
+    if (drawable->retained)
+        resources->scene->membership_changed = true;
+}
+
+/* World space bounding sphere of the drawable's mesh, a point at its
+ * position if the mesh has been released */
+void renderer_get_drawable_sphere(
+        struct renderer_resources *resources,
+        struct renderer_drawable *drawable,
+        float sphere[4])
+{
+    const struct renderer_mesh* mesh = renderer_registry_get_mesh(
+        &resources->registry,
+        drawable->mesh
+    );
+    const float origin[3] = {0.0f, 0.0f, 0.0f};
+
+    transform_get_sphere(
+        &resources->transforms,
+        drawable->matrix_index,
+        mesh ? mesh->center : origin,
+        mesh ? mesh->radius : 0.0f,
+        sphere
+    );
+}
+
+// Both vertex streams at binding 0 and 1, offsets come with the draw
+void renderer_bind_mesh_buffers(
+        const struct renderer_registry* registry,
+        VkCommandBuffer cmd,
+        const struct renderer_mesh* mesh)
+{
+    const struct renderer_buffer* position_vbo = renderer_registry_get_buffer(
+        registry,
+        mesh->position_vbo
+    );
+    const struct renderer_buffer* vbo = renderer_registry_get_buffer(
+        registry,
+        mesh->vbo
+    );
+    const struct renderer_buffer* ibo = renderer_registry_get_buffer(
+        registry,
+        mesh->ibo
+    );
+    assert(position_vbo && vbo && ibo);
+
+    VkBuffer vertex_buffers[] = {position_vbo->buffer, vbo->buffer};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(
+        cmd,
+        0,
+        2,
+        vertex_buffers,
+        offsets
+    );
+
+    vkCmdBindIndexBuffer(
+        cmd,
+        ibo->buffer,
+        0,
+        VK_INDEX_TYPE_UINT32
+    );
+}
+
+/* Gives the drawable a transform at the origin, with the matrix slots that
+ * go with it, and bounds in the BVH */
+void renderer_register_drawable(
+        struct renderer_resources *resources,
+        struct renderer_drawable *drawable)
+{
+    drawable->matrix_index = transform_create(
+        &resources->transforms,
+        TRANSFORM_NONE
+    );
+    resources->transform_drawables[drawable->matrix_index] = drawable;
+
+    const struct renderer_mesh* mesh = renderer_registry_get_mesh(
+        &resources->registry,
+        drawable->mesh
+    );
+
+    // At the origin until its transform is first updated
+    float min[3] = {0.0f, 0.0f, 0.0f}, max[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; mesh && i < 3; i++) {
+        min[i] = mesh->center[i] - mesh->radius;
+        max[i] = mesh->center[i] + mesh->radius;
+    }
+    drawable->bvh_proxy = bvh_insert(&resources->bvh, min, max, drawable);
+    drawable->cull_frame = 0;
+}
+
+/* A drawable owns one model matrix slot per swapchain image, so it can only
+ * be drawn once per frame. A null texture handle draws with the default */
+void renderer_init_drawable(
+        struct renderer_resources *resources,
+        struct renderer_resource_handle mesh,
+        struct renderer_resource_handle texture,
+        struct renderer_drawable *drawable)
+{
+    drawable->mesh = mesh;
+    drawable->texture = texture;
+
+    VkCommandPool command_pool = resources->command_pool;
+    drawable->record_pool = 0;
+    drawable->record_pending = false;
+    if (resources->record_pool_count > 0) {
+        drawable->record_pool = resources->next_record_pool++ %
+            resources->record_pool_count;
+        command_pool = resources->record_pools[drawable->record_pool];
+    }
 
     VkCommandBufferAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .pNext = NULL,
-        .commandPool = resources->command_pool,
+        .commandPool = command_pool,
         .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
         .commandBufferCount = MAX_FRAMEBUFFERS
     };
     vkAllocateCommandBuffers(resources->device, &alloc_info, drawable->cmd);
+    VkPipeline depth_pipeline = renderer_registry_get_pipeline(
+        &resources->registry,
+        resources->depth_pipeline
+    );
+    if (depth_pipeline != VK_NULL_HANDLE) {
+        vkAllocateCommandBuffers(
+            resources->device,
+            &alloc_info,
+            drawable->depth_cmd
+        );
+    }
 
-    drawable->descriptor_set = VK_NULL_HANDLE; // same reason as above
-    drawable->matrix_index = 9;
+    drawable->retained = false;
+    renderer_register_drawable(resources, drawable);
 
+    // Generation 0 is never recorded
+    drawable->generation = 1;
     for (int i = 0; i < MAX_FRAMEBUFFERS; i++) {
-        drawable->updated[i] = true;
+        drawable->recorded_generation[i] = 0;
+        drawable->framebuffer_generation[i] =
+            resources->framebuffer_generation;
     }
 }
+
+// Shares the uniform buffers of the default set, only the texture differs
+VkDescriptorSet renderer_get_texture_descriptor_set(
+        struct renderer_resources *resources,
+        struct renderer_image *texture)
+{
+    return renderer_get_descriptor_set(
+        resources->device,
+        resources->descriptor_pool,
+        &resources->descriptor_layout,
+        1,
+        &resources->view_projection_uniform_buffer,
+        &resources->dynamic_uniform_buffer,
+        texture
+    );
+}
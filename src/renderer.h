@@ -6,6 +6,11 @@
 
 #include "linmath.h"
 #include "queue.h"
+#include "transform.h"
+#include "bvh.h"
+#include "job.h"
+#include "arena.h"
+#include "renderer_registry.h"
 
 #include <stdbool.h>
 
@@ -16,7 +21,9 @@
 #define APP_VERSION_MINOR 0
 #define APP_VERSION_PATCH 0
 
-#define MAX_FRAMEBUFFERS 3
+#define MAX_FRAMEBUFFERS 4
+#define MAX_FRAMES_IN_FLIGHT 2
+#define MAX_RETIRED_SWAPCHAINS 4
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
@@ -30,18 +37,77 @@
 // - Update uniform buffer on resize while paused
 // - Remove glfwGetWindowSize for swapchain image size
 
+// Chosen per deployment, see renderer_default_settings
+struct renderer_settings
+{
+    VkPresentModeKHR present_mode; // Falls back to FIFO when unsupported
+    uint32_t swapchain_image_count; // 0 uses minImageCount + 1
+
+    // Render to offscreen images without a window, surface or swapchain
+    bool headless;
+    uint32_t headless_width, headless_height;
+
+    bool profile_gpu; // Timestamp queries around passes and uploads
+    bool pipeline_stats; // Pipeline statistics and occlusion queries
+    bool occlusion_culling; // Two pass culling against a depth pyramid
+    bool depth_prepass; // Depth only subpass before shading, not with culling
+    bool frustum_culling; // Drop queued draws outside the view on the CPU
+    uint32_t job_threads; // Record and upload on this many, 0 or 1 uses none
+    uint32_t msaa_samples; // 1 disables MSAA, clamped to what the device has
+
+    uint32_t max_drawables; // Drawables that can be created and drawn
+    uint32_t max_textures; // Per drawable texture descriptor sets
+};
+
+struct renderer_frame_stats
+{
+    double input_time; // When the input used for the frame was sampled
+    // Seconds from input_time until vkQueuePresentKHR returned. The time the
+    // presentation engine and compositor take to show the image is not in it
+    double input_to_queue_present;
+    double cpu_time; // Seconds spent in renderer_draw_frame
+    uint32_t draw_count; // Draws recorded into the last frame
+    uint64_t triangle_count; // Triangles those draws submitted
+    uint32_t cmds_recorded; // Secondary cmds recorded for the last frame
+    uint32_t cmds_reused; // Secondary cmds executed as previously recorded
+    bool primary_reused; // Submitted the image's primary cmd as it was
+    uint32_t arena_blocks_allocated; // During renderer_draw_frame
+};
+
 struct camera
 {
     float x, y, z;
     float pitch, yaw;
 };
 
+// Vertex as loaded or generated, split into two streams when uploaded
 struct renderer_vertex
 {
     float x, y, z;
     float u, v;
 };
 
+// The streams on the GPU. Positions are kept apart so depth only passes
+// fetch 12 bytes per vertex rather than the whole vertex
+struct renderer_vertex_position
+{
+    float x, y, z;
+};
+
+struct renderer_vertex_attributes
+{
+    float u, v;
+};
+
+// Geometry for one mesh held in memory, e.g. generated procedurally
+struct renderer_mesh_data
+{
+    struct renderer_vertex* vertices;
+    uint32_t vertex_count;
+    uint32_t* indices;
+    uint32_t index_count;
+};
+
 struct renderer_swapchain_buffer
 {
     VkImage image;
@@ -49,30 +115,76 @@ struct renderer_swapchain_buffer
     VkCommandBuffer cmd;
 };
 
+// Synchronization for one frame being recorded while others are in flight
+struct renderer_frame
+{
+    VkSemaphore image_available;
+    VkSemaphore render_finished;
+    VkFence in_flight;
+};
+
+// Swapchain objects replaced by a recreation, kept alive until the frames
+// that may still reference them have retired
+struct renderer_retired_swapchain
+{
+    VkSwapchainKHR swapchain;
+    uint32_t image_count;
+    struct renderer_swapchain_buffer* swapchain_buffers;
+    VkFramebuffer* framebuffers;
+    struct renderer_image depth_image;
+    struct renderer_image color_image;
+    uint64_t retired_frame; // Value of frame_count when retired
+};
+
+// What an image's primary cmd was last recorded with, so an identical frame
+// can submit it again
+struct renderer_primary_record
+{
+    bool valid; // Recorded without per frame work, see renderer_frame_reusable
+    uint32_t framebuffer_generation;
+    uint32_t scene_generation; // Of the scene's draw list
+    struct renderer_drawable** draws; // The queued drawables, in order
+    uint32_t draw_count;
+    struct renderer_frame_stats stats; // As recorded
+};
+
 struct renderer_draw_command
 {
     struct renderer_drawable *drawable;
-    float x, y, z;
 };
 
 struct renderer_drawable
 {
-    struct renderer_mesh *mesh;
-    struct renderer_image *texture;
+    struct renderer_resource_handle mesh; // Not drawn while it doesn't resolve
+    struct renderer_resource_handle texture; // The default until it resolves
     VkCommandBuffer cmd[MAX_FRAMEBUFFERS];
-    VkDescriptorSet descriptor_set;
-    int matrix_index; // Index into uniform buffer for transformation matrix
-    bool updated[MAX_FRAMEBUFFERS]; // This drawable cmd must be updated
+    VkCommandBuffer depth_cmd[MAX_FRAMEBUFFERS]; // Only with a depth pre-pass
+    uint32_t matrix_index; // Its transform, and its matrix in the uniform buffer
+    uint32_t generation; // Bumped when what it draws with changes
+    uint32_t recorded_generation[MAX_FRAMEBUFFERS]; // Of the drawable, in cmd
+    uint32_t framebuffer_generation[MAX_FRAMEBUFFERS]; // When cmd recorded
+    uint32_t bvh_proxy; // Its world bounds in the scene's BVH
+    uint32_t cull_frame; // Last frustum cull it was queued for
+    bool retained; // Part of the retained scene, drawn without being queued
+    uint32_t record_pool; // Index into record_pools, which its cmds came from
+    bool record_pending; // Stale cmds, recorded by its pool's job this frame
 };
 
 struct renderer_resources
 {
     GLFWwindow* window;
 
+    struct renderer_settings settings;
+    struct renderer_frame_stats frame_stats;
+
     struct camera camera;
 
-    struct renderer_mesh* meshes;
+    struct renderer_registry registry; // Meshes, textures, buffers, pipelines
     struct queue drawable_queue;
+    struct transform_store transforms; // One per matrix slot
+    struct renderer_drawable** transform_drawables; // NULL for group nodes
+    struct bvh bvh; // World bounds of every drawable, drawn or not
+    uint32_t cull_frame;
 
     VkInstance instance;
 
@@ -97,23 +209,46 @@ struct renderer_resources
     VkSwapchainKHR swapchain;
     uint32_t image_count;
     struct renderer_swapchain_buffer* swapchain_buffers;
+    struct renderer_primary_record primary_records[MAX_FRAMEBUFFERS];
     VkSurfaceFormatKHR swapchain_image_format;
     VkExtent2D swapchain_extent;
+    bool swapchain_dirty; // Recreate before the next acquire
+    uint32_t window_width, window_height; // Latest size from resize
+    struct renderer_retired_swapchain retired_swapchains[MAX_RETIRED_SWAPCHAINS];
+    uint32_t retired_swapchain_count;
+
+    // Headless render targets standing in for the swapchain images, each
+    // copied into a host visible buffer at the end of its frame
+    struct renderer_image offscreen_images[MAX_FRAMES_IN_FLIGHT];
+    struct renderer_buffer readback_buffers[MAX_FRAMES_IN_FLIGHT];
 
     VkFormat depth_format;
+    VkImageUsageFlags depth_usage; // Sampled for occlusion culling or transient
+    VkSampleCountFlagBits samples; // Of the color and depth attachments
     struct renderer_image depth_image;
+    struct renderer_image color_image; // Multisampled, unused without MSAA
 
     VkCommandPool command_pool;
 
+    // With jobs, drawables' cmds come from one pool per thread, handed out in
+    // turn. A job records all the stale cmds of one pool, so no pool is used
+    // by two threads at once
+    struct job_system* jobs; // NULL unless job_threads > 1
+    VkCommandPool record_pools[JOB_MAX_THREADS];
+    uint32_t record_pool_count; // 0 without jobs, cmds use command_pool
+    uint32_t next_record_pool;
+
     VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_layout;
     VkDescriptorSet descriptor_set;
 
-    struct renderer_image tex_image;
+    struct renderer_resource_handle default_texture; // Bound by descriptor_set
 
+    // One model matrix per drawable for each swapchain image, persistently
+    // mapped and written as the drawables are recorded
     struct renderer_buffer dynamic_uniform_buffer;
-    struct renderer_buffer view_projection_uniform_buffer;
-    mat4x4 model_matrix;
+    size_t matrix_alignment; // Stride between model matrices
+    struct renderer_buffer view_projection_uniform_buffer; // Per image
     mat4x4 view_matrix;
     mat4x4 projection_matrix;
     mat4x4 view_proj_matrix; // Computed before being passed to shader
@@ -121,24 +256,45 @@ struct renderer_resources
     VkRenderPass render_pass;
 
     VkPipelineLayout pipeline_layout;
-    VkPipeline graphics_pipeline;
+    struct renderer_resource_handle graphics_pipeline;
+    struct renderer_resource_handle depth_pipeline; // Null without a pre-pass
 
     VkFramebuffer* framebuffers;
+    uint32_t framebuffer_generation; // Incremented when framebuffers rebuilt
 
-    struct renderer_buffer vbo;
-    struct renderer_buffer ibo;
+    // Shared by the meshes, null until renderer_upload_meshes
+    struct renderer_resource_handle position_vbo;
+    struct renderer_resource_handle vbo; // Attributes other than position
+    struct renderer_resource_handle ibo;
     uint32_t index_count;
 
-    VkSemaphore image_available;
-    VkSemaphore render_finished;
+    struct renderer_frame frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t current_frame; // Index into frames
+    // Lists built while drawing a frame, reset once its fence has signalled
+    struct arena frame_arenas[MAX_FRAMES_IN_FLIGHT];
+    uint64_t frame_count; // Frames submitted so far
+    VkFence* images_in_flight; // Fence of the frame using each image
+
+    struct renderer_capture* capture; // Optional, owned by the caller
+    struct renderer_gpu_profiler* gpu_profiler; // NULL unless profile_gpu
+    struct renderer_pipeline_stats* pipeline_stats; // NULL if unsupported
+    struct renderer_occlusion* occlusion; // NULL unless occlusion_culling
+    struct renderer_scene* scene; // Retained objects
 };
 
+void renderer_default_settings(
+    struct renderer_settings* settings
+);
+
 void renderer_initialize_resources(
     struct renderer_resources* resources,
-    GLFWwindow* window
+    GLFWwindow* window,
+    const struct renderer_settings* settings
 );
 
-VkInstance renderer_get_instance();
+VkInstance renderer_get_instance(
+    bool headless
+);
 
 VkDebugReportCallbackEXT renderer_get_debug_callback_ext(
     VkInstance instance
@@ -202,6 +358,8 @@ VkSwapchainKHR renderer_get_swapchain(
 	VkSurfaceKHR surface,
 	VkSurfaceFormatKHR image_format,
 	VkExtent2D swapchain_extent,
+	VkPresentModeKHR requested_present_mode,
+	uint32_t requested_image_count,
 	VkSwapchainKHR old_swapchain
 );
 
@@ -224,22 +382,45 @@ void renderer_create_swapchain_buffers(
     uint32_t swapchain_image_count
 );
 
+void renderer_create_offscreen_buffers(
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    VkCommandPool command_pool,
+    VkSurfaceFormatKHR image_format,
+    VkExtent2D extent,
+    struct renderer_swapchain_buffer* swapchain_buffers,
+    struct renderer_image* offscreen_images,
+    struct renderer_buffer* readback_buffers,
+    uint32_t image_count
+);
+
+void renderer_destroy_offscreen_buffers(
+    VkDevice device,
+    VkCommandPool command_pool,
+    struct renderer_swapchain_buffer* swapchain_buffers,
+    struct renderer_image* offscreen_images,
+    struct renderer_buffer* readback_buffers,
+    uint32_t image_count
+);
+
 VkFormat renderer_get_depth_format(
     VkPhysicalDevice physical_device,
     VkImageTiling tiling,
     VkFormatFeatureFlags features
 );
 
-void renderer_set_depth_image_layout(
-    VkDevice device,
-    VkQueue graphics_queue,
-    VkCommandPool command_pool,
-    VkImage depth_image,
-    VkFormat depth_format
+VkSampleCountFlagBits renderer_get_sample_count(
+    VkPhysicalDevice physical_device,
+    uint32_t requested_samples
+);
+
+void renderer_create_attachment_images(
+    struct renderer_resources* resources
 );
 
 VkDescriptorPool renderer_get_descriptor_pool(
-    VkDevice device
+    VkDevice device,
+    uint32_t max_sets
 );
 
 VkDescriptorSetLayout renderer_get_descriptor_layout(
@@ -256,15 +437,10 @@ VkDescriptorSet renderer_get_descriptor_set(
     struct renderer_image *tex_image
 );
 
-void renderer_update_dynamic_uniform_buffer(
-    VkDevice device,
-    struct renderer_buffer* uniform_buffer_instance,
-    mat4x4 model_matrix
-);
-
 void renderer_update_view_projection_uniform_buffer(
     VkExtent2D swapchain_extent,
     struct renderer_buffer* uniform_buffer,
+    size_t offset,
     mat4x4 view_matrix,
     mat4x4 projection_matrix,
     mat4x4 view_proj_matrix,
@@ -275,7 +451,12 @@ void renderer_update_view_projection_uniform_buffer(
 VkRenderPass renderer_get_render_pass(
 	VkDevice device,
 	VkFormat image_format,
-	VkFormat depth_format
+	VkFormat depth_format,
+    VkSampleCountFlagBits samples,
+    VkAttachmentLoadOp load_op,
+    bool store_depth,
+    bool depth_prepass,
+    VkImageLayout final_layout
 );
 
 VkPipelineLayout renderer_get_pipeline_layout(
@@ -294,10 +475,13 @@ VkShaderModule renderer_get_shader_module(
 
 VkPipeline renderer_get_graphics_pipeline(
     VkDevice device,
-    VkExtent2D swapchain_extent,
     VkPipelineLayout pipeline_layout,
     VkRenderPass render_pass,
-    uint32_t subpass
+    uint32_t subpass,
+    VkSampleCountFlagBits samples,
+    bool depth_only,
+    VkCompareOp depth_compare_op,
+    bool depth_write
 );
 
 void renderer_create_framebuffers(
@@ -306,6 +490,7 @@ void renderer_create_framebuffers(
 	VkExtent2D swapchain_extent,
 	struct renderer_swapchain_buffer* swapchain_buffers,
 	VkImageView depth_image_view,
+	VkImageView color_image_view,
 	VkFramebuffer* framebuffers,
 	uint32_t swapchain_image_count
 );
@@ -315,8 +500,9 @@ struct renderer_buffer renderer_get_vertex_buffer(
 	VkDevice device,
 	VkCommandPool command_pool,
 	VkQueue queue,
-	struct renderer_vertex* vertices,
-	uint32_t vertex_count
+	const void* vertices,
+	VkDeviceSize size,
+    struct renderer_gpu_profiler* profiler
 );
 
 struct renderer_buffer renderer_get_index_buffer(
@@ -325,11 +511,25 @@ struct renderer_buffer renderer_get_index_buffer(
     VkCommandPool command_pool,
     VkQueue queue,
     uint32_t* indices,
-    uint32_t index_count
+    uint32_t index_count,
+    struct renderer_gpu_profiler* profiler
+);
+
+uint32_t renderer_get_matrix_offset(
+    size_t matrix_alignment,
+    uint32_t max_drawables,
+    uint32_t image_index,
+    uint32_t matrix_index
+);
+
+uint32_t renderer_get_view_projection_offset(
+    size_t matrix_alignment,
+    uint32_t image_index
 );
 
 void renderer_record_draw_commands(
     VkPipeline pipeline,
+    VkPipeline depth_pipeline,
     VkRenderPass render_pass,
     VkExtent2D swapchain_extent,
     VkFramebuffer *framebuffers,
@@ -337,23 +537,104 @@ void renderer_record_draw_commands(
     struct renderer_swapchain_buffer swapchain_buffer,
     struct queue *drawable_queue,
     VkPipelineLayout pipeline_layout,
-    VkDescriptorSet *descriptor_set
+    VkDescriptorSet *descriptor_set,
+    uint32_t framebuffer_generation,
+    struct renderer_buffer* dynamic_uniform_buffer,
+    size_t matrix_alignment,
+    uint32_t max_drawables,
+    struct renderer_scene* scene,
+    const struct renderer_registry* registry,
+    struct job_system* jobs,
+    struct arena* frame_arena,
+    struct renderer_gpu_profiler* profiler,
+    struct renderer_pipeline_stats* pipeline_stats,
+    struct renderer_frame_stats* frame_stats
+);
+
+void renderer_record_image_readback(
+    VkCommandBuffer cmd,
+    VkImage image,
+    VkExtent2D extent,
+    struct renderer_buffer* readback_buffer
 );
 
 VkSemaphore renderer_get_semaphore(
     VkDevice device
 );
 
+VkFence renderer_get_fence(
+    VkDevice device,
+    bool signaled
+);
+
+void renderer_recreate_swapchain(
+    struct renderer_resources* resources
+);
+
+void renderer_recreate_offscreen_targets(
+    struct renderer_resources* resources
+);
+
+void renderer_destroy_retired_swapchain(
+    VkDevice device,
+    VkCommandPool command_pool,
+    struct renderer_retired_swapchain* retired
+);
+
+void renderer_destroy_retired_swapchains(
+    struct renderer_resources* resources,
+    bool wait
+);
+
+bool renderer_frame_reusable(
+    struct renderer_resources* resources
+);
+
+bool renderer_can_replay_frame(
+    struct renderer_resources* resources,
+    uint32_t image_index
+);
+
+void renderer_replay_frame(
+    struct renderer_resources* resources,
+    uint32_t image_index
+);
+
+void renderer_record_frame(
+    struct renderer_resources* resources,
+    uint32_t image_index
+);
+
 void renderer_draw_frame(
     struct renderer_resources* resources
 );
 
+void renderer_set_render_thread(
+    struct renderer_resources* resources
+);
+
 void renderer_resize(
     struct renderer_resources* resources,
     int width,
     int height
 );
 
+void renderer_set_present_mode(
+    struct renderer_resources* resources,
+    VkPresentModeKHR present_mode
+);
+
+void renderer_set_swapchain_image_count(
+    struct renderer_resources* resources,
+    uint32_t image_count
+);
+
+const void* renderer_get_frame_pixels(
+    struct renderer_resources* resources,
+    uint32_t* width,
+    uint32_t* height
+);
+
 void renderer_destroy_resources(
     struct renderer_resources* resources
 );
@@ -361,7 +642,20 @@ void renderer_destroy_resources(
 void renderer_generate_meshes(
     struct renderer_resources* resources,
     const char** models,
-    const uint32_t model_count
+    const uint32_t model_count,
+    struct renderer_resource_handle* handles
+);
+
+void renderer_upload_meshes(
+    struct renderer_resources* resources,
+    const struct renderer_mesh_data* meshes,
+    uint32_t mesh_count,
+    struct renderer_resource_handle* handles
+);
+
+void renderer_get_mesh_bounds(
+    const struct renderer_mesh_data* data,
+    struct renderer_mesh* mesh
 );
 
 void renderer_destroy_meshes(
@@ -386,6 +680,25 @@ void renderer_draw(
     float x, float y, float z
 );
 
+uint32_t renderer_create_transform(
+    struct renderer_resources *resources,
+    uint32_t parent
+);
+
+void renderer_update_drawable_bounds(
+    struct renderer_resources *resources
+);
+
+void renderer_frustum_cull(
+    struct renderer_resources *resources
+);
+
+struct renderer_drawable* renderer_pick_drawable(
+    struct renderer_resources *resources,
+    vec3 origin,
+    vec3 direction
+);
+
 void renderer_create_drawable(
     struct renderer_resources *resources,
     const char *model_src,
@@ -393,4 +706,45 @@ void renderer_create_drawable(
     struct renderer_drawable *drawable
 );
 
+void renderer_set_drawable_mesh(
+    struct renderer_resources *resources,
+    struct renderer_drawable *drawable,
+    struct renderer_resource_handle mesh
+);
+
+void renderer_set_drawable_texture(
+    struct renderer_resources *resources,
+    struct renderer_drawable *drawable,
+    struct renderer_resource_handle texture
+);
+
+void renderer_get_drawable_sphere(
+    struct renderer_resources *resources,
+    struct renderer_drawable *drawable,
+    float sphere[4]
+);
+
+void renderer_bind_mesh_buffers(
+    const struct renderer_registry* registry,
+    VkCommandBuffer cmd,
+    const struct renderer_mesh* mesh
+);
+
+void renderer_register_drawable(
+    struct renderer_resources *resources,
+    struct renderer_drawable *drawable
+);
+
+void renderer_init_drawable(
+    struct renderer_resources *resources,
+    struct renderer_resource_handle mesh,
+    struct renderer_resource_handle texture,
+    struct renderer_drawable *drawable
+);
+
+VkDescriptorSet renderer_get_texture_descriptor_set(
+    struct renderer_resources *resources,
+    struct renderer_image *texture
+);
+
 #endif
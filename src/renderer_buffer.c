@@ -1,5 +1,7 @@
 #include "renderer_tools.h"
 #include "renderer_buffer.h"
+#include "renderer_gpu_profiler.h"
+#include "cpu_profiler.h"
 
 #include <assert.h>
 
@@ -45,13 +47,13 @@ struct renderer_buffer renderer_get_buffer(
     };
 
     VkResult result;
-    result = vkAllocateMemory(
+    result = renderer_allocate_memory(
         device,
         &alloc_info,
-        NULL,
         &buffer.memory
     );
     assert(result == VK_SUCCESS);
+    buffer.memory_size = mem_reqs.size;
 
     vkBindBufferMemory(
         device,
@@ -67,7 +69,7 @@ void renderer_destroy_buffer(
         VkDevice device,
         struct renderer_buffer* buffer)
 {
-    vkFreeMemory(device, buffer->memory, NULL);
+    renderer_free_memory(device, buffer->memory, buffer->memory_size);
     vkDestroyBuffer(device, buffer->buffer, NULL);
 }
 
@@ -108,8 +110,11 @@ void renderer_copy_buffer_to_buffer(
         VkQueue queue,
         VkBuffer src_buffer,
         VkBuffer dst_buffer,
-        VkDeviceSize mem_size)
+        VkDeviceSize mem_size,
+        struct renderer_gpu_profiler* profiler)
 {
+    struct cpu_profiler_scope scope = cpu_profiler_begin("upload buffer");
+
     VkCommandBuffer copy_cmd;
     VkCommandBufferAllocateInfo cmd_alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -137,6 +142,9 @@ void renderer_copy_buffer_to_buffer(
         .size = mem_size
     };
 
+    if (profiler)
+        renderer_gpu_profiler_begin_immediate(profiler, copy_cmd);
+
     vkCmdCopyBuffer(
         copy_cmd,
         src_buffer,
@@ -145,6 +153,9 @@ void renderer_copy_buffer_to_buffer(
         &region
     );
 
+    if (profiler)
+        renderer_gpu_profiler_end_immediate(profiler, copy_cmd);
+
     vkEndCommandBuffer(copy_cmd);
 
     VkSubmitInfo submit_info = {
@@ -169,12 +180,17 @@ void renderer_copy_buffer_to_buffer(
 
     vkQueueWaitIdle(queue);
 
+    if (profiler)
+        renderer_gpu_profiler_resolve_immediate(profiler, "upload buffer");
+
     vkFreeCommandBuffers(
         device,
         command_pool,
         1,
         &copy_cmd
     );
+
+    cpu_profiler_end(&scope);
 }
 
 void renderer_copy_buffer_to_image(
@@ -183,8 +199,11 @@ void renderer_copy_buffer_to_image(
         VkQueue queue,
         VkBuffer src_buffer,
         VkImage dst_image,
-        VkExtent3D extent)
+        VkExtent3D extent,
+        struct renderer_gpu_profiler* profiler)
 {
+    struct cpu_profiler_scope scope = cpu_profiler_begin("upload image");
+
     VkCommandBuffer copy_cmd;
     VkCommandBufferAllocateInfo cmd_alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -215,6 +234,9 @@ void renderer_copy_buffer_to_image(
         .imageExtent = extent
     };
 
+    if (profiler)
+        renderer_gpu_profiler_begin_immediate(profiler, copy_cmd);
+
     vkCmdCopyBufferToImage(
         copy_cmd,
         src_buffer,
@@ -224,6 +246,9 @@ void renderer_copy_buffer_to_image(
         &region
     );
 
+    if (profiler)
+        renderer_gpu_profiler_end_immediate(profiler, copy_cmd);
+
     vkEndCommandBuffer(copy_cmd);
 
     VkSubmitInfo submit_info = {
@@ -248,12 +273,17 @@ void renderer_copy_buffer_to_image(
 
     vkQueueWaitIdle(queue);
 
+    if (profiler)
+        renderer_gpu_profiler_resolve_immediate(profiler, "upload image");
+
     vkFreeCommandBuffers(
         device,
         command_pool,
         1,
         &copy_cmd
     );
+
+    cpu_profiler_end(&scope);
 }
 
 size_t renderer_get_buffer_alignment(
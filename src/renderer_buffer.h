@@ -4,11 +4,14 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+struct renderer_gpu_profiler;
+
 struct renderer_buffer
 {
     VkBuffer buffer;
     VkDeviceMemory memory;
     VkDeviceSize size;
+    VkDeviceSize memory_size; // Allocated, may be larger than size
     void* mapped;
 };
 
@@ -43,7 +46,8 @@ void renderer_copy_buffer_to_buffer(
     VkQueue queue,
     VkBuffer src_buffer,
     VkBuffer dst_buffer,
-    VkDeviceSize mem_size
+    VkDeviceSize mem_size,
+    struct renderer_gpu_profiler* profiler
 );
 
 void renderer_copy_buffer_to_image(
@@ -52,7 +56,8 @@ void renderer_copy_buffer_to_image(
     VkQueue queue,
     VkBuffer src_buffer,
     VkImage dst_image,
-    VkExtent3D extent
+    VkExtent3D extent,
+    struct renderer_gpu_profiler* profiler
 );
 
 size_t renderer_get_buffer_alignment(
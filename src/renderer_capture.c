@@ -0,0 +1,532 @@
+#include "renderer_buffer.h"
+#include "renderer_image.h"
+#include "renderer.h"
+#include "renderer_capture.h"
+#include "cpu_profiler.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static uint32_t crc_table[256];
+
+static void crc_init()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void write_be32(uint8_t* out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// Writes bytes that are part of a chunk, keeping the chunk's CRC up to date
+static void png_write(FILE* file, uint32_t* crc, const void* data, size_t size)
+{
+    fwrite(data, 1, size, file);
+    *crc = crc_update(*crc, data, size);
+}
+
+static void png_write_chunk(
+        FILE* file,
+        const char* type,
+        const uint8_t* data,
+        uint32_t size)
+{
+    uint8_t header[4];
+    write_be32(header, size);
+    fwrite(header, 1, 4, file);
+
+    uint32_t crc = 0xffffffffu;
+    png_write(file, &crc, type, 4);
+    if (size > 0)
+        png_write(file, &crc, data, size);
+
+    write_be32(header, crc ^ 0xffffffffu);
+    fwrite(header, 1, 4, file);
+}
+
+/* Encodes RGBA8 pixels as a PNG using stored (uncompressed) deflate blocks.
+ * Compression would cost far more than the disk bandwidth it saves at capture
+ * rates, the images can be recompressed offline */
+static void write_png(
+        FILE* file,
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height)
+{
+    static const uint8_t signature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    uint8_t ihdr[13];
+    write_be32(&ihdr[0], width);
+    write_be32(&ihdr[4], height);
+    ihdr[8] = 8; // Bit depth
+    ihdr[9] = 6; // Color type RGBA
+    ihdr[10] = 0; // Compression
+    ihdr[11] = 0; // Filter
+    ihdr[12] = 0; // Interlace
+    png_write_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+
+    // Each scanline is prefixed with filter type 0 (none)
+    size_t row_size = (size_t)width * 4 + 1;
+    size_t data_size = row_size * height;
+    size_t block_count = (data_size + 0xffff - 1) / 0xffff;
+    size_t idat_size = 2 + block_count * 5 + data_size + 4;
+
+    uint8_t header[4];
+    write_be32(header, (uint32_t)idat_size);
+    fwrite(header, 1, 4, file);
+
+    uint32_t crc = 0xffffffffu;
+    png_write(file, &crc, "IDAT", 4);
+
+    const uint8_t zlib_header[] = {0x78, 0x01};
+    png_write(file, &crc, zlib_header, 2);
+
+    uint32_t adler_a = 1, adler_b = 0;
+    size_t remaining = data_size;
+    size_t offset = 0; // Into the filtered stream
+    while (remaining > 0) {
+        uint16_t block_size = remaining > 0xffff ? 0xffff : remaining;
+        remaining -= block_size;
+
+        uint8_t block_header[5] = {
+            remaining == 0 ? 1 : 0,
+            block_size & 0xff, block_size >> 8,
+            ~block_size & 0xff, (~block_size >> 8) & 0xff
+        };
+        png_write(file, &crc, block_header, 5);
+
+        // Copy out of the filtered stream without materializing it
+        size_t end = offset + block_size;
+        while (offset < end) {
+            size_t row = offset / row_size;
+            size_t column = offset % row_size;
+            size_t run;
+            const uint8_t* src;
+            static const uint8_t filter = 0;
+
+            if (column == 0) {
+                src = &filter;
+                run = 1;
+            } else {
+                src = &pixels[row * width * 4 + column - 1];
+                run = MIN(row_size - column, end - offset);
+            }
+            png_write(file, &crc, src, run);
+
+            for (size_t i = 0; i < run; i++) {
+                adler_a = (adler_a + src[i]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+            offset += run;
+        }
+    }
+
+    uint8_t adler[4];
+    write_be32(adler, (adler_b << 16) | adler_a);
+    png_write(file, &crc, adler, 4);
+
+    write_be32(header, crc ^ 0xffffffffu);
+    fwrite(header, 1, 4, file);
+
+    png_write_chunk(file, "IEND", NULL, 0);
+}
+
+static void swizzle_bgra(uint8_t* pixels, uint32_t width, uint32_t height)
+{
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        uint8_t b = pixels[i * 4];
+        pixels[i * 4] = pixels[i * 4 + 2];
+        pixels[i * 4 + 2] = b;
+    }
+}
+
+static void* capture_worker(void* arg)
+{
+    struct renderer_capture* capture = arg;
+
+    cpu_profiler_set_thread_name("capture");
+
+    pthread_mutex_lock(&capture->mutex);
+    for (;;) {
+        while (queue_empty(&capture->ready) && !capture->quit)
+            pthread_cond_wait(&capture->cond, &capture->mutex);
+
+        // Drain everything already handed over before quitting
+        if (queue_empty(&capture->ready))
+            break;
+
+        uint32_t slot_index;
+        queue_dequeue(&capture->ready, &slot_index);
+        pthread_mutex_unlock(&capture->mutex);
+
+        struct cpu_profiler_scope scope = cpu_profiler_begin("encode frame");
+
+        struct renderer_capture_slot* slot = &capture->slots[slot_index];
+        uint8_t* pixels = slot->buffer.mapped;
+        size_t size = (size_t)slot->width * slot->height * 4;
+
+        if (slot->bgra)
+            swizzle_bgra(pixels, slot->width, slot->height);
+
+        char path[300];
+        snprintf(
+            path,
+            sizeof(path),
+            "%s/frame_%06llu.%s",
+            capture->directory,
+            (unsigned long long)slot->frame,
+            capture->format == RENDERER_CAPTURE_PNG ? "png" : "raw"
+        );
+
+        bool ok = false;
+        FILE* file = fopen(path, "wb");
+        if (file) {
+            if (capture->format == RENDERER_CAPTURE_PNG)
+                write_png(file, pixels, slot->width, slot->height);
+            else
+                fwrite(pixels, 1, size, file);
+            ok = !ferror(file);
+            fclose(file);
+        }
+        if (!ok)
+            fprintf(stderr, "Failed to write %s\n", path);
+
+        double latency = timer_now() - slot->capture_time;
+        cpu_profiler_end(&scope);
+
+        pthread_mutex_lock(&capture->mutex);
+        if (ok) {
+            capture->stats.written++;
+            capture->stats.bytes_written += size;
+            capture->stats.total_latency += latency;
+            capture->stats.max_latency =
+                MAX(capture->stats.max_latency, latency);
+        }
+        slot->state = RENDERER_CAPTURE_SLOT_FREE;
+    }
+    pthread_mutex_unlock(&capture->mutex);
+
+    return NULL;
+}
+
+/* Frames can be captured from the offscreen targets when headless, or from
+ * the swapchain if the surface allows transfers from its images */
+bool renderer_capture_init(
+        struct renderer_capture* capture,
+        struct renderer_resources* resources,
+        const char* directory,
+        enum renderer_capture_format format)
+{
+    memset(capture, 0, sizeof(*capture));
+
+    VkFormat image_format = resources->swapchain_image_format.format;
+    if (image_format != VK_FORMAT_R8G8B8A8_UNORM &&
+            image_format != VK_FORMAT_R8G8B8A8_SRGB &&
+            image_format != VK_FORMAT_B8G8R8A8_UNORM &&
+            image_format != VK_FORMAT_B8G8R8A8_SRGB) {
+        printf("Capture not supported for image format %d\n", image_format);
+        return false;
+    }
+
+    if (!resources->settings.headless) {
+        VkSurfaceCapabilitiesKHR surface_capabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+            resources->physical_device,
+            resources->surface,
+            &surface_capabilities
+        );
+        if (!(surface_capabilities.supportedUsageFlags &
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+            printf("Capture not supported, surface can't be read back\n");
+            return false;
+        }
+    }
+
+    crc_init();
+
+    capture->physical_device = resources->physical_device;
+    capture->device = resources->device;
+    capture->format = format;
+    snprintf(capture->directory, sizeof(capture->directory), "%s", directory);
+
+    queue_init(&capture->ready, sizeof(uint32_t), RENDERER_CAPTURE_SLOTS);
+    pthread_mutex_init(&capture->mutex, NULL);
+    pthread_cond_init(&capture->cond, NULL);
+
+    capture->stats.start_time = timer_now();
+
+    int error = pthread_create(
+        &capture->thread,
+        NULL,
+        capture_worker,
+        capture
+    );
+    assert(error == 0);
+
+    return true;
+}
+
+/* Records a copy of image into a free slot. The image must be in image_layout
+ * after the render pass, and is returned to it. Never waits, when every slot
+ * is busy the frame is dropped and false returned */
+bool renderer_capture_record(
+        struct renderer_capture* capture,
+        VkCommandBuffer cmd,
+        VkImage image,
+        VkFormat image_format,
+        VkImageLayout image_layout,
+        VkExtent2D extent,
+        VkFence fence,
+        uint64_t frame)
+{
+    struct renderer_capture_slot* slot = NULL;
+
+    pthread_mutex_lock(&capture->mutex);
+    for (uint32_t i = 0; i < RENDERER_CAPTURE_SLOTS; i++) {
+        if (capture->slots[i].state == RENDERER_CAPTURE_SLOT_FREE) {
+            slot = &capture->slots[i];
+            slot->state = RENDERER_CAPTURE_SLOT_PENDING;
+            break;
+        }
+    }
+    if (!slot)
+        capture->stats.dropped++;
+    else
+        capture->stats.captured++;
+    pthread_mutex_unlock(&capture->mutex);
+
+    if (!slot)
+        return false;
+
+    // Grown lazily, so a resize only reallocates the slots it reaches
+    VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+    if (slot->buffer.size < size) {
+        if (slot->buffer.buffer != VK_NULL_HANDLE) {
+            renderer_unmap_buffer(capture->device, &slot->buffer);
+            renderer_destroy_buffer(capture->device, &slot->buffer);
+        }
+
+        slot->buffer = renderer_get_buffer(
+            capture->physical_device,
+            capture->device,
+            size,
+            0,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        renderer_map_buffer(capture->device, 0, &slot->buffer);
+    }
+
+    VkImageMemoryBarrier image_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = image_layout,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, NULL,
+        0, NULL,
+        1, &image_barrier
+    );
+
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {extent.width, extent.height, 1}
+    };
+
+    vkCmdCopyImageToBuffer(
+        cmd,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        slot->buffer.buffer,
+        1,
+        &region
+    );
+
+    // Back to where the render pass left it (e.g. for presenting)
+    if (image_layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+        image_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        image_barrier.dstAccessMask = 0;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.newLayout = image_layout;
+
+        vkCmdPipelineBarrier(
+            cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, NULL,
+            0, NULL,
+            1, &image_barrier
+        );
+    }
+
+    VkBufferMemoryBarrier buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slot->buffer.buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+    };
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0, NULL,
+        1, &buffer_barrier,
+        0, NULL
+    );
+
+    slot->fence = fence;
+    slot->frame = frame;
+    slot->width = extent.width;
+    slot->height = extent.height;
+    slot->bgra = image_format == VK_FORMAT_B8G8R8A8_UNORM ||
+        image_format == VK_FORMAT_B8G8R8A8_SRGB;
+    slot->capture_time = timer_now();
+
+    return true;
+}
+
+/* Hands slots whose copies have completed to the worker. Must be called each
+ * frame after the frame fence wait and before that fence is reset: a pending
+ * slot's fence is then always observed signaled at least once, because frame
+ * fences are only reset after being waited on */
+void renderer_capture_poll(
+        struct renderer_capture* capture)
+{
+    bool handed_over = false;
+
+    pthread_mutex_lock(&capture->mutex);
+    for (uint32_t i = 0; i < RENDERER_CAPTURE_SLOTS; i++) {
+        struct renderer_capture_slot* slot = &capture->slots[i];
+        if (slot->state != RENDERER_CAPTURE_SLOT_PENDING)
+            continue;
+
+        if (vkGetFenceStatus(capture->device, slot->fence) != VK_SUCCESS)
+            continue;
+
+        slot->state = RENDERER_CAPTURE_SLOT_ENCODING;
+        queue_enqueue(&capture->ready, &i);
+        handed_over = true;
+    }
+    if (handed_over)
+        pthread_cond_signal(&capture->cond);
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+void renderer_capture_get_stats(
+        struct renderer_capture* capture,
+        struct renderer_capture_stats* stats)
+{
+    pthread_mutex_lock(&capture->mutex);
+    *stats = capture->stats;
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+void renderer_capture_print_report(
+        struct renderer_capture* capture)
+{
+    struct renderer_capture_stats stats;
+    renderer_capture_get_stats(capture, &stats);
+
+    double elapsed = timer_now() - stats.start_time;
+    double avg_latency = stats.written ?
+        stats.total_latency / stats.written : 0.0;
+
+    printf("Capture: %llu written, %llu dropped, %.1f frames/s, %.1f MB/s\n",
+            (unsigned long long)stats.written,
+            (unsigned long long)stats.dropped,
+            elapsed > 0.0 ? stats.written / elapsed : 0.0,
+            elapsed > 0.0 ? stats.bytes_written / elapsed / 1e6 : 0.0);
+    printf("Capture latency: avg %.2f ms, max %.2f ms\n",
+            avg_latency * 1000.0,
+            stats.max_latency * 1000.0);
+}
+
+/* Writes out every remaining frame and stops the worker. The device must be
+ * idle, so every pending copy has completed and gets handed over */
+void renderer_capture_finish(
+        struct renderer_capture* capture)
+{
+    renderer_capture_poll(capture);
+
+    pthread_mutex_lock(&capture->mutex);
+    capture->quit = true;
+    pthread_cond_signal(&capture->cond);
+    pthread_mutex_unlock(&capture->mutex);
+
+    pthread_join(capture->thread, NULL);
+}
+
+void renderer_capture_destroy(
+        struct renderer_capture* capture)
+{
+    for (uint32_t i = 0; i < RENDERER_CAPTURE_SLOTS; i++) {
+        struct renderer_capture_slot* slot = &capture->slots[i];
+        if (slot->buffer.buffer == VK_NULL_HANDLE)
+            continue;
+
+        renderer_unmap_buffer(capture->device, &slot->buffer);
+        renderer_destroy_buffer(capture->device, &slot->buffer);
+    }
+
+    queue_destroy(&capture->ready);
+    pthread_mutex_destroy(&capture->mutex);
+    pthread_cond_destroy(&capture->cond);
+}
@@ -0,0 +1,109 @@
+#ifndef RENDERER_CAPTURE_H_
+#define RENDERER_CAPTURE_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RENDERER_CAPTURE_SLOTS 4
+
+enum renderer_capture_format
+{
+    RENDERER_CAPTURE_PNG,
+    RENDERER_CAPTURE_RAW // Tightly packed RGBA8, no header
+};
+
+enum renderer_capture_slot_state
+{
+    RENDERER_CAPTURE_SLOT_FREE,
+    RENDERER_CAPTURE_SLOT_PENDING, // Copy submitted, waiting on the GPU
+    RENDERER_CAPTURE_SLOT_ENCODING // Handed to the worker thread
+};
+
+// Host visible buffer a frame is copied into, owned by the render thread
+// while free or pending and by the worker while encoding
+struct renderer_capture_slot
+{
+    struct renderer_buffer buffer;
+    enum renderer_capture_slot_state state;
+    VkFence fence; // Fence of the frame the copy was recorded in
+    uint64_t frame;
+    uint32_t width, height;
+    bool bgra; // Swapchain formats are usually BGRA, swizzled on encode
+    double capture_time; // When the copy was recorded
+};
+
+struct renderer_capture_stats
+{
+    uint64_t captured; // Copies recorded
+    uint64_t written; // Files written by the worker
+    uint64_t dropped; // Frames skipped because every slot was busy
+    uint64_t bytes_written;
+    double total_latency; // Sum of record-to-file times, seconds
+    double max_latency;
+    double start_time;
+};
+
+struct renderer_capture
+{
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+
+    enum renderer_capture_format format;
+    char directory[256];
+
+    struct renderer_capture_slot slots[RENDERER_CAPTURE_SLOTS];
+
+    // Slot indices completed by the GPU, consumed by the worker
+    struct queue ready;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool quit;
+
+    struct renderer_capture_stats stats; // Guarded by mutex
+};
+
+bool renderer_capture_init(
+    struct renderer_capture* capture,
+    struct renderer_resources* resources,
+    const char* directory,
+    enum renderer_capture_format format
+);
+
+bool renderer_capture_record(
+    struct renderer_capture* capture,
+    VkCommandBuffer cmd,
+    VkImage image,
+    VkFormat image_format,
+    VkImageLayout image_layout,
+    VkExtent2D extent,
+    VkFence fence,
+    uint64_t frame
+);
+
+void renderer_capture_poll(
+    struct renderer_capture* capture
+);
+
+void renderer_capture_get_stats(
+    struct renderer_capture* capture,
+    struct renderer_capture_stats* stats
+);
+
+void renderer_capture_print_report(
+    struct renderer_capture* capture
+);
+
+void renderer_capture_finish(
+    struct renderer_capture* capture
+);
+
+void renderer_capture_destroy(
+    struct renderer_capture* capture
+);
+
+#endif
@@ -0,0 +1,356 @@
+#include "renderer_gpu_profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static VkQueryPool get_timestamp_pool(VkDevice device, uint32_t query_count)
+{
+    VkQueryPool query_pool;
+
+    VkQueryPoolCreateInfo query_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = query_count,
+        .pipelineStatistics = 0
+    };
+
+    VkResult result;
+    result = vkCreateQueryPool(device, &query_pool_info, NULL, &query_pool);
+    assert(result == VK_SUCCESS);
+
+    return query_pool;
+}
+
+static uint32_t find_scope(
+        struct renderer_gpu_profiler* profiler,
+        const char* name)
+{
+    for (uint32_t i = 0; i < profiler->scope_count; i++) {
+        if (!strcmp(profiler->scopes[i].name, name))
+            return i;
+    }
+
+    return GPU_PROFILER_NO_SCOPE;
+}
+
+static uint32_t get_scope(
+        struct renderer_gpu_profiler* profiler,
+        const char* name)
+{
+    uint32_t scope = find_scope(profiler, name);
+    if (scope != GPU_PROFILER_NO_SCOPE)
+        return scope;
+
+    if (profiler->scope_count == GPU_PROFILER_MAX_SCOPES)
+        return GPU_PROFILER_NO_SCOPE;
+
+    scope = profiler->scope_count++;
+    memset(&profiler->scopes[scope], 0, sizeof(profiler->scopes[scope]));
+    profiler->scopes[scope].name = name;
+
+    return scope;
+}
+
+static void add_sample(
+        struct renderer_gpu_profiler* profiler,
+        uint32_t scope,
+        uint64_t frame_id,
+        uint64_t begin,
+        uint64_t end)
+{
+    struct renderer_gpu_profiler_scope* s = &profiler->scopes[scope];
+    s->latest_frame = frame_id;
+
+    uint64_t ticks = (end - begin) & profiler->timestamp_mask;
+    s->history[s->next] = ticks * profiler->timestamp_period / 1e6;
+    s->next = (s->next + 1) % GPU_PROFILER_HISTORY;
+    if (s->sample_count < GPU_PROFILER_HISTORY)
+        s->sample_count++;
+}
+
+static int compare_float(const void* a, const void* b)
+{
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+/* Timestamps need a queue family with timestampValidBits, returns false (and
+ * the profiler must not be used) when the graphics queue has none */
+bool renderer_gpu_profiler_init(
+        struct renderer_gpu_profiler* profiler,
+        VkPhysicalDevice physical_device,
+        VkDevice device,
+        uint32_t queue_family_index)
+{
+    memset(profiler, 0, sizeof(*profiler));
+
+    uint32_t family_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physical_device,
+        &family_count,
+        NULL
+    );
+
+    VkQueueFamilyProperties* families;
+    families = malloc(family_count * sizeof(*families));
+    assert(families);
+
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physical_device,
+        &family_count,
+        families
+    );
+    uint32_t valid_bits = families[queue_family_index].timestampValidBits;
+    free(families);
+
+    if (valid_bits == 0) {
+        printf("GPU profiling not supported, queue has no timestamps\n");
+        return false;
+    }
+
+    VkPhysicalDeviceProperties gpu_props;
+    vkGetPhysicalDeviceProperties(physical_device, &gpu_props);
+
+    profiler->device = device;
+    profiler->timestamp_period = gpu_props.limits.timestampPeriod;
+    profiler->timestamp_mask = valid_bits >= 64 ?
+        UINT64_MAX : (1ull << valid_bits) - 1;
+
+    for (uint32_t i = 0; i < GPU_PROFILER_FRAMES; i++) {
+        profiler->frames[i].query_pool = get_timestamp_pool(
+            device,
+            GPU_PROFILER_MAX_QUERIES
+        );
+    }
+
+    profiler->immediate_pool = get_timestamp_pool(device, 2);
+
+    return true;
+}
+
+/* Reads back the timestamps the frame slot wrote last time it was used and
+ * resets its queries. Call with the slot's fence already waited on, so the
+ * results are ready and reading them never stalls. frame_id identifies the
+ * frame being recorded, its samples carry it once they are read back */
+void renderer_gpu_profiler_begin_frame(
+        struct renderer_gpu_profiler* profiler,
+        VkCommandBuffer cmd,
+        uint32_t frame_index,
+        uint64_t frame_id)
+{
+    struct renderer_gpu_profiler_frame* frame;
+    frame = &profiler->frames[frame_index];
+
+    if (frame->query_count > 0) {
+        uint64_t timestamps[GPU_PROFILER_MAX_QUERIES];
+
+        // No WAIT flag, anything not ready is simply skipped
+        VkResult result;
+        result = vkGetQueryPoolResults(
+            profiler->device,
+            frame->query_pool,
+            0,
+            frame->query_count,
+            sizeof(timestamps),
+            timestamps,
+            sizeof(timestamps[0]),
+            VK_QUERY_RESULT_64_BIT
+        );
+
+        if (result == VK_SUCCESS) {
+            for (uint32_t i = 0; i < frame->query_count; i += 2) {
+                if (frame->scopes[i / 2] == GPU_PROFILER_NO_SCOPE)
+                    continue;
+
+                add_sample(
+                    profiler,
+                    frame->scopes[i / 2],
+                    frame->frame_id,
+                    timestamps[i],
+                    timestamps[i + 1]
+                );
+            }
+        }
+    }
+
+    vkCmdResetQueryPool(cmd, frame->query_pool, 0, GPU_PROFILER_MAX_QUERIES);
+    frame->query_count = 0;
+    frame->frame_id = frame_id;
+    profiler->current_frame = frame_index;
+}
+
+/* Returns a handle for renderer_gpu_profiler_end_scope. The scope covers all
+ * work recorded into cmd between the two calls */
+uint32_t renderer_gpu_profiler_begin_scope(
+        struct renderer_gpu_profiler* profiler,
+        VkCommandBuffer cmd,
+        const char* name)
+{
+    struct renderer_gpu_profiler_frame* frame;
+    frame = &profiler->frames[profiler->current_frame];
+
+    if (frame->query_count + 2 > GPU_PROFILER_MAX_QUERIES)
+        return GPU_PROFILER_NO_SCOPE;
+
+    uint32_t query = frame->query_count;
+    frame->query_count += 2;
+    frame->scopes[query / 2] = get_scope(profiler, name);
+
+    vkCmdWriteTimestamp(
+        cmd,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        frame->query_pool,
+        query
+    );
+
+    return query;
+}
+
+void renderer_gpu_profiler_end_scope(
+        struct renderer_gpu_profiler* profiler,
+        VkCommandBuffer cmd,
+        uint32_t scope)
+{
+    if (scope == GPU_PROFILER_NO_SCOPE)
+        return;
+
+    vkCmdWriteTimestamp(
+        cmd,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        profiler->frames[profiler->current_frame].query_pool,
+        scope + 1
+    );
+}
+
+void renderer_gpu_profiler_begin_immediate(
+        struct renderer_gpu_profiler* profiler,
+        VkCommandBuffer cmd)
+{
+    vkCmdResetQueryPool(cmd, profiler->immediate_pool, 0, 2);
+    vkCmdWriteTimestamp(
+        cmd,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        profiler->immediate_pool,
+        0
+    );
+}
+
+void renderer_gpu_profiler_end_immediate(
+        struct renderer_gpu_profiler* profiler,
+        VkCommandBuffer cmd)
+{
+    vkCmdWriteTimestamp(
+        cmd,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        profiler->immediate_pool,
+        1
+    );
+}
+
+/* For submits the caller has already waited on, so reading back right away
+ * costs nothing extra */
+void renderer_gpu_profiler_resolve_immediate(
+        struct renderer_gpu_profiler* profiler,
+        const char* name)
+{
+    uint64_t timestamps[2];
+
+    VkResult result;
+    result = vkGetQueryPoolResults(
+        profiler->device,
+        profiler->immediate_pool,
+        0,
+        2,
+        sizeof(timestamps),
+        timestamps,
+        sizeof(timestamps[0]),
+        VK_QUERY_RESULT_64_BIT
+    );
+    if (result != VK_SUCCESS)
+        return;
+
+    uint32_t scope = get_scope(profiler, name);
+    if (scope != GPU_PROFILER_NO_SCOPE)
+        add_sample(
+            profiler,
+            scope,
+            GPU_PROFILER_NO_FRAME,
+            timestamps[0],
+            timestamps[1]
+        );
+}
+
+bool renderer_gpu_profiler_get_stats(
+        struct renderer_gpu_profiler* profiler,
+        const char* name,
+        struct renderer_gpu_profiler_stats* stats)
+{
+    uint32_t scope = find_scope(profiler, name);
+    if (scope == GPU_PROFILER_NO_SCOPE)
+        return false;
+
+    struct renderer_gpu_profiler_scope* s = &profiler->scopes[scope];
+    if (s->sample_count == 0)
+        return false;
+
+    float sorted[GPU_PROFILER_HISTORY];
+    memcpy(sorted, s->history, s->sample_count * sizeof(sorted[0]));
+    qsort(sorted, s->sample_count, sizeof(sorted[0]), compare_float);
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < s->sample_count; i++)
+        sum += sorted[i];
+
+    stats->min = sorted[0];
+    stats->avg = sum / s->sample_count;
+    stats->p99 = sorted[(s->sample_count - 1) * 99 / 100];
+    stats->latest = s->history[
+        (s->next + GPU_PROFILER_HISTORY - 1) % GPU_PROFILER_HISTORY
+    ];
+    stats->latest_frame = s->latest_frame;
+    stats->sample_count = s->sample_count;
+
+    return true;
+}
+
+void renderer_gpu_profiler_print_report(
+        struct renderer_gpu_profiler* profiler)
+{
+    printf("GPU times over the last %d samples (ms):\n", GPU_PROFILER_HISTORY);
+    printf("%-20s %9s %9s %9s\n", "scope", "min", "avg", "p99");
+
+    for (uint32_t i = 0; i < profiler->scope_count; i++) {
+        struct renderer_gpu_profiler_stats stats;
+        if (!renderer_gpu_profiler_get_stats(
+                profiler,
+                profiler->scopes[i].name,
+                &stats)) {
+            continue;
+        }
+
+        printf("%-20s %9.3f %9.3f %9.3f\n",
+                profiler->scopes[i].name,
+                stats.min,
+                stats.avg,
+                stats.p99);
+    }
+}
+
+void renderer_gpu_profiler_destroy(
+        struct renderer_gpu_profiler* profiler)
+{
+    for (uint32_t i = 0; i < GPU_PROFILER_FRAMES; i++) {
+        vkDestroyQueryPool(
+            profiler->device,
+            profiler->frames[i].query_pool,
+            NULL
+        );
+    }
+
+    vkDestroyQueryPool(profiler->device, profiler->immediate_pool, NULL);
+}
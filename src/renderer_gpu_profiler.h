@@ -0,0 +1,116 @@
+#ifndef RENDERER_GPU_PROFILER_H_
+#define RENDERER_GPU_PROFILER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPU_PROFILER_MAX_SCOPES 32
+#define GPU_PROFILER_MAX_QUERIES 64 // Per frame, two per scope
+#define GPU_PROFILER_HISTORY 256 // Samples kept per scope
+#define GPU_PROFILER_FRAMES 2 // Matches MAX_FRAMES_IN_FLIGHT
+#define GPU_PROFILER_NO_SCOPE UINT32_MAX
+#define GPU_PROFILER_NO_FRAME UINT64_MAX // Samples of one-off submits
+
+struct renderer_gpu_profiler_stats
+{
+    double min, avg, p99; // Milliseconds
+    double latest; // Most recent sample
+    uint64_t latest_frame; // frame_id the latest sample was recorded with
+    uint32_t sample_count;
+};
+
+// Rolling window of GPU times for one named scope
+struct renderer_gpu_profiler_scope
+{
+    const char* name; // Not copied, scope names are string literals
+    float history[GPU_PROFILER_HISTORY]; // Milliseconds
+    uint32_t next; // Where the next sample goes
+    uint32_t sample_count;
+    uint64_t latest_frame;
+};
+
+// Timestamps written during one frame slot, read back once the slot's fence
+// has been waited on
+struct renderer_gpu_profiler_frame
+{
+    VkQueryPool query_pool;
+    uint64_t frame_id; // Given to begin_frame when the queries were written
+    uint32_t query_count;
+    uint32_t scopes[GPU_PROFILER_MAX_QUERIES / 2]; // Scope of each pair
+};
+
+struct renderer_gpu_profiler
+{
+    VkDevice device;
+    double timestamp_period; // Nanoseconds per tick
+    uint64_t timestamp_mask; // Covers timestampValidBits
+
+    struct renderer_gpu_profiler_frame frames[GPU_PROFILER_FRAMES];
+    uint32_t current_frame;
+
+    // Single pair for blocking one-off submits such as uploads
+    VkQueryPool immediate_pool;
+
+    struct renderer_gpu_profiler_scope scopes[GPU_PROFILER_MAX_SCOPES];
+    uint32_t scope_count;
+};
+
+bool renderer_gpu_profiler_init(
+    struct renderer_gpu_profiler* profiler,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    uint32_t queue_family_index
+);
+
+void renderer_gpu_profiler_begin_frame(
+    struct renderer_gpu_profiler* profiler,
+    VkCommandBuffer cmd,
+    uint32_t frame_index,
+    uint64_t frame_id
+);
+
+uint32_t renderer_gpu_profiler_begin_scope(
+    struct renderer_gpu_profiler* profiler,
+    VkCommandBuffer cmd,
+    const char* name
+);
+
+void renderer_gpu_profiler_end_scope(
+    struct renderer_gpu_profiler* profiler,
+    VkCommandBuffer cmd,
+    uint32_t scope
+);
+
+void renderer_gpu_profiler_begin_immediate(
+    struct renderer_gpu_profiler* profiler,
+    VkCommandBuffer cmd
+);
+
+void renderer_gpu_profiler_end_immediate(
+    struct renderer_gpu_profiler* profiler,
+    VkCommandBuffer cmd
+);
+
+void renderer_gpu_profiler_resolve_immediate(
+    struct renderer_gpu_profiler* profiler,
+    const char* name
+);
+
+bool renderer_gpu_profiler_get_stats(
+    struct renderer_gpu_profiler* profiler,
+    const char* name,
+    struct renderer_gpu_profiler_stats* stats
+);
+
+void renderer_gpu_profiler_print_report(
+    struct renderer_gpu_profiler* profiler
+);
+
+void renderer_gpu_profiler_destroy(
+    struct renderer_gpu_profiler* profiler
+);
+
+#endif
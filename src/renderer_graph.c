@@ -0,0 +1,641 @@
+#include "renderer_graph.h"
+#include "renderer_tools.h"
+#include "renderer_gpu_profiler.h"
+
+#include <string.h>
+#include <assert.h>
+
+/* Barriers are derived by walking the passes in order and keeping, per
+ * resource, the last write, the reads since then and the current layout:
+ *
+ * - A layout change always gets an image barrier.
+ * - A read after a write waits for the write and makes it visible, unless
+ *   an earlier barrier already made it visible to the reading stages.
+ * - A write waits for the last write and every read since (WAR).
+ * - Reads of the same state after each other need nothing.
+ *
+ * Buffers only ever need global memory barriers, so they can be swapped
+ * between frames with renderer_graph_set_buffer without recompiling. Image
+ * barriers cover every level, passes working on single levels synchronize
+ * those themselves.
+ *
+ * Transient images are placed first fit, in the order they are first used,
+ * into blocks of memory whose current occupants are no longer used by the
+ * time they are. The first access of each then also waits for the last
+ * access of the previous occupant, which for the first occupant is the last
+ * occupant of the frame before */
+
+#define GRAPH_WRITE_ACCESS ( \
+    VK_ACCESS_SHADER_WRITE_BIT | \
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | \
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | \
+    VK_ACCESS_TRANSFER_WRITE_BIT | \
+    VK_ACCESS_HOST_WRITE_BIT | \
+    VK_ACCESS_MEMORY_WRITE_BIT)
+
+// A resource's state while walking the passes
+struct graph_tracked
+{
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages; // Since the last write
+    VkPipelineStageFlags visible_stages; // Already waited for the write
+    VkAccessFlags visible_access;
+    VkImageLayout layout;
+};
+
+void renderer_graph_init(
+        struct renderer_graph* graph,
+        VkPhysicalDevice physical_device,
+        VkDevice device)
+{
+    memset(graph, 0, sizeof(*graph));
+    graph->physical_device = physical_device;
+    graph->device = device;
+}
+
+static uint32_t add_resource(
+        struct renderer_graph* graph,
+        const char* name,
+        enum renderer_graph_resource_type type)
+{
+    assert(!graph->compiled);
+    assert(graph->resource_count < GRAPH_MAX_RESOURCES);
+
+    uint32_t index = graph->resource_count++;
+    struct renderer_graph_resource* resource = &graph->resources[index];
+    memset(resource, 0, sizeof(*resource));
+    resource->name = name;
+    resource->type = type;
+    resource->aliased = -1;
+
+    return index;
+}
+
+uint32_t renderer_graph_import_buffer(
+        struct renderer_graph* graph,
+        const char* name,
+        VkBuffer buffer,
+        struct renderer_graph_state initial)
+{
+    uint32_t index = add_resource(graph, name, RENDERER_GRAPH_BUFFER);
+    graph->resources[index].buffer = buffer;
+    graph->resources[index].initial = initial;
+
+    return index;
+}
+
+uint32_t renderer_graph_import_image(
+        struct renderer_graph* graph,
+        const char* name,
+        VkImage image,
+        VkImageAspectFlags aspect_mask,
+        struct renderer_graph_state initial)
+{
+    uint32_t index = add_resource(graph, name, RENDERER_GRAPH_IMAGE);
+    graph->resources[index].image = image;
+    graph->resources[index].aspect_mask = aspect_mask;
+    graph->resources[index].initial = initial;
+
+    return index;
+}
+
+uint32_t renderer_graph_create_image(
+        struct renderer_graph* graph,
+        const char* name,
+        const struct renderer_graph_image_info* info)
+{
+    uint32_t index = add_resource(graph, name, RENDERER_GRAPH_TRANSIENT_IMAGE);
+    graph->resources[index].aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT;
+    graph->resources[index].info = *info;
+    graph->resources[index].initial.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    return index;
+}
+
+// For buffers that change every frame, e.g. one per frame in flight
+void renderer_graph_set_buffer(
+        struct renderer_graph* graph,
+        uint32_t resource,
+        VkBuffer buffer)
+{
+    assert(graph->resources[resource].type == RENDERER_GRAPH_BUFFER);
+    graph->resources[resource].buffer = buffer;
+}
+
+// Transient images only exist once the graph is compiled
+VkImage renderer_graph_get_image(
+        struct renderer_graph* graph,
+        uint32_t resource)
+{
+    assert(graph->resources[resource].type != RENDERER_GRAPH_BUFFER);
+    assert(graph->compiled ||
+        graph->resources[resource].type == RENDERER_GRAPH_IMAGE);
+
+    return graph->resources[resource].image;
+}
+
+uint32_t renderer_graph_add_pass(
+        struct renderer_graph* graph,
+        const char* name,
+        renderer_graph_record_fn record,
+        void* user)
+{
+    assert(!graph->compiled);
+    assert(graph->pass_count < GRAPH_MAX_PASSES);
+
+    uint32_t index = graph->pass_count++;
+    struct renderer_graph_pass* pass = &graph->passes[index];
+    memset(pass, 0, sizeof(*pass));
+    pass->name = name;
+    pass->record = record;
+    pass->user = user;
+
+    return index;
+}
+
+// A resource is declared once per pass, as a write if it is also read
+static void add_access(
+        struct renderer_graph* graph,
+        uint32_t pass,
+        uint32_t resource,
+        struct renderer_graph_state state,
+        bool write)
+{
+    assert(!graph->compiled);
+    assert(pass < graph->pass_count && resource < graph->resource_count);
+
+    struct renderer_graph_pass* p = &graph->passes[pass];
+    assert(p->access_count < GRAPH_MAX_ACCESSES);
+    for (uint32_t i = 0; i < p->access_count; i++)
+        assert(p->accesses[i].resource != resource);
+
+    if (graph->resources[resource].type == RENDERER_GRAPH_BUFFER)
+        state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    else
+        assert(state.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+    struct renderer_graph_access* access = &p->accesses[p->access_count++];
+    access->resource = resource;
+    access->state = state;
+    access->write = write;
+}
+
+void renderer_graph_read(
+        struct renderer_graph* graph,
+        uint32_t pass,
+        uint32_t resource,
+        VkPipelineStageFlags stages,
+        VkAccessFlags access,
+        VkImageLayout layout)
+{
+    struct renderer_graph_state state = {stages, access, layout};
+    add_access(graph, pass, resource, state, false);
+}
+
+void renderer_graph_write(
+        struct renderer_graph* graph,
+        uint32_t pass,
+        uint32_t resource,
+        VkPipelineStageFlags stages,
+        VkAccessFlags access,
+        VkImageLayout layout)
+{
+    struct renderer_graph_state state = {stages, access, layout};
+    add_access(graph, pass, resource, state, true);
+}
+
+static const struct renderer_graph_access* find_access(
+        const struct renderer_graph_pass* pass,
+        uint32_t resource)
+{
+    for (uint32_t i = 0; i < pass->access_count; i++) {
+        if (pass->accesses[i].resource == resource)
+            return &pass->accesses[i];
+    }
+
+    return NULL;
+}
+
+static void create_transient_images(
+        struct renderer_graph* graph)
+{
+    VkDevice device = graph->device;
+    VkMemoryRequirements mem_reqs[GRAPH_MAX_RESOURCES];
+    bool placed[GRAPH_MAX_RESOURCES];
+
+    for (uint32_t i = 0; i < graph->resource_count; i++) {
+        struct renderer_graph_resource* resource = &graph->resources[i];
+        placed[i] = resource->type != RENDERER_GRAPH_TRANSIENT_IMAGE;
+        if (placed[i])
+            continue;
+
+        // Lifetime, in passes
+        bool used = false;
+        for (uint32_t j = 0; j < graph->pass_count; j++) {
+            if (!find_access(&graph->passes[j], i))
+                continue;
+            if (!used)
+                resource->first_pass = j;
+            resource->last_pass = j;
+            used = true;
+        }
+        assert(used);
+
+        VkImageCreateInfo image_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = resource->info.format,
+            .extent = {
+                resource->info.extent.width,
+                resource->info.extent.height,
+                1
+            },
+            .mipLevels = resource->info.levels,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = resource->info.usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = NULL,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+        };
+
+        VkResult result;
+        result = vkCreateImage(device, &image_info, NULL, &resource->image);
+        assert(result == VK_SUCCESS);
+
+        vkGetImageMemoryRequirements(device, resource->image, &mem_reqs[i]);
+        graph->transient_bytes += mem_reqs[i].size;
+    }
+
+    VkPhysicalDeviceMemoryProperties mem_props;
+    vkGetPhysicalDeviceMemoryProperties(graph->physical_device, &mem_props);
+
+    // First fit in order of first use
+    while (true) {
+        int32_t next = -1;
+        for (uint32_t i = 0; i < graph->resource_count; i++) {
+            if (!placed[i] && (next < 0 ||
+                    graph->resources[i].first_pass <
+                    graph->resources[next].first_pass))
+                next = i;
+        }
+        if (next < 0)
+            break;
+
+        struct renderer_graph_resource* resource = &graph->resources[next];
+        placed[next] = true;
+
+        uint32_t b;
+        for (b = 0; b < graph->block_count; b++) {
+            struct renderer_graph_block* block = &graph->blocks[b];
+            if (block->last_pass < resource->first_pass &&
+                    (mem_reqs[next].memoryTypeBits &
+                    (1 << block->memory_type)))
+                break;
+        }
+
+        struct renderer_graph_block* block = &graph->blocks[b];
+        if (b == graph->block_count) {
+            assert(graph->block_count < GRAPH_MAX_BLOCKS);
+            graph->block_count++;
+
+            memset(block, 0, sizeof(*block));
+            block->memory_type = renderer_find_memory_type(
+                mem_reqs[next].memoryTypeBits,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                mem_props.memoryTypeCount,
+                mem_props.memoryTypes
+            );
+            block->last_resource = -1;
+        }
+
+        // Every image starts at offset 0, so the block's alignment is
+        // simply the largest one
+        if (mem_reqs[next].size > block->size)
+            block->size = mem_reqs[next].size;
+        block->last_pass = resource->last_pass;
+        resource->aliased = block->last_resource;
+        resource->block = b;
+        block->last_resource = next;
+    }
+
+    for (uint32_t b = 0; b < graph->block_count; b++) {
+        struct renderer_graph_block* block = &graph->blocks[b];
+
+        VkMemoryAllocateInfo alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = NULL,
+            .allocationSize = block->size,
+            .memoryTypeIndex = block->memory_type
+        };
+
+        VkResult result;
+        result = renderer_allocate_memory(device, &alloc_info, &block->memory);
+        assert(result == VK_SUCCESS);
+
+        graph->allocated_bytes += block->size;
+    }
+
+    for (uint32_t i = 0; i < graph->resource_count; i++) {
+        struct renderer_graph_resource* resource = &graph->resources[i];
+        if (resource->type != RENDERER_GRAPH_TRANSIENT_IMAGE)
+            continue;
+
+        struct renderer_graph_block* block = &graph->blocks[resource->block];
+        vkBindImageMemory(device, resource->image, block->memory, 0);
+
+        // The block's first occupant follows its last one from the frame
+        // before
+        if (resource->aliased < 0)
+            resource->aliased = block->last_resource;
+    }
+}
+
+// What a resource was left in by its last pass, for the next user
+static void get_last_use(
+        const struct renderer_graph* graph,
+        uint32_t resource,
+        struct graph_tracked* tracked)
+{
+    const struct renderer_graph_access* access = find_access(
+        &graph->passes[graph->resources[resource].last_pass],
+        resource
+    );
+    assert(access);
+
+    if (access->write) {
+        tracked->write_stages = access->state.stages;
+        tracked->write_access = access->state.access & GRAPH_WRITE_ACCESS;
+    } else {
+        tracked->read_stages = access->state.stages;
+    }
+}
+
+static void get_initial_state(
+        const struct renderer_graph* graph,
+        uint32_t resource,
+        struct graph_tracked* tracked)
+{
+    const struct renderer_graph_resource* r = &graph->resources[resource];
+    memset(tracked, 0, sizeof(*tracked));
+
+    if (r->type == RENDERER_GRAPH_TRANSIENT_IMAGE) {
+        get_last_use(graph, r->aliased, tracked);
+        tracked->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        return;
+    }
+
+    if (r->initial.access & GRAPH_WRITE_ACCESS) {
+        tracked->write_stages = r->initial.stages;
+        tracked->write_access = r->initial.access & GRAPH_WRITE_ACCESS;
+    } else {
+        tracked->read_stages = r->initial.stages;
+    }
+    tracked->layout = r->initial.layout;
+}
+
+// Returns whether the access needs a barrier, filled in if so
+static bool track_access(
+        struct graph_tracked* tracked,
+        const struct renderer_graph_access* access,
+        struct renderer_graph_barrier* barrier)
+{
+    const struct renderer_graph_state* state = &access->state;
+    bool layout_change = state->layout != tracked->layout;
+
+    bool hazard;
+    if (access->write) {
+        hazard = tracked->write_stages || tracked->read_stages;
+    } else {
+        hazard = tracked->write_stages &&
+            ((state->stages & ~tracked->visible_stages) ||
+            (state->access & ~tracked->visible_access));
+    }
+
+    if (hazard || layout_change) {
+        barrier->resource = access->resource;
+        barrier->src.stages = tracked->write_stages;
+        barrier->src.access = tracked->write_access;
+        barrier->src.layout = tracked->layout;
+        barrier->dst = *state;
+
+        // Reads only hold back writes and transitions
+        if (access->write || layout_change)
+            barrier->src.stages |= tracked->read_stages;
+    }
+
+    if (access->write) {
+        tracked->write_stages = state->stages;
+        tracked->write_access = state->access & GRAPH_WRITE_ACCESS;
+        tracked->read_stages = 0;
+        tracked->visible_stages = 0;
+        tracked->visible_access = 0;
+    } else if (layout_change) {
+        // Later readers wait for the transition, which is already visible
+        tracked->write_stages = state->stages;
+        tracked->write_access = 0;
+        tracked->read_stages = state->stages;
+        tracked->visible_stages = state->stages;
+        tracked->visible_access = state->access;
+    } else {
+        tracked->read_stages |= state->stages;
+        if (hazard) {
+            tracked->visible_stages |= state->stages;
+            tracked->visible_access |= state->access;
+        }
+    }
+    tracked->layout = state->layout;
+
+    return hazard || layout_change;
+}
+
+/* Creates the transient images and derives every pass's barriers. The
+ * graph can't be changed afterwards, only executed */
+void renderer_graph_compile(
+        struct renderer_graph* graph)
+{
+    assert(!graph->compiled);
+
+    create_transient_images(graph);
+
+    struct graph_tracked tracked[GRAPH_MAX_RESOURCES];
+    for (uint32_t i = 0; i < graph->resource_count; i++)
+        get_initial_state(graph, i, &tracked[i]);
+
+    for (uint32_t i = 0; i < graph->pass_count; i++) {
+        struct renderer_graph_pass* pass = &graph->passes[i];
+        pass->barrier_count = 0;
+
+        for (uint32_t j = 0; j < pass->access_count; j++) {
+            const struct renderer_graph_access* access = &pass->accesses[j];
+            bool needed = track_access(
+                &tracked[access->resource],
+                access,
+                &pass->barriers[pass->barrier_count]
+            );
+            if (needed)
+                pass->barrier_count++;
+        }
+    }
+
+    graph->final_barrier_count = 0;
+    for (uint32_t i = 0; i < graph->resource_count; i++) {
+        const struct renderer_graph_resource* resource = &graph->resources[i];
+        if (resource->type != RENDERER_GRAPH_IMAGE ||
+                tracked[i].layout == resource->initial.layout)
+            continue;
+
+        struct renderer_graph_barrier* barrier =
+            &graph->final_barriers[graph->final_barrier_count++];
+        barrier->resource = i;
+        barrier->src.stages = tracked[i].write_stages | tracked[i].read_stages;
+        barrier->src.access = tracked[i].write_access;
+        barrier->src.layout = tracked[i].layout;
+        barrier->dst = resource->initial;
+    }
+
+    graph->compiled = true;
+}
+
+// One vkCmdPipelineBarrier for all of them, buffers and hazards without a
+// layout change share a single global memory barrier
+static void record_barriers(
+        const struct renderer_graph* graph,
+        VkCommandBuffer cmd,
+        const struct renderer_graph_barrier* barriers,
+        uint32_t barrier_count)
+{
+    if (barrier_count == 0)
+        return;
+
+    VkPipelineStageFlags src_stages = 0;
+    VkPipelineStageFlags dst_stages = 0;
+
+    VkMemoryBarrier memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = 0,
+        .dstAccessMask = 0
+    };
+    uint32_t memory_barrier_count = 0;
+
+    VkImageMemoryBarrier image_barriers[GRAPH_MAX_RESOURCES];
+    uint32_t image_barrier_count = 0;
+
+    for (uint32_t i = 0; i < barrier_count; i++) {
+        const struct renderer_graph_barrier* barrier = &barriers[i];
+        const struct renderer_graph_resource* resource =
+            &graph->resources[barrier->resource];
+
+        src_stages |= barrier->src.stages;
+        dst_stages |= barrier->dst.stages;
+
+        if (resource->type == RENDERER_GRAPH_BUFFER ||
+                barrier->src.layout == barrier->dst.layout) {
+            memory_barrier.srcAccessMask |= barrier->src.access;
+            memory_barrier.dstAccessMask |= barrier->dst.access;
+            memory_barrier_count = 1;
+            continue;
+        }
+
+        VkImageMemoryBarrier image_barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = barrier->src.access,
+            .dstAccessMask = barrier->dst.access,
+            .oldLayout = barrier->src.layout,
+            .newLayout = barrier->dst.layout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = resource->image,
+            .subresourceRange = {
+                resource->aspect_mask,
+                0,
+                VK_REMAINING_MIP_LEVELS,
+                0,
+                VK_REMAINING_ARRAY_LAYERS
+            }
+        };
+        image_barriers[image_barrier_count++] = image_barrier;
+    }
+
+    // Nothing to wait for, e.g. the first use of a transient image
+    if (src_stages == 0)
+        src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+    vkCmdPipelineBarrier(
+        cmd,
+        src_stages,
+        dst_stages,
+        0,
+        memory_barrier_count,
+        &memory_barrier,
+        0,
+        NULL,
+        image_barrier_count,
+        image_barriers
+    );
+}
+
+/* Records every pass with its barriers before it, each pass in a GPU
+ * profiler scope of its name if there is a profiler */
+void renderer_graph_execute(
+        struct renderer_graph* graph,
+        VkCommandBuffer cmd,
+        struct renderer_gpu_profiler* profiler)
+{
+    assert(graph->compiled);
+
+    for (uint32_t i = 0; i < graph->pass_count; i++) {
+        struct renderer_graph_pass* pass = &graph->passes[i];
+
+        record_barriers(graph, cmd, pass->barriers, pass->barrier_count);
+
+        if (!pass->record)
+            continue;
+
+        uint32_t scope = GPU_PROFILER_NO_SCOPE;
+        if (profiler)
+            scope = renderer_gpu_profiler_begin_scope(profiler, cmd, pass->name);
+
+        pass->record(cmd, pass->user);
+
+        if (profiler)
+            renderer_gpu_profiler_end_scope(profiler, cmd, scope);
+    }
+
+    record_barriers(
+        graph,
+        cmd,
+        graph->final_barriers,
+        graph->final_barrier_count
+    );
+}
+
+// The GPU must be done with the graph's last execution
+void renderer_graph_destroy(
+        struct renderer_graph* graph)
+{
+    VkDevice device = graph->device;
+
+    for (uint32_t i = 0; i < graph->resource_count; i++) {
+        struct renderer_graph_resource* resource = &graph->resources[i];
+        if (resource->type == RENDERER_GRAPH_TRANSIENT_IMAGE)
+            vkDestroyImage(device, resource->image, NULL);
+    }
+
+    for (uint32_t i = 0; i < graph->block_count; i++) {
+        renderer_free_memory(
+            device,
+            graph->blocks[i].memory,
+            graph->blocks[i].size
+        );
+    }
+
+    renderer_graph_init(graph, graph->physical_device, device);
+}
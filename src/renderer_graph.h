@@ -0,0 +1,206 @@
+#ifndef RENDERER_GRAPH_H_
+#define RENDERER_GRAPH_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GRAPH_MAX_RESOURCES 32
+#define GRAPH_MAX_PASSES 16
+#define GRAPH_MAX_ACCESSES 8 // Per pass
+#define GRAPH_MAX_BLOCKS GRAPH_MAX_RESOURCES
+
+struct renderer_gpu_profiler;
+
+// Records a pass, with the barriers for its declared accesses already done
+typedef void (*renderer_graph_record_fn)(VkCommandBuffer cmd, void* user);
+
+// How a pass uses a resource, or the state a resource is in
+struct renderer_graph_state
+{
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout; // Images only
+};
+
+enum renderer_graph_resource_type
+{
+    RENDERER_GRAPH_BUFFER,
+    RENDERER_GRAPH_IMAGE, // Owned elsewhere, e.g. a render pass attachment
+    RENDERER_GRAPH_TRANSIENT_IMAGE // Created by the graph, memory aliased
+};
+
+// Transient images are created by renderer_graph_compile
+struct renderer_graph_image_info
+{
+    VkFormat format;
+    VkExtent2D extent;
+    uint32_t levels;
+    VkImageUsageFlags usage;
+};
+
+struct renderer_graph_resource
+{
+    const char* name; // Not copied
+    enum renderer_graph_resource_type type;
+
+    VkBuffer buffer;
+    VkImage image;
+    VkImageAspectFlags aspect_mask;
+    struct renderer_graph_image_info info;
+
+    // Imported resources only, their last use before the graph starts.
+    // Images are transitioned back to this layout after the last pass
+    struct renderer_graph_state initial;
+
+    // Transient images only, passes using them and where they live
+    uint32_t first_pass, last_pass;
+    uint32_t block;
+    int32_t aliased; // Previous user of the block's memory, maybe itself
+};
+
+struct renderer_graph_access
+{
+    uint32_t resource;
+    struct renderer_graph_state state;
+    bool write;
+};
+
+// Layout transitions and the hazards on one resource before a pass
+struct renderer_graph_barrier
+{
+    uint32_t resource;
+    struct renderer_graph_state src;
+    struct renderer_graph_state dst;
+};
+
+struct renderer_graph_pass
+{
+    const char* name; // Not copied, also the GPU profiler scope
+    renderer_graph_record_fn record; // May be NULL for a pure transition
+    void* user;
+
+    struct renderer_graph_access accesses[GRAPH_MAX_ACCESSES];
+    uint32_t access_count;
+
+    // Computed by renderer_graph_compile, issued in one batch
+    struct renderer_graph_barrier barriers[GRAPH_MAX_ACCESSES];
+    uint32_t barrier_count;
+};
+
+// Device memory shared by transient images whose lifetimes don't overlap
+struct renderer_graph_block
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    uint32_t last_pass; // Last pass using any resource placed so far
+    int32_t last_resource;
+};
+
+/* Passes run in the order they are added. Each declares the resources it
+ * touches and how, and the barriers and layout transitions between them
+ * are derived from that once, in renderer_graph_compile */
+struct renderer_graph
+{
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+
+    struct renderer_graph_resource resources[GRAPH_MAX_RESOURCES];
+    uint32_t resource_count;
+
+    struct renderer_graph_pass passes[GRAPH_MAX_PASSES];
+    uint32_t pass_count;
+
+    // Back to the initial layouts, after the last pass
+    struct renderer_graph_barrier final_barriers[GRAPH_MAX_RESOURCES];
+    uint32_t final_barrier_count;
+
+    struct renderer_graph_block blocks[GRAPH_MAX_BLOCKS];
+    uint32_t block_count;
+
+    VkDeviceSize transient_bytes; // Requested by the transient images
+    VkDeviceSize allocated_bytes; // Allocated for them after aliasing
+    bool compiled;
+};
+
+void renderer_graph_init(
+    struct renderer_graph* graph,
+    VkPhysicalDevice physical_device,
+    VkDevice device
+);
+
+uint32_t renderer_graph_import_buffer(
+    struct renderer_graph* graph,
+    const char* name,
+    VkBuffer buffer,
+    struct renderer_graph_state initial
+);
+
+uint32_t renderer_graph_import_image(
+    struct renderer_graph* graph,
+    const char* name,
+    VkImage image,
+    VkImageAspectFlags aspect_mask,
+    struct renderer_graph_state initial
+);
+
+uint32_t renderer_graph_create_image(
+    struct renderer_graph* graph,
+    const char* name,
+    const struct renderer_graph_image_info* info
+);
+
+void renderer_graph_set_buffer(
+    struct renderer_graph* graph,
+    uint32_t resource,
+    VkBuffer buffer
+);
+
+VkImage renderer_graph_get_image(
+    struct renderer_graph* graph,
+    uint32_t resource
+);
+
+uint32_t renderer_graph_add_pass(
+    struct renderer_graph* graph,
+    const char* name,
+    renderer_graph_record_fn record,
+    void* user
+);
+
+void renderer_graph_read(
+    struct renderer_graph* graph,
+    uint32_t pass,
+    uint32_t resource,
+    VkPipelineStageFlags stages,
+    VkAccessFlags access,
+    VkImageLayout layout
+);
+
+void renderer_graph_write(
+    struct renderer_graph* graph,
+    uint32_t pass,
+    uint32_t resource,
+    VkPipelineStageFlags stages,
+    VkAccessFlags access,
+    VkImageLayout layout
+);
+
+void renderer_graph_compile(
+    struct renderer_graph* graph
+);
+
+void renderer_graph_execute(
+    struct renderer_graph* graph,
+    VkCommandBuffer cmd,
+    struct renderer_gpu_profiler* profiler
+);
+
+void renderer_graph_destroy(
+    struct renderer_graph* graph
+);
+
+#endif
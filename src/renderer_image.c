@@ -1,6 +1,7 @@
 #include "renderer_buffer.h"
 #include "renderer_tools.h"
 #include "renderer_image.h"
+#include "cpu_profiler.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -16,6 +17,7 @@ struct renderer_image renderer_get_image(
         VkFormat format,
         VkImageAspectFlags aspect_mask,
         VkImageTiling tiling,
+        VkSampleCountFlagBits samples,
         VkImageUsageFlags usage,
         VkMemoryPropertyFlags memory_flags)
 {
@@ -34,7 +36,7 @@ struct renderer_image renderer_get_image(
         .extent = {extent.width, extent.height, 1},
         .mipLevels = 1,
         .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .samples = samples,
         .tiling = tiling,
         .usage = usage,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
@@ -53,6 +55,20 @@ struct renderer_image renderer_get_image(
     VkPhysicalDeviceMemoryProperties mem_props;
     vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
 
+    // Transient attachments never leave tile memory on tiled GPUs, which
+    // then need not back them at all. Other GPUs have no lazily allocated
+    // memory and get the flags asked for
+    VkMemoryPropertyFlags lazy_flags =
+        memory_flags | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    if ((usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) &&
+            renderer_has_memory_type(
+                mem_reqs.memoryTypeBits,
+                lazy_flags,
+                mem_props.memoryTypeCount,
+                mem_props.memoryTypes)) {
+        memory_flags = lazy_flags;
+    }
+
     VkMemoryAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
         .pNext = NULL,
@@ -65,8 +81,9 @@ struct renderer_image renderer_get_image(
         )
     };
 
-    result = vkAllocateMemory(device, &alloc_info, NULL, &image.memory);
+    result = renderer_allocate_memory(device, &alloc_info, &image.memory);
     assert(result == VK_SUCCESS);
+    image.memory_size = mem_reqs.size;
 
     vkBindImageMemory(device, image.image, image.memory, 0);
 
@@ -118,6 +135,7 @@ struct renderer_image renderer_get_sampled_image(
         format,
         aspect_mask,
         tiling,
+        VK_SAMPLE_COUNT_1_BIT,
         usage,
         memory_flags
     );
@@ -290,15 +308,14 @@ void renderer_change_image_layout(
     );
 }
 
-struct renderer_image renderer_load_texture(
-    const char* src,
-    VkPhysicalDevice physical_device,
-    VkDevice device,
-    VkQueue queue,
-    VkCommandPool command_pool)
+/* Decodes an image file into tightly packed RGBA8 pixels, NULL if it can't
+ * be read. Touches no Vulkan objects, so any thread may call it. Free the
+ * pixels with renderer_free_texture_file */
+void* renderer_read_texture_file(
+        const char* src,
+        uint32_t* width,
+        uint32_t* height)
 {
-    struct renderer_image tex_image;
-
     stbi_uc* pixels = NULL;
     int tex_width, tex_height, tex_channels;
     pixels = stbi_load(
@@ -308,11 +325,73 @@ struct renderer_image renderer_load_texture(
         &tex_channels,
         STBI_rgb_alpha
     );
-    assert(pixels && tex_width && tex_height);
+    if (!pixels || !tex_width || !tex_height) {
+        stbi_image_free(pixels);
+        return NULL;
+    }
+
+    *width = tex_width;
+    *height = tex_height;
+
+    return pixels;
+}
 
-    VkDeviceSize image_size = tex_width * tex_height * 4;
+void renderer_free_texture_file(
+        void* pixels)
+{
+    stbi_image_free(pixels);
+}
 
-    VkExtent2D extent = {.width = tex_width, .height = tex_height};
+struct renderer_image renderer_load_texture(
+    const char* src,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    VkQueue queue,
+    VkCommandPool command_pool,
+    struct renderer_gpu_profiler* profiler)
+{
+    struct cpu_profiler_scope scope = cpu_profiler_begin("load texture");
+
+    uint32_t tex_width = 0, tex_height = 0;
+    void* pixels = renderer_read_texture_file(src, &tex_width, &tex_height);
+    assert(pixels);
+
+    struct renderer_image tex_image;
+    tex_image = renderer_create_texture(
+        pixels,
+        tex_width,
+        tex_height,
+        physical_device,
+        device,
+        queue,
+        command_pool,
+        profiler
+    );
+
+    renderer_free_texture_file(pixels);
+
+    cpu_profiler_end(&scope);
+
+    return tex_image;
+}
+
+/* Uploads tightly packed RGBA8 pixels into a sampled image, for textures
+ * that are generated rather than loaded from a file */
+struct renderer_image renderer_create_texture(
+        const void* pixels,
+        uint32_t width,
+        uint32_t height,
+        VkPhysicalDevice physical_device,
+        VkDevice device,
+        VkQueue queue,
+        VkCommandPool command_pool,
+        struct renderer_gpu_profiler* profiler)
+{
+    struct renderer_image tex_image;
+
+    VkDeviceSize image_size = (VkDeviceSize)width * height * 4;
+
+    VkExtent2D extent = {.width = width, .height = height};
     tex_image = renderer_get_sampled_image(
         physical_device,
         device,
@@ -349,8 +428,6 @@ struct renderer_image renderer_load_texture(
     memcpy(mapped, pixels, (size_t)image_size);
     vkUnmapMemory(device, staging_buffer.memory);
 
-    stbi_image_free(pixels);
-
     renderer_change_image_layout(
         device,
         queue,
@@ -362,14 +439,15 @@ struct renderer_image renderer_load_texture(
         VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    VkExtent3D copy_extent = {tex_width, tex_height, 1};
+    VkExtent3D copy_extent = {width, height, 1};
     renderer_copy_buffer_to_image(
         device,
         command_pool,
         queue,
         staging_buffer.buffer,
         tex_image.image,
-        copy_extent
+        copy_extent,
+        profiler
     );
 
     renderer_change_image_layout(
@@ -383,8 +461,20 @@ struct renderer_image renderer_load_texture(
         VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    vkDestroyBuffer(device, staging_buffer.buffer, NULL);
-    vkFreeMemory(device, staging_buffer.memory, NULL);
+    renderer_destroy_buffer(device, &staging_buffer);
 
     return tex_image;
 }
+
+// The sampler is only destroyed if the image has one
+void renderer_destroy_image(
+        VkDevice device,
+        struct renderer_image* image)
+{
+    if (image->sampler != VK_NULL_HANDLE)
+        vkDestroySampler(device, image->sampler, NULL);
+
+    vkDestroyImageView(device, image->image_view, NULL);
+    vkDestroyImage(device, image->image, NULL);
+    renderer_free_memory(device, image->memory, image->memory_size);
+}
@@ -4,11 +4,14 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+struct renderer_gpu_profiler;
+
 struct renderer_image
 {
     VkImage image;
     VkImageView image_view;
     VkDeviceMemory memory;
+    VkDeviceSize memory_size;
     VkSampler sampler;
     uint32_t width, height;
 };
@@ -20,6 +23,7 @@ struct renderer_image renderer_get_image(
     VkFormat format,
     VkImageAspectFlags aspect_mask,
     VkImageTiling tiling,
+    VkSampleCountFlagBits samples,
     VkImageUsageFlags usage,
     VkMemoryPropertyFlags memory_flags
 );
@@ -46,12 +50,39 @@ void renderer_change_image_layout(
     VkImageAspectFlags aspect_mask
 );
 
+void* renderer_read_texture_file(
+    const char* src,
+    uint32_t* width,
+    uint32_t* height
+);
+
+void renderer_free_texture_file(
+    void* pixels
+);
+
 struct renderer_image renderer_load_texture(
     const char* src,
     VkPhysicalDevice physical_device,
     VkDevice device,
     VkQueue queue,
-    VkCommandPool command_pool
+    VkCommandPool command_pool,
+    struct renderer_gpu_profiler* profiler
+);
+
+struct renderer_image renderer_create_texture(
+    const void* pixels,
+    uint32_t width,
+    uint32_t height,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    VkQueue queue,
+    VkCommandPool command_pool,
+    struct renderer_gpu_profiler* profiler
+);
+
+void renderer_destroy_image(
+    VkDevice device,
+    struct renderer_image* image
 );
 
 #endif
@@ -4,15 +4,20 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "renderer_registry.h"
+
 #include <stdint.h>
 
+// The buffers are registry handles, shared by every mesh uploaded together
 struct renderer_mesh
 {
-    struct renderer_buffer* vbo;
-    uint32_t vbo_offset;
-    struct renderer_buffer* ibo;
+    struct renderer_resource_handle position_vbo;
+    struct renderer_resource_handle vbo; // Attributes other than position
+    uint32_t vbo_offset; // First vertex, the same in both streams
+    struct renderer_resource_handle ibo;
     uint32_t ibo_offset;
     uint32_t index_count;
+    float center[3], radius; // Bounding sphere in model space
 };
 
 #endif
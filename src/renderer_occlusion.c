@@ -0,0 +1,1362 @@
+#include "renderer_buffer.h"
+#include "renderer_image.h"
+#include "renderer_tools.h"
+#include "renderer_mesh.h"
+#include "renderer.h"
+#include "renderer_occlusion.h"
+#include "renderer_pipeline_stats.h"
+#include "cpu_profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Two phase occlusion culling against a hierarchical depth buffer:
+ *
+ * 1. The objects visible at the end of the last frame (and inside the
+ *    frustum) are drawn in the first pass.
+ * 2. A pyramid of the farthest depth per region is built from its depth.
+ * 3. Every object's bounds are tested against the pyramid. Objects that
+ *    turn out visible but were not drawn yet are drawn in the second pass,
+ *    and the result is kept as the visible set for the next frame.
+ *
+ * Objects only pop in when they were hidden by something that disappeared,
+ * and then only for a frame. The draws are indirect with the instance
+ * count written by the cull shader, so the CPU never waits on the results */
+
+#define OCCLUSION_REDUCE_SHADER "assets/shaders/hiz_reduce.spv"
+#define OCCLUSION_CULL_SHADER "assets/shaders/occlusion_cull.spv"
+
+// Matches the push constants of hiz_reduce.comp
+struct occlusion_reduce_constants
+{
+    uint32_t src_size[2];
+    uint32_t dst_size[2];
+};
+
+// Matches the push constants of occlusion_cull.comp
+struct occlusion_cull_constants
+{
+    mat4x4 view_projection;
+    uint32_t pyramid_size[2];
+    uint32_t pyramid_levels;
+    uint32_t object_count;
+    uint32_t phase;
+};
+
+static VkShaderModule load_shader(
+        VkDevice device,
+        const char* path)
+{
+    size_t size = renderer_get_file_size(path);
+    char* code = malloc(size);
+    assert(code);
+    renderer_read_file_to_buffer(path, &code, size);
+
+    VkShaderModule module = renderer_get_shader_module(device, code, size);
+    free(code);
+
+    return module;
+}
+
+static VkPipeline get_compute_pipeline(
+        VkDevice device,
+        VkPipelineLayout layout,
+        const char* path)
+{
+    VkShaderModule module = load_shader(device, path);
+
+    VkComputePipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+            .pSpecializationInfo = NULL
+        },
+        .layout = layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1
+    };
+
+    VkPipeline pipeline;
+    VkResult result;
+    result = vkCreateComputePipelines(
+        device,
+        VK_NULL_HANDLE,
+        1,
+        &pipeline_info,
+        NULL,
+        &pipeline
+    );
+    assert(result == VK_SUCCESS);
+
+    vkDestroyShaderModule(device, module, NULL);
+
+    return pipeline;
+}
+
+static VkPipelineLayout get_compute_pipeline_layout(
+        VkDevice device,
+        VkDescriptorSetLayout* descriptor_layout,
+        uint32_t push_constant_size)
+{
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = push_constant_size
+    };
+
+    return renderer_get_pipeline_layout(
+        device,
+        descriptor_layout,
+        1,
+        &push_constant_range,
+        1
+    );
+}
+
+static VkDescriptorSetLayout get_descriptor_layout(
+        VkDevice device,
+        const VkDescriptorType* types,
+        uint32_t binding_count)
+{
+    VkDescriptorSetLayoutBinding bindings[8];
+    assert(binding_count <= 8);
+
+    for (uint32_t i = 0; i < binding_count; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = NULL;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .bindingCount = binding_count,
+        .pBindings = bindings
+    };
+
+    VkDescriptorSetLayout layout;
+    VkResult result;
+    result = vkCreateDescriptorSetLayout(device, &layout_info, NULL, &layout);
+    assert(result == VK_SUCCESS);
+
+    return layout;
+}
+
+static VkExtent2D get_level_extent(
+        VkExtent2D extent,
+        uint32_t level)
+{
+    VkExtent2D level_extent = {
+        .width = MAX(extent.width >> level, 1),
+        .height = MAX(extent.height >> level, 1)
+    };
+
+    return level_extent;
+}
+
+// Points the sets at the current depth image and pyramid
+static void write_descriptors(
+        struct renderer_occlusion* occlusion,
+        VkImageView depth_view)
+{
+    for (uint32_t i = 0; i < occlusion->level_count; i++) {
+        // Level 0 copies the depth buffer, each other level reduces the one
+        // below it
+        VkDescriptorImageInfo src_info = {
+            .sampler = occlusion->sampler,
+            .imageView = i == 0 ? depth_view : occlusion->level_views[i - 1],
+            .imageLayout = i == 0 ?
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL :
+                VK_IMAGE_LAYOUT_GENERAL
+        };
+
+        VkDescriptorImageInfo dst_info = {
+            .sampler = VK_NULL_HANDLE,
+            .imageView = occlusion->level_views[i],
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+        };
+
+        VkWriteDescriptorSet writes[] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = NULL,
+                .dstSet = occlusion->reduce_sets[i],
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &src_info,
+                .pBufferInfo = NULL,
+                .pTexelBufferView = NULL
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = NULL,
+                .dstSet = occlusion->reduce_sets[i],
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &dst_info,
+                .pBufferInfo = NULL,
+                .pTexelBufferView = NULL
+            }
+        };
+
+        vkUpdateDescriptorSets(occlusion->device, 2, writes, 0, NULL);
+    }
+
+    VkDescriptorImageInfo pyramid_info = {
+        .sampler = occlusion->sampler,
+        .imageView = occlusion->pyramid_view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    };
+
+    for (uint32_t i = 0; i < OCCLUSION_FRAMES; i++) {
+        VkDescriptorBufferInfo buffer_infos[] = {
+            {occlusion->objects[i].buffer, 0, VK_WHOLE_SIZE},
+            {occlusion->first_args[i].buffer, 0, VK_WHOLE_SIZE},
+            {occlusion->second_args[i].buffer, 0, VK_WHOLE_SIZE},
+            {occlusion->visibility.buffer, 0, VK_WHOLE_SIZE}
+        };
+
+        VkWriteDescriptorSet writes[] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = NULL,
+                .dstSet = occlusion->cull_sets[i],
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &pyramid_info,
+                .pBufferInfo = NULL,
+                .pTexelBufferView = NULL
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = NULL,
+                .dstSet = occlusion->cull_sets[i],
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 4, // Bindings 1 to 4
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pImageInfo = NULL,
+                .pBufferInfo = buffer_infos,
+                .pTexelBufferView = NULL
+            }
+        };
+
+        vkUpdateDescriptorSets(occlusion->device, 2, writes, 0, NULL);
+    }
+}
+
+static void memory_barrier(
+        VkCommandBuffer cmd,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags dst_access)
+{
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access
+    };
+
+    vkCmdPipelineBarrier(
+        cmd,
+        src_stage,
+        dst_stage,
+        0,
+        1,
+        &barrier,
+        0,
+        NULL,
+        0,
+        NULL
+    );
+}
+
+// The slot's fence has been waited on, so its args hold the GPU's decisions
+static void read_counts(
+        struct renderer_occlusion* occlusion,
+        uint32_t frame_index)
+{
+    uint32_t count = occlusion->object_counts[frame_index];
+    const VkDrawIndexedIndirectCommand* first_args;
+    first_args = occlusion->first_args[frame_index].mapped;
+    const VkDrawIndexedIndirectCommand* second_args;
+    second_args = occlusion->second_args[frame_index].mapped;
+
+    struct renderer_occlusion_counts counts;
+    memset(&counts, 0, sizeof(counts));
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t instances =
+            first_args[i].instanceCount + second_args[i].instanceCount;
+
+        counts.first_pass += first_args[i].instanceCount;
+        counts.second_pass += second_args[i].instanceCount;
+        counts.triangle_count +=
+            (uint64_t)instances * first_args[i].indexCount / 3;
+    }
+    counts.culled = count - counts.first_pass - counts.second_pass;
+
+    occlusion->latest = counts;
+}
+
+static void record_pass(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources,
+        VkCommandBuffer cmd,
+        uint32_t image_index,
+        VkRenderPass render_pass,
+        VkBuffer args,
+        uint32_t count)
+{
+    VkClearValue clear_values[] = {
+        {.color.float32 = {0.2f, 0.2f, 0.2f, 1.0f}},
+        {.depthStencil = {1.0f, 0}}
+    };
+
+    VkRenderPassBeginInfo render_pass_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .pNext = NULL,
+        .renderPass = render_pass,
+        .framebuffer = resources->framebuffers[image_index],
+        .renderArea.offset = {0, 0},
+        .renderArea.extent = resources->swapchain_extent,
+        .clearValueCount = 2,
+        .pClearValues = clear_values
+    };
+
+    // Recorded inline, the draws depend on this frame's args buffers so
+    // there is nothing to gain from caching them in secondaries
+    vkCmdBeginRenderPass(cmd, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+
+    struct renderer_registry* registry = &resources->registry;
+    vkCmdBindPipeline(
+        cmd,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        renderer_registry_get_pipeline(registry, resources->graphics_pipeline)
+    );
+
+    VkViewport viewport = {
+        .x = 0,
+        .y = 0,
+        .width = (float)resources->swapchain_extent.width,
+        .height = (float)resources->swapchain_extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = resources->swapchain_extent
+    };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    // All meshes share the buffers, only drawables with a mesh were kept
+    if (count > 0) {
+        renderer_bind_mesh_buffers(
+            registry,
+            cmd,
+            renderer_registry_get_mesh(
+                registry,
+                occlusion->draws[0].drawable->mesh
+            )
+        );
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct renderer_drawable* drawable = occlusion->draws[i].drawable;
+        struct renderer_texture* texture = renderer_registry_get_texture(
+            registry,
+            drawable->texture
+        );
+
+        VkDescriptorSet* descriptor_set = &resources->descriptor_set;
+        if (texture)
+            descriptor_set = &texture->descriptor_set;
+
+        uint32_t dynamic_offsets[2] = {
+            renderer_get_view_projection_offset(
+                resources->matrix_alignment,
+                image_index
+            ),
+            occlusion->matrix_offsets[i]
+        };
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            resources->pipeline_layout,
+            0,
+            1,
+            descriptor_set,
+            2,
+            dynamic_offsets
+        );
+
+        vkCmdDrawIndexedIndirect(
+            cmd,
+            args,
+            i * sizeof(VkDrawIndexedIndirectCommand),
+            1,
+            sizeof(VkDrawIndexedIndirectCommand)
+        );
+    }
+
+    vkCmdEndRenderPass(cmd);
+}
+
+static void record_cull(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources,
+        VkCommandBuffer cmd,
+        uint32_t frame_index,
+        uint32_t count,
+        uint32_t phase)
+{
+    struct occlusion_cull_constants constants;
+    memcpy(
+        constants.view_projection,
+        resources->view_proj_matrix,
+        sizeof(mat4x4)
+    );
+    constants.pyramid_size[0] = occlusion->pyramid_extent.width;
+    constants.pyramid_size[1] = occlusion->pyramid_extent.height;
+    constants.pyramid_levels = occlusion->level_count;
+    constants.object_count = count;
+    constants.phase = phase;
+
+    vkCmdBindPipeline(
+        cmd,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        occlusion->cull_pipeline
+    );
+    vkCmdBindDescriptorSets(
+        cmd,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        occlusion->cull_pipeline_layout,
+        0,
+        1,
+        &occlusion->cull_sets[frame_index],
+        0,
+        NULL
+    );
+    vkCmdPushConstants(
+        cmd,
+        occlusion->cull_pipeline_layout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof(constants),
+        &constants
+    );
+    vkCmdDispatch(cmd, (count + 63) / 64, 1, 1);
+}
+
+/* Expects the depth image in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL.
+ * The graph only tracks whole images, so the barriers between levels are
+ * done here */
+static void record_pyramid(
+        struct renderer_occlusion* occlusion,
+        VkCommandBuffer cmd)
+{
+    vkCmdBindPipeline(
+        cmd,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        occlusion->reduce_pipeline
+    );
+
+    for (uint32_t i = 0; i < occlusion->level_count; i++) {
+        VkExtent2D src = get_level_extent(
+            occlusion->pyramid_extent,
+            i == 0 ? 0 : i - 1
+        );
+        VkExtent2D dst = get_level_extent(occlusion->pyramid_extent, i);
+
+        struct occlusion_reduce_constants constants = {
+            .src_size = {src.width, src.height},
+            .dst_size = {dst.width, dst.height}
+        };
+
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            occlusion->reduce_pipeline_layout,
+            0,
+            1,
+            &occlusion->reduce_sets[i],
+            0,
+            NULL
+        );
+        vkCmdPushConstants(
+            cmd,
+            occlusion->reduce_pipeline_layout,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            0,
+            sizeof(constants),
+            &constants
+        );
+        vkCmdDispatch(cmd, (dst.width + 7) / 8, (dst.height + 7) / 8, 1);
+
+        if (i + 1 == occlusion->level_count)
+            break;
+
+        memory_barrier(
+            cmd,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT
+        );
+    }
+}
+
+// The graph's passes, for the frame set up by renderer_occlusion_record
+
+static void record_cull_visible(
+        VkCommandBuffer cmd,
+        void* user)
+{
+    struct renderer_occlusion* occlusion = user;
+    uint32_t frame_index = occlusion->frame_index;
+
+    record_cull(
+        occlusion,
+        occlusion->resources,
+        cmd,
+        frame_index,
+        occlusion->object_counts[frame_index],
+        0
+    );
+}
+
+static void record_first_pass(
+        VkCommandBuffer cmd,
+        void* user)
+{
+    struct renderer_occlusion* occlusion = user;
+    struct renderer_resources* resources = occlusion->resources;
+    uint32_t frame_index = occlusion->frame_index;
+
+    // Covers both passes, ended by record_second_pass
+    if (resources->pipeline_stats)
+        renderer_pipeline_stats_begin(resources->pipeline_stats, cmd);
+
+    record_pass(
+        occlusion,
+        resources,
+        cmd,
+        occlusion->image_index,
+        occlusion->first_pass,
+        occlusion->first_args[frame_index].buffer,
+        occlusion->object_counts[frame_index]
+    );
+}
+
+static void record_depth_pyramid(
+        VkCommandBuffer cmd,
+        void* user)
+{
+    record_pyramid(user, cmd);
+}
+
+static void record_cull_hidden(
+        VkCommandBuffer cmd,
+        void* user)
+{
+    struct renderer_occlusion* occlusion = user;
+    uint32_t frame_index = occlusion->frame_index;
+
+    record_cull(
+        occlusion,
+        occlusion->resources,
+        cmd,
+        frame_index,
+        occlusion->object_counts[frame_index],
+        1
+    );
+}
+
+static void record_second_pass(
+        VkCommandBuffer cmd,
+        void* user)
+{
+    struct renderer_occlusion* occlusion = user;
+    struct renderer_resources* resources = occlusion->resources;
+    uint32_t frame_index = occlusion->frame_index;
+
+    record_pass(
+        occlusion,
+        resources,
+        cmd,
+        occlusion->image_index,
+        occlusion->second_pass,
+        occlusion->second_args[frame_index].buffer,
+        occlusion->object_counts[frame_index]
+    );
+
+    if (resources->pipeline_stats)
+        renderer_pipeline_stats_end(resources->pipeline_stats, cmd);
+}
+
+/* Declares what each pass reads and writes, the barriers and the pyramid's
+ * memory come from renderer_graph_compile. The per frame buffers are set
+ * before each execution */
+static void build_graph(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources)
+{
+    struct renderer_graph* graph = &occlusion->graph;
+    VkDevice device = occlusion->device;
+    VkExtent2D extent = resources->swapchain_extent;
+
+    occlusion->pyramid_extent = extent;
+    occlusion->level_count = 1;
+    while (occlusion->level_count < OCCLUSION_MAX_LEVELS &&
+            MAX(extent.width, extent.height) >> occlusion->level_count)
+        occlusion->level_count++;
+
+    renderer_graph_init(graph, resources->physical_device, device);
+
+    // Layouts of depth/stencil images change for both aspects together
+    VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (resources->depth_format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+            resources->depth_format == VK_FORMAT_D24_UNORM_S8_UINT) {
+        depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    // Left by the second pass of the frame before, or never used yet
+    struct renderer_graph_state depth_state = {
+        .stages = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+    uint32_t depth = renderer_graph_import_image(
+        graph,
+        "depth",
+        resources->depth_image.image,
+        depth_aspect,
+        depth_state
+    );
+
+    // Written by the culling of the frame before
+    struct renderer_graph_state visibility_state = {
+        .stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        .access = VK_ACCESS_SHADER_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    uint32_t visibility = renderer_graph_import_buffer(
+        graph,
+        "visibility",
+        occlusion->visibility.buffer,
+        visibility_state
+    );
+
+    // Only written by the CPU before the frame is submitted
+    struct renderer_graph_state host_state = {0, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+    uint32_t objects = renderer_graph_import_buffer(
+        graph,
+        "objects",
+        VK_NULL_HANDLE,
+        host_state
+    );
+    uint32_t first_args = renderer_graph_import_buffer(
+        graph,
+        "first args",
+        VK_NULL_HANDLE,
+        host_state
+    );
+    uint32_t second_args = renderer_graph_import_buffer(
+        graph,
+        "second args",
+        VK_NULL_HANDLE,
+        host_state
+    );
+    occlusion->objects_resource = objects;
+    occlusion->first_args_resource = first_args;
+    occlusion->second_args_resource = second_args;
+
+    struct renderer_graph_image_info pyramid_info = {
+        .format = VK_FORMAT_R32_SFLOAT,
+        .extent = extent,
+        .levels = occlusion->level_count,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+    };
+    uint32_t pyramid = renderer_graph_create_image(
+        graph,
+        "depth pyramid",
+        &pyramid_info
+    );
+    occlusion->pyramid = pyramid;
+
+    VkPipelineStageFlags compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkPipelineStageFlags depth_tests =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    VkAccessFlags depth_access =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    VkImageLayout no_layout = VK_IMAGE_LAYOUT_UNDEFINED; // Buffers
+
+    // Phase 0 doesn't sample the pyramid, but it is bound
+    uint32_t pass = renderer_graph_add_pass(
+        graph,
+        "cull visible",
+        record_cull_visible,
+        occlusion
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        objects,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        no_layout
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        visibility,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        no_layout
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        first_args,
+        compute,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        no_layout
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        pyramid,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL
+    );
+
+    pass = renderer_graph_add_pass(
+        graph,
+        "first pass",
+        record_first_pass,
+        occlusion
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        first_args,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        no_layout
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        depth,
+        depth_tests,
+        depth_access,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    );
+
+    // Each level reads the one below it
+    pass = renderer_graph_add_pass(
+        graph,
+        "depth pyramid",
+        record_depth_pyramid,
+        occlusion
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        depth,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        pyramid,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT |
+        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL
+    );
+
+    pass = renderer_graph_add_pass(
+        graph,
+        "cull hidden",
+        record_cull_hidden,
+        occlusion
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        pyramid,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        objects,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        no_layout
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        first_args,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT,
+        no_layout
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        second_args,
+        compute,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        no_layout
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        visibility,
+        compute,
+        VK_ACCESS_SHADER_READ_BIT |
+        VK_ACCESS_SHADER_WRITE_BIT,
+        no_layout
+    );
+
+    pass = renderer_graph_add_pass(
+        graph,
+        "second pass",
+        record_second_pass,
+        occlusion
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        second_args,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        no_layout
+    );
+    renderer_graph_write(
+        graph,
+        pass,
+        depth,
+        depth_tests,
+        depth_access,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    );
+
+    // The CPU reads the args for the counts once the frame's fence signals
+    pass = renderer_graph_add_pass(graph, "readback", NULL, NULL);
+    renderer_graph_read(
+        graph,
+        pass,
+        first_args,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        VK_ACCESS_HOST_READ_BIT,
+        no_layout
+    );
+    renderer_graph_read(
+        graph,
+        pass,
+        second_args,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        VK_ACCESS_HOST_READ_BIT,
+        no_layout
+    );
+
+    renderer_graph_compile(graph);
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .image = renderer_graph_get_image(graph, pyramid),
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .components = {
+            .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .a = VK_COMPONENT_SWIZZLE_IDENTITY
+        },
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = occlusion->level_count,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1
+    };
+
+    VkResult result;
+    result = vkCreateImageView(
+        device,
+        &view_info,
+        NULL,
+        &occlusion->pyramid_view
+    );
+    assert(result == VK_SUCCESS);
+
+    for (uint32_t i = 0; i < occlusion->level_count; i++) {
+        view_info.subresourceRange.baseMipLevel = i;
+        view_info.subresourceRange.levelCount = 1;
+
+        result = vkCreateImageView(
+            device,
+            &view_info,
+            NULL,
+            &occlusion->level_views[i]
+        );
+        assert(result == VK_SUCCESS);
+    }
+}
+
+static void destroy_graph(
+        struct renderer_occlusion* occlusion)
+{
+    VkDevice device = occlusion->device;
+
+    for (uint32_t i = 0; i < occlusion->level_count; i++)
+        vkDestroyImageView(device, occlusion->level_views[i], NULL);
+
+    vkDestroyImageView(device, occlusion->pyramid_view, NULL);
+    renderer_graph_destroy(&occlusion->graph);
+}
+
+/* The depth format must be sampleable and the compute shaders built, which
+ * happens separately with glslc (see the shaders target in Makefile.am) */
+bool renderer_occlusion_supported(
+        VkPhysicalDevice physical_device,
+        VkFormat depth_format)
+{
+    VkFormatProperties format_props;
+    vkGetPhysicalDeviceFormatProperties(
+        physical_device,
+        depth_format,
+        &format_props
+    );
+    if (!(format_props.optimalTilingFeatures &
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        fprintf(
+            stderr,
+            "Depth format can't be sampled for occlusion culling.\n"
+        );
+        return false;
+    }
+
+    const char* shaders[] = {OCCLUSION_REDUCE_SHADER, OCCLUSION_CULL_SHADER};
+    for (uint32_t i = 0; i < 2; i++) {
+        if (!renderer_file_exists(shaders[i])) {
+            fprintf(
+                stderr,
+                "Missing %s for occlusion culling, build it with make "
+                "shaders.\n",
+                shaders[i]
+            );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Called once the renderer's render pass, pipeline and framebuffers exist.
+ * The depth image must have been created with VK_IMAGE_USAGE_SAMPLED_BIT */
+void renderer_occlusion_init(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources)
+{
+    memset(occlusion, 0, sizeof(*occlusion));
+
+    VkDevice device = resources->device;
+    occlusion->device = device;
+    occlusion->max_objects = resources->settings.max_drawables;
+
+    occlusion->first_pass = renderer_get_render_pass(
+        device,
+        resources->swapchain_image_format.format,
+        resources->depth_format,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_ATTACHMENT_LOAD_OP_CLEAR,
+        true,
+        false,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    );
+
+    occlusion->second_pass = renderer_get_render_pass(
+        device,
+        resources->swapchain_image_format.format,
+        resources->depth_format,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_ATTACHMENT_LOAD_OP_LOAD,
+        false,
+        false,
+        resources->settings.headless ?
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    );
+
+    // Nearest, the shaders only use texelFetch
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = VK_FALSE,
+        .maxAnisotropy = 1.0f,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .minLod = 0.0f,
+        .maxLod = OCCLUSION_MAX_LEVELS,
+        .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+        .unnormalizedCoordinates = VK_FALSE
+    };
+
+    VkResult result;
+    result = vkCreateSampler(device, &sampler_info, NULL, &occlusion->sampler);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorType reduce_types[] = {
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+    };
+    occlusion->reduce_layout = get_descriptor_layout(device, reduce_types, 2);
+
+    VkDescriptorType cull_types[] = {
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, // Objects
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, // First pass args
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, // Second pass args
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER // Visibility
+    };
+    occlusion->cull_layout = get_descriptor_layout(device, cull_types, 5);
+
+    occlusion->reduce_pipeline_layout = get_compute_pipeline_layout(
+        device,
+        &occlusion->reduce_layout,
+        sizeof(struct occlusion_reduce_constants)
+    );
+    occlusion->cull_pipeline_layout = get_compute_pipeline_layout(
+        device,
+        &occlusion->cull_layout,
+        sizeof(struct occlusion_cull_constants)
+    );
+
+    occlusion->reduce_pipeline = get_compute_pipeline(
+        device,
+        occlusion->reduce_pipeline_layout,
+        OCCLUSION_REDUCE_SHADER
+    );
+    occlusion->cull_pipeline = get_compute_pipeline(
+        device,
+        occlusion->cull_pipeline_layout,
+        OCCLUSION_CULL_SHADER
+    );
+
+    VkDescriptorPoolSize pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = OCCLUSION_MAX_LEVELS + OCCLUSION_FRAMES
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = OCCLUSION_MAX_LEVELS
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 4 * OCCLUSION_FRAMES
+        }
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .maxSets = OCCLUSION_MAX_LEVELS + OCCLUSION_FRAMES,
+        .poolSizeCount = 3,
+        .pPoolSizes = pool_sizes
+    };
+
+    result = vkCreateDescriptorPool(
+        device,
+        &pool_info,
+        NULL,
+        &occlusion->descriptor_pool
+    );
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorSetLayout reduce_layouts[OCCLUSION_MAX_LEVELS];
+    for (uint32_t i = 0; i < OCCLUSION_MAX_LEVELS; i++)
+        reduce_layouts[i] = occlusion->reduce_layout;
+
+    VkDescriptorSetAllocateInfo set_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = NULL,
+        .descriptorPool = occlusion->descriptor_pool,
+        .descriptorSetCount = OCCLUSION_MAX_LEVELS,
+        .pSetLayouts = reduce_layouts
+    };
+    result = vkAllocateDescriptorSets(device, &set_info, occlusion->reduce_sets);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorSetLayout cull_layouts[OCCLUSION_FRAMES];
+    for (uint32_t i = 0; i < OCCLUSION_FRAMES; i++)
+        cull_layouts[i] = occlusion->cull_layout;
+
+    set_info.descriptorSetCount = OCCLUSION_FRAMES;
+    set_info.pSetLayouts = cull_layouts;
+    result = vkAllocateDescriptorSets(device, &set_info, occlusion->cull_sets);
+    assert(result == VK_SUCCESS);
+
+    occlusion->visibility = renderer_get_buffer(
+        resources->physical_device,
+        device,
+        occlusion->max_objects * sizeof(uint32_t),
+        0,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    );
+
+    for (uint32_t i = 0; i < OCCLUSION_FRAMES; i++) {
+        occlusion->objects[i] = renderer_get_buffer(
+            resources->physical_device,
+            device,
+            occlusion->max_objects * sizeof(struct renderer_occlusion_object),
+            0,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        renderer_map_buffer(device, 0, &occlusion->objects[i]);
+
+        // Read back by the CPU for the counts as well as drawn from
+        occlusion->first_args[i] = renderer_get_buffer(
+            resources->physical_device,
+            device,
+            occlusion->max_objects * sizeof(VkDrawIndexedIndirectCommand),
+            0,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        renderer_map_buffer(device, 0, &occlusion->first_args[i]);
+
+        occlusion->second_args[i] = renderer_get_buffer(
+            resources->physical_device,
+            device,
+            occlusion->max_objects * sizeof(VkDrawIndexedIndirectCommand),
+            0,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        renderer_map_buffer(device, 0, &occlusion->second_args[i]);
+    }
+
+    occlusion->draws = NULL;
+    occlusion->matrix_offsets = NULL;
+
+    occlusion->resources = resources;
+    occlusion->reset = true;
+
+    build_graph(occlusion, resources);
+    write_descriptors(occlusion, resources->depth_image.image_view);
+}
+
+/* Follows the depth image when the render targets are recreated. This
+ * waits for the device, resizing is rare enough that retiring the old
+ * graph like the swapchain isn't worth it */
+void renderer_occlusion_resize(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources)
+{
+    vkDeviceWaitIdle(occlusion->device);
+
+    destroy_graph(occlusion);
+    build_graph(occlusion, resources);
+    write_descriptors(occlusion, resources->depth_image.image_view);
+}
+
+/* Records both passes and the culling between them for the draws queued
+ * this frame, in place of renderer_record_draw_commands. The frame stats
+ * report what the GPU drew MAX_FRAMES_IN_FLIGHT frames ago, the most recent
+ * frame whose results can be read without waiting */
+void renderer_occlusion_record(
+        struct renderer_occlusion* occlusion,
+        struct renderer_resources* resources,
+        VkCommandBuffer cmd,
+        uint32_t image_index)
+{
+    struct cpu_profiler_scope record_scope = cpu_profiler_begin("record");
+
+    uint32_t frame_index = resources->current_frame;
+
+    read_counts(occlusion, frame_index);
+    resources->frame_stats.draw_count =
+        occlusion->latest.first_pass + occlusion->latest.second_pass;
+    resources->frame_stats.triangle_count = occlusion->latest.triangle_count;
+
+    struct renderer_occlusion_object* objects;
+    objects = occlusion->objects[frame_index].mapped;
+    VkDrawIndexedIndirectCommand* first_args;
+    first_args = occlusion->first_args[frame_index].mapped;
+    VkDrawIndexedIndirectCommand* second_args;
+    second_args = occlusion->second_args[frame_index].mapped;
+
+    struct arena* frame_arena = &resources->frame_arenas[frame_index];
+    uint32_t queued = (uint32_t)resources->drawable_queue.elements_in_use;
+    occlusion->draws = ARENA_NEW(
+        frame_arena,
+        struct renderer_draw_command,
+        queued
+    );
+    occlusion->matrix_offsets = ARENA_NEW(frame_arena, uint32_t, queued);
+
+    uint32_t count = 0;
+    while (!queue_empty(&resources->drawable_queue)) {
+        assert(count < occlusion->max_objects);
+
+        struct renderer_draw_command* draw = &occlusion->draws[count];
+        queue_dequeue(&resources->drawable_queue, draw);
+
+        // Released meshes are not drawn, the slot is taken by the next one
+        struct renderer_mesh* mesh = renderer_registry_get_mesh(
+            &resources->registry,
+            draw->drawable->mesh
+        );
+        if (!mesh)
+            continue;
+
+        occlusion->matrix_offsets[count] = renderer_get_matrix_offset(
+            resources->matrix_alignment,
+            resources->settings.max_drawables,
+            image_index,
+            draw->drawable->matrix_index
+        );
+
+        transform_get_sphere(
+            &resources->transforms,
+            draw->drawable->matrix_index,
+            mesh->center,
+            mesh->radius,
+            objects[count].sphere
+        );
+        objects[count].visibility_index = draw->drawable->matrix_index;
+
+        // The cull shader only fills in the instance counts
+        VkDrawIndexedIndirectCommand args = {
+            .indexCount = mesh->index_count,
+            .instanceCount = 0,
+            .firstIndex = mesh->ibo_offset,
+            .vertexOffset = mesh->vbo_offset,
+            .firstInstance = 0
+        };
+        first_args[count] = args;
+        second_args[count] = args;
+
+        count++;
+    }
+    occlusion->object_counts[frame_index] = count;
+
+    if (occlusion->reset) {
+        // Nothing visible yet, everything is found by the pyramid test. The
+        // graph's first barrier expects the visibility written by compute
+        vkCmdFillBuffer(cmd, occlusion->visibility.buffer, 0, VK_WHOLE_SIZE, 0);
+        memory_barrier(
+            cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+        );
+
+        occlusion->reset = false;
+    }
+
+    struct renderer_graph* graph = &occlusion->graph;
+    renderer_graph_set_buffer(
+        graph,
+        occlusion->objects_resource,
+        occlusion->objects[frame_index].buffer
+    );
+    renderer_graph_set_buffer(
+        graph,
+        occlusion->first_args_resource,
+        occlusion->first_args[frame_index].buffer
+    );
+    renderer_graph_set_buffer(
+        graph,
+        occlusion->second_args_resource,
+        occlusion->second_args[frame_index].buffer
+    );
+
+    occlusion->image_index = image_index;
+    occlusion->frame_index = frame_index;
+    renderer_graph_execute(graph, cmd, resources->gpu_profiler);
+
+    cpu_profiler_end(&record_scope);
+}
+
+void renderer_occlusion_destroy(
+        struct renderer_occlusion* occlusion)
+{
+    VkDevice device = occlusion->device;
+
+    for (uint32_t i = 0; i < OCCLUSION_FRAMES; i++) {
+        renderer_unmap_buffer(device, &occlusion->objects[i]);
+        renderer_destroy_buffer(device, &occlusion->objects[i]);
+        renderer_unmap_buffer(device, &occlusion->first_args[i]);
+        renderer_destroy_buffer(device, &occlusion->first_args[i]);
+        renderer_unmap_buffer(device, &occlusion->second_args[i]);
+        renderer_destroy_buffer(device, &occlusion->second_args[i]);
+    }
+    renderer_destroy_buffer(device, &occlusion->visibility);
+
+    destroy_graph(occlusion);
+
+    vkDestroyDescriptorPool(device, occlusion->descriptor_pool, NULL);
+    vkDestroyPipeline(device, occlusion->cull_pipeline, NULL);
+    vkDestroyPipeline(device, occlusion->reduce_pipeline, NULL);
+    vkDestroyPipelineLayout(device, occlusion->cull_pipeline_layout, NULL);
+    vkDestroyPipelineLayout(device, occlusion->reduce_pipeline_layout, NULL);
+    vkDestroyDescriptorSetLayout(device, occlusion->cull_layout, NULL);
+    vkDestroyDescriptorSetLayout(device, occlusion->reduce_layout, NULL);
+    vkDestroySampler(device, occlusion->sampler, NULL);
+
+    vkDestroyRenderPass(device, occlusion->second_pass, NULL);
+    vkDestroyRenderPass(device, occlusion->first_pass, NULL);
+}
@@ -0,0 +1,120 @@
+#ifndef RENDERER_OCCLUSION_H_
+#define RENDERER_OCCLUSION_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "renderer_graph.h"
+
+#define OCCLUSION_FRAMES 2 // Matches MAX_FRAMES_IN_FLIGHT
+#define OCCLUSION_MAX_LEVELS 16 // Enough for 32768 pixel wide targets
+
+struct renderer_resources;
+struct renderer_draw_command;
+
+// What the GPU decided for a frame, read back once the frame has finished
+struct renderer_occlusion_counts
+{
+    uint32_t first_pass; // Visible last frame and drawn first
+    uint32_t second_pass; // Found visible by the pyramid test
+    uint32_t culled; // Outside the frustum or occluded
+    uint64_t triangle_count; // Triangles of both passes
+};
+
+// Per object input of the cull shader
+struct renderer_occlusion_object
+{
+    float sphere[4]; // World space center and radius
+    uint32_t visibility_index; // The drawable's matrix_index
+    uint32_t padding[3];
+};
+
+struct renderer_occlusion
+{
+    VkDevice device;
+    uint32_t max_objects;
+
+    // The first pass clears and keeps depth for the pyramid, the second
+    // loads both attachments and ends like the renderer's own render pass
+    VkRenderPass first_pass;
+    VkRenderPass second_pass;
+
+    // The culling and both passes, rebuilt along with the depth image
+    struct renderer_graph graph;
+    uint32_t objects_resource;
+    uint32_t first_args_resource;
+    uint32_t second_args_resource;
+
+    // Farthest depth pyramid, level 0 the size of the depth buffer. A
+    // transient image of the graph
+    uint32_t pyramid;
+    VkImageView pyramid_view; // All levels, for culling
+    VkImageView level_views[OCCLUSION_MAX_LEVELS]; // For building
+    VkExtent2D pyramid_extent;
+    uint32_t level_count;
+    bool reset; // Visibility still to be cleared
+    VkSampler sampler;
+
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSetLayout reduce_layout;
+    VkDescriptorSetLayout cull_layout;
+    VkPipelineLayout reduce_pipeline_layout;
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline reduce_pipeline;
+    VkPipeline cull_pipeline;
+    VkDescriptorSet reduce_sets[OCCLUSION_MAX_LEVELS];
+    VkDescriptorSet cull_sets[OCCLUSION_FRAMES];
+
+    // Whether each drawable was visible at the end of its last frame, kept
+    // on the GPU across frames
+    struct renderer_buffer visibility;
+
+    // Written by the CPU each frame, host visible and persistently mapped
+    struct renderer_buffer objects[OCCLUSION_FRAMES];
+    struct renderer_buffer first_args[OCCLUSION_FRAMES];
+    struct renderer_buffer second_args[OCCLUSION_FRAMES];
+    uint32_t object_counts[OCCLUSION_FRAMES];
+
+    // This frame's draws, drained from the drawable queue since both passes
+    // go through them. From the frame's arena, valid while recording
+    struct renderer_draw_command* draws;
+    uint32_t* matrix_offsets;
+
+    // The frame being recorded, for the graph's passes
+    struct renderer_resources* resources;
+    uint32_t image_index;
+    uint32_t frame_index;
+
+    struct renderer_occlusion_counts latest; // Most recent finished frame
+};
+
+bool renderer_occlusion_supported(
+    VkPhysicalDevice physical_device,
+    VkFormat depth_format
+);
+
+void renderer_occlusion_init(
+    struct renderer_occlusion* occlusion,
+    struct renderer_resources* resources
+);
+
+void renderer_occlusion_resize(
+    struct renderer_occlusion* occlusion,
+    struct renderer_resources* resources
+);
+
+void renderer_occlusion_record(
+    struct renderer_occlusion* occlusion,
+    struct renderer_resources* resources,
+    VkCommandBuffer cmd,
+    uint32_t image_index
+);
+
+void renderer_occlusion_destroy(
+    struct renderer_occlusion* occlusion
+);
+
+#endif
@@ -0,0 +1,170 @@
+#include "renderer_pipeline_stats.h"
+
+#include <string.h>
+#include <assert.h>
+
+/* Both features are needed since all drawing happens in secondary command
+ * buffers, which must inherit the queries active in the primary */
+bool renderer_pipeline_stats_supported(
+        VkPhysicalDevice physical_device)
+{
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physical_device, &features);
+
+    return features.pipelineStatisticsQuery && features.inheritedQueries;
+}
+
+/* The device must have been created with pipelineStatisticsQuery and
+ * inheritedQueries enabled, and occlusionQueryPrecise if supported */
+void renderer_pipeline_stats_init(
+        struct renderer_pipeline_stats* stats,
+        VkPhysicalDevice physical_device,
+        VkDevice device)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // Without precise queries the sample count may only be zero or non-zero
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physical_device, &features);
+    if (features.occlusionQueryPrecise)
+        stats->occlusion_flags = VK_QUERY_CONTROL_PRECISE_BIT;
+
+    stats->device = device;
+    stats->statistics =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    VkQueryPoolCreateInfo statistics_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = 1,
+        .pipelineStatistics = stats->statistics
+    };
+
+    VkQueryPoolCreateInfo occlusion_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_OCCLUSION,
+        .queryCount = 1,
+        .pipelineStatistics = 0
+    };
+
+    VkResult result;
+    for (uint32_t i = 0; i < PIPELINE_STATS_FRAMES; i++) {
+        result = vkCreateQueryPool(
+            device,
+            &statistics_info,
+            NULL,
+            &stats->statistics_pools[i]
+        );
+        assert(result == VK_SUCCESS);
+
+        result = vkCreateQueryPool(
+            device,
+            &occlusion_info,
+            NULL,
+            &stats->occlusion_pools[i]
+        );
+        assert(result == VK_SUCCESS);
+    }
+}
+
+/* Resolves the counters the frame slot wrote last time it was used, then
+ * resets its queries. Like the GPU profiler this runs after the slot's fence
+ * was waited on, so the results are read without VK_QUERY_RESULT_WAIT_BIT */
+void renderer_pipeline_stats_begin_frame(
+        struct renderer_pipeline_stats* stats,
+        VkCommandBuffer cmd,
+        uint32_t frame_index,
+        uint64_t frame)
+{
+    if (stats->written[frame_index]) {
+        uint64_t statistics[5];
+        uint64_t samples_passed;
+
+        VkResult statistics_result;
+        statistics_result = vkGetQueryPoolResults(
+            stats->device,
+            stats->statistics_pools[frame_index],
+            0,
+            1,
+            sizeof(statistics),
+            statistics,
+            sizeof(statistics),
+            VK_QUERY_RESULT_64_BIT
+        );
+
+        VkResult occlusion_result;
+        occlusion_result = vkGetQueryPoolResults(
+            stats->device,
+            stats->occlusion_pools[frame_index],
+            0,
+            1,
+            sizeof(samples_passed),
+            &samples_passed,
+            sizeof(samples_passed),
+            VK_QUERY_RESULT_64_BIT
+        );
+
+        if (statistics_result == VK_SUCCESS &&
+                occlusion_result == VK_SUCCESS) {
+            stats->latest.input_assembly_vertices = statistics[0];
+            stats->latest.vertex_shader_invocations = statistics[1];
+            stats->latest.clipping_invocations = statistics[2];
+            stats->latest.clipping_primitives = statistics[3];
+            stats->latest.fragment_shader_invocations = statistics[4];
+            stats->latest.samples_passed = samples_passed;
+            stats->latest.frame = stats->written_frame[frame_index];
+        }
+    }
+
+    vkCmdResetQueryPool(cmd, stats->statistics_pools[frame_index], 0, 1);
+    vkCmdResetQueryPool(cmd, stats->occlusion_pools[frame_index], 0, 1);
+
+    stats->current_frame = frame_index;
+    stats->written[frame_index] = false;
+    stats->written_frame[frame_index] = frame;
+}
+
+// Begun outside the render pass so the queries cover all of it
+void renderer_pipeline_stats_begin(
+        struct renderer_pipeline_stats* stats,
+        VkCommandBuffer cmd)
+{
+    uint32_t frame_index = stats->current_frame;
+
+    vkCmdBeginQuery(cmd, stats->statistics_pools[frame_index], 0, 0);
+    vkCmdBeginQuery(
+        cmd,
+        stats->occlusion_pools[frame_index],
+        0,
+        stats->occlusion_flags
+    );
+}
+
+void renderer_pipeline_stats_end(
+        struct renderer_pipeline_stats* stats,
+        VkCommandBuffer cmd)
+{
+    uint32_t frame_index = stats->current_frame;
+
+    vkCmdEndQuery(cmd, stats->occlusion_pools[frame_index], 0);
+    vkCmdEndQuery(cmd, stats->statistics_pools[frame_index], 0);
+
+    stats->written[frame_index] = true;
+}
+
+void renderer_pipeline_stats_destroy(
+        struct renderer_pipeline_stats* stats)
+{
+    for (uint32_t i = 0; i < PIPELINE_STATS_FRAMES; i++) {
+        vkDestroyQueryPool(stats->device, stats->statistics_pools[i], NULL);
+        vkDestroyQueryPool(stats->device, stats->occlusion_pools[i], NULL);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef RENDERER_PIPELINE_STATS_H_
+#define RENDERER_PIPELINE_STATS_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PIPELINE_STATS_FRAMES 2 // Matches MAX_FRAMES_IN_FLIGHT
+
+// Order matches the bit order of the requested statistics, which is the
+// order the results are written in
+struct renderer_pipeline_counters
+{
+    uint64_t input_assembly_vertices;
+    uint64_t vertex_shader_invocations;
+    uint64_t clipping_invocations; // Primitives reaching the clipper
+    uint64_t clipping_primitives; // Primitives surviving clipping
+    uint64_t fragment_shader_invocations;
+    uint64_t samples_passed; // From the occlusion query
+    uint64_t frame; // Frame the counters were taken from
+};
+
+struct renderer_pipeline_stats
+{
+    VkDevice device;
+    VkQueryPipelineStatisticFlags statistics;
+    VkQueryControlFlags occlusion_flags; // Precise when the device allows
+
+    VkQueryPool statistics_pools[PIPELINE_STATS_FRAMES];
+    VkQueryPool occlusion_pools[PIPELINE_STATS_FRAMES];
+    bool written[PIPELINE_STATS_FRAMES]; // Slot's queries hold a result
+    uint64_t written_frame[PIPELINE_STATS_FRAMES];
+    uint32_t current_frame;
+
+    struct renderer_pipeline_counters latest; // Most recent resolved frame
+};
+
+bool renderer_pipeline_stats_supported(
+    VkPhysicalDevice physical_device
+);
+
+void renderer_pipeline_stats_init(
+    struct renderer_pipeline_stats* stats,
+    VkPhysicalDevice physical_device,
+    VkDevice device
+);
+
+void renderer_pipeline_stats_begin_frame(
+    struct renderer_pipeline_stats* stats,
+    VkCommandBuffer cmd,
+    uint32_t frame_index,
+    uint64_t frame
+);
+
+void renderer_pipeline_stats_begin(
+    struct renderer_pipeline_stats* stats,
+    VkCommandBuffer cmd
+);
+
+void renderer_pipeline_stats_end(
+    struct renderer_pipeline_stats* stats,
+    VkCommandBuffer cmd
+);
+
+void renderer_pipeline_stats_destroy(
+    struct renderer_pipeline_stats* stats
+);
+
+#endif
@@ -0,0 +1,566 @@
+#include "renderer_buffer.h"
+#include "renderer_image.h"
+#include "renderer_mesh.h"
+#include "renderer.h"
+#include "renderer_registry.h"
+#include "renderer_scene.h"
+#include "cpu_profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static void renderer_pool_init(
+        struct renderer_resource_pool* pool,
+        size_t element_size,
+        uint32_t capacity)
+{
+    pool->elements = malloc(capacity * element_size);
+    pool->ready = malloc(capacity * sizeof(*pool->ready));
+    pool->element_slots = malloc(capacity * sizeof(*pool->element_slots));
+    pool->slots = malloc(capacity * sizeof(*pool->slots));
+    assert(pool->elements && pool->ready && pool->element_slots && pool->slots);
+
+    pool->element_size = element_size;
+    pool->count = 0;
+    pool->capacity = capacity;
+    pool->slot_count = 0;
+    pool->free_list = REGISTRY_NO_SLOT;
+}
+
+static void* renderer_pool_element(
+        const struct renderer_resource_pool* pool,
+        uint32_t element)
+{
+    return pool->elements + (size_t)element * pool->element_size;
+}
+
+// Appended after the live elements, in a released slot if there is one
+static struct renderer_resource_handle renderer_pool_add(
+        struct renderer_resource_pool* pool,
+        const void* element,
+        bool ready)
+{
+    assert(pool->count < pool->capacity);
+
+    uint32_t index = pool->free_list;
+    if (index != REGISTRY_NO_SLOT) {
+        pool->free_list = pool->slots[index].next_free;
+    } else {
+        index = pool->slot_count++;
+        pool->slots[index].generation = 1;
+    }
+
+    uint32_t dense = pool->count++;
+    memcpy(renderer_pool_element(pool, dense), element, pool->element_size);
+    pool->ready[dense] = ready;
+    pool->element_slots[dense] = index;
+    pool->slots[index].element = dense;
+
+    struct renderer_resource_handle handle = {
+        .index = index,
+        .generation = pool->slots[index].generation
+    };
+
+    return handle;
+}
+
+// The handle's element, REGISTRY_NO_SLOT if it was released
+static uint32_t renderer_pool_lookup(
+        const struct renderer_resource_pool* pool,
+        struct renderer_resource_handle handle)
+{
+    if (handle.index >= pool->slot_count)
+        return REGISTRY_NO_SLOT;
+
+    const struct renderer_resource_slot* slot = &pool->slots[handle.index];
+    if (slot->generation != handle.generation)
+        return REGISTRY_NO_SLOT;
+
+    return slot->element;
+}
+
+// The last element moves into the gap, so its slot is pointed at it
+static void renderer_pool_remove(
+        struct renderer_resource_pool* pool,
+        uint32_t element)
+{
+    uint32_t index = pool->element_slots[element];
+    uint32_t last = --pool->count;
+
+    if (element != last) {
+        memcpy(
+            renderer_pool_element(pool, element),
+            renderer_pool_element(pool, last),
+            pool->element_size
+        );
+        pool->ready[element] = pool->ready[last];
+        pool->element_slots[element] = pool->element_slots[last];
+        pool->slots[pool->element_slots[element]].element = element;
+    }
+
+    pool->slots[index].generation++;
+    pool->slots[index].element = REGISTRY_NO_SLOT;
+    pool->slots[index].next_free = pool->free_list;
+    pool->free_list = index;
+}
+
+static void renderer_pool_destroy(
+        struct renderer_resource_pool* pool)
+{
+    free(pool->slots);
+    free(pool->element_slots);
+    free(pool->ready);
+    free(pool->elements);
+}
+
+/* The texture pool has room for the default texture on top of max_textures,
+ * the same count the descriptor pool was sized for */
+void renderer_registry_init(
+        struct renderer_registry* registry,
+        uint32_t max_textures)
+{
+    size_t element_sizes[RENDERER_RESOURCE_TYPE_COUNT] = {
+        [RENDERER_RESOURCE_MESH] = sizeof(struct renderer_mesh),
+        [RENDERER_RESOURCE_TEXTURE] = sizeof(struct renderer_texture),
+        [RENDERER_RESOURCE_BUFFER] = sizeof(struct renderer_buffer),
+        [RENDERER_RESOURCE_PIPELINE] = sizeof(VkPipeline)
+    };
+    uint32_t capacities[RENDERER_RESOURCE_TYPE_COUNT] = {
+        [RENDERER_RESOURCE_MESH] = REGISTRY_MAX_MESHES,
+        [RENDERER_RESOURCE_TEXTURE] = 1 + max_textures,
+        [RENDERER_RESOURCE_BUFFER] = REGISTRY_MAX_BUFFERS,
+        [RENDERER_RESOURCE_PIPELINE] = REGISTRY_MAX_PIPELINES
+    };
+
+    for (uint32_t i = 0; i < RENDERER_RESOURCE_TYPE_COUNT; i++) {
+        renderer_pool_init(
+            &registry->pools[i],
+            element_sizes[i],
+            capacities[i]
+        );
+    }
+
+    registry->retired_count = 0;
+
+    registry->load_capacity = capacities[RENDERER_RESOURCE_TEXTURE];
+    registry->loads = calloc(registry->load_capacity, sizeof(*registry->loads));
+    assert(registry->loads);
+}
+
+// A copy of element becomes the resource, ready for use
+struct renderer_resource_handle renderer_registry_add(
+        struct renderer_registry* registry,
+        enum renderer_resource_type type,
+        const void* element)
+{
+    return renderer_pool_add(&registry->pools[type], element, true);
+}
+
+/* NULL for released resources, those still loading and the null handle.
+ * Pointers are good until the next resource of the type is released */
+void* renderer_registry_get(
+        const struct renderer_registry* registry,
+        enum renderer_resource_type type,
+        struct renderer_resource_handle handle)
+{
+    const struct renderer_resource_pool* pool = &registry->pools[type];
+
+    uint32_t element = renderer_pool_lookup(pool, handle);
+    if (element == REGISTRY_NO_SLOT || !pool->ready[element])
+        return NULL;
+
+    return renderer_pool_element(pool, element);
+}
+
+struct renderer_mesh* renderer_registry_get_mesh(
+        const struct renderer_registry* registry,
+        struct renderer_resource_handle handle)
+{
+    return renderer_registry_get(registry, RENDERER_RESOURCE_MESH, handle);
+}
+
+struct renderer_texture* renderer_registry_get_texture(
+        const struct renderer_registry* registry,
+        struct renderer_resource_handle handle)
+{
+    return renderer_registry_get(registry, RENDERER_RESOURCE_TEXTURE, handle);
+}
+
+struct renderer_buffer* renderer_registry_get_buffer(
+        const struct renderer_registry* registry,
+        struct renderer_resource_handle handle)
+{
+    return renderer_registry_get(registry, RENDERER_RESOURCE_BUFFER, handle);
+}
+
+// VK_NULL_HANDLE where the others return NULL
+VkPipeline renderer_registry_get_pipeline(
+        const struct renderer_registry* registry,
+        struct renderer_resource_handle handle)
+{
+    VkPipeline* pipeline = renderer_registry_get(
+        registry,
+        RENDERER_RESOURCE_PIPELINE,
+        handle
+    );
+
+    return pipeline ? *pipeline : VK_NULL_HANDLE;
+}
+
+// Live resources of the type, loading ones included
+uint32_t renderer_registry_count(
+        const struct renderer_registry* registry,
+        enum renderer_resource_type type)
+{
+    return registry->pools[type].count;
+}
+
+// Handle of the element-th live resource, an order that changes on release
+struct renderer_resource_handle renderer_registry_handle_at(
+        const struct renderer_registry* registry,
+        enum renderer_resource_type type,
+        uint32_t element)
+{
+    const struct renderer_resource_pool* pool = &registry->pools[type];
+    assert(element < pool->count);
+
+    uint32_t index = pool->element_slots[element];
+    struct renderer_resource_handle handle = {
+        .index = index,
+        .generation = pool->slots[index].generation
+    };
+
+    return handle;
+}
+
+bool renderer_resource_handle_equal(
+        struct renderer_resource_handle a,
+        struct renderer_resource_handle b)
+{
+    return a.index == b.index && a.generation == b.generation;
+}
+
+/* Drawables using the resource record their cmds again, to pick up a texture
+ * that finished loading or to stop drawing a released mesh */
+static void renderer_registry_invalidate(
+        struct renderer_resources* resources,
+        enum renderer_resource_type type,
+        struct renderer_resource_handle handle)
+{
+    for (uint32_t i = 0; i < resources->transforms.count; i++) {
+        struct renderer_drawable* drawable = resources->transform_drawables[i];
+        if (!drawable)
+            continue;
+
+        struct renderer_resource_handle used = type == RENDERER_RESOURCE_MESH ?
+            drawable->mesh :
+            drawable->texture;
+        if (!renderer_resource_handle_equal(used, handle))
+            continue;
+
+        drawable->generation++;
+        if (drawable->retained)
+            resources->scene->membership_changed = true;
+    }
+}
+
+static void renderer_registry_destroy_element(
+        struct renderer_resources* resources,
+        enum renderer_resource_type type,
+        void* element)
+{
+    switch (type) {
+    case RENDERER_RESOURCE_TEXTURE: {
+        struct renderer_texture* texture = element;
+
+        // The default texture's set belongs to the renderer
+        if (texture->descriptor_set != resources->descriptor_set) {
+            vkFreeDescriptorSets(
+                resources->device,
+                resources->descriptor_pool,
+                1,
+                &texture->descriptor_set
+            );
+        }
+        renderer_destroy_image(resources->device, &texture->image);
+        break;
+    }
+    case RENDERER_RESOURCE_BUFFER:
+        renderer_destroy_buffer(resources->device, element);
+        break;
+    case RENDERER_RESOURCE_PIPELINE:
+        vkDestroyPipeline(resources->device, *(VkPipeline*)element, NULL);
+        break;
+    default:
+        // Meshes are ranges of shared buffers, they own no GPU objects
+        break;
+    }
+}
+
+// Sets up the image's descriptor set, the texture is ready right away
+struct renderer_resource_handle renderer_registry_add_texture(
+        struct renderer_resources* resources,
+        struct renderer_image image)
+{
+    struct renderer_texture texture = {
+        .image = image,
+        .descriptor_set = renderer_get_texture_descriptor_set(
+            resources,
+            &image
+        )
+    };
+
+    return renderer_registry_add(
+        &resources->registry,
+        RENDERER_RESOURCE_TEXTURE,
+        &texture
+    );
+}
+
+static void renderer_registry_read_job(void* data)
+{
+    struct renderer_texture_load* load = data;
+
+    struct cpu_profiler_scope scope = cpu_profiler_begin("read texture");
+    load->pixels = renderer_read_texture_file(
+        load->src,
+        &load->width,
+        &load->height
+    );
+    cpu_profiler_end(&scope);
+}
+
+/* Uploads a read texture, unless it was released meanwhile. The upload
+ * waits for the graphics queue like any other texture creation */
+static void renderer_registry_finish_load(
+        struct renderer_resources* resources,
+        struct renderer_texture_load* load)
+{
+    struct renderer_resource_pool* pool =
+        &resources->registry.pools[RENDERER_RESOURCE_TEXTURE];
+
+    uint32_t element = renderer_pool_lookup(pool, load->handle);
+    if (element != REGISTRY_NO_SLOT && load->pixels) {
+        struct cpu_profiler_scope scope = cpu_profiler_begin("upload texture");
+        struct renderer_texture* texture = renderer_pool_element(pool, element);
+        texture->image = renderer_create_texture(
+            load->pixels,
+            load->width,
+            load->height,
+            resources->physical_device,
+            resources->device,
+            resources->graphics_queue,
+            resources->command_pool,
+            resources->gpu_profiler
+        );
+        texture->descriptor_set = renderer_get_texture_descriptor_set(
+            resources,
+            &texture->image
+        );
+        pool->ready[element] = true;
+        cpu_profiler_end(&scope);
+
+        renderer_registry_invalidate(
+            resources,
+            RENDERER_RESOURCE_TEXTURE,
+            load->handle
+        );
+    } else if (element != REGISTRY_NO_SLOT) {
+        fprintf(stderr, "Failed to load texture %s\n", load->src);
+        renderer_pool_remove(pool, element);
+    }
+
+    renderer_free_texture_file(load->pixels);
+    load->pixels = NULL;
+    load->active = false;
+}
+
+/* Returns at once, the file is read by a job when there are jobs and right
+ * here otherwise. The texture is uploaded by renderer_registry_update, and
+ * stays unresolvable until then or for good if the file can't be read */
+struct renderer_resource_handle renderer_registry_load_texture(
+        struct renderer_resources* resources,
+        const char* src)
+{
+    struct renderer_registry* registry = &resources->registry;
+
+    struct renderer_texture texture = {0};
+    struct renderer_resource_handle handle = renderer_pool_add(
+        &registry->pools[RENDERER_RESOURCE_TEXTURE],
+        &texture,
+        false
+    );
+
+    // Textures released while loading may still hold every load, finish one
+    struct renderer_texture_load* load = NULL;
+    for (uint32_t i = 0; !load && i < registry->load_capacity; i++) {
+        if (!registry->loads[i].active)
+            load = &registry->loads[i];
+    }
+    if (!load) {
+        load = &registry->loads[0];
+        if (resources->jobs)
+            job_wait(resources->jobs, &load->counter);
+        renderer_registry_finish_load(resources, load);
+    }
+
+    load->active = true;
+    load->handle = handle;
+    snprintf(load->src, sizeof(load->src), "%s", src);
+    load->pixels = NULL;
+    load->counter.value = 0;
+
+    if (resources->jobs) {
+        job_run(
+            resources->jobs,
+            renderer_registry_read_job,
+            load,
+            &load->counter
+        );
+    } else {
+        renderer_registry_read_job(load);
+    }
+
+    return handle;
+}
+
+/* The handle stops resolving at once. Drawables using a released mesh are
+ * no longer drawn and those using a released texture fall back to the
+ * default, buffers and pipelines must not be in use by meshes or the
+ * renderer any more. GPU objects are destroyed once the frames in flight
+ * have retired. Stale handles are ignored */
+void renderer_registry_release(
+        struct renderer_resources* resources,
+        enum renderer_resource_type type,
+        struct renderer_resource_handle handle)
+{
+    struct renderer_registry* registry = &resources->registry;
+    struct renderer_resource_pool* pool = &registry->pools[type];
+
+    assert(type != RENDERER_RESOURCE_TEXTURE ||
+        !renderer_resource_handle_equal(handle, resources->default_texture));
+
+    uint32_t element = renderer_pool_lookup(pool, handle);
+    if (element == REGISTRY_NO_SLOT)
+        return;
+
+    // A loading texture has nothing on the GPU yet
+    if (pool->ready[element] && type != RENDERER_RESOURCE_MESH) {
+        if (registry->retired_count == REGISTRY_MAX_RETIRED)
+            renderer_registry_destroy_retired(resources, true);
+
+        struct renderer_retired_resource* retired;
+        retired = &registry->retired[registry->retired_count++];
+        retired->type = type;
+        retired->retired_frame = resources->frame_count;
+        memcpy(
+            &retired->texture,
+            renderer_pool_element(pool, element),
+            pool->element_size
+        );
+    }
+
+    renderer_pool_remove(pool, element);
+
+    if (type == RENDERER_RESOURCE_MESH || type == RENDERER_RESOURCE_TEXTURE)
+        renderer_registry_invalidate(resources, type, handle);
+}
+
+/* Once per frame after its fence wait. Destroys what the GPU is done with
+ * and uploads the textures whose files have been read */
+void renderer_registry_update(
+        struct renderer_resources* resources)
+{
+    struct renderer_registry* registry = &resources->registry;
+
+    renderer_registry_destroy_retired(resources, false);
+
+    for (uint32_t i = 0; i < registry->load_capacity; i++) {
+        struct renderer_texture_load* load = &registry->loads[i];
+        if (load->active &&
+                __atomic_load_n(&load->counter.value, __ATOMIC_ACQUIRE) == 0)
+            renderer_registry_finish_load(resources, load);
+    }
+}
+
+/* With wait, stalls until every frame in flight has finished and destroys
+ * everything released, e.g. when the list is full */
+void renderer_registry_destroy_retired(
+        struct renderer_resources* resources,
+        bool wait)
+{
+    struct renderer_registry* registry = &resources->registry;
+    if (registry->retired_count == 0)
+        return;
+
+    if (wait) {
+        VkFence fences[MAX_FRAMES_IN_FLIGHT];
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            fences[i] = resources->frames[i].in_flight;
+
+        VkResult result;
+        result = vkWaitForFences(
+            resources->device,
+            MAX_FRAMES_IN_FLIGHT,
+            fences,
+            VK_TRUE,
+            UINT64_MAX
+        );
+        assert(result == VK_SUCCESS);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < registry->retired_count; i++) {
+        struct renderer_retired_resource* retired = &registry->retired[i];
+
+        if (wait || resources->frame_count >=
+                retired->retired_frame + MAX_FRAMES_IN_FLIGHT) {
+            renderer_registry_destroy_element(
+                resources,
+                retired->type,
+                &retired->texture
+            );
+        } else {
+            registry->retired[kept++] = *retired;
+        }
+    }
+    registry->retired_count = kept;
+}
+
+// Destroys every resource left, once the device is idle
+void renderer_registry_destroy(
+        struct renderer_resources* resources)
+{
+    struct renderer_registry* registry = &resources->registry;
+
+    for (uint32_t i = 0; i < registry->load_capacity; i++) {
+        struct renderer_texture_load* load = &registry->loads[i];
+        if (!load->active)
+            continue;
+
+        if (resources->jobs)
+            job_wait(resources->jobs, &load->counter);
+        renderer_free_texture_file(load->pixels);
+        load->active = false;
+    }
+    free(registry->loads);
+
+    renderer_registry_destroy_retired(resources, true);
+
+    for (uint32_t i = 0; i < RENDERER_RESOURCE_TYPE_COUNT; i++) {
+        struct renderer_resource_pool* pool = &registry->pools[i];
+
+        for (uint32_t j = 0; j < pool->count; j++) {
+            if (pool->ready[j]) {
+                renderer_registry_destroy_element(
+                    resources,
+                    i,
+                    renderer_pool_element(pool, j)
+                );
+            }
+        }
+        renderer_pool_destroy(pool);
+    }
+}
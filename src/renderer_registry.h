@@ -0,0 +1,193 @@
+#ifndef RENDERER_REGISTRY_H_
+#define RENDERER_REGISTRY_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "renderer_image.h"
+#include "renderer_buffer.h"
+#include "job.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REGISTRY_NO_SLOT UINT32_MAX
+#define REGISTRY_MAX_MESHES 256
+#define REGISTRY_MAX_BUFFERS 64
+#define REGISTRY_MAX_PIPELINES 16
+#define REGISTRY_MAX_RETIRED 64 // Released resources the GPU may still use
+#define REGISTRY_MAX_PATH 256
+
+struct renderer_resources;
+struct renderer_mesh;
+
+enum renderer_resource_type
+{
+    RENDERER_RESOURCE_MESH,
+    RENDERER_RESOURCE_TEXTURE,
+    RENDERER_RESOURCE_BUFFER,
+    RENDERER_RESOURCE_PIPELINE,
+    RENDERER_RESOURCE_TYPE_COUNT
+};
+
+/* Stays valid until its resource is released, then never matches again.
+ * Generation 0 is never handed out, so a zeroed handle refers to nothing */
+struct renderer_resource_handle
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+struct renderer_texture
+{
+    struct renderer_image image;
+    VkDescriptorSet descriptor_set; // Binds the image with the uniforms
+};
+
+struct renderer_resource_slot
+{
+    uint32_t element; // Index into the pool's elements while alive
+    uint32_t generation; // Bumped on release
+    uint32_t next_free;
+};
+
+/* Slot map over densely packed elements. Handles name slots, which point at
+ * the element, and releasing one moves the last element into its place, so
+ * the live resources of a type are walked without gaps */
+struct renderer_resource_pool
+{
+    uint8_t* elements;
+    size_t element_size;
+    bool* ready; // Per element, false while loading
+    uint32_t* element_slots; // Per element, the slot pointing at it
+    uint32_t count;
+    uint32_t capacity;
+
+    struct renderer_resource_slot* slots;
+    uint32_t slot_count; // Handed out at least once
+    uint32_t free_list;
+};
+
+// The GPU objects of a released resource, destroyed once no frame in flight
+// can still use them
+struct renderer_retired_resource
+{
+    enum renderer_resource_type type;
+    uint64_t retired_frame; // Value of frame_count when released
+    union {
+        struct renderer_texture texture;
+        struct renderer_buffer buffer;
+        VkPipeline pipeline;
+    };
+};
+
+// A texture file decoded by a job, uploaded on the thread drawing frames
+struct renderer_texture_load
+{
+    bool active;
+    struct renderer_resource_handle handle;
+    char src[REGISTRY_MAX_PATH];
+    void* pixels; // NULL if the file could not be read
+    uint32_t width, height;
+    struct job_counter counter;
+};
+
+/* Owns the meshes, textures, buffers and pipelines drawables refer to by
+ * handle. Released resources stop resolving at once, while their GPU objects
+ * are kept until the frames that may use them have retired. Textures can be
+ * loaded in the background, a drawable uses the default texture until its
+ * own is ready. Only the thread drawing frames may change it */
+struct renderer_registry
+{
+    struct renderer_resource_pool pools[RENDERER_RESOURCE_TYPE_COUNT];
+
+    struct renderer_retired_resource retired[REGISTRY_MAX_RETIRED];
+    uint32_t retired_count;
+
+    struct renderer_texture_load* loads; // One per texture slot at most
+    uint32_t load_capacity;
+};
+
+void renderer_registry_init(
+    struct renderer_registry* registry,
+    uint32_t max_textures
+);
+
+struct renderer_resource_handle renderer_registry_add(
+    struct renderer_registry* registry,
+    enum renderer_resource_type type,
+    const void* element
+);
+
+void* renderer_registry_get(
+    const struct renderer_registry* registry,
+    enum renderer_resource_type type,
+    struct renderer_resource_handle handle
+);
+
+struct renderer_mesh* renderer_registry_get_mesh(
+    const struct renderer_registry* registry,
+    struct renderer_resource_handle handle
+);
+
+struct renderer_texture* renderer_registry_get_texture(
+    const struct renderer_registry* registry,
+    struct renderer_resource_handle handle
+);
+
+struct renderer_buffer* renderer_registry_get_buffer(
+    const struct renderer_registry* registry,
+    struct renderer_resource_handle handle
+);
+
+VkPipeline renderer_registry_get_pipeline(
+    const struct renderer_registry* registry,
+    struct renderer_resource_handle handle
+);
+
+uint32_t renderer_registry_count(
+    const struct renderer_registry* registry,
+    enum renderer_resource_type type
+);
+
+struct renderer_resource_handle renderer_registry_handle_at(
+    const struct renderer_registry* registry,
+    enum renderer_resource_type type,
+    uint32_t element
+);
+
+bool renderer_resource_handle_equal(
+    struct renderer_resource_handle a,
+    struct renderer_resource_handle b
+);
+
+struct renderer_resource_handle renderer_registry_add_texture(
+    struct renderer_resources* resources,
+    struct renderer_image image
+);
+
+struct renderer_resource_handle renderer_registry_load_texture(
+    struct renderer_resources* resources,
+    const char* src
+);
+
+void renderer_registry_release(
+    struct renderer_resources* resources,
+    enum renderer_resource_type type,
+    struct renderer_resource_handle handle
+);
+
+void renderer_registry_update(
+    struct renderer_resources* resources
+);
+
+void renderer_registry_destroy_retired(
+    struct renderer_resources* resources,
+    bool wait
+);
+
+void renderer_registry_destroy(
+    struct renderer_resources* resources
+);
+
+#endif
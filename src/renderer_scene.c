@@ -0,0 +1,465 @@
+#include "renderer_buffer.h"
+#include "renderer_image.h"
+#include "renderer_mesh.h"
+#include "renderer.h"
+#include "renderer_scene.h"
+#include "transform.h"
+#include "bvh.h"
+#include "queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define SCENE_NO_SLOT UINT32_MAX
+
+void renderer_scene_init(
+        struct renderer_scene* scene,
+        struct renderer_resources* resources)
+{
+    memset(scene, 0, sizeof(*scene));
+
+    scene->device = resources->device;
+    scene->command_pool = resources->command_pool;
+
+    scene->capacity = resources->settings.max_drawables;
+    scene->objects = calloc(scene->capacity, sizeof(*scene->objects));
+    scene->draw_list = malloc(scene->capacity * sizeof(*scene->draw_list));
+    scene->in_view = malloc(scene->capacity * sizeof(*scene->in_view));
+    assert(scene->objects && scene->draw_list && scene->in_view);
+    scene->free_list = SCENE_NO_SLOT;
+
+    // Generation 0 is never drawn, so every image records on first use
+    scene->draw_list_generation = 1;
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = resources->command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = MAX_FRAMEBUFFERS
+    };
+
+    VkResult result;
+    result = vkAllocateCommandBuffers(
+        resources->device,
+        &alloc_info,
+        scene->cmds
+    );
+    assert(result == VK_SUCCESS);
+
+    VkPipeline depth_pipeline = renderer_registry_get_pipeline(
+        &resources->registry,
+        resources->depth_pipeline
+    );
+    if (depth_pipeline != VK_NULL_HANDLE) {
+        result = vkAllocateCommandBuffers(
+            resources->device,
+            &alloc_info,
+            scene->depth_cmds
+        );
+        assert(result == VK_SUCCESS);
+    }
+}
+
+/* Registers the object for drawing from the next frame on, at the origin.
+ * Slots of removed objects are reused along with their transforms */
+struct renderer_object_handle renderer_scene_add(
+        struct renderer_resources* resources,
+        struct renderer_resource_handle mesh,
+        struct renderer_resource_handle texture)
+{
+    struct renderer_scene* scene = resources->scene;
+
+    uint32_t index = scene->free_list;
+    if (index != SCENE_NO_SLOT) {
+        scene->free_list = scene->objects[index].next_free;
+    } else {
+        assert(scene->slot_count < scene->capacity);
+        index = scene->slot_count++;
+    }
+
+    struct renderer_scene_object* object = &scene->objects[index];
+    struct renderer_drawable* drawable = &object->drawable;
+
+    drawable->mesh = mesh;
+    drawable->texture = texture;
+    drawable->retained = true;
+
+    if (!object->registered) {
+        renderer_register_drawable(resources, drawable);
+        object->registered = true;
+    } else {
+        uint32_t transform = drawable->matrix_index;
+        quat identity;
+        quat_identity(identity);
+
+        transform_set_parent(&resources->transforms, transform, TRANSFORM_NONE);
+        transform_set_position(&resources->transforms, transform, 0, 0, 0);
+        transform_set_rotation(&resources->transforms, transform, identity);
+        transform_set_scale(&resources->transforms, transform, 1, 1, 1);
+
+        // Where it was left, moved along with the transform's next update
+        float sphere[4];
+        renderer_get_drawable_sphere(resources, drawable, sphere);
+
+        float min[3], max[3];
+        for (int i = 0; i < 3; i++) {
+            min[i] = sphere[i] - sphere[3];
+            max[i] = sphere[i] + sphere[3];
+        }
+        drawable->bvh_proxy = bvh_insert(&resources->bvh, min, max, drawable);
+    }
+
+    object->alive = true;
+    object->visible = true;
+    object->in_view = false;
+    scene->membership_changed = true;
+
+    struct renderer_object_handle handle = {
+        .index = index,
+        .generation = object->generation
+    };
+
+    return handle;
+}
+
+static struct renderer_scene_object* renderer_scene_lookup(
+        struct renderer_scene* scene,
+        struct renderer_object_handle handle)
+{
+    if (handle.index >= scene->slot_count)
+        return NULL;
+
+    struct renderer_scene_object* object = &scene->objects[handle.index];
+    if (!object->alive || object->generation != handle.generation)
+        return NULL;
+
+    return object;
+}
+
+// Stale handles are ignored
+void renderer_scene_remove(
+        struct renderer_resources* resources,
+        struct renderer_object_handle handle)
+{
+    struct renderer_scene* scene = resources->scene;
+    struct renderer_scene_object* object =
+        renderer_scene_lookup(scene, handle);
+    if (!object)
+        return;
+
+    bvh_remove(&resources->bvh, object->drawable.bvh_proxy);
+
+    object->alive = false;
+    object->in_view = false;
+    object->generation++;
+    object->next_free = scene->free_list;
+    scene->free_list = handle.index;
+    scene->membership_changed = true;
+}
+
+// NULL for stale handles
+struct renderer_drawable* renderer_scene_get(
+        struct renderer_scene* scene,
+        struct renderer_object_handle handle)
+{
+    struct renderer_scene_object* object =
+        renderer_scene_lookup(scene, handle);
+
+    return object ? &object->drawable : NULL;
+}
+
+void renderer_scene_set_position(
+        struct renderer_resources* resources,
+        struct renderer_object_handle handle,
+        float x, float y, float z)
+{
+    struct renderer_scene_object* object =
+        renderer_scene_lookup(resources->scene, handle);
+    if (!object)
+        return;
+
+    transform_set_position(
+        &resources->transforms,
+        object->drawable.matrix_index,
+        x, y, z
+    );
+}
+
+void renderer_scene_set_visible(
+        struct renderer_scene* scene,
+        struct renderer_object_handle handle,
+        bool visible)
+{
+    struct renderer_scene_object* object =
+        renderer_scene_lookup(scene, handle);
+    if (!object || object->visible == visible)
+        return;
+
+    object->visible = visible;
+    scene->membership_changed = true;
+}
+
+void renderer_scene_begin_cull(
+        struct renderer_scene* scene)
+{
+    scene->in_view_count = 0;
+    scene->entered_count = 0;
+}
+
+// For each of the scene's drawables the frustum cull finds
+void renderer_scene_cull_visit(
+        struct renderer_scene* scene,
+        struct renderer_drawable* drawable,
+        uint32_t cull_frame)
+{
+    struct renderer_scene_object* object =
+        (struct renderer_scene_object*)drawable;
+    if (!object->visible)
+        return;
+
+    object->seen_frame = cull_frame;
+    if (!object->in_view)
+        scene->entered_count++;
+
+    scene->in_view[scene->in_view_count++] = drawable;
+}
+
+// Texture first, binding a descriptor set is the costlier change
+static int renderer_scene_compare(
+        const void* a,
+        const void* b)
+{
+    const struct renderer_drawable* drawable_a =
+        *(struct renderer_drawable* const*)a;
+    const struct renderer_drawable* drawable_b =
+        *(struct renderer_drawable* const*)b;
+
+    if (drawable_a->texture.index != drawable_b->texture.index)
+        return drawable_a->texture.index < drawable_b->texture.index ? -1 : 1;
+    if (drawable_a->mesh.index != drawable_b->mesh.index)
+        return drawable_a->mesh.index < drawable_b->mesh.index ? -1 : 1;
+    if (drawable_a->matrix_index != drawable_b->matrix_index)
+        return drawable_a->matrix_index < drawable_b->matrix_index ? -1 : 1;
+
+    return 0;
+}
+
+/* Brings the draw list up to date, from the drawables the frustum cull
+ * found when culled and from every shown object otherwise. Nothing is done
+ * while the same objects stay in view */
+void renderer_scene_update(
+        struct renderer_scene* scene,
+        const struct renderer_registry* registry,
+        bool culled,
+        uint32_t cull_frame)
+{
+    if (culled) {
+        // Nothing entered and as many found as before, so none left either
+        if (!scene->membership_changed && scene->entered_count == 0 &&
+                scene->in_view_count == scene->draw_count)
+            return;
+
+        for (uint32_t i = 0; i < scene->draw_count; i++) {
+            struct renderer_scene_object* object =
+                (struct renderer_scene_object*)scene->draw_list[i];
+            if (object->seen_frame != cull_frame)
+                object->in_view = false;
+        }
+
+        // Swapped so the next cull fills the old list
+        struct renderer_drawable** in_view = scene->in_view;
+        scene->in_view = scene->draw_list;
+        scene->draw_list = in_view;
+        scene->draw_count = scene->in_view_count;
+    } else {
+        if (!scene->membership_changed)
+            return;
+
+        scene->draw_count = 0;
+        for (uint32_t i = 0; i < scene->slot_count; i++) {
+            struct renderer_scene_object* object = &scene->objects[i];
+            if (object->alive && object->visible)
+                scene->draw_list[scene->draw_count++] = &object->drawable;
+        }
+    }
+
+    qsort(
+        scene->draw_list,
+        scene->draw_count,
+        sizeof(*scene->draw_list),
+        renderer_scene_compare
+    );
+
+    scene->triangle_count = 0;
+    for (uint32_t i = 0; i < scene->draw_count; i++) {
+        struct renderer_scene_object* object =
+            (struct renderer_scene_object*)scene->draw_list[i];
+        object->in_view = true;
+
+        const struct renderer_mesh* mesh =
+            renderer_registry_get_mesh(registry, object->drawable.mesh);
+        if (mesh)
+            scene->triangle_count += mesh->index_count / 3;
+    }
+
+    scene->membership_changed = false;
+    scene->draw_list_generation++;
+}
+
+// For paths that take queued draws, such as occlusion culling
+void renderer_scene_enqueue(
+        struct renderer_scene* scene,
+        struct queue* drawable_queue)
+{
+    for (uint32_t i = 0; i < scene->draw_count; i++) {
+        struct renderer_draw_command draw_cmd = {
+            .drawable = scene->draw_list[i]
+        };
+        queue_enqueue(drawable_queue, &draw_cmd);
+    }
+}
+
+static bool renderer_mesh_buffers_equal(
+        const struct renderer_mesh* a,
+        const struct renderer_mesh* b)
+{
+    return renderer_resource_handle_equal(a->position_vbo, b->position_vbo) &&
+        renderer_resource_handle_equal(a->vbo, b->vbo) &&
+        renderer_resource_handle_equal(a->ibo, b->ibo);
+}
+
+/* Records the image's secondaries if the draw list or the framebuffers
+ * changed since they were last recorded, returns whether it did. Vertex and
+ * index buffers are only bound again when the mesh's buffers change along
+ * the sorted list */
+bool renderer_scene_record(
+        struct renderer_scene* scene,
+        uint32_t image_index,
+        uint32_t framebuffer_generation,
+        VkCommandBufferInheritanceInfo* inheritance_info,
+        const VkCommandBufferBeginInfo* begin_info,
+        VkPipeline depth_pipeline,
+        VkPipeline pipeline,
+        const VkViewport* viewport,
+        const VkRect2D* scissor,
+        VkPipelineLayout pipeline_layout,
+        VkDescriptorSet* descriptor_sets,
+        const struct renderer_registry* registry,
+        size_t matrix_alignment,
+        uint32_t max_drawables)
+{
+    if (scene->recorded_generation[image_index] ==
+                scene->draw_list_generation &&
+            scene->framebuffer_generation[image_index] ==
+                framebuffer_generation)
+        return false;
+
+    scene->recorded_generation[image_index] = scene->draw_list_generation;
+    scene->framebuffer_generation[image_index] = framebuffer_generation;
+
+    bool depth_prepass = depth_pipeline != VK_NULL_HANDLE;
+    VkCommandBuffer cmds[] = {
+        scene->depth_cmds[image_index],
+        scene->cmds[image_index]
+    };
+    VkPipeline pipelines[] = {depth_pipeline, pipeline};
+
+    for (uint32_t pass = depth_prepass ? 0 : 1; pass < 2; pass++) {
+        VkCommandBuffer cmd = cmds[pass];
+
+        inheritance_info->subpass = depth_prepass ? pass : 0;
+        VkResult result;
+        result = vkBeginCommandBuffer(cmd, begin_info);
+        assert(result == VK_SUCCESS);
+
+        vkCmdBindPipeline(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipelines[pass]
+        );
+        vkCmdSetViewport(cmd, 0, 1, viewport);
+        vkCmdSetScissor(cmd, 0, 1, scissor);
+
+        const struct renderer_mesh* bound = NULL;
+        for (uint32_t i = 0; i < scene->draw_count; i++) {
+            struct renderer_drawable* drawable = scene->draw_list[i];
+            const struct renderer_mesh* mesh =
+                renderer_registry_get_mesh(registry, drawable->mesh);
+            if (!mesh)
+                continue;
+
+            if (!bound || !renderer_mesh_buffers_equal(bound, mesh)) {
+                renderer_bind_mesh_buffers(registry, cmd, mesh);
+                bound = mesh;
+            }
+
+            struct renderer_texture* texture =
+                renderer_registry_get_texture(registry, drawable->texture);
+            VkDescriptorSet* descriptor_set = descriptor_sets;
+            if (texture)
+                descriptor_set = &texture->descriptor_set;
+
+            uint32_t dynamic_offsets[2] = {
+                renderer_get_view_projection_offset(
+                    matrix_alignment,
+                    image_index
+                ),
+                renderer_get_matrix_offset(
+                    matrix_alignment,
+                    max_drawables,
+                    image_index,
+                    drawable->matrix_index
+                )
+            };
+            vkCmdBindDescriptorSets(
+                cmd,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipeline_layout,
+                0,
+                1,
+                descriptor_set,
+                2,
+                dynamic_offsets
+            );
+
+            vkCmdDrawIndexed(
+                cmd,
+                mesh->index_count,
+                1,
+                mesh->ibo_offset,
+                mesh->vbo_offset,
+                0
+            );
+        }
+
+        result = vkEndCommandBuffer(cmd);
+        assert(result == VK_SUCCESS);
+    }
+
+    return true;
+}
+
+void renderer_scene_destroy(
+        struct renderer_scene* scene)
+{
+    vkFreeCommandBuffers(
+        scene->device,
+        scene->command_pool,
+        MAX_FRAMEBUFFERS,
+        scene->cmds
+    );
+    if (scene->depth_cmds[0] != VK_NULL_HANDLE) {
+        vkFreeCommandBuffers(
+            scene->device,
+            scene->command_pool,
+            MAX_FRAMEBUFFERS,
+            scene->depth_cmds
+        );
+    }
+
+    free(scene->in_view);
+    free(scene->draw_list);
+    free(scene->objects);
+}
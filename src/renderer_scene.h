@@ -0,0 +1,139 @@
+#ifndef RENDERER_SCENE_H_
+#define RENDERER_SCENE_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Stays valid until its object is removed, then never matches again
+struct renderer_object_handle
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+struct renderer_scene_object
+{
+    struct renderer_drawable drawable; // First, the BVH hands out drawables
+    uint32_t generation; // Bumped on removal
+    uint32_t next_free;
+    bool alive;
+    bool registered; // Has a transform and BVH proxy, kept across reuse
+    bool visible;
+    bool in_view; // In the draw list as of the last update
+    uint32_t seen_frame; // Last frustum cull that found it
+};
+
+/* Objects that are drawn every frame until removed, without being queued.
+ * The drawn ones are kept in a list sorted by texture and mesh, which only
+ * changes when objects are added, removed, hidden or shown or, with frustum
+ * culling, enter or leave the view. Each image has one secondary cmd drawing
+ * the whole list, recorded again only when the list or the framebuffers
+ * changed, so moving objects costs no recording */
+struct renderer_scene
+{
+    VkDevice device;
+    VkCommandPool command_pool;
+
+    // Slot map, slots below slot_count have been handed out at least once
+    struct renderer_scene_object* objects;
+    uint32_t capacity;
+    uint32_t slot_count;
+    uint32_t free_list;
+    bool membership_changed; // Objects added, removed, hidden or shown
+
+    struct renderer_drawable** draw_list;
+    uint32_t draw_count;
+    uint64_t triangle_count;
+    uint32_t draw_list_generation;
+
+    // Found by the frustum cull of the current frame
+    struct renderer_drawable** in_view;
+    uint32_t in_view_count;
+    uint32_t entered_count; // Not in the draw list yet
+
+    VkCommandBuffer cmds[MAX_FRAMEBUFFERS];
+    VkCommandBuffer depth_cmds[MAX_FRAMEBUFFERS]; // Only with a depth pre-pass
+    uint32_t recorded_generation[MAX_FRAMEBUFFERS]; // Of the draw list
+    uint32_t framebuffer_generation[MAX_FRAMEBUFFERS];
+};
+
+void renderer_scene_init(
+    struct renderer_scene* scene,
+    struct renderer_resources* resources
+);
+
+struct renderer_object_handle renderer_scene_add(
+    struct renderer_resources* resources,
+    struct renderer_resource_handle mesh,
+    struct renderer_resource_handle texture
+);
+
+void renderer_scene_remove(
+    struct renderer_resources* resources,
+    struct renderer_object_handle handle
+);
+
+struct renderer_drawable* renderer_scene_get(
+    struct renderer_scene* scene,
+    struct renderer_object_handle handle
+);
+
+void renderer_scene_set_position(
+    struct renderer_resources* resources,
+    struct renderer_object_handle handle,
+    float x, float y, float z
+);
+
+void renderer_scene_set_visible(
+    struct renderer_scene* scene,
+    struct renderer_object_handle handle,
+    bool visible
+);
+
+void renderer_scene_begin_cull(
+    struct renderer_scene* scene
+);
+
+void renderer_scene_cull_visit(
+    struct renderer_scene* scene,
+    struct renderer_drawable* drawable,
+    uint32_t cull_frame
+);
+
+void renderer_scene_update(
+    struct renderer_scene* scene,
+    const struct renderer_registry* registry,
+    bool culled,
+    uint32_t cull_frame
+);
+
+void renderer_scene_enqueue(
+    struct renderer_scene* scene,
+    struct queue* drawable_queue
+);
+
+bool renderer_scene_record(
+    struct renderer_scene* scene,
+    uint32_t image_index,
+    uint32_t framebuffer_generation,
+    VkCommandBufferInheritanceInfo* inheritance_info,
+    const VkCommandBufferBeginInfo* begin_info,
+    VkPipeline depth_pipeline,
+    VkPipeline pipeline,
+    const VkViewport* viewport,
+    const VkRect2D* scissor,
+    VkPipelineLayout pipeline_layout,
+    VkDescriptorSet* descriptor_sets,
+    const struct renderer_registry* registry,
+    size_t matrix_alignment,
+    uint32_t max_drawables
+);
+
+void renderer_scene_destroy(
+    struct renderer_scene* scene
+);
+
+#endif
@@ -21,6 +21,18 @@ size_t renderer_get_file_size(
     return fsize;
 }
 
+bool renderer_file_exists(
+        const char* fname)
+{
+    FILE* fp = fopen(fname, "rb");
+    if (!fp)
+        return false;
+
+    fclose(fp);
+
+    return true;
+}
+
 void renderer_read_file_to_buffer(
         const char* fname,
         char** buffer,
@@ -38,6 +50,21 @@ void renderer_read_file_to_buffer(
     fclose(fp);
 }
 
+bool renderer_has_memory_type(
+        uint32_t memory_type_bits,
+        VkMemoryPropertyFlags properties,
+        uint32_t memory_type_count,
+        VkMemoryType* memory_types)
+{
+    for (uint32_t i = 0; i < memory_type_count; i++) {
+        if ((memory_type_bits & (1 << i)) &&
+                (memory_types[i].propertyFlags & properties) == properties)
+            return true;
+    }
+
+    return false;
+}
+
 uint32_t renderer_find_memory_type(
         uint32_t memory_type_bits,
         VkMemoryPropertyFlags properties,
@@ -64,10 +91,86 @@ uint32_t renderer_find_memory_type(
     return memory_type;
 }
 
+static struct renderer_memory_stats memory_stats;
+
+/* vkAllocateMemory that keeps count of what is allocated, so benchmarks can
+ * report device memory use. Pair with renderer_free_memory */
+VkResult renderer_allocate_memory(
+        VkDevice device,
+        const VkMemoryAllocateInfo* alloc_info,
+        VkDeviceMemory* memory)
+{
+    VkResult result;
+    result = vkAllocateMemory(device, alloc_info, NULL, memory);
+    if (result != VK_SUCCESS)
+        return result;
+
+    VkDeviceSize allocated = __atomic_add_fetch(
+        &memory_stats.allocated_bytes,
+        alloc_info->allocationSize,
+        __ATOMIC_RELAXED
+    );
+    __atomic_add_fetch(&memory_stats.allocation_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memory_stats.total_allocations, 1, __ATOMIC_RELAXED);
+
+    VkDeviceSize peak = __atomic_load_n(
+        &memory_stats.peak_allocated_bytes,
+        __ATOMIC_RELAXED
+    );
+    while (allocated > peak &&
+            !__atomic_compare_exchange_n(
+                &memory_stats.peak_allocated_bytes,
+                &peak,
+                allocated,
+                false,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED));
+
+    return result;
+}
+
+// size is the allocationSize the memory was allocated with
+void renderer_free_memory(
+        VkDevice device,
+        VkDeviceMemory memory,
+        VkDeviceSize size)
+{
+    if (memory == VK_NULL_HANDLE)
+        return;
+
+    vkFreeMemory(device, memory, NULL);
+
+    __atomic_sub_fetch(&memory_stats.allocated_bytes, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&memory_stats.allocation_count, 1, __ATOMIC_RELAXED);
+}
+
+struct renderer_memory_stats renderer_get_memory_stats()
+{
+    struct renderer_memory_stats stats;
+    stats.allocation_count = __atomic_load_n(
+        &memory_stats.allocation_count,
+        __ATOMIC_RELAXED
+    );
+    stats.allocated_bytes = __atomic_load_n(
+        &memory_stats.allocated_bytes,
+        __ATOMIC_RELAXED
+    );
+    stats.peak_allocated_bytes = __atomic_load_n(
+        &memory_stats.peak_allocated_bytes,
+        __ATOMIC_RELAXED
+    );
+    stats.total_allocations = __atomic_load_n(
+        &memory_stats.total_allocations,
+        __ATOMIC_RELAXED
+    );
+
+    return stats;
+}
+
+// C11 provides aligned_alloc everywhere else
+#ifdef _WIN32
 void* aligned_alloc(size_t alignment, size_t size)
 {
-    void* ptr = NULL;
-    _aligned_malloc(size, alignment);
-	// posix_memalign(&ptr, alignment, size);
-    return ptr;
+    return _aligned_malloc(size, alignment);
 }
+#endif
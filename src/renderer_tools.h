@@ -4,16 +4,29 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <stdbool.h>
+
 size_t renderer_get_file_size(
     const char* fname
 );
 
+bool renderer_file_exists(
+    const char* fname
+);
+
 void renderer_read_file_to_buffer(
     const char* fname,
     char** buffer,
     size_t buffer_size
 );
 
+bool renderer_has_memory_type(
+    uint32_t memory_type_bits,
+    VkMemoryPropertyFlags properties,
+    uint32_t memory_type_count,
+    VkMemoryType* memory_types
+);
+
 uint32_t renderer_find_memory_type(
 	uint32_t memory_type_bits,
 	VkMemoryPropertyFlags properties,
@@ -21,9 +34,34 @@ uint32_t renderer_find_memory_type(
 	VkMemoryType* memory_types
 );
 
+// Device memory currently held through renderer_allocate_memory
+struct renderer_memory_stats
+{
+    uint32_t allocation_count;
+    VkDeviceSize allocated_bytes;
+    VkDeviceSize peak_allocated_bytes;
+    uint64_t total_allocations; // Including those since freed
+};
+
+VkResult renderer_allocate_memory(
+    VkDevice device,
+    const VkMemoryAllocateInfo* alloc_info,
+    VkDeviceMemory* memory
+);
+
+void renderer_free_memory(
+    VkDevice device,
+    VkDeviceMemory memory,
+    VkDeviceSize size
+);
+
+struct renderer_memory_stats renderer_get_memory_stats();
+
+#ifdef _WIN32
 void* aligned_alloc(
     size_t alignment,
     size_t size
 );
+#endif
 
 #endif
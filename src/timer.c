@@ -0,0 +1,71 @@
+#include "timer.h"
+
+#include <time.h>
+
+#define TIMER_MIN_SPIN 0.0002
+#define TIMER_MAX_SPIN 0.004
+
+// Monotonic time in seconds
+double timer_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Sleeps until spin_threshold seconds before the deadline, then busy waits.
+ * The threshold adapts to how late the OS actually wakes us so the sleep
+ * never overshoots the deadline on a loaded system */
+void timer_sleep_until(
+        double deadline,
+        double *spin_threshold)
+{
+    double now = timer_now();
+    double sleep_time = deadline - now - *spin_threshold;
+
+    if (sleep_time > 0.0) {
+        struct timespec ts = {
+            .tv_sec = (time_t)sleep_time,
+            .tv_nsec = (long)((sleep_time - (time_t)sleep_time) * 1e9)
+        };
+        nanosleep(&ts, NULL);
+
+        double oversleep = timer_now() - (now + sleep_time);
+        double threshold = *spin_threshold * 0.9 + oversleep * 1.5 * 0.1;
+        if (threshold < TIMER_MIN_SPIN)
+            threshold = TIMER_MIN_SPIN;
+        if (threshold > TIMER_MAX_SPIN)
+            threshold = TIMER_MAX_SPIN;
+        *spin_threshold = threshold;
+    }
+
+    while (timer_now() < deadline) {
+        // Spin
+    }
+}
+
+void frame_limiter_init(
+        struct frame_limiter *limiter,
+        double target_fps)
+{
+    limiter->target_frame_time = target_fps > 0.0 ? 1.0 / target_fps : 0.0;
+    limiter->next_deadline = timer_now() + limiter->target_frame_time;
+    limiter->spin_threshold = TIMER_MAX_SPIN / 2;
+}
+
+void frame_limiter_wait(
+        struct frame_limiter *limiter)
+{
+    if (limiter->target_frame_time <= 0.0)
+        return;
+
+    timer_sleep_until(limiter->next_deadline, &limiter->spin_threshold);
+
+    // Schedule from the previous deadline to avoid drift, but do not try to
+    // catch up with a burst of frames after a long stall
+    limiter->next_deadline += limiter->target_frame_time;
+    double now = timer_now();
+    if (limiter->next_deadline < now)
+        limiter->next_deadline = now + limiter->target_frame_time;
+}
@@ -0,0 +1,31 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdbool.h>
+
+// Sleeps the bulk of a frame and spins the remainder so the frame deadline
+// is hit with sub-millisecond precision despite coarse OS sleep granularity
+struct frame_limiter
+{
+    double target_frame_time; // Seconds, 0 disables the limiter
+    double next_deadline;
+    double spin_threshold; // Time left to the deadline that is spun, not slept
+};
+
+double timer_now();
+
+void timer_sleep_until(
+    double deadline,
+    double *spin_threshold
+);
+
+void frame_limiter_init(
+    struct frame_limiter *limiter,
+    double target_fps
+);
+
+void frame_limiter_wait(
+    struct frame_limiter *limiter
+);
+
+#endif
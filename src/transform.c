@@ -0,0 +1,350 @@
+#include "transform.h"
+#include "linmath_simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+void transform_store_init(
+        struct transform_store* store,
+        uint32_t capacity,
+        uint32_t frame_count)
+{
+    assert(frame_count <= TRANSFORM_MAX_FRAMES);
+    memset(store, 0, sizeof(*store));
+
+    store->capacity = capacity;
+    store->frame_count = frame_count;
+
+    store->positions = malloc(capacity * sizeof(*store->positions));
+    store->rotations = malloc(capacity * sizeof(*store->rotations));
+    store->scales = malloc(capacity * sizeof(*store->scales));
+    store->world_matrices = malloc(capacity * sizeof(*store->world_matrices));
+    assert(store->positions && store->rotations && store->scales);
+    assert(store->world_matrices);
+
+    store->parents = malloc(capacity * sizeof(*store->parents));
+    store->first_children = malloc(capacity * sizeof(*store->first_children));
+    store->next_siblings = malloc(capacity * sizeof(*store->next_siblings));
+    assert(store->parents && store->first_children && store->next_siblings);
+
+    store->dirty = malloc(capacity * sizeof(*store->dirty));
+    store->dirty_list = malloc(capacity * sizeof(*store->dirty_list));
+    store->updated_list = malloc(capacity * sizeof(*store->updated_list));
+    store->stale_frames = malloc(capacity * sizeof(*store->stale_frames));
+    assert(store->dirty && store->dirty_list && store->updated_list);
+    assert(store->stale_frames);
+
+    for (uint32_t i = 0; i < frame_count; i++) {
+        store->upload_lists[i] = malloc(capacity * sizeof(uint32_t));
+        assert(store->upload_lists[i]);
+    }
+}
+
+static void mark_dirty(
+        struct transform_store* store,
+        uint32_t transform)
+{
+    if (store->dirty[transform])
+        return;
+
+    store->dirty[transform] = true;
+    store->dirty_list[store->dirty_count++] = transform;
+}
+
+static void link_child(
+        struct transform_store* store,
+        uint32_t transform,
+        uint32_t parent)
+{
+    store->parents[transform] = parent;
+    store->next_siblings[transform] = TRANSFORM_NONE;
+    if (parent == TRANSFORM_NONE)
+        return;
+
+    store->next_siblings[transform] = store->first_children[parent];
+    store->first_children[parent] = transform;
+}
+
+static void unlink_child(
+        struct transform_store* store,
+        uint32_t transform)
+{
+    uint32_t parent = store->parents[transform];
+    if (parent == TRANSFORM_NONE)
+        return;
+
+    uint32_t* link = &store->first_children[parent];
+    while (*link != transform)
+        link = &store->next_siblings[*link];
+    *link = store->next_siblings[transform];
+
+    store->parents[transform] = TRANSFORM_NONE;
+}
+
+// At the origin of its parent, or of the world with TRANSFORM_NONE
+uint32_t transform_create(
+        struct transform_store* store,
+        uint32_t parent)
+{
+    assert(store->count < store->capacity);
+    assert(parent == TRANSFORM_NONE || parent < store->count);
+
+    uint32_t transform = store->count++;
+
+    memset(store->positions[transform], 0, sizeof(vec3));
+    quat_identity(store->rotations[transform]);
+    store->scales[transform][0] = 1.0f;
+    store->scales[transform][1] = 1.0f;
+    store->scales[transform][2] = 1.0f;
+
+    store->first_children[transform] = TRANSFORM_NONE;
+    link_child(store, transform, parent);
+
+    store->dirty[transform] = false;
+    store->stale_frames[transform] = 0;
+    mark_dirty(store, transform);
+
+    return transform;
+}
+
+// Keeps the local values, so the transform moves along with its new parent
+void transform_set_parent(
+        struct transform_store* store,
+        uint32_t transform,
+        uint32_t parent)
+{
+    if (store->parents[transform] == parent)
+        return;
+
+    // Not under itself
+    for (uint32_t p = parent; p != TRANSFORM_NONE; p = store->parents[p])
+        assert(p != transform);
+
+    unlink_child(store, transform);
+    link_child(store, transform, parent);
+    mark_dirty(store, transform);
+}
+
+// Setting the current value again leaves the transform clean
+void transform_set_position(
+        struct transform_store* store,
+        uint32_t transform,
+        float x, float y, float z)
+{
+    float* position = store->positions[transform];
+    if (position[0] == x && position[1] == y && position[2] == z)
+        return;
+
+    position[0] = x;
+    position[1] = y;
+    position[2] = z;
+    mark_dirty(store, transform);
+}
+
+void transform_set_rotation(
+        struct transform_store* store,
+        uint32_t transform,
+        quat rotation)
+{
+    if (!memcmp(store->rotations[transform], rotation, sizeof(quat)))
+        return;
+
+    memcpy(store->rotations[transform], rotation, sizeof(quat));
+    mark_dirty(store, transform);
+}
+
+void transform_set_scale(
+        struct transform_store* store,
+        uint32_t transform,
+        float x, float y, float z)
+{
+    float* scale = store->scales[transform];
+    if (scale[0] == x && scale[1] == y && scale[2] == z)
+        return;
+
+    scale[0] = x;
+    scale[1] = y;
+    scale[2] = z;
+    mark_dirty(store, transform);
+}
+
+// Scale, then rotation, then translation
+static void compose_local(
+        struct transform_store* store,
+        uint32_t transform,
+        mat4x4 local)
+{
+    mat4x4_from_quat(local, store->rotations[transform]);
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            local[i][j] *= store->scales[transform][i];
+        local[3][i] = store->positions[transform][i];
+    }
+}
+
+static void update_world(
+        struct transform_store* store,
+        uint32_t transform)
+{
+    uint32_t parent = store->parents[transform];
+    mat4x4* world = &store->world_matrices[transform];
+
+    if (parent == TRANSFORM_NONE) {
+        compose_local(store, transform, *world);
+    } else {
+        mat4x4 local;
+        compose_local(store, transform, local);
+        mat4x4_mul_simd(*world, store->world_matrices[parent], local);
+    }
+
+    store->dirty[transform] = false;
+    store->updated_list[store->updated_count++] = transform;
+
+    // Queued once per frame however often it changes before the upload
+    uint32_t all_frames = (1u << store->frame_count) - 1;
+    uint32_t newly_stale = all_frames & ~store->stale_frames[transform];
+    for (uint32_t i = 0; i < store->frame_count; i++) {
+        if (newly_stale & (1u << i))
+            store->upload_lists[i][store->upload_counts[i]++] = transform;
+    }
+    store->stale_frames[transform] = all_frames;
+}
+
+// Depth first, parents before their children
+static uint32_t update_subtree(
+        struct transform_store* store,
+        uint32_t root)
+{
+    uint32_t updated = 0;
+    uint32_t transform = root;
+
+    while (true) {
+        update_world(store, transform);
+        updated++;
+
+        if (store->first_children[transform] != TRANSFORM_NONE) {
+            transform = store->first_children[transform];
+            continue;
+        }
+
+        while (transform != root &&
+                store->next_siblings[transform] == TRANSFORM_NONE)
+            transform = store->parents[transform];
+
+        if (transform == root)
+            return updated;
+
+        transform = store->next_siblings[transform];
+    }
+}
+
+/* Recomputes the world matrices of every transform changed since the last
+ * update along with everything below them, each subtree once. Returns how
+ * many were recomputed */
+uint32_t transform_store_update(
+        struct transform_store* store)
+{
+    uint32_t updated = 0;
+    store->updated_count = 0;
+
+    for (uint32_t i = 0; i < store->dirty_count; i++) {
+        uint32_t transform = store->dirty_list[i];
+
+        // Already done as part of a dirty ancestor's subtree
+        if (!store->dirty[transform])
+            continue;
+
+        // Or still to be, in which case this subtree is done then
+        bool ancestor_dirty = false;
+        for (uint32_t p = store->parents[transform]; p != TRANSFORM_NONE;
+                p = store->parents[p]) {
+            if (store->dirty[p]) {
+                ancestor_dirty = true;
+                break;
+            }
+        }
+
+        if (!ancestor_dirty)
+            updated += update_subtree(store, transform);
+    }
+
+    store->dirty_count = 0;
+
+    return updated;
+}
+
+/* Writes the world matrices that changed since this frame's copy was last
+ * written, transform i at matrices + i * stride. Returns how many */
+uint32_t transform_store_upload(
+        struct transform_store* store,
+        uint32_t frame,
+        void* matrices,
+        size_t stride)
+{
+    assert(frame < store->frame_count);
+
+    uint32_t count = store->upload_counts[frame];
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t transform = store->upload_lists[frame][i];
+
+        memcpy(
+            (char*)matrices + transform * stride,
+            store->world_matrices[transform],
+            sizeof(mat4x4)
+        );
+        store->stale_frames[transform] &= ~(1u << frame);
+    }
+    store->upload_counts[frame] = 0;
+
+    return count;
+}
+
+/* World space bounding sphere of a local one, as of the last update. The
+ * radius grows with the largest scale */
+void transform_get_sphere(
+        struct transform_store* store,
+        uint32_t transform,
+        const vec3 center,
+        float radius,
+        float sphere[4])
+{
+    mat4x4* world = &store->world_matrices[transform];
+
+    vec4 local_center = {center[0], center[1], center[2], 1.0f};
+    vec4 world_center;
+    mat4x4_mul_vec4_simd(world_center, *world, local_center);
+
+    float max_scale = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        vec3 axis = {(*world)[i][0], (*world)[i][1], (*world)[i][2]};
+        float scale = vec3_len(axis);
+        if (scale > max_scale)
+            max_scale = scale;
+    }
+
+    sphere[0] = world_center[0];
+    sphere[1] = world_center[1];
+    sphere[2] = world_center[2];
+    sphere[3] = radius * max_scale;
+}
+
+void transform_store_destroy(
+        struct transform_store* store)
+{
+    for (uint32_t i = 0; i < store->frame_count; i++)
+        free(store->upload_lists[i]);
+
+    free(store->stale_frames);
+    free(store->updated_list);
+    free(store->dirty_list);
+    free(store->dirty);
+    free(store->next_siblings);
+    free(store->first_children);
+    free(store->parents);
+    free(store->world_matrices);
+    free(store->scales);
+    free(store->rotations);
+    free(store->positions);
+}
@@ -0,0 +1,108 @@
+#ifndef TRANSFORM_H_
+#define TRANSFORM_H_
+
+#include "linmath.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRANSFORM_NONE UINT32_MAX
+#define TRANSFORM_MAX_FRAMES 8 // Copies of the world matrices kept up to date
+
+/* Positions, rotations and scales relative to the parent, and the world
+ * matrices derived from them, each in its own array indexed by transform.
+ * Changing a transform only marks it dirty, transform_store_update then
+ * recomputes the world matrices of the dirty transforms and their subtrees
+ * and nothing else */
+struct transform_store
+{
+    uint32_t capacity;
+    uint32_t count; // Handed out in order, never reused
+
+    vec3* positions;
+    quat* rotations;
+    vec3* scales;
+    mat4x4* world_matrices;
+
+    // The hierarchy, children as a linked list
+    uint32_t* parents;
+    uint32_t* first_children;
+    uint32_t* next_siblings;
+
+    // Local values changed since the last update
+    bool* dirty;
+    uint32_t* dirty_list;
+    uint32_t dirty_count;
+
+    // World matrices recomputed by the last update
+    uint32_t* updated_list;
+    uint32_t updated_count;
+
+    // World matrices changed since the copy of each frame was last written,
+    // as a bit per frame and a list per frame
+    uint32_t frame_count;
+    uint32_t* stale_frames;
+    uint32_t* upload_lists[TRANSFORM_MAX_FRAMES];
+    uint32_t upload_counts[TRANSFORM_MAX_FRAMES];
+};
+
+void transform_store_init(
+    struct transform_store* store,
+    uint32_t capacity,
+    uint32_t frame_count
+);
+
+uint32_t transform_create(
+    struct transform_store* store,
+    uint32_t parent
+);
+
+void transform_set_parent(
+    struct transform_store* store,
+    uint32_t transform,
+    uint32_t parent
+);
+
+void transform_set_position(
+    struct transform_store* store,
+    uint32_t transform,
+    float x, float y, float z
+);
+
+void transform_set_rotation(
+    struct transform_store* store,
+    uint32_t transform,
+    quat rotation
+);
+
+void transform_set_scale(
+    struct transform_store* store,
+    uint32_t transform,
+    float x, float y, float z
+);
+
+uint32_t transform_store_update(
+    struct transform_store* store
+);
+
+uint32_t transform_store_upload(
+    struct transform_store* store,
+    uint32_t frame,
+    void* matrices,
+    size_t stride
+);
+
+void transform_get_sphere(
+    struct transform_store* store,
+    uint32_t transform,
+    const vec3 center,
+    float radius,
+    float sphere[4]
+);
+
+void transform_store_destroy(
+    struct transform_store* store
+);
+
+#endif